@@ -0,0 +1,104 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// A synthetic N-to-1 write benchmark: NPROCS processes write one shared
+// file, each the records RANK, RANK+NPROCS, ... of it, using lseek and
+// write. This is the pattern that the write aggregation of the server
+// merges into large writes. Each process reports its bandwidth including
+// the time for close; run_n_to_1_benchmark.sh starts all processes and
+// reports the total bandwidth.
+// Usage: n_to_1_benchmark FILE RANK NPROCS [SIZE_MB [RECORD_BYTES]]
+// SIZE_MB is the size of the whole file.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// ----------------------------------------------------------------------------
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec*1.0e-6;
+}   // now
+
+// ----------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    if(argc<4)
+    {
+        printf("Usage: %s FILE RANK NPROCS [SIZE_MB [RECORD_BYTES]]\n",
+               argv[0]);
+        return 1;
+    }
+    const char *name  = argv[1];
+    int rank          = atoi(argv[2]);
+    int nprocs        = atoi(argv[3]);
+    long long size_mb = argc>4 ? atoll(argv[4]) : 1024;
+    size_t record     = argc>5 ? atol (argv[5]) : 65536;
+    if(nprocs<1 || rank<0 || rank>=nprocs || size_mb<=0 || record==0)
+    {
+        printf("Invalid rank, number of processes or size.\n");
+        return 1;
+    }
+    long long total       = size_mb*1024*1024;
+    long long num_records = (total+record-1)/record;
+
+    char *buffer = (char*)malloc(record);
+    for(size_t i=0; i<record; i++)
+        buffer[i] = (char)(rank+i);
+
+    double start = now();
+    int fd = open(name, O_WRONLY|O_CREAT, 0644);
+    if(fd<0)
+    {
+        perror(name);
+        return 1;
+    }
+    long long written = 0;
+    for(long long r=rank; r<num_records; r+=nprocs)
+    {
+        off_t offset = (off_t)(r*record);
+        size_t n = record;
+        if(offset+(long long)n>total)
+            n = total-offset;
+        if(lseek(fd, offset, SEEK_SET)!=offset)
+        {
+            perror("lseek");
+            return 1;
+        }
+        if(write(fd, buffer, n)!=(ssize_t)n)
+        {
+            perror("write");
+            return 1;
+        }
+        written += n;
+    }
+    if(close(fd)!=0)
+    {
+        perror("close");
+        return 1;
+    }
+    double t = now()-start;
+    printf("%-20s rank %4d %8.1f MB in %8.3f s: %10.2f MB/s\n", name, rank,
+           written/(1024.0*1024.0), t, written/(1024.0*1024.0)/t);
+    free(buffer);
+    return 0;
+}   // main
@@ -0,0 +1,36 @@
+#!/bin/sh
+# Writes one shared file from NPROCS processes, directly and through the
+# alio server. Write aggregation must be enabled when starting the server,
+# e.g. "server eth0 4 64M 1M" (window 64M, stripe size 1M).
+# Usage: run_n_to_1_benchmark.sh BUILD_DIR [DIRECTORY [NPROCS [SIZE_MB [RECORD]]]]
+# The file is written in DIRECTORY (default: current directory), which
+# should be on the file system to be tested.
+
+if [ $# -lt 1 ]; then
+    echo "Usage: $0 BUILD_DIR [DIRECTORY [NPROCS [SIZE_MB [RECORD]]]]"
+    exit 1
+fi
+BUILD=$(cd "$1" && pwd)
+DIR=${2:-.}
+NPROCS=${3:-8}
+SIZE=${4:-1024}
+RECORD=${5:-65536}
+SRC=$(cd "$(dirname "$0")" && pwd)
+
+cp "$SRC/alio.xml" "$DIR/alio.xml"
+cd "$DIR" || exit 1
+for name in bench_n1_direct bench_n1_remote; do
+    rm -f $name
+    start=$(date +%s.%N)
+    rank=0
+    while [ $rank -lt $NPROCS ]; do
+        LD_PRELOAD=$BUILD/client/libclient.so \
+            "$BUILD/bin/n_to_1_benchmark" $name $rank $NPROCS $SIZE $RECORD &
+        rank=$((rank+1))
+    done
+    wait
+    end=$(date +%s.%N)
+    echo "$name: $NPROCS processes, $SIZE MB" | awk -v s=$start -v e=$end \
+        -v size=$SIZE '{ printf "%s in %.3f s: %.2f MB/s\n", $0, e-s, size/(e-s) }'
+    rm -f $name
+done
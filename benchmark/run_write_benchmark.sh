@@ -0,0 +1,23 @@
+#!/bin/sh
+# Compares the sync and io_uring engines of the buffered file object.
+# Usage: run_write_benchmark.sh BUILD_DIR [DIRECTORY [SIZE_MB [RECORD]]]
+# The files are written in DIRECTORY (default: current directory), which
+# should be on the file system to be tested.
+
+if [ $# -lt 1 ]; then
+    echo "Usage: $0 BUILD_DIR [DIRECTORY [SIZE_MB [RECORD]]]"
+    exit 1
+fi
+BUILD=$(cd "$1" && pwd)
+DIR=${2:-.}
+SIZE=${3:-1024}
+RECORD=${4:-4096}
+SRC=$(cd "$(dirname "$0")" && pwd)
+
+cp "$SRC/alio.xml" "$DIR/alio.xml"
+cd "$DIR" || exit 1
+for name in bench_sync bench_uring bench_direct_sync bench_direct_uring; do
+    LD_PRELOAD=$BUILD/client/libclient.so \
+        "$BUILD/bin/write_benchmark" $name $SIZE $RECORD
+    rm -f $name
+done
@@ -0,0 +1,91 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// A simple write benchmark: writes a file sequentially using records of
+// a fixed size with fwrite, and reports the bandwidth including the time
+// for fclose (which, depending on the alio configuration, flushes all
+// cached data and syncs the file). It is meant to be run with LD_PRELOAD
+// to compare different alio configurations, see run_write_benchmark.sh.
+// Usage: write_benchmark FILE [SIZE_MB [RECORD_BYTES]]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+// ----------------------------------------------------------------------------
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec*1.0e-6;
+}   // now
+
+// ----------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    if(argc<2)
+    {
+        printf("Usage: %s FILE [SIZE_MB [RECORD_BYTES]]\n", argv[0]);
+        return 1;
+    }
+    const char *name  = argv[1];
+    long long size_mb = argc>2 ? atoll(argv[2]) : 1024;
+    size_t record     = argc>3 ? atol (argv[3]) : 4096;
+    if(size_mb<=0 || record==0)
+    {
+        printf("Invalid size or record size.\n");
+        return 1;
+    }
+    long long total   = size_mb*1024*1024;
+
+    char *buffer = (char*)malloc(record);
+    for(size_t i=0; i<record; i++)
+        buffer[i] = (char)i;
+
+    double start = now();
+    FILE *f = fopen(name, "w");
+    if(!f)
+    {
+        perror(name);
+        return 1;
+    }
+    long long written = 0;
+    while(written<total)
+    {
+        size_t n = record;
+        if(written+(long long)n>total)
+            n = total-written;
+        if(fwrite(buffer, 1, n, f)!=n)
+        {
+            perror("fwrite");
+            return 1;
+        }
+        written += n;
+    }
+    if(fclose(f)!=0)
+    {
+        perror("fclose");
+        return 1;
+    }
+    double t = now()-start;
+    printf("%-20s %8lld MB in %8.3f s: %10.2f MB/s\n", name, size_mb, t,
+           size_mb/t);
+    free(buffer);
+    return 0;
+}   // main
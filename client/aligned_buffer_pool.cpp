@@ -0,0 +1,198 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "client/aligned_buffer_pool.hpp"
+
+#include "client/thread_placement.hpp"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+namespace ALIO
+{
+
+Synchronised< std::map<size_t, AlignedBufferPool*> >
+                                           AlignedBufferPool::m_all_pools;
+unsigned int AlignedBufferPool::m_generation = 0;
+
+// ----------------------------------------------------------------------------
+/** Returns the pool for buffers of the given size, creating it if
+ *  necessary.
+ */
+AlignedBufferPool *AlignedBufferPool::getPool(size_t buffer_size)
+{
+    m_all_pools.lock();
+    std::map<size_t, AlignedBufferPool*> &all = m_all_pools.getData();
+    std::map<size_t, AlignedBufferPool*>::iterator i = all.find(buffer_size);
+    AlignedBufferPool *pool;
+    if(i==all.end())
+    {
+        pool = new AlignedBufferPool(buffer_size);
+        all[buffer_size] = pool;
+    }
+    else
+        pool = i->second;
+    m_all_pools.unlock();
+    return pool;
+}   // getPool
+
+// ----------------------------------------------------------------------------
+/** Frees all pools and all buffers in them. Must only be called when no
+ *  buffer is in use anymore.
+ */
+void AlignedBufferPool::destroyAll()
+{
+    m_all_pools.lock();
+    std::map<size_t, AlignedBufferPool*> &all = m_all_pools.getData();
+    std::map<size_t, AlignedBufferPool*>::iterator i;
+    for(i=all.begin(); i!=all.end(); i++)
+        delete i->second;
+    all.clear();
+    m_all_pools.unlock();
+}   // destroyAll
+
+// ----------------------------------------------------------------------------
+/** Returns the alignment of all buffers, which is the page size. This is
+ *  sufficient for O_DIRECT on all common file systems.
+ */
+size_t AlignedBufferPool::getAlignment()
+{
+    static size_t page_size = sysconf(_SC_PAGESIZE);
+    return page_size;
+}   // getAlignment
+
+// ----------------------------------------------------------------------------
+/** Appends all buffers of all pools (whether in use or not) to the given
+ *  vector. This is used to register the buffers with the kernel, so that
+ *  IO from them does not need to map the pages for each operation.
+ *  \return The generation of the buffer list, which changes whenever a
+ *          pool allocates a new buffer.
+ */
+unsigned int AlignedBufferPool::getAllBuffers(std::vector<struct iovec> *all)
+{
+    m_all_pools.lock();
+    unsigned int generation = __sync_fetch_and_add(&m_generation, 0);
+    std::map<size_t, AlignedBufferPool*> &pools = m_all_pools.getData();
+    std::map<size_t, AlignedBufferPool*>::iterator i;
+    for(i=pools.begin(); i!=pools.end(); i++)
+    {
+        AlignedBufferPool *pool = i->second;
+        pool->m_free_buffers.lock();
+        std::map<char*, int>::iterator j;
+        for(j=pool->m_all_buffers.begin(); j!=pool->m_all_buffers.end(); j++)
+        {
+            struct iovec v;
+            v.iov_base = j->first;
+            v.iov_len  = pool->m_buffer_size;
+            all->push_back(v);
+        }
+        pool->m_free_buffers.unlock();
+    }
+    m_all_pools.unlock();
+    return generation;
+}   // getAllBuffers
+
+// ----------------------------------------------------------------------------
+AlignedBufferPool::AlignedBufferPool(size_t buffer_size)
+{
+    m_buffer_size = buffer_size;
+}   // AlignedBufferPool
+
+// ----------------------------------------------------------------------------
+AlignedBufferPool::~AlignedBufferPool()
+{
+    m_free_buffers.lock();
+    std::map<char*, int>::iterator i;
+    for(i=m_all_buffers.begin(); i!=m_all_buffers.end(); i++)
+        ::free(i->first);
+    m_all_buffers.clear();
+    m_free_buffers.getData().clear();
+    m_free_buffers.unlock();
+}   // ~AlignedBufferPool
+
+// ----------------------------------------------------------------------------
+/** Allocates a new buffer. Must be called with m_free_buffers locked.
+ *  \param node The NUMA node to bind the buffer to, or -1.
+ */
+char *AlignedBufferPool::allocateNew(int node)
+{
+    void *p = NULL;
+    int error = posix_memalign(&p, getAlignment(), m_buffer_size);
+    if(error)
+    {
+        printf("Can't allocate aligned buffer of %ld bytes.\n",
+               (long)m_buffer_size);
+        assert(false);
+        return NULL;
+    }
+    // The buffer is not touched yet, so all its pages will be on node.
+    if(node>=0)
+        ThreadPlacement::bindToNode(p, m_buffer_size, node);
+    m_all_buffers[(char*)p] = node;
+    __sync_fetch_and_add(&m_generation, 1);
+    return (char*)p;
+}   // allocateNew
+
+// ----------------------------------------------------------------------------
+/** Makes sure that at least n buffers are available in the pool without
+ *  further allocation.
+ */
+void AlignedBufferPool::preallocate(unsigned int n)
+{
+    int node = ThreadPlacement::getBufferNode();
+    m_free_buffers.lock();
+    std::vector<char*> &buffers = m_free_buffers.getData()[node];
+    while(buffers.size()<n)
+        buffers.push_back(allocateNew(node));
+    m_free_buffers.unlock();
+}   // preallocate
+
+// ----------------------------------------------------------------------------
+/** Returns a buffer (on the NUMA node selected by the placement policy)
+ *  from the pool, or allocates a new one if there is none.
+ */
+char *AlignedBufferPool::allocate()
+{
+    int node = ThreadPlacement::getBufferNode();
+    m_free_buffers.lock();
+    std::vector<char*> &buffers = m_free_buffers.getData()[node];
+    if(buffers.empty())
+    {
+        char *p = allocateNew(node);
+        m_free_buffers.unlock();
+        return p;
+    }
+    char *p = buffers.back();
+    buffers.pop_back();
+    m_free_buffers.unlock();
+    return p;
+}   // allocate
+
+// ----------------------------------------------------------------------------
+/** Returns a buffer to the pool. */
+void AlignedBufferPool::free(char *buffer)
+{
+    m_free_buffers.lock();
+    int node = m_all_buffers[buffer];
+    m_free_buffers.getData()[node].push_back(buffer);
+    m_free_buffers.unlock();
+}   // free
+
+}   // namespace ALIO
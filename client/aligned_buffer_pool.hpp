@@ -0,0 +1,80 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef HEADER_ALIGNED_BUFFER_POOL_HPP
+#define HEADER_ALIGNED_BUFFER_POOL_HPP
+
+#include "tools/synchronised.hpp"
+
+#include <map>
+#include <stddef.h>
+#include <sys/uio.h>
+#include <vector>
+
+namespace ALIO
+{
+
+/** A pool of page-aligned buffers of one fixed size. Buffers that are
+ *  freed are kept for reuse, so large buffers (e.g. the chunks of the
+ *  buffered file object, or bounce buffers for O_DIRECT) are not
+ *  allocated and freed again for each operation. There is one pool
+ *  for each buffer size, which is created on demand by getPool().
+ *  If a NUMA policy is configured (see ThreadPlacement), new buffers are
+ *  bound to the requested node, and free buffers are kept per node so
+ *  that a buffer is only reused on the node it was allocated on.
+ */
+class AlignedBufferPool
+{
+private:
+    /** Size of each buffer in this pool. */
+    size_t m_buffer_size;
+
+    /** All buffers that are not in use, indexed by NUMA node (-1 if the
+     *  buffer is not bound to a node). The lock also protects
+     *  m_all_buffers. */
+    Synchronised< std::map<int, std::vector<char*> > > m_free_buffers;
+
+    /** All buffers ever allocated by this pool, with their NUMA node. */
+    std::map<char*, int> m_all_buffers;
+
+    /** All pools, indexed by buffer size. */
+    static Synchronised< std::map<size_t, AlignedBufferPool*> > m_all_pools;
+
+    /** Incremented each time a new buffer is allocated by any pool. */
+    static unsigned int m_generation;
+
+    AlignedBufferPool(size_t buffer_size);
+   ~AlignedBufferPool();
+    char *allocateNew(int node);
+
+public:
+    static AlignedBufferPool *getPool(size_t buffer_size);
+    static void               destroyAll();
+    static size_t             getAlignment();
+    static unsigned int       getAllBuffers(std::vector<struct iovec> *all);
+
+    void  preallocate(unsigned int n);
+    char *allocate();
+    void  free(char *buffer);
+    // ------------------------------------------------------------------------
+    /** Returns the size of the buffers in this pool. */
+    size_t getBufferSize() const { return m_buffer_size; }
+};   // AlignedBufferPool
+
+}   // namespace ALIO
+#endif
@@ -19,15 +19,46 @@
 #include "buffered.hpp"
 
 #include "client/request.hpp"
+#include "client/thread_placement.hpp"
+#include "client/uring_engine.hpp"
+#include "tools/string_utils.hpp"
 #include "xml/xml_node.hpp"
 
+#include <errno.h>
 #include <pthread.h>
+#include <set>
+#include <unistd.h>
 
 namespace ALIO
 {
 
     pthread_cond_t BufferedFileObject::m_request_signal;
-    Synchronised< std::vector<Request*> > BufferedFileObject::m_request_queue;    
+    bool           BufferedFileObject::m_worker_waiting = false;
+    pthread_t      BufferedFileObject::m_thread;
+    Synchronised< std::vector<Request*> > BufferedFileObject::m_request_queue;
+    Synchronised< std::vector<BufferedFileObject*> >
+                                          BufferedFileObject::m_all_objects;
+    Synchronised< std::map<std::string, int> > BufferedFileObject::m_closing;
+    Synchronised<int> BufferedFileObject::m_close_error(0);
+    UringEngine   *BufferedFileObject::m_uring                 = NULL;
+    bool           BufferedFileObject::m_uring_failed          = false;
+    unsigned int   BufferedFileObject::m_registered_generation = 0;
+    std::set< std::pair<BufferedFileObject*, off64_t> >
+                   BufferedFileObject::m_uring_queued;
+
+    /** Number of submission queue entries of the io_uring engine. */
+    static const unsigned int URING_QUEUE_DEPTH = 128;
+
+    /** One asynchronous operation submitted to io_uring. For writes the
+     *  data is kept so that short writes can be completed. */
+    struct UringOperation
+    {
+        Request    *m_request;
+        const char *m_data;
+        size_t      m_size;
+        off64_t     m_offset;
+    };   // UringOperation
+
     int BufferedFileObject::init()
     {
 
@@ -39,78 +70,1231 @@ namespace ALIO
         pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
          // Should be the default, but just in case:
         pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-        pthread_t *thread_id = new pthread_t();
-        int error = pthread_create(thread_id, &attr,
+        int error = pthread_create(&m_thread, &attr,
                                    &BufferedFileObject::serverMainLoop, NULL);
+        pthread_attr_destroy(&attr);
+        if(error)
+            printf("Can not create buffered IO thread: error %d.\n", error);
 
-        return 0;
+        return error;
     }   // init
 
     // ------------------------------------------------------------------------
-    /** No static atExit function needed. */
+    /** Writes all data still cached by any buffered file object, then
+     *  stops the IO thread. Since requests are handled in order, this also
+     *  waits for all asynchronous closes.
+     */
     int BufferedFileObject::atExit()
     {
+        m_all_objects.lock();
+        std::vector<BufferedFileObject*> all = m_all_objects.getData();
+        m_all_objects.unlock();
+        for(unsigned int i=0; i<all.size(); i++)
+        {
+            if(all[i]->isOpen())
+                all[i]->flushChunks();
+        }
+
         BlockingRequest *quit = new BlockingRequest(Request::RQ_QUIT);
         addRequest(quit);
         quit->wait();
+        delete quit;
+        pthread_join(m_thread, NULL);
         pthread_cond_destroy(&m_request_signal);
-        return 0; 
-    }
+        return 0;
+    }   // atExit
+
     // ------------------------------------------------------------------------
+    /** Constructor. Reads the chunk-size and cache-size (maximum memory used
+     *  for partially written chunks of this file) from the io node. If
+     *  direct IO is requested, the chunk size is rounded up to a multiple
+     *  of the page size, and bounce-buffers buffers are preallocated.
+     *  engine selects how the IO thread writes: "sync" (default) or
+     *  "uring".
+     */
     BufferedFileObject::BufferedFileObject(const XMLNode *info)
                       : BaseFileObject(info)
     {
-        m_file     = NULL;
-        printf("node name %s\n", info->getName().c_str());
+        m_filedes    = -1;
+        m_open_flags = 0;
+        m_append     = false;
+        m_eof        = false;
+        m_position   = 0;
+        m_size       = 0;
+        m_pending_writes.setAtomic(0);
+        m_error.setAtomic(0);
+
+        int64_t chunk_size = 4*1024*1024;
+        int64_t cache_size = 64*1024*1024;
+        std::string s;
+        if(info->get("chunk-size", &s) &&
+           (!StringUtils::parseSize(s, &chunk_size) || chunk_size<=0) )
+        {
+            printf("Invalid chunk-size '%s' - using 4M.\n", s.c_str());
+            chunk_size = 4*1024*1024;
+        }
+        if(info->get("cache-size", &s) &&
+           !StringUtils::parseSize(s, &cache_size))
+        {
+            printf("Invalid cache-size '%s' - using 64M.\n", s.c_str());
+            cache_size = 64*1024*1024;
+        }
+        m_use_direct = false;
+        m_direct     = false;
+        info->get("direct", &m_use_direct);
+        if(m_use_direct)
+        {
+            size_t alignment = AlignedBufferPool::getAlignment();
+            chunk_size = (chunk_size+alignment-1)/alignment*alignment;
+        }
+        m_use_uring = false;
+        if(info->get("engine", &s))
+        {
+            if(s=="uring")
+                m_use_uring = true;
+            else if(s!="sync")
+                printf("Unknown engine '%s' - using sync.\n", s.c_str());
+        }
+        m_fsync = false;
+        info->get("fsync", &m_fsync);
+        m_async_close  = false;
+        m_close_queued = false;
+        info->get("async-close", &m_async_close);
+        m_read_ahead      = 0;
+        m_next_sequential = 0;
+        info->get("read-ahead", &m_read_ahead);
+        m_disk_end = 0;
+        m_elided   = false;
+        std::string sparse, sparse_block;
+        info->get("sparse", &sparse);
+        info->get("sparse-block-size", &sparse_block);
+        if(!m_fill.parse(sparse, sparse_block))
+            printf("Invalid sparse '%s' or sparse-block-size '%s' - not "
+                   "skipping blocks.\n", sparse.c_str(), sparse_block.c_str());
+        m_chunk_size = chunk_size;
+        m_max_chunks = cache_size/chunk_size;
+        if(m_max_chunks<1)
+            m_max_chunks = 1;
+        m_pool = AlignedBufferPool::getPool(m_chunk_size);
+        if(m_use_direct)
+        {
+            int bounce_buffers = 4;
+            info->get("bounce-buffers", &bounce_buffers);
+            m_pool->preallocate(bounce_buffers);
+        }
+
+        m_all_objects.lock();
+        m_all_objects.getData().push_back(this);
+        m_all_objects.unlock();
     };   // BufferedFileObject
     // ------------------------------------------------------------------------
     BufferedFileObject::~BufferedFileObject()
     {
+        m_all_objects.lock();
+        std::vector<BufferedFileObject*> &all = m_all_objects.getData();
+        for(unsigned int i=0; i<all.size(); i++)
+        {
+            if(all[i]==this)
+            {
+                all.erase(all.begin()+i);
+                break;
+            }
+        }
+        m_all_objects.unlock();
     }   // ~BufferedFileObject
     // ------------------------------------------------------------------------
     void BufferedFileObject::addRequest(Request *request)
     {
         m_request_queue.lock();
         m_request_queue.getData().push_back(request);
-        pthread_cond_signal(&m_request_signal);
+        if(m_worker_waiting)
+            pthread_cond_signal(&m_request_signal);
         m_request_queue.unlock();
     }   // addRequest
 
+    // ------------------------------------------------------------------------
+    /** Converts a fopen mode string into the corresponding open flags. */
+    int BufferedFileObject::modeToFlags(const char *mode) const
+    {
+        bool plus = strchr(mode, '+')!=NULL;
+        switch(mode[0])
+        {
+        case 'r': return plus ? O_RDWR : O_RDONLY;
+        case 'w': return (plus ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC;
+        case 'a': return (plus ? O_RDWR : O_WRONLY) | O_CREAT | O_APPEND;
+        }
+        return O_RDONLY;
+    }   // modeToFlags
+
+    // ------------------------------------------------------------------------
+    /** Opens the file. O_APPEND is handled by this object (since pwrite
+     *  would otherwise ignore the offset), so it is not passed on. For
+     *  direct IO a write-only file is opened read-write if possible, since
+     *  partially written blocks must be read before they can be written.
+     *  If the file system does not support O_DIRECT, the file is opened
+     *  without it. If the file is still being closed asynchronously, this
+     *  first waits till the close is done, so all its data is visible.
+     *  \return The file descriptor, or -1 on error.
+     */
+    int BufferedFileObject::openFile(int flags, mode_t mode)
+    {
+        m_closing.lock();
+        bool closing = m_closing.getData().find(getFilename())
+                    != m_closing.getData().end();
+        m_closing.unlock();
+        if(closing)
+            drain();
+
+        m_close_queued = false;
+        m_open_flags = flags;
+        m_append     = (flags & O_APPEND)!=0;
+        m_direct     = false;
+        int os_flags = flags & ~O_APPEND;
+        m_filedes    = -1;
+        if(m_use_direct)
+        {
+            int direct_flags = os_flags | O_DIRECT;
+            if((direct_flags & O_ACCMODE)==O_WRONLY)
+            {
+                direct_flags = (direct_flags & ~O_ACCMODE) | O_RDWR;
+                m_filedes = OS::open(getFilename().c_str(), direct_flags,
+                                     mode);
+                if(m_filedes<0 && errno==EACCES)
+                    direct_flags = os_flags | O_DIRECT;
+            }
+            if(m_filedes<0)
+                m_filedes = OS::open(getFilename().c_str(), direct_flags,
+                                     mode);
+            if(m_filedes>=0)
+                m_direct = true;
+            else if(errno==EINVAL)
+                printf("O_DIRECT not supported for '%s' - not using it.\n",
+                       getFilename().c_str());
+        }
+        if(m_filedes<0)
+            m_filedes = OS::open(getFilename().c_str(), os_flags, mode);
+        if(m_filedes<0)
+            return -1;
+
+        struct stat64 buf;
+        m_size     = ::fstat64(m_filedes, &buf)==0 ? buf.st_size : 0;
+        m_disk_end = m_size;
+        m_elided   = false;
+        m_position = 0;
+        m_next_sequential = 0;
+        m_eof      = false;
+        m_error.setAtomic(0);
+        return m_filedes;
+    }   // openFile
+
+    // ------------------------------------------------------------------------
+    /** Sets the file position.
+     *  \return The new position, or -1 on error.
+     */
+    off64_t BufferedFileObject::seek(off64_t offset, int whence)
+    {
+        off64_t new_pos;
+        switch(whence)
+        {
+        case SEEK_SET: new_pos = offset;            break;
+        case SEEK_CUR: new_pos = m_position+offset; break;
+        case SEEK_END: new_pos = m_size+offset;     break;
+        default:       errno = EINVAL;              return -1;
+        }
+        if(new_pos<0)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+        m_position = new_pos;
+        m_eof      = false;
+        return m_position;
+    }   // seek
+
+    // ------------------------------------------------------------------------
+    ssize_t BufferedFileObject::write(const void *buf, size_t nbyte)
+    {
+        if(!isOpen() || (m_open_flags & O_ACCMODE)==O_RDONLY)
+        {
+            errno = EBADF;
+            return -1;
+        }
+        if(m_append)
+            m_position = m_size;
+        ssize_t n = writeAt(buf, nbyte, m_position);
+        if(n>0)
+            m_position += n;
+        return n;
+    }   // write
+
+    // ------------------------------------------------------------------------
+    ssize_t BufferedFileObject::read(void *buf, size_t count)
+    {
+        if(!isOpen() || (m_open_flags & O_ACCMODE)==O_WRONLY)
+        {
+            errno = EBADF;
+            return -1;
+        }
+        ssize_t n = readAt(buf, count, m_position);
+        if(n>0)
+            m_position += n;
+        if(n<(ssize_t)count)
+            m_eof = true;
+        return n;
+    }   // read
+
+    // ------------------------------------------------------------------------
+    /** Reads at most size-1 characters up to and including a newline. */
+    char *BufferedFileObject::fgets(char *s, int size)
+    {
+        if(size<=0)
+            return NULL;
+        int count = 0;
+        while(count<size-1)
+        {
+            int wanted = std::min(size-1-count, 256);
+            ssize_t n  = read(s+count, wanted);
+            if(n<=0)
+                break;
+            char *newline = (char*)memchr(s+count, '\n', n);
+            if(newline)
+            {
+                int used = newline - (s+count) + 1;
+                // Undo the read of everything after the newline. The next
+                // read continues here, which is still sequential.
+                m_position       -= n-used;
+                m_next_sequential = m_position;
+                m_eof             = false;
+                count            += used;
+                break;
+            }
+            count += n;
+        }
+        if(count==0)
+            return NULL;
+        s[count] = 0;
+        return s;
+    }   // fgets
+
+    // ------------------------------------------------------------------------
+    /** Copies data into the chunks covering [offset, offset+n). Chunks that
+     *  are then completely written are handed to the IO thread.
+     */
+    ssize_t BufferedFileObject::writeAt(const void *buf, size_t n,
+                                        off64_t offset)
+    {
+        const char *p = (const char*)buf;
+        size_t left   = n;
+        while(left>0)
+        {
+            off64_t chunk_start = offset - offset % m_chunk_size;
+            size_t  in_chunk    = offset - chunk_start;
+            size_t  len         = std::min(left, m_chunk_size-in_chunk);
+            WriteChunk *chunk   = getChunk(chunk_start);
+            chunk->write(in_chunk, p, len);
+            if(chunk->isFull())
+                submitChunk(chunk);
+            p      += len;
+            offset += len;
+            left   -= len;
+        }
+        if(offset>m_size)
+            m_size = offset;
+        return n;
+    }   // writeAt
+
+    // ------------------------------------------------------------------------
+    /** Reads data from the file (or from chunks read in advance), and then
+     *  overlays all data from cached chunks. Data between the end of the
+     *  file on disk and the logical end of file (i.e. holes) is returned
+     *  as zeros.
+     */
+    ssize_t BufferedFileObject::readAt(void *buf, size_t n, off64_t offset)
+    {
+        if(offset>=m_size)
+            return 0;
+        size_t available = std::min((off64_t)n, m_size-offset);
+
+        char *p = (char*)buf;
+        size_t done = 0;
+        while(done<available)
+        {
+            off64_t pos = offset+done;
+            size_t  len = available-done;
+            if(!m_prefetched.empty())
+            {
+                // Handle one chunk at a time, since some might have been
+                // read in advance.
+                off64_t chunk_start = pos - pos % m_chunk_size;
+                len = std::min(len, (size_t)(chunk_start+m_chunk_size-pos));
+                if(readPrefetched(p+done, len, pos))
+                {
+                    done += len;
+                    continue;
+                }
+            }
+            if(readRange(p+done, len, pos)<0)
+                return -1;
+            done += len;
+        }
+
+        std::map<off64_t, WriteChunk*>::iterator i =
+            m_chunks.lower_bound(offset - offset % m_chunk_size);
+        for(; i!=m_chunks.end() && i->first<offset+(off64_t)available; i++)
+            i->second->overlay(offset, p, available);
+
+        if(m_read_ahead>0 && offset==m_next_sequential)
+            startPrefetch(offset+available);
+        m_next_sequential = offset+available;
+        return available;
+    }   // readAt
+
+    // ------------------------------------------------------------------------
+    /** Reads n bytes from the file, zero filling everything beyond the end
+     *  of the file on disk. If the IO thread still has to write data of
+     *  this file, the read is done by the IO thread (after these writes),
+     *  which avoids waiting for the writes separately.
+     *  \return n, or -1 on error.
+     */
+    ssize_t BufferedFileObject::readRange(char *buf, size_t n, off64_t offset)
+    {
+        ssize_t r;
+        if(m_pending_writes.getAtomic()>0)
+        {
+            ReadRequest *read = new ReadRequest(this, buf, n, offset);
+            addRequest(read);
+            read->wait();
+            r         = read->getResult();
+            int error = read->getError();
+            delete read;
+            if(r<0)
+                errno = error;
+        }
+        else
+            r = readFromFile(buf, n, offset);
+        if(r<0)
+            return -1;
+        // Data beyond the end of the file on disk was either never written,
+        // or skipped as a fill block and not yet extended.
+        m_fill.fill(buf+r, n-r, offset+r);
+        return n;
+    }   // readRange
+
+    // ------------------------------------------------------------------------
+    /** Reads up to n bytes from the file on disk. Holes are replaced by a
+     *  non-zero fill value. This is called from the application thread and
+     *  from the IO thread.
+     *  \return Number of bytes read (less than n at end of file), or -1.
+     */
+    ssize_t BufferedFileObject::readFromFile(char *buf, size_t n,
+                                             off64_t offset)
+    {
+        ssize_t done = 0;
+        if(m_direct)
+            done = readDirect(buf, n, offset);
+        else
+        {
+            while(done<(ssize_t)n)
+            {
+                ssize_t r = ::pread64(m_filedes, buf+done, n-done,
+                                      offset+done);
+                if(r<0 && errno==EINTR) continue;
+                if(r<0) return -1;
+                if(r==0) break;
+                done += r;
+            }
+        }
+        if(done>0)
+            m_fill.fillHoles(m_filedes, buf, done, offset);
+        return done;
+    }   // readFromFile
+
+    // ------------------------------------------------------------------------
+    /** Copies data from a chunk that was read in advance.
+     *  \param buf Where to store the data.
+     *  \param n Number of bytes, [offset, offset+n) must be in one chunk.
+     *  \param offset File offset of the data.
+     *  \return False if the chunk was not read in advance (or reading it
+     *          failed), true if the data was copied.
+     */
+    bool BufferedFileObject::readPrefetched(char *buf, size_t n,
+                                            off64_t offset)
+    {
+        off64_t chunk_start = offset - offset % m_chunk_size;
+        std::map<off64_t, PrefetchRequest*>::iterator i =
+            m_prefetched.find(chunk_start);
+        if(i==m_prefetched.end())
+            return false;
+        PrefetchRequest *prefetch = i->second;
+        prefetch->wait();
+        if(prefetch->getResult()<0)
+        {
+            dropPrefetch(chunk_start);
+            return false;
+        }
+        size_t skip   = offset-chunk_start;
+        size_t usable = prefetch->getResult()>(ssize_t)skip
+                      ? prefetch->getResult()-skip : 0;
+        usable        = std::min(usable, n);
+        memcpy(buf, prefetch->getBuffer()+skip, usable);
+        // Same as in readRange: beyond the end of the file on disk.
+        m_fill.fill(buf+usable, n-usable, offset+usable);
+        return true;
+    }   // readPrefetched
+
+    // ------------------------------------------------------------------------
+    /** Called after a sequential read that ended at the given offset: frees
+     *  all chunks read in advance that are before the current chunk, and
+     *  asks the IO thread to read the next read-ahead chunks.
+     */
+    void BufferedFileObject::startPrefetch(off64_t end)
+    {
+        off64_t current = (end-1) - (end-1) % m_chunk_size;
+        while(!m_prefetched.empty() && m_prefetched.begin()->first<current)
+            dropPrefetch(m_prefetched.begin()->first);
+
+        for(unsigned int i=1; i<=m_read_ahead; i++)
+        {
+            off64_t chunk_start = current + i*m_chunk_size;
+            if(chunk_start>=m_size)
+                break;
+            if(m_prefetched.find(chunk_start)!=m_prefetched.end())
+                continue;
+            PrefetchRequest *prefetch =
+                new PrefetchRequest(this, m_pool->allocate(), m_chunk_size,
+                                    chunk_start);
+            m_prefetched[chunk_start] = prefetch;
+            addRequest(prefetch);
+        }
+    }   // startPrefetch
+
+    // ------------------------------------------------------------------------
+    /** Frees a chunk read in advance. If the IO thread has not read it yet,
+     *  this waits for it, since the IO thread still uses the buffer. */
+    void BufferedFileObject::dropPrefetch(off64_t chunk_offset)
+    {
+        std::map<off64_t, PrefetchRequest*>::iterator i =
+            m_prefetched.find(chunk_offset);
+        if(i==m_prefetched.end())
+            return;
+        PrefetchRequest *prefetch = i->second;
+        m_prefetched.erase(i);
+        prefetch->wait();
+        m_pool->free(prefetch->getBuffer());
+        delete prefetch;
+    }   // dropPrefetch
+
+    // ------------------------------------------------------------------------
+    /** Frees all chunks read in advance. */
+    void BufferedFileObject::dropAllPrefetches()
+    {
+        while(!m_prefetched.empty())
+            dropPrefetch(m_prefetched.begin()->first);
+    }   // dropAllPrefetches
+
+    // ------------------------------------------------------------------------
+    /** Reads data from a file opened with O_DIRECT. The aligned range that
+     *  contains the requested data is read into a bounce buffer, and the
+     *  requested part is then copied into buf.
+     *  \return Number of bytes read (less than n at end of file), or -1.
+     */
+    ssize_t BufferedFileObject::readDirect(char *buf, size_t n, off64_t offset)
+    {
+        size_t alignment = AlignedBufferPool::getAlignment();
+        char *bounce     = m_pool->allocate();
+        size_t done      = 0;
+        while(done<n)
+        {
+            off64_t pos     = offset+done;
+            off64_t start   = pos - pos % alignment;
+            off64_t end     = pos + (n-done);
+            end             = (end+alignment-1)/alignment*alignment;
+            size_t  len     = std::min((off64_t)m_chunk_size, end-start);
+            ssize_t r;
+            do
+            {
+                r = ::pread64(m_filedes, bounce, len, start);
+            } while(r<0 && errno==EINTR);
+            if(r<0)
+            {
+                m_pool->free(bounce);
+                return -1;
+            }
+            size_t skip   = pos-start;
+            size_t usable = r>(ssize_t)skip ? r-skip : 0;
+            usable        = std::min(usable, n-done);
+            memcpy(buf+done, bounce+skip, usable);
+            done         += usable;
+            if(r<(ssize_t)len)
+                break;   // end of file
+        }
+        m_pool->free(bounce);
+        return done;
+    }   // readDirect
+
+    // ------------------------------------------------------------------------
+    /** Returns the chunk starting at the given offset, creating it if
+     *  necessary. If creating a new chunk would exceed the cache size, the
+     *  chunk with the most data is written first. This keeps chunks with
+     *  few scattered writes (e.g. a file header that is patched later)
+     *  in memory as long as possible.
+     */
+    WriteChunk *BufferedFileObject::getChunk(off64_t offset)
+    {
+        std::map<off64_t, WriteChunk*>::iterator i = m_chunks.find(offset);
+        if(i!=m_chunks.end())
+            return i->second;
+
+        if(m_chunks.size()>=m_max_chunks)
+        {
+            WriteChunk *victim = NULL;
+            for(i=m_chunks.begin(); i!=m_chunks.end(); i++)
+            {
+                if(!victim ||
+                   i->second->getNumDirtyBytes()>victim->getNumDirtyBytes())
+                    victim = i->second;
+            }
+            submitChunk(victim);
+        }
+        WriteChunk *chunk = new WriteChunk(offset, m_pool);
+        m_chunks[offset] = chunk;
+        return chunk;
+    }   // getChunk
+
+    // ------------------------------------------------------------------------
+    /** Removes the chunk from the cache and hands it to the IO thread. A
+     *  copy of this chunk read in advance is outdated once the chunk is
+     *  written, so it is dropped. */
+    void BufferedFileObject::submitChunk(WriteChunk *chunk)
+    {
+        m_chunks.erase(chunk->getOffset());
+        if(!m_prefetched.empty())
+            dropPrefetch(chunk->getOffset());
+        m_pending_writes.lock();
+        m_pending_writes.getData()++;
+        m_pending_writes.unlock();
+        addRequest(new WriteRequest(this, chunk));
+    }   // submitChunk
+
+    // ------------------------------------------------------------------------
+    /** Stores the first error that happened in the IO thread, it will be
+     *  reported to the application on the next flush or close. */
+    void BufferedFileObject::setError(int error)
+    {
+        m_error.lock();
+        if(m_error.getData()==0)
+            m_error.getData() = error;
+        m_error.unlock();
+    }   // setError
+
+    // ------------------------------------------------------------------------
+    /** Writes n bytes at the given offset, repeating partial writes.
+     *  \return True if all data was written, false on error.
+     */
+    bool BufferedFileObject::writeFully(const char *p, size_t n, off64_t offset)
+    {
+        while(n>0)
+        {
+            ssize_t written = ::pwrite64(m_filedes, p, n, offset);
+            if(written<0 && errno==EINTR) continue;
+            if(written<=0)
+            {
+                setError(written<0 ? errno : EIO);
+                return false;
+            }
+            p      += written;
+            offset += written;
+            n      -= written;
+        }
+        return true;
+    }   // writeFully
+
+    // ------------------------------------------------------------------------
+    /** Called from the IO thread: computes the file ranges (relative to the
+     *  chunk start) that must be written for a chunk. Normally these are
+     *  just the dirty ranges, a full chunk results in one aligned range of
+     *  chunk-size bytes.
+     */
+    void BufferedFileObject::getWriteRanges(WriteChunk *chunk,
+                                            ExtentMap *ranges)
+    {
+        if(m_direct)
+            getWriteRangesDirect(chunk, ranges);
+        else
+        {
+            const ExtentMap &dirty = chunk->getDirty();
+            ExtentMap::const_iterator i;
+            for(i=dirty.begin(); i!=dirty.end(); i++)
+                ranges->add(i->first, i->second);
+        }
+        if(m_fill.isEnabled() && !m_append)
+            removeFillBlocks(chunk, ranges);
+    }   // getWriteRanges
+
+    // ------------------------------------------------------------------------
+    /** Called from the IO thread: removes all aligned blocks that only
+     *  contain the fill value from the ranges to write. If such a block is
+     *  inside data already written, a hole is punched instead (or the block
+     *  is written if the file system does not support this).
+     */
+    void BufferedFileObject::removeFillBlocks(WriteChunk *chunk,
+                                              ExtentMap *ranges)
+    {
+        ExtentMap write;
+        std::vector<FillPattern::Range> runs;
+        const off64_t chunk_offset = chunk->getOffset();
+        ExtentMap::const_iterator i;
+        for(i=ranges->begin(); i!=ranges->end(); i++)
+        {
+            runs.clear();
+            m_fill.findFillRuns(chunk->getData()+i->first,
+                                i->second - i->first,
+                                chunk_offset+i->first, &runs);
+            off64_t start = i->first;
+            for(unsigned int j=0; j<runs.size(); j++)
+            {
+                off64_t run_start = runs[j].first  - chunk_offset;
+                off64_t run_end   = runs[j].second - chunk_offset;
+                write.add(start, run_start);
+                start = run_end;
+                off64_t punch_end = std::min(runs[j].second, m_disk_end);
+                if(runs[j].first<punch_end &&
+                   !FillPattern::punchHole(m_filedes, runs[j].first,
+                                           punch_end-runs[j].first) )
+                {
+                    write.add(run_start, run_end);
+                    continue;
+                }
+                if(runs[j].second>m_disk_end)
+                    m_elided = true;
+            }
+            write.add(start, i->second);
+        }
+        *ranges = write;
+        m_disk_end = std::max(m_disk_end, chunk_offset+write.getEnd());
+    }   // removeFillBlocks
+
+    // ------------------------------------------------------------------------
+    /** Called from the IO thread for a file opened with O_DIRECT. Each dirty
+     *  range is extended to block (page) boundaries. Blocks that are only
+     *  partially written (typically the head and tail of a range) are read
+     *  from disk into a bounce buffer first, the dirty data is copied over
+     *  it, and the completed block is copied back into the chunk. Then each
+     *  aligned range can be written with one write.
+     *  Data beyond the logical end of file is written as zeros, the file is
+     *  truncated to its logical size when it is flushed.
+     */
+    void BufferedFileObject::getWriteRangesDirect(WriteChunk *chunk,
+                                                  ExtentMap *ranges)
+    {
+        const off64_t alignment = AlignedBufferPool::getAlignment();
+        const ExtentMap &dirty  = chunk->getDirty();
+        char *block             = NULL;
+
+        ExtentMap::const_iterator i;
+        for(i=dirty.begin(); i!=dirty.end(); i++)
+        {
+            off64_t start = i->first - i->first % alignment;
+            off64_t end   = (i->second+alignment-1)/alignment*alignment;
+            ranges->add(start, std::min(end, (off64_t)chunk->getSize()));
+        }
+
+        for(i=ranges->begin(); i!=ranges->end(); i++)
+        {
+            for(off64_t b=i->first; b<i->second; b+=alignment)
+            {
+                if(dirty.covers(b, b+alignment))
+                    continue;
+                // Read-modify-write of a partially written block.
+                if(!block)
+                    block = AlignedBufferPool::getPool(alignment)->allocate();
+                off64_t file_pos = chunk->getOffset()+b;
+                ssize_t r;
+                do
+                {
+                    r = ::pread64(m_filedes, block, alignment, file_pos);
+                } while(r<0 && errno==EINTR);
+                if(r<0)
+                {
+                    setError(errno);
+                    r = 0;
+                }
+                memset(block+r, 0, alignment-r);
+                chunk->overlay(file_pos, block, alignment);
+                memcpy(chunk->getData()+b, block, alignment);
+            }
+        }
+        if(block)
+            AlignedBufferPool::getPool(alignment)->free(block);
+    }   // getWriteRangesDirect
+
+    // ------------------------------------------------------------------------
+    /** Called from the IO thread: writes a chunk with normal (synchronous)
+     *  writes.
+     */
+    void BufferedFileObject::writeChunk(WriteChunk *chunk)
+    {
+        ExtentMap ranges;
+        getWriteRanges(chunk, &ranges);
+        ExtentMap::const_iterator i;
+        for(i=ranges.begin(); i!=ranges.end(); i++)
+        {
+            if(!writeFully(chunk->getData()+i->first, i->second - i->first,
+                           chunk->getOffset()+i->first))
+                break;
+        }
+    }   // writeChunk
+
+    // ------------------------------------------------------------------------
+    /** Waits till the IO thread has handled all requests queued so far. */
+    void BufferedFileObject::drain()
+    {
+        BarrierRequest *barrier = new BarrierRequest();
+        addRequest(barrier);
+        barrier->wait();
+        delete barrier;
+    }   // drain
+
+    // ------------------------------------------------------------------------
+    /** Waits till the IO thread has written all data of this file queued
+     *  so far. */
+    void BufferedFileObject::flushFile()
+    {
+        FlushRequest *flush = new FlushRequest(this);
+        addRequest(flush);
+        flush->wait();
+        delete flush;
+    }   // flushFile
+
+    // ------------------------------------------------------------------------
+    /** Lets the IO thread sync the file once all previously queued writes
+     *  are done, and waits for it. */
+    void BufferedFileObject::syncFile()
+    {
+        FsyncRequest *fsync = new FsyncRequest(this);
+        addRequest(fsync);
+        fsync->wait();
+        delete fsync;
+    }   // syncFile
+
+    // ------------------------------------------------------------------------
+    /** Hands all cached chunks to the IO thread and waits till they are
+     *  written.
+     *  \return 0 if no error happened, otherwise -1 (with errno set). An
+     *          unreported error of an asynchronous close is returned here
+     *          as well.
+     */
+    int BufferedFileObject::flushChunks()
+    {
+        while(!m_chunks.empty())
+            submitChunk(m_chunks.begin()->second);
+        bool writable = (m_open_flags & O_ACCMODE)!=O_RDONLY;
+        if(m_fsync && writable && !m_direct && !m_fill.isEnabled())
+        {
+            // The fsync is only done after all queued writes of this file,
+            // so there is no need to wait for them separately.
+            syncFile();
+        }
+        else
+        {
+            // m_elided is set by the IO thread, so it is only valid once
+            // all writes are done.
+            flushFile();
+            // Aligned writes might have extended the file beyond its
+            // logical size, and skipped blocks at the end not extended it.
+            // This must be done before the fsync, as in finishClose.
+            if((m_direct || m_elided) && writable &&
+               ::ftruncate64(m_filedes, m_size)!=0)
+                setError(errno);
+            if(m_fsync && writable)
+                syncFile();
+        }
+        int error = m_error.getAtomic();
+        if(!error)
+            error = takeCloseError();
+        if(error)
+        {
+            errno = error;
+            return -1;
+        }
+        return 0;
+    }   // flushChunks
+
+    // ------------------------------------------------------------------------
+    /** Writes all cached data and closes the file.
+     *  \return 0 if no error happened, otherwise -1 (with errno set).
+     */
+    int BufferedFileObject::closeFile()
+    {
+        if(!isOpen())
+        {
+            errno = EBADF;
+            return -1;
+        }
+        dropAllPrefetches();
+        if(m_async_close)
+            return closeAsync();
+        int result = flushChunks();
+        int error  = errno;
+        if(OS::close(m_filedes)!=0 && result==0)
+        {
+            result = -1;
+            error  = errno;
+        }
+        m_filedes = -1;
+        errno     = error;
+        return result;
+    }   // closeFile
+
+    // ------------------------------------------------------------------------
+    /** Hands all cached chunks and a close request to the IO thread, and
+     *  returns without waiting.
+     *  \return 0, or -1 (with errno set) if an earlier asynchronous close
+     *          failed and this was not reported yet.
+     */
+    int BufferedFileObject::closeAsync()
+    {
+        while(!m_chunks.empty())
+            submitChunk(m_chunks.begin()->second);
+        m_close_queued = true;
+        m_closing.lock();
+        m_closing.getData()[getFilename()]++;
+        m_closing.unlock();
+        addRequest(new CloseRequest(this, m_filedes));
+
+        int error = takeCloseError();
+        if(error)
+        {
+            errno = error;
+            return -1;
+        }
+        return 0;
+    }   // closeAsync
+
+    // ------------------------------------------------------------------------
+    /** Called from the IO thread to close a file after all its data was
+     *  written. Errors are printed, and stored so that they can be reported
+     *  by the next flush or close.
+     */
+    void BufferedFileObject::finishClose(int filedes)
+    {
+        bool writable = (m_open_flags & O_ACCMODE)!=O_RDONLY;
+        if((m_direct || m_elided) && writable &&
+           ::ftruncate64(filedes, m_size)!=0)
+            setError(errno);
+        if(m_fsync && writable && ::fsync(filedes)!=0)
+            setError(errno);
+        if(OS::close(filedes)!=0)
+            setError(errno);
+        m_filedes = -1;
+
+        int error = m_error.getAtomic();
+        if(error)
+        {
+            printf("Error closing '%s': %s.\n", getFilename().c_str(),
+                   strerror(error));
+            m_close_error.lock();
+            if(m_close_error.getData()==0)
+                m_close_error.getData() = error;
+            m_close_error.unlock();
+        }
+
+        m_closing.lock();
+        std::map<std::string, int>::iterator i =
+            m_closing.getData().find(getFilename());
+        if(--i->second==0)
+            m_closing.getData().erase(i);
+        m_closing.unlock();
+    }   // finishClose
+
+    // ------------------------------------------------------------------------
+    /** Returns and clears the first error of an asynchronous close that
+     *  was not reported yet, or 0 if there is none. */
+    int BufferedFileObject::takeCloseError()
+    {
+        m_close_error.lock();
+        int error = m_close_error.getData();
+        m_close_error.getData() = 0;
+        m_close_error.unlock();
+        return error;
+    }   // takeCloseError
+
     // ========================================================================
+    /** Called from the IO thread when the first file with engine="uring" is
+     *  written. Creates the io_uring engine; if that fails, a message is
+     *  printed and all files use normal writes from then on.
+     *  \return True if io_uring can be used.
+     */
+    bool BufferedFileObject::startUring()
+    {
+        if(m_uring)
+            return true;
+        if(m_uring_failed)
+            return false;
+        m_uring = new UringEngine();
+        if(!m_uring->init(URING_QUEUE_DEPTH))
+        {
+            printf("io_uring not available (%s) - using normal writes.\n",
+                   strerror(errno));
+            delete m_uring;
+            m_uring        = NULL;
+            m_uring_failed = true;
+            return false;
+        }
+        if(!ThreadPlacement::getCpus().empty() &&
+           !m_uring->setWorkerAffinity(ThreadPlacement::getCpus()))
+            printf("Can not pin io_uring workers: %s.\n", strerror(errno));
+        m_registered_generation = 0;
+        registerUringBuffers();
+        return true;
+    }   // startUring
+
+    // ------------------------------------------------------------------------
+    /** Registers all buffers of the buffer pools with io_uring, if new
+     *  buffers were allocated since the last registration. Writes from
+     *  chunks then use fixed buffers. Must only be called when no io_uring
+     *  operation is pending.
+     */
+    void BufferedFileObject::registerUringBuffers()
+    {
+        std::vector<struct iovec> buffers;
+        unsigned int generation = AlignedBufferPool::getAllBuffers(&buffers);
+        if(generation==m_registered_generation)
+            return;
+        // Even if registration fails (e.g. because of the locked memory
+        // limit) don't try again till more buffers are allocated.
+        m_registered_generation = generation;
+        if(!m_uring->registerBuffers(buffers))
+            printf("Can not register %d buffers with io_uring: %s.\n",
+                   (int)buffers.size(), strerror(errno));
+    }   // registerUringBuffers
+
+    // ------------------------------------------------------------------------
+    /** Queues all writes for a chunk in the io_uring engine. The request is
+     *  finished once the last of these writes has completed.
+     */
+    void BufferedFileObject::queueUringWrite(WriteRequest *request)
+    {
+        BufferedFileObject *object = request->getFileObject();
+        WriteChunk *chunk          = request->getChunk();
+        ExtentMap ranges;
+        object->getWriteRanges(chunk, &ranges);
+
+        // Hold one reference while queueing, since queueWrite might already
+        // complete earlier writes if the submission queue is full.
+        request->addOutstanding();
+        ExtentMap::const_iterator i;
+        for(i=ranges.begin(); i!=ranges.end(); i++)
+        {
+            UringOperation *op = new UringOperation();
+            op->m_request = request;
+            op->m_data    = chunk->getData()+i->first;
+            op->m_size    = i->second - i->first;
+            op->m_offset  = chunk->getOffset()+i->first;
+            request->addOutstanding();
+            m_uring->queueWrite(object->m_filedes, op->m_data, op->m_size,
+                                op->m_offset, op, &uringCompleted);
+        }
+        if(request->removeOutstanding()==0)
+            finishWrite(request);
+    }   // queueUringWrite
+
+    // ------------------------------------------------------------------------
+    /** Called by the io_uring engine for each completed operation. Failed
+     *  and short writes are completed with normal writes, which also
+     *  records the error if the write fails again.
+     */
+    void BufferedFileObject::uringCompleted(void *user_data, int result)
+    {
+        UringOperation *op = (UringOperation*)user_data;
+        if(op->m_request->getType()==Request::RQ_FSYNC)
+        {
+            FsyncRequest *fsync = (FsyncRequest*)op->m_request;
+            if(result<0)
+                fsync->getFileObject()->setError(-result);
+            fsync->done();
+            delete op;
+            return;
+        }
+
+        WriteRequest *request      = (WriteRequest*)op->m_request;
+        BufferedFileObject *object = request->getFileObject();
+        if(result<0)
+            object->writeFully(op->m_data, op->m_size, op->m_offset);
+        else if((size_t)result<op->m_size)
+            object->writeFully(op->m_data+result, op->m_size-result,
+                               op->m_offset+result);
+        delete op;
+        if(request->removeOutstanding()==0)
+            finishWrite(request);
+    }   // uringCompleted
+
+    // ------------------------------------------------------------------------
+    /** Called from the IO thread once all data of a write request is
+     *  written. Frees the chunk and the request.
+     */
+    void BufferedFileObject::finishWrite(WriteRequest *request)
+    {
+        BufferedFileObject *object = request->getFileObject();
+        object->m_pending_writes.lock();
+        object->m_pending_writes.getData()--;
+        object->m_pending_writes.unlock();
+        delete request->getChunk();
+        delete request;
+    }   // finishWrite
+
+    // ------------------------------------------------------------------------
+    /** Called from the IO thread: waits till all io_uring writes of the
+     *  given file (or of all files if object is NULL) are done.
+     */
+    void BufferedFileObject::waitForUring(BufferedFileObject *object)
+    {
+        if(!m_uring)
+            return;
+        if(object)
+        {
+            std::set< std::pair<BufferedFileObject*, off64_t> >::iterator i =
+                m_uring_queued.lower_bound(std::make_pair(object, (off64_t)0));
+            if(i==m_uring_queued.end() || i->first!=object)
+                return;
+        }
+        m_uring->submitAndWaitAll(&uringCompleted);
+        m_uring_queued.clear();
+    }   // waitForUring
+
+    // ------------------------------------------------------------------------
+    /** Called from the IO thread to handle a read or prefetch request. */
+    void BufferedFileObject::handleRead(ReadRequest *request)
+    {
+        BufferedFileObject *object = request->getFileObject();
+        waitForUring(object);
+        ssize_t r = object->readFromFile(request->getBuffer(),
+                                         request->getSize(),
+                                         request->getOffset());
+        request->setResult(r, r<0 ? errno : 0);
+        request->done();
+    }   // handleRead
+
+    // ------------------------------------------------------------------------
     /** This is a separate server thread, that will try to write back stored
-     *  pages. It will use alio itself for all IO, so it can make use of all
-     *  those features.
+     *  pages. All requests queued at the same time are handled as one batch:
+     *  normal writes are done immediately, while writes of files using
+     *  io_uring are queued and submitted together at the end of the batch
+     *  (or earlier if a request depends on them). Since io_uring does not
+     *  keep the order of operations, a second write to the same chunk of a
+     *  file waits for all queued operations first.
      */
     void *BufferedFileObject::serverMainLoop(void *obj)
     {
-        printf("Thread started - hoooray\n\n");
-        
-        m_request_queue.lock();
+        ThreadPlacement::registerWorker();
+        std::vector<Request*> batch;
         while(1)
         {
-            bool empty = m_request_queue.getData().empty();
+            m_request_queue.lock();
             // Wait in cond_wait for a request to arrive. The 'while' is necessary
             // since "spurious wakeups from the pthread_cond_wait ... may occur"
             // (pthread_cond_wait man page)!
-            while(empty)
+            while(m_request_queue.getData().empty())
             {
+                m_worker_waiting = true;
                 pthread_cond_wait(&m_request_signal, m_request_queue.getMutex());
-                empty = m_request_queue.getData().empty();
+                m_worker_waiting = false;
             }
-            std::vector<Request*>::iterator i = m_request_queue.getData().begin();
-            Request *request = *i;
-            m_request_queue.getData().erase(i);
+            batch.swap(m_request_queue.getData());
             m_request_queue.unlock();
-            printf("Received request %d\n", request->getType());
-            if(request->getType()==Request::RQ_QUIT) 
+
+            if(m_uring)
+                registerUringBuffers();
+
+            for(unsigned int i=0; i<batch.size(); i++)
             {
-                request->done();
-                break;
-            }
-        }   // while !m_abort
-        printf("Thread now exiting.\n");
+                Request *request = batch[i];
+                switch(request->getType())
+                {
+                case Request::RQ_QUIT:
+                    waitForUring(NULL);
+                    delete m_uring;
+                    m_uring = NULL;
+                    request->done();
+                    return NULL;
+                case Request::RQ_WRITE:
+                    {
+                        WriteRequest *wr = (WriteRequest*)request;
+                        BufferedFileObject *object = wr->getFileObject();
+                        if(!object->m_use_uring || !startUring())
+                        {
+                            object->writeChunk(wr->getChunk());
+                            finishWrite(wr);
+                            break;
+                        }
+                        std::pair<BufferedFileObject*, off64_t>
+                            key(object, wr->getChunk()->getOffset());
+                        if(m_uring_queued.find(key)!=m_uring_queued.end())
+                            waitForUring(NULL);
+                        m_uring_queued.insert(key);
+                        queueUringWrite(wr);
+                        break;
+                    }
+                case Request::RQ_READ:
+                case Request::RQ_PREFETCH:
+                    handleRead((ReadRequest*)request);
+                    break;
+                case Request::RQ_FLUSH:
+                    // Normal writes are already done, so only wait for
+                    // io_uring writes of this file, then signal the waiting
+                    // thread (which also frees the request).
+                    waitForUring(((FlushRequest*)request)->getFileObject());
+                    request->done();
+                    break;
+                case Request::RQ_BARRIER:
+                    waitForUring(NULL);
+                    request->done();
+                    break;
+                case Request::RQ_FSYNC:
+                    {
+                        FsyncRequest *fsync = (FsyncRequest*)request;
+                        BufferedFileObject *object = fsync->getFileObject();
+                        if(object->m_use_uring && m_uring)
+                        {
+                            // The engine only starts the fsync once all
+                            // earlier writes are done.
+                            UringOperation *op = new UringOperation();
+                            op->m_request = fsync;
+                            op->m_data    = NULL;
+                            op->m_size    = 0;
+                            op->m_offset  = 0;
+                            m_uring->queueFsync(object->m_filedes, op,
+                                                &uringCompleted);
+                            break;
+                        }
+                        if(::fsync(object->m_filedes)!=0)
+                            object->setError(errno);
+                        fsync->done();
+                        break;
+                    }
+                case Request::RQ_CLOSE:
+                    {
+                        CloseRequest *close = (CloseRequest*)request;
+                        // All writes of this file must be done first.
+                        waitForUring(close->getFileObject());
+                        close->getFileObject()
+                             ->finishClose(close->getFiledes());
+                        delete close;
+                        break;
+                    }
+                default:
+                    printf("Received unknown request %d.\n",
+                           request->getType());
+                    request->done();
+                }
+            }   // for i<batch.size()
+            batch.clear();
+
+            // Submit all queued io_uring operations of this batch.
+            waitForUring(NULL);
+        }   // while 1
 
         return NULL;
-    }   // server
+    }   // serverMainLoop
 
 };   // namespace ALIO
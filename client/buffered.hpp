@@ -22,40 +22,226 @@
 #include "client/base_file_object.hpp"
 #include "client/config.hpp"
 #include "client/request.hpp"
+#include "client/write_chunk.hpp"
+#include "tools/fill_pattern.hpp"
 #include "tools/os.hpp"
 #include "tools/synchronised.hpp"
 
-#include <queue>
+#include <map>
+#include <set>
 #include <string>
-
-class XMLNode;
+#include <vector>
 
 namespace ALIO
 {
+class UringEngine;
+class XMLNode;
+
+/** A file object that collects writes in memory before writing them
+ *  to disk. The file is divided into aligned chunks (chunk-size in the
+ *  config file, e.g. 1, 4 or 16 MiB). Writes are copied into the chunk
+ *  they belong to, so many small adjacent or overlapping writes are
+ *  coalesced. A chunk that is completely written is handed to a separate
+ *  IO thread, which writes it with a single aligned write. Partially
+ *  written chunks stay in memory (with their written ranges stored in an
+ *  extent map) till the file is flushed or closed, or till cache-size is
+ *  exceeded. Reads are served from the file with the cached data overlaid.
+ *  With read-ahead="N", sequential reads let the IO thread read the next
+ *  N chunks in advance.
+ *  Both FILE and file descriptor based functions are implemented on top of
+ *  a file descriptor, with the file position managed by this object.
+ *  With direct="yes" the file is opened with O_DIRECT, bypassing the page
+ *  cache. All data is then staged through page-aligned buffers (the chunks
+ *  themselves, and bounce buffers for reads), and partially written blocks
+ *  at the head and tail of a write are completed with a read-modify-write.
+ *  With engine="uring" the IO thread submits the writes of all queued
+ *  requests as one batch using io_uring (if available, otherwise normal
+ *  writes are used). With fsync="yes" each flush and close also syncs the
+ *  file to stable storage.
+ *  With async-close="yes" close only queues the remaining data and a close
+ *  request for the IO thread and returns immediately. Errors of such a
+ *  close are printed, and returned by the next flush or close of any
+ *  buffered file. Opening a file that is still being closed waits till
+ *  the close is done, and all closes are finished at exit.
+ *  With sparse="zero" (or a fill value like sparse="float32:9.96921e36")
+ *  the IO thread does not write aligned blocks (sparse-block-size, default
+ *  64K) that only contain zeros or the fill value, so the file becomes
+ *  sparse. Blocks inside existing data are deallocated with a punched
+ *  hole, and the file is extended to its size on flush and close.
+ */
 class BufferedFileObject : public BaseFileObject
 {
+private:
+    /** The original file descriptor. */
+    int  m_filedes;
 
+    /** The flags used when opening the file. */
+    int  m_open_flags;
 
-    // ========================================================================
-protected:
-    /** The original stream pointer in case of stream objects. */
-    FILE *m_file;
+    /** True if all writes are appended to the end of the file. */
+    bool m_append;
 
-    /** The original file descriptor. */
-    int  m_filedes;
+    /** Set when a read hits the end of file. */
+    bool m_eof;
+
+    /** The current file position. */
+    off64_t m_position;
+
+    /** The logical size of the file, including all cached data. */
+    off64_t m_size;
+
+    /** Size of a chunk in bytes. */
+    size_t m_chunk_size;
+
+    /** Maximum number of partially written chunks kept in memory. */
+    size_t m_max_chunks;
+
+    /** True if O_DIRECT was requested in the config file. */
+    bool   m_use_direct;
+
+    /** True if the file is actually opened with O_DIRECT. */
+    bool   m_direct;
+
+    /** True if the IO thread should use io_uring for this file. */
+    bool   m_use_uring;
+
+    /** True if flush and close should also fsync the file. */
+    bool   m_fsync;
 
-    /** Signals the thread to abort. */
-    bool m_abort;
+    /** True if close should not wait for the data to be written. */
+    bool   m_async_close;
+
+    /** Set when an asynchronous close was queued. The file descriptor
+     *  stays valid till the IO thread has closed it. */
+    bool   m_close_queued;
+
+    /** Number of chunks to read ahead for sequential reads, 0 if
+     *  read-ahead is disabled. */
+    unsigned int m_read_ahead;
+
+    /** File offset at which the next read is sequential. */
+    off64_t      m_next_sequential;
+
+    /** Chunks read (or being read) by the IO thread in advance, indexed by
+     *  the chunk offset. */
+    std::map<off64_t, PrefetchRequest*> m_prefetched;
+
+    /** The pool for chunk and bounce buffers (all of chunk size). */
+    AlignedBufferPool *m_pool;
+
+    /** All chunks that are not yet handed to the IO thread, indexed by
+     *  the offset of the chunk. */
+    std::map<off64_t, WriteChunk*> m_chunks;
+
+    /** Number of write requests for this file that the IO thread has not
+     *  yet finished. */
+    Synchronised<int> m_pending_writes;
+
+    /** The first error (errno) that happened in the IO thread when writing
+     *  data of this file, 0 if no error happened. */
+    Synchronised<int> m_error;
+
+    /** Detects blocks that do not need to be written. */
+    FillPattern m_fill;
+
+    /** Used by the IO thread: end of the data written to disk so far
+     *  (blocks skipped before it must be punched out). */
+    off64_t m_disk_end;
+
+    /** Set by the IO thread when a block was skipped at the end of the
+     *  file, so that the file must be extended on flush and close. */
+    bool    m_elided;
 
     /** To synchronise access to the request queue. */
     static pthread_cond_t m_request_signal;
 
-    static void addRequest(Request *p);
-    static void *serverMainLoop(void *obj);
+    /** True while the IO thread waits for requests, so it needs a signal.
+     *  Protected by the lock of m_request_queue. */
+    static bool m_worker_waiting;
+
+    /** The IO thread. */
+    static pthread_t m_thread;
 
     /** The list of pointers to all requests that still need to be handled. */
     static Synchronised< std::vector<Request*> > m_request_queue;
 
+    /** All buffered file objects, so that cached data can be written
+     *  at exit. */
+    static Synchronised< std::vector<BufferedFileObject*> > m_all_objects;
+
+    /** Number of asynchronous closes not yet done for each file name. */
+    static Synchronised< std::map<std::string, int> > m_closing;
+
+    /** The first error of an asynchronous close that was not yet reported
+     *  to the application. */
+    static Synchronised<int> m_close_error;
+
+    /** The io_uring engine of the IO thread, NULL if not used (yet). */
+    static UringEngine *m_uring;
+
+    /** Set if io_uring could not be initialised, all files then use
+     *  normal writes. */
+    static bool m_uring_failed;
+
+    /** The buffer generation (see AlignedBufferPool::getAllBuffers) of
+     *  the buffers registered with m_uring. */
+    static unsigned int m_registered_generation;
+
+    /** The (file, chunk offset) pairs of all writes queued in m_uring
+     *  since it was last waited for. Only used by the IO thread. */
+    static std::set< std::pair<BufferedFileObject*, off64_t> > m_uring_queued;
+
+    static void addRequest(Request *p);
+    static void *serverMainLoop(void *obj);
+    static bool startUring();
+    static void registerUringBuffers();
+    static void queueUringWrite(WriteRequest *request);
+    static void uringCompleted(void *user_data, int result);
+    static void finishWrite(WriteRequest *request);
+    static void waitForUring(BufferedFileObject *object);
+    static void handleRead(ReadRequest *request);
+    static int  takeCloseError();
+
+    int         openFile(int flags, mode_t mode);
+    int         modeToFlags(const char *mode) const;
+    off64_t     seek(off64_t offset, int whence);
+    ssize_t     writeAt(const void *buf, size_t n, off64_t offset);
+    ssize_t     readAt(void *buf, size_t n, off64_t offset);
+    ssize_t     readRange(char *buf, size_t n, off64_t offset);
+    ssize_t     readFromFile(char *buf, size_t n, off64_t offset);
+    ssize_t     readDirect(char *buf, size_t n, off64_t offset);
+    bool        readPrefetched(char *buf, size_t n, off64_t offset);
+    void        startPrefetch(off64_t end);
+    void        dropPrefetch(off64_t chunk_offset);
+    void        dropAllPrefetches();
+    WriteChunk *getChunk(off64_t offset);
+    void        submitChunk(WriteChunk *chunk);
+    void        getWriteRanges(WriteChunk *chunk, ExtentMap *ranges);
+    void        getWriteRangesDirect(WriteChunk *chunk, ExtentMap *ranges);
+    void        removeFillBlocks(WriteChunk *chunk, ExtentMap *ranges);
+    void        writeChunk(WriteChunk *chunk);
+    bool        writeFully(const char *p, size_t n, off64_t offset);
+    void        setError(int error);
+    void        drain();
+    void        flushFile();
+    void        syncFile();
+    int         flushChunks();
+    int         closeFile();
+    int         closeAsync();
+    void        finishClose(int filedes);
+    // ------------------------------------------------------------------------
+    /** True if the file is open and can be used by the application. */
+    bool isOpen() const { return m_filedes>=0 && !m_close_queued; }
+    // ------------------------------------------------------------------------
+    /** Adjusts the size returned by a stat call to include cached data. */
+    template <typename T>
+    void adjustSize(T *size) const
+    {
+        if(m_filedes>=0 && m_size>*size)
+            *size = m_size;
+    }   // adjustSize
+    // ------------------------------------------------------------------------
+
 public:
 
     static int init();
@@ -67,8 +253,7 @@ public:
     // ------------------------------------------------------------------------
     virtual FILE*  fopen(const char *mode)
     {
-        m_file=OS::fopen(getFilename().c_str(), mode);
-        if(!m_file)
+        if(openFile(modeToFlags(mode), 0666)<0)
             return NULL;
         return (FILE*)this;
     }   // fopen
@@ -76,156 +261,142 @@ public:
     // ------------------------------------------------------------------------
     virtual FILE*  fopen64(const char *mode)
     {
-        m_file=OS::fopen64(getFilename().c_str(), mode);
-        if(!m_file)
+        if(openFile(modeToFlags(mode)|O_LARGEFILE, 0666)<0)
             return NULL;
         return (FILE*)this;
-    }   // fopen
+    }   // fopen64
 
     // ------------------------------------------------------------------------
-    virtual int setvbuf(char *buf, int mode, size_t size)
-    {
-        return OS::setvbuf(m_file, buf, mode, size);
-    }   // setvbuf
+    /** The stream buffer is replaced by the chunk cache, so this is
+     *  ignored. */
+    virtual int setvbuf(char *buf, int mode, size_t size) { return 0; }
     // ------------------------------------------------------------------------
     virtual int fseek(long offset, int whence)
     {
-        return OS::fseek(m_file, offset, whence);
-    }   // fseeko
+        return seek(offset, whence)<0 ? -1 : 0;
+    }   // fseek
     // ------------------------------------------------------------------------
     virtual int fseeko(off_t offset, int whence)
     {
-        return OS::fseeko(m_file, offset, whence);
-    }   // fseek
+        return seek(offset, whence)<0 ? -1 : 0;
+    }   // fseeko
     // ------------------------------------------------------------------------
     virtual int fseeko64(off64_t offset, int whence)
     {
-        return OS::fseeko64(m_file, offset, whence);
+        return seek(offset, whence)<0 ? -1 : 0;
     }   // fseeko64
     // ------------------------------------------------------------------------
-    virtual long ftell()
-    {
-        return OS::ftell(m_file);
-    }   // ftell
+    virtual long ftell() { return m_position; }
     // ------------------------------------------------------------------------
-    virtual off_t ftello()
-    {
-        return OS::ftello(m_file);
-    }   // ftello
+    virtual off_t ftello() { return m_position; }
     // ------------------------------------------------------------------------
-    virtual off64_t ftello64()
-    {
-        return OS::ftello64(m_file);
-    }   // ftello64
+    virtual off64_t ftello64() { return m_position; }
     // ------------------------------------------------------------------------
     virtual int fflush()
     {
-        return OS::fflush(m_file);
+        return flushChunks()==0 ? 0 : EOF;
     }   // fflush
     // ------------------------------------------------------------------------
-    virtual int ferror()
-    {
-        return OS::ferror(m_file);
-    }   // ferror
+    virtual int ferror() { return m_error.getAtomic()!=0; }
     // ------------------------------------------------------------------------
     virtual int fileno()
     {
-        return OS::fileno(m_file);
+        // Same as StandardFileObject: return a 'virtual' file descriptor
+        // so that further access is still handled by alio.
+        return getIndex()+Config::get()->getMaxFiles();
     }   // fileno
     // ------------------------------------------------------------------------
-    virtual size_t fwrite(const void *ptr,size_t size, size_t nmemb)
+    virtual size_t fwrite(const void *ptr, size_t size, size_t nmemb)
     {
-        return OS::fwrite(ptr, size, nmemb, m_file);
-    }   // f_write
+        if(size==0 || nmemb==0) return 0;
+        ssize_t n = write(ptr, size*nmemb);
+        return n<0 ? 0 : n/size;
+    }   // fwrite
 
     // ------------------------------------------------------------------------
-    virtual size_t fread(void *ptr,size_t size, size_t nmemb)
+    virtual size_t fread(void *ptr, size_t size, size_t nmemb)
     {
-        return OS::fread(ptr, size, nmemb, m_file);
-    }   // f_read
+        if(size==0 || nmemb==0) return 0;
+        ssize_t n = read(ptr, size*nmemb);
+        return n<0 ? 0 : n/size;
+    }   // fread
 
     // ------------------------------------------------------------------------
-    virtual int feof()
-    {
-        return OS::feof(m_file);
-    }   // feof
+    virtual int feof() { return m_eof; }
     // ------------------------------------------------------------------------
-    virtual char *fgets(char *s, int size)
-    {
-        return OS::fgets(s, size, m_file);
-    }   // fgets
+    virtual char *fgets(char *s, int size);
     // ------------------------------------------------------------------------
     virtual int fclose()
     {
-        int error = OS::fclose(m_file);
-        if(!error)
-            m_file = NULL;
-        return error;
+        return closeFile()==0 ? 0 : EOF;
     }   // fclose
 
     // ------------------------------------------------------------------------
     virtual int open(int flags, mode_t mode)
     {
-        m_filedes = OS::open(getFilename().c_str(), flags, mode);
+        if(openFile(flags, mode)<0)
+            return -1;
         return getIndex()+Config::get()->getMaxFiles();
     }   // open
     // ------------------------------------------------------------------------
     virtual int open64(int flags, mode_t mode)
     {
-        m_filedes = OS::open64(getFilename().c_str(), flags, mode);
+        if(openFile(flags|O_LARGEFILE, mode)<0)
+            return -1;
         return getIndex()+Config::get()->getMaxFiles();
-    }   // open
+    }   // open64
     // ------------------------------------------------------------------------
     virtual int __xstat(int ver, struct stat *buf)
     {
-        return OS::__xstat(ver, getFilename().c_str(), buf);
-    }   // fstat
+        int result = OS::__xstat(ver, getFilename().c_str(), buf);
+        if(result==0) adjustSize(&buf->st_size);
+        return result;
+    }   // __xstat
     // ------------------------------------------------------------------------
     virtual int __fxstat(int ver, struct stat *buf)
     {
-        return OS::__fxstat(ver, m_filedes, buf);
-    }   // fstat
+        int result = OS::__fxstat(ver, m_filedes, buf);
+        if(result==0) adjustSize(&buf->st_size);
+        return result;
+    }   // __fxstat
     // ------------------------------------------------------------------------
     virtual int __fxstat64(int ver, struct stat64 *buf)
     {
-        return OS::__fxstat64(ver, m_filedes, buf);
-    }   // fstat
+        int result = OS::__fxstat64(ver, m_filedes, buf);
+        if(result==0) adjustSize(&buf->st_size);
+        return result;
+    }   // __fxstat64
     // ------------------------------------------------------------------------
     virtual int __lxstat(int ver, struct stat *buf)
     {
-        return OS::__lxstat(ver, getFilename().c_str(), buf);
-    }   // fstat
+        int result = OS::__lxstat(ver, getFilename().c_str(), buf);
+        if(result==0) adjustSize(&buf->st_size);
+        return result;
+    }   // __lxstat
     // ------------------------------------------------------------------------
     virtual off_t lseek(off_t offset, int whence)
     {
-        return OS::lseek(m_filedes, offset, whence);
+        return seek(offset, whence);
     }   // lseek
     // ------------------------------------------------------------------------
     virtual off64_t lseek64(off64_t offset, int whence)
     {
-        return OS::lseek64(m_filedes, offset, whence);
+        return seek(offset, whence);
     }   // lseek64
     // ------------------------------------------------------------------------
-    virtual ssize_t write(const void *buf, size_t nbyte)
-    {
-        return OS::write(m_filedes, buf, nbyte);
-    }   // write
+    virtual ssize_t write(const void *buf, size_t nbyte);
     // ------------------------------------------------------------------------
-    virtual ssize_t read(void *buf, size_t count)
-    {
-        return OS::read(m_filedes, buf, count);
-    }   // read
+    virtual ssize_t read(void *buf, size_t count);
     // ------------------------------------------------------------------------
-    virtual int close()
-    {
-        return OS::close(m_filedes);
-    }   // close
+    virtual int close() { return closeFile(); }
     // ------------------------------------------------------------------------
     virtual int rename(const char *newpath)
     {
         return OS::rename(getFilename().c_str(), newpath);
     }
     // ------------------------------------------------------------------------
+    virtual int unlink() { return OS::unlink(getFilename().c_str()); }
+    // ------------------------------------------------------------------------
 
 
 };   // BufferedFileObject
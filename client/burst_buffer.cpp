@@ -0,0 +1,500 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "client/burst_buffer.hpp"
+
+#include "client/thread_placement.hpp"
+#include "tools/buffer_arena.hpp"
+#include "xml/xml_node.hpp"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace ALIO
+{
+
+pthread_t      BurstBufferFileObject::m_thread;
+pthread_cond_t BurstBufferFileObject::m_job_signal;
+pthread_cond_t BurstBufferFileObject::m_done_signal;
+Synchronised< std::deque<BurstBufferFileObject::DrainJob> >
+               BurstBufferFileObject::m_queue;
+std::map<std::string, std::string> BurstBufferFileObject::m_draining;
+std::set<BurstBufferFileObject*>   BurstBufferFileObject::m_open_files;
+bool           BurstBufferFileObject::m_quit          = false;
+bool           BurstBufferFileObject::m_report        = false;
+off64_t        BurstBufferFileObject::m_backlog_bytes = 0;
+int            BurstBufferFileObject::m_drained_files = 0;
+off64_t        BurstBufferFileObject::m_drained_bytes = 0;
+double         BurstBufferFileObject::m_drain_time    = 0;
+
+/** Size of the buffer used if the data can not be copied in the kernel. */
+static const size_t DRAIN_BUFFER_SIZE = 4*1024*1024;
+
+// ----------------------------------------------------------------------------
+static double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec*1.0e-9;
+}   // now
+
+// ----------------------------------------------------------------------------
+/** Starts the drain thread. */
+int BurstBufferFileObject::init()
+{
+    pthread_cond_init(&m_job_signal,  NULL);
+    pthread_cond_init(&m_done_signal, NULL);
+    m_quit = false;
+    int error = pthread_create(&m_thread, NULL,
+                               &BurstBufferFileObject::drainLoop, NULL);
+    if(error)
+        printf("Can not create burst buffer drain thread: error %d.\n",
+               error);
+    return error;
+}   // init
+
+// ----------------------------------------------------------------------------
+/** Closes all staged files that are still open, then waits till all files
+ *  are drained and stops the drain thread.
+ */
+int BurstBufferFileObject::atExit()
+{
+    m_queue.lock();
+    std::set<BurstBufferFileObject*> open_files = m_open_files;
+    m_queue.unlock();
+    std::set<BurstBufferFileObject*>::iterator i;
+    for(i=open_files.begin(); i!=open_files.end(); i++)
+    {
+        if((*i)->m_file)
+            (*i)->fclose();
+        else
+            (*i)->close();
+    }
+
+    m_queue.lock();
+    if(!m_queue.getData().empty())
+        printf("Waiting for %d file(s) (%lld bytes) to drain.\n",
+               (int)m_queue.getData().size(), (long long)m_backlog_bytes);
+    m_quit = true;
+    pthread_cond_signal(&m_job_signal);
+    m_queue.unlock();
+    pthread_join(m_thread, NULL);
+
+    if(m_report && m_drained_files>0)
+        printf("Drained %d file(s), %lld bytes in %.3f s: %.2f MB/s.\n",
+               m_drained_files, (long long)m_drained_bytes, m_drain_time,
+               m_drain_time>0 ? m_drained_bytes/m_drain_time/(1024*1024)
+                              : 0.0);
+    pthread_cond_destroy(&m_job_signal);
+    pthread_cond_destroy(&m_done_signal);
+    return 0;
+}   // atExit
+
+// ----------------------------------------------------------------------------
+/** Constructor. Reads the local directory (default /tmp) and creates it
+ *  if necessary.
+ */
+BurstBufferFileObject::BurstBufferFileObject(const XMLNode *info)
+                     : StandardFileObject(info)
+{
+    m_staged    = false;
+    m_directory = "/tmp";
+    info->get("directory", &m_directory);
+    bool report = false;
+    info->get("report", &report);
+    if(report)
+        m_report = true;
+    if(::mkdir(m_directory.c_str(), 0700)!=0 && errno!=EEXIST)
+        printf("Can not create burst buffer directory '%s': %s.\n",
+               m_directory.c_str(), strerror(errno));
+}   // BurstBufferFileObject
+
+// ----------------------------------------------------------------------------
+BurstBufferFileObject::~BurstBufferFileObject()
+{
+    m_queue.lock();
+    m_open_files.erase(this);
+    m_queue.unlock();
+}   // ~BurstBufferFileObject
+
+// ----------------------------------------------------------------------------
+/** Sets the name of the file, and determines the name of the local copy:
+ *  the absolute path with all '/' replaced by '%', so that different files
+ *  with the same basename do not collide.
+ */
+void BurstBufferFileObject::setFilename(const std::string &filename)
+{
+    StandardFileObject::setFilename(filename);
+    std::string path = filename;
+    if(path.empty() || path[0]!='/')
+    {
+        char cwd[4096];
+        if(getcwd(cwd, sizeof(cwd)))
+            path = std::string(cwd)+"/"+path;
+    }
+    for(unsigned int i=0; i<path.size(); i++)
+        if(path[i]=='/') path[i] = '%';
+    m_local_path = m_directory+"/"+path;
+}   // setFilename
+
+// ----------------------------------------------------------------------------
+/** Returns the local copy of a file that is still being drained, or an
+ *  empty string if the file is not being drained.
+ */
+std::string BurstBufferFileObject::getDrainingCopy(const std::string &target)
+{
+    m_queue.lock();
+    std::map<std::string, std::string>::iterator i = m_draining.find(target);
+    std::string local = i==m_draining.end() ? "" : i->second;
+    m_queue.unlock();
+    return local;
+}   // getDrainingCopy
+
+// ----------------------------------------------------------------------------
+/** Waits till a file is not being drained anymore. */
+void BurstBufferFileObject::waitForDrain(const std::string &target)
+{
+    m_queue.lock();
+    while(m_draining.find(target)!=m_draining.end())
+        pthread_cond_wait(&m_done_signal, m_queue.getMutex());
+    m_queue.unlock();
+}   // waitForDrain
+
+// ----------------------------------------------------------------------------
+/** Selects which file to open and sets m_staged accordingly.
+ *  \param write True if the file is opened for writing.
+ *  \param truncate True if the file is truncated when opened.
+ */
+std::string BurstBufferFileObject::selectPath(bool write, bool truncate)
+{
+    m_staged = false;
+    if(!write)
+    {
+        std::string local = getDrainingCopy(getFilename());
+        return local.empty() ? getFilename() : local;
+    }
+    waitForDrain(getFilename());
+    if(!truncate && access(getFilename().c_str(), F_OK)==0)
+        return getFilename();
+    m_staged = true;
+    return m_local_path;
+}   // selectPath
+
+// ----------------------------------------------------------------------------
+/** Called once a staged file was opened. */
+void BurstBufferFileObject::startStaging()
+{
+    m_queue.lock();
+    m_open_files.insert(this);
+    m_queue.unlock();
+}   // startStaging
+
+// ----------------------------------------------------------------------------
+/** Called before a staged file is closed: queues the local copy to be
+ *  drained to the target.
+ */
+void BurstBufferFileObject::finishStaging()
+{
+    if(!m_staged)
+        return;
+    m_staged = false;
+    struct stat64 buf;
+    DrainJob job;
+    job.m_local  = m_local_path;
+    job.m_target = getFilename();
+    job.m_size   = ::fstat64(m_filedes, &buf)==0 ? buf.st_size : 0;
+
+    m_queue.lock();
+    m_open_files.erase(this);
+    m_queue.getData().push_back(job);
+    m_draining[job.m_target] = job.m_local;
+    m_backlog_bytes += job.m_size;
+    pthread_cond_signal(&m_job_signal);
+    m_queue.unlock();
+}   // finishStaging
+
+// ----------------------------------------------------------------------------
+FILE *BurstBufferFileObject::fopen(const char *mode)
+{
+    bool write = mode[0]!='r' || strchr(mode, '+');
+    std::string path = selectPath(write, mode[0]=='w');
+    m_file = OS::fopen(path.c_str(), mode);
+    if(!m_file && m_staged)
+    {
+        printf("Can not stage '%s' in '%s': %s - writing it directly.\n",
+               getFilename().c_str(), m_local_path.c_str(), strerror(errno));
+        m_staged = false;
+        m_file   = OS::fopen(getFilename().c_str(), mode);
+    }
+    // The local copy might have been removed since it was looked up.
+    else if(!m_file && !write && path!=getFilename())
+        m_file = OS::fopen(getFilename().c_str(), mode);
+    if(!m_file)
+        return NULL;
+    m_filedes = OS::fileno(m_file);
+    if(m_staged)
+        startStaging();
+    return (FILE*)this;
+}   // fopen
+
+// ----------------------------------------------------------------------------
+FILE *BurstBufferFileObject::fopen64(const char *mode)
+{
+    // The OS functions handle large files in all cases.
+    return fopen(mode);
+}   // fopen64
+
+// ----------------------------------------------------------------------------
+int BurstBufferFileObject::fclose()
+{
+    if(m_staged)
+        OS::fflush(m_file);
+    finishStaging();
+    return StandardFileObject::fclose();
+}   // fclose
+
+// ----------------------------------------------------------------------------
+int BurstBufferFileObject::open(int flags, mode_t mode)
+{
+    bool write = (flags & O_ACCMODE)!=O_RDONLY;
+    std::string path = selectPath(write, (flags & O_TRUNC)!=0);
+    m_filedes = OS::open(path.c_str(), flags, mode);
+    if(m_filedes<0 && m_staged)
+    {
+        printf("Can not stage '%s' in '%s': %s - writing it directly.\n",
+               getFilename().c_str(), m_local_path.c_str(), strerror(errno));
+        m_staged  = false;
+        m_filedes = OS::open(getFilename().c_str(), flags, mode);
+    }
+    else if(m_filedes<0 && !write && path!=getFilename())
+        m_filedes = OS::open(getFilename().c_str(), flags, mode);
+    if(m_filedes<0)
+        return -1;
+    if(m_staged)
+        startStaging();
+    return getIndex()+Config::get()->getMaxFiles();
+}   // open
+
+// ----------------------------------------------------------------------------
+int BurstBufferFileObject::open64(int flags, mode_t mode)
+{
+    return open(flags|O_LARGEFILE, mode);
+}   // open64
+
+// ----------------------------------------------------------------------------
+int BurstBufferFileObject::close()
+{
+    finishStaging();
+    return StandardFileObject::close();
+}   // close
+
+// ----------------------------------------------------------------------------
+/** Calls a stat function with the name of the local copy if the file is
+ *  being drained, otherwise with the file name. */
+template<typename T, typename F>
+int BurstBufferFileObject::statName(F function, int ver, T *buf)
+{
+    std::string local = getDrainingCopy(getFilename());
+    if(!local.empty() && function(ver, local.c_str(), buf)==0)
+        return 0;
+    return function(ver, getFilename().c_str(), buf);
+}   // statName
+
+// ----------------------------------------------------------------------------
+int BurstBufferFileObject::__xstat(int ver, struct stat *buf)
+{
+    return statName(OS::__xstat, ver, buf);
+}   // __xstat
+
+// ----------------------------------------------------------------------------
+int BurstBufferFileObject::__lxstat(int ver, struct stat *buf)
+{
+    return statName(OS::__lxstat, ver, buf);
+}   // __lxstat
+
+// ----------------------------------------------------------------------------
+/** Renames the target file once it is drained. */
+int BurstBufferFileObject::rename(const char *newpath)
+{
+    waitForDrain(getFilename());
+    return OS::rename(getFilename().c_str(), newpath);
+}   // rename
+
+// ----------------------------------------------------------------------------
+/** Removes the target file once it is drained (otherwise the drain would
+ *  create it again). */
+int BurstBufferFileObject::unlink()
+{
+    waitForDrain(getFilename());
+    return OS::unlink(getFilename().c_str());
+}   // unlink
+
+// ----------------------------------------------------------------------------
+/** Copies all data from one file descriptor to another, in the kernel if
+ *  possible.
+ *  \return False if an error occurred (errno is set).
+ */
+bool BurstBufferFileObject::copyData(int in, int out)
+{
+    bool in_kernel = true;
+    while(in_kernel)
+    {
+        ssize_t n = copy_file_range(in, NULL, out, NULL, 64*1024*1024, 0);
+        if(n==0)
+            return true;
+        if(n<0)
+        {
+            if(errno==EINTR)
+                continue;
+            if(errno!=EXDEV && errno!=ENOSYS && errno!=EINVAL &&
+               errno!=EOPNOTSUPP)
+                return false;
+            in_kernel = false;
+        }
+    }
+
+    char *buffer = BufferArena::allocate(DRAIN_BUFFER_SIZE);
+    bool ok = true;
+    while(ok)
+    {
+        ssize_t n = OS::read(in, buffer, DRAIN_BUFFER_SIZE);
+        if(n<0 && errno==EINTR)
+            continue;
+        if(n<=0)
+        {
+            ok = n==0;
+            break;
+        }
+        ssize_t written = 0;
+        while(written<n)
+        {
+            ssize_t w = OS::write(out, buffer+written, n-written);
+            if(w<0 && errno==EINTR)
+                continue;
+            if(w<=0)
+            {
+                ok = false;
+                break;
+            }
+            written += w;
+        }
+        if(written<n)
+            break;
+    }
+    int error = errno;
+    BufferArena::free(buffer);
+    errno = error;
+    return ok;
+}   // copyData
+
+// ----------------------------------------------------------------------------
+/** Copies a local file to a temporary file next to the target, syncs it
+ *  and renames it to the target. On success the local copy is removed,
+ *  otherwise it is kept so no data is lost.
+ *  \return True if successful.
+ */
+bool BurstBufferFileObject::drainFile(const DrainJob &job)
+{
+    std::string tmp = job.m_target+".alio-drain";
+    int in = OS::open(job.m_local.c_str(), O_RDONLY, 0);
+    struct stat64 buf;
+    int out = -1;
+    if(in>=0 && ::fstat64(in, &buf)==0)
+        out = OS::open(tmp.c_str(), O_WRONLY|O_CREAT|O_TRUNC,
+                       buf.st_mode & 07777);
+    bool ok = in>=0 && out>=0 && copyData(in, out) && fsync(out)==0;
+    int error = errno;
+    if(out>=0 && OS::close(out)!=0 && ok)
+    {
+        ok    = false;
+        error = errno;
+    }
+    if(in>=0)
+        OS::close(in);
+    if(ok && OS::rename(tmp.c_str(), job.m_target.c_str())!=0)
+    {
+        ok    = false;
+        error = errno;
+    }
+    if(!ok)
+    {
+        printf("Can not drain '%s' to '%s': %s - data is kept in '%s'.\n",
+               job.m_local.c_str(), job.m_target.c_str(), strerror(error),
+               job.m_local.c_str());
+        if(out>=0)
+            OS::unlink(tmp.c_str());
+        return false;
+    }
+    OS::unlink(job.m_local.c_str());
+    return true;
+}   // drainFile
+
+// ----------------------------------------------------------------------------
+/** The main loop of the drain thread: drains one file after the other. A
+ *  job stays in the queue while it is drained, so it is counted in the
+ *  backlog, and waitForDrain() waits for it.
+ */
+void *BurstBufferFileObject::drainLoop(void *obj)
+{
+    ThreadPlacement::pinCurrentThread();
+    while(1)
+    {
+        m_queue.lock();
+        while(m_queue.getData().empty() && !m_quit)
+            pthread_cond_wait(&m_job_signal, m_queue.getMutex());
+        if(m_queue.getData().empty())
+        {
+            m_queue.unlock();
+            break;
+        }
+        DrainJob job = m_queue.getData().front();
+        m_queue.unlock();
+
+        double start = now();
+        bool ok      = drainFile(job);
+        double t     = now()-start;
+
+        m_queue.lock();
+        m_queue.getData().pop_front();
+        m_draining.erase(job.m_target);
+        m_backlog_bytes -= job.m_size;
+        if(ok)
+        {
+            m_drained_files++;
+            m_drained_bytes += job.m_size;
+            m_drain_time    += t;
+        }
+        int     backlog_files = m_queue.getData().size();
+        off64_t backlog_bytes = m_backlog_bytes;
+        pthread_cond_broadcast(&m_done_signal);
+        m_queue.unlock();
+
+        if(m_report && ok)
+            printf("Drained '%s': %lld bytes in %.3f s (%.2f MB/s), "
+                   "backlog %d file(s) %lld bytes.\n",
+                   job.m_target.c_str(), (long long)job.m_size, t,
+                   t>0 ? job.m_size/t/(1024*1024) : 0.0, backlog_files,
+                   (long long)backlog_bytes);
+    }
+    return NULL;
+}   // drainLoop
+
+}   // namespace ALIO
@@ -0,0 +1,139 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef HEADER_BURST_BUFFER_HPP
+#define HEADER_BURST_BUFFER_HPP
+
+#include "client/standard_file_object.hpp"
+#include "tools/synchronised.hpp"
+
+#include <deque>
+#include <map>
+#include <pthread.h>
+#include <set>
+#include <string>
+
+namespace ALIO
+{
+class XMLNode;
+
+/** A file object that stages written files in a fast node-local directory
+ *  (e.g. tmpfs or a local SSD, set with directory="..." in the io node).
+ *  All IO goes to the local copy at local speed. When the file is closed,
+ *  a background thread copies the local file to a temporary file next to
+ *  the real target, syncs it, and renames it to the target, so the target
+ *  is replaced atomically. The local copy is removed afterwards.
+ *  Opening a file that is still being drained for reading uses the local
+ *  copy; opening it for writing, or renaming it, first waits till the
+ *  drain is done. Existing files that are opened for writing without
+ *  truncation are written directly to the target, since their old content
+ *  would otherwise have to be copied first. If the local file can not be
+ *  created, the target is used as well.
+ *  With report="yes" each drained file is printed together with the drain
+ *  bandwidth and the remaining backlog, and a summary is printed at exit.
+ *  At exit all files are closed and the program waits till all are
+ *  drained.
+ */
+class BurstBufferFileObject : public StandardFileObject
+{
+private:
+    /** A file to copy from the local directory to its target. */
+    struct DrainJob
+    {
+        std::string m_local;
+        std::string m_target;
+        off64_t     m_size;
+    };   // DrainJob
+
+    /** The node-local directory for staged files. */
+    std::string m_directory;
+
+    /** The name of the local copy of this file. */
+    std::string m_local_path;
+
+    /** True if the file is currently open and staged in m_local_path. */
+    bool        m_staged;
+
+    /** The drain thread. */
+    static pthread_t m_thread;
+
+    /** Signals the drain thread that a new job was queued. */
+    static pthread_cond_t m_job_signal;
+
+    /** Signalled whenever a file was drained. */
+    static pthread_cond_t m_done_signal;
+
+    /** All files still to be drained; the first is the one being drained.
+     *  The lock also protects all other static members below. */
+    static Synchronised< std::deque<DrainJob> > m_queue;
+
+    /** Maps the target name of each file in m_queue to its local copy. */
+    static std::map<std::string, std::string> m_draining;
+
+    /** All staged files that are currently open, so they can be closed
+     *  (and drained) at exit. */
+    static std::set<BurstBufferFileObject*> m_open_files;
+
+    /** Set to stop the drain thread once the queue is empty. */
+    static bool m_quit;
+
+    /** True if drain statistics should be printed. */
+    static bool m_report;
+
+    /** Number of bytes in m_queue. */
+    static off64_t m_backlog_bytes;
+
+    /** Statistics of all drained files. */
+    static int     m_drained_files;
+    static off64_t m_drained_bytes;
+    static double  m_drain_time;
+
+    static void       *drainLoop(void *obj);
+    static bool        drainFile(const DrainJob &job);
+    static bool        copyData(int in, int out);
+    static void        waitForDrain(const std::string &target);
+    static std::string getDrainingCopy(const std::string &target);
+
+    std::string selectPath(bool write, bool truncate);
+    void        startStaging();
+    void        finishStaging();
+    template<typename T, typename F>
+    int         statName(F function, int ver, T *buf);
+
+public:
+    static int init();
+    static int atExit();
+
+             BurstBufferFileObject(const XMLNode *info);
+    virtual ~BurstBufferFileObject();
+
+    virtual void    setFilename(const std::string &filename);
+    virtual FILE   *fopen(const char *mode);
+    virtual FILE   *fopen64(const char *mode);
+    virtual int     fclose();
+    virtual int     open(int flags, mode_t mode);
+    virtual int     open64(int flags, mode_t mode);
+    virtual int     close();
+    virtual int     __xstat(int ver, struct stat *buf);
+    virtual int     __lxstat(int ver, struct stat *buf);
+    virtual int     rename(const char *newpath);
+    virtual int     unlink();
+};   // BurstBufferFileObject
+
+}   // namespace ALIO
+#endif
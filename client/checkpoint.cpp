@@ -0,0 +1,911 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "client/checkpoint.hpp"
+
+#include "tools/block_hash.hpp"
+#include "tools/buffer_arena.hpp"
+#include "tools/string_utils.hpp"
+#include "xml/xml_node.hpp"
+
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace ALIO
+{
+
+const uint32_t CheckpointFileObject::NO_SOURCE;
+
+/** Identifies a manifest. */
+static const char MANIFEST_MAGIC[8] = {'A','L','I','O','C','K','P','1'};
+
+// ----------------------------------------------------------------------------
+static double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec*1.0e-9;
+}   // now
+
+// ----------------------------------------------------------------------------
+/** Compares two generations: numerically if both are numbers, otherwise as
+ *  strings.
+ *  \return <0, 0 or >0 if a is older, the same or newer than b.
+ */
+static int compareGenerations(const std::string &a, const std::string &b)
+{
+    size_t na = a.find_first_not_of('0');
+    size_t nb = b.find_first_not_of('0');
+    if(a.find_first_not_of("0123456789")==std::string::npos &&
+       b.find_first_not_of("0123456789")==std::string::npos)
+    {
+        std::string sa = na==std::string::npos ? "" : a.substr(na);
+        std::string sb = nb==std::string::npos ? "" : b.substr(nb);
+        if(sa.size()!=sb.size())
+            return sa.size()<sb.size() ? -1 : 1;
+        return sa.compare(sb);
+    }
+    return a.compare(b);
+}   // compareGenerations
+
+// ----------------------------------------------------------------------------
+/** Reads exactly n bytes at the given offset.
+ *  \return False on an error or if the file is too short.
+ */
+static bool readFully(int filedes, void *buf, size_t n, off64_t offset)
+{
+    char *p = (char*)buf;
+    while(n>0)
+    {
+        ssize_t r = ::pread64(filedes, p, n, offset);
+        if(r<0 && errno==EINTR)
+            continue;
+        if(r<=0)
+            return false;
+        p      += r;
+        n      -= r;
+        offset += r;
+    }
+    return true;
+}   // readFully
+
+// ----------------------------------------------------------------------------
+static bool writeFully(int filedes, const void *buf, size_t n, off64_t offset)
+{
+    const char *p = (const char*)buf;
+    while(n>0)
+    {
+        ssize_t r = ::pwrite64(filedes, p, n, offset);
+        if(r<0 && errno==EINTR)
+            continue;
+        if(r<=0)
+        {
+            if(r==0)
+                errno = EIO;
+            return false;
+        }
+        p      += r;
+        n      -= r;
+        offset += r;
+    }
+    return true;
+}   // writeFully
+
+// ----------------------------------------------------------------------------
+/** Constructor. Reads the generation pattern, block size, full-every and
+ *  report settings.
+ */
+CheckpointFileObject::CheckpointFileObject(const XMLNode *info)
+                    : BaseFileObject(info)
+{
+    m_filedes     = -1;
+    m_open_flags  = 0;
+    m_passthrough = false;
+    m_writable    = false;
+    m_block       = NULL;
+    m_block_index = -1;
+    m_block_dirty = false;
+    m_position    = 0;
+    m_size        = 0;
+    m_eof         = false;
+    m_error       = 0;
+
+    std::string s;
+    m_has_generation = false;
+    if(info->get("generation", &s))
+    {
+        int error = regcomp(&m_generation, s.c_str(), REG_EXTENDED);
+        if(error)
+            printf("Generation pattern '%s' is not a valid regular "
+                   "expression: error %d.\n", s.c_str(), error);
+        else if(m_generation.re_nsub<1)
+        {
+            printf("Generation pattern '%s' needs a subexpression '(...)' "
+                   "for the generation.\n", s.c_str());
+            regfree(&m_generation);
+        }
+        else
+            m_has_generation = true;
+    }
+
+    int64_t block_size = 1024*1024;
+    if(info->get("block-size", &s) &&
+       (!StringUtils::parseSize(s, &block_size) || block_size<4096 ||
+        block_size>256*1024*1024) )
+    {
+        printf("Invalid block-size '%s' - using 1M.\n", s.c_str());
+        block_size = 1024*1024;
+    }
+    m_default_block_size = block_size;
+    m_block_size         = block_size;
+
+    int full_every = 0;
+    info->get("full-every", &full_every);
+    m_full_every = full_every>0 ? full_every : 0;
+
+    m_report = false;
+    info->get("report", &m_report);
+}   // CheckpointFileObject
+
+// ----------------------------------------------------------------------------
+CheckpointFileObject::~CheckpointFileObject()
+{
+    if(m_has_generation)
+        regfree(&m_generation);
+    if(m_block)
+        BufferArena::free(m_block);
+}   // ~CheckpointFileObject
+
+// ----------------------------------------------------------------------------
+/** Returns the directory of the file including the final '/', or an empty
+ *  string if the name has no directory. */
+std::string CheckpointFileObject::getDirectory() const
+{
+    size_t slash = getFilename().rfind('/');
+    if(slash==std::string::npos)
+        return "";
+    return getFilename().substr(0, slash+1);
+}   // getDirectory
+
+// ----------------------------------------------------------------------------
+/** Splits a file name into the generation and the name of the logical file
+ *  (everything except the generation).
+ *  \return False if the name does not match the generation pattern.
+ */
+bool CheckpointFileObject::getGeneration(const std::string &name,
+                                         std::string *logical,
+                                         std::string *generation) const
+{
+    regmatch_t match[2];
+    if(!m_has_generation ||
+       regexec(&m_generation, name.c_str(), 2, match, 0)!=0 ||
+       match[1].rm_so<0)
+        return false;
+    *generation = name.substr(match[1].rm_so, match[1].rm_eo-match[1].rm_so);
+    // The '*' can not be part of the generation, so two names only have
+    // the same logical name if they differ in the generation only.
+    *logical    = name.substr(0, match[1].rm_so) + "*"
+                + name.substr(match[1].rm_eo);
+    return true;
+}   // getGeneration
+
+// ----------------------------------------------------------------------------
+/** Searches the directory of this file for the newest checkpoint of the
+ *  same logical file that is older than this one.
+ *  \return The name of the previous checkpoint, or "" if there is none.
+ */
+std::string CheckpointFileObject::findPrevious() const
+{
+    std::string logical, generation;
+    if(!getGeneration(getFilename(), &logical, &generation))
+        return "";
+    std::string directory = getDirectory();
+    DIR *dir = opendir(directory.empty() ? "." : directory.c_str());
+    if(!dir)
+        return "";
+    std::string best, best_generation;
+    struct dirent *entry;
+    while((entry=readdir(dir))!=NULL)
+    {
+        std::string name = directory + entry->d_name;
+        std::string l, g;
+        if(name==getFilename() || !getGeneration(name, &l, &g) ||
+           l!=logical || compareGenerations(g, generation)>=0)
+            continue;
+        if(best.empty() || compareGenerations(g, best_generation)>0)
+        {
+            best            = name;
+            best_generation = g;
+        }
+    }
+    closedir(dir);
+    return best;
+}   // findPrevious
+
+// ----------------------------------------------------------------------------
+/** Reads a manifest.
+ *  \return False if the file is not a (valid) manifest.
+ */
+bool CheckpointFileObject::readManifest(int filedes, ManifestHeader *header,
+                                        std::vector<std::string> *sources,
+                                        std::vector<BlockEntry> *entries)
+{
+    struct stat64 buf;
+    if(::fstat64(filedes, &buf)!=0 ||
+       buf.st_size<(off64_t)sizeof(ManifestHeader) ||
+       !readFully(filedes, header, sizeof(ManifestHeader), 0) ||
+       memcmp(header->m_magic, MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC))!=0 ||
+       header->m_block_size==0)
+        return false;
+    uint64_t num_blocks = (header->m_size+header->m_block_size-1)
+                        / header->m_block_size;
+    if(num_blocks!=header->m_num_blocks)
+        return false;
+
+    std::vector<char> data(buf.st_size-sizeof(ManifestHeader));
+    if(!data.empty() &&
+       !readFully(filedes, &data[0], data.size(), sizeof(ManifestHeader)))
+        return false;
+    size_t pos = 0;
+    sources->clear();
+    for(unsigned int i=0; i<header->m_num_sources; i++)
+    {
+        uint32_t length;
+        if(pos+sizeof(length)>data.size())
+            return false;
+        memcpy(&length, &data[pos], sizeof(length));
+        pos += sizeof(length);
+        if(length==0 || pos+length>data.size())
+            return false;
+        sources->push_back(std::string(&data[pos], length));
+        pos += length;
+    }
+    if(data.size()-pos!=header->m_num_blocks*sizeof(BlockEntry))
+        return false;
+    entries->resize(header->m_num_blocks);
+    if(header->m_num_blocks>0)
+        memcpy(&(*entries)[0], &data[pos], data.size()-pos);
+    for(unsigned int i=0; i<entries->size(); i++)
+    {
+        const BlockEntry &e = (*entries)[i];
+        if(e.m_source!=NO_SOURCE &&
+           (e.m_source>=header->m_num_sources ||
+            e.m_length>header->m_block_size) )
+            return false;
+    }
+    return true;
+}   // readManifest
+
+// ----------------------------------------------------------------------------
+/** Loads the block hashes of the previous checkpoint, unless a complete
+ *  checkpoint must be written.
+ */
+void CheckpointFileObject::loadPrevious()
+{
+    m_chain = 0;
+    std::string name = findPrevious();
+    if(name.empty())
+        return;
+    int filedes = OS::open(name.c_str(), O_RDONLY, 0);
+    if(filedes<0)
+        return;
+    ManifestHeader header;
+    std::vector<std::string> sources;
+    std::vector<BlockEntry>  entries;
+    bool ok = readManifest(filedes, &header, &sources, &entries);
+    OS::close(filedes);
+    if(!ok)
+        return;
+    if(header.m_block_size!=m_block_size)
+    {
+        printf("Checkpoint '%s' uses a different block size than '%s' - "
+               "writing all blocks.\n", name.c_str(), getFilename().c_str());
+        return;
+    }
+    if(m_full_every>0 && header.m_chain+1>=m_full_every)
+        return;
+    m_chain         = header.m_chain+1;
+    m_previous_name = name;
+
+    // Both manifests are in the same directory, so the names of the delta
+    // files can be used unchanged.
+    std::vector<uint32_t> map(sources.size());
+    for(unsigned int i=0; i<sources.size(); i++)
+    {
+        std::vector<std::string>::iterator s =
+            std::find(m_sources.begin(), m_sources.end(), sources[i]);
+        map[i] = s - m_sources.begin();
+        if(s==m_sources.end())
+        {
+            m_sources.push_back(sources[i]);
+            m_source_filedes.push_back(-1);
+        }
+    }
+    m_previous = entries;
+    for(unsigned int i=0; i<m_previous.size(); i++)
+    {
+        if(m_previous[i].m_source!=NO_SOURCE)
+            m_previous[i].m_source = map[m_previous[i].m_source];
+    }
+}   // loadPrevious
+
+// ----------------------------------------------------------------------------
+/** Converts a fopen mode string into the corresponding open flags. */
+int CheckpointFileObject::modeToFlags(const char *mode) const
+{
+    bool plus = strchr(mode, '+')!=NULL;
+    switch(mode[0])
+    {
+    case 'r': return plus ? O_RDWR : O_RDONLY;
+    case 'w': return (plus ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC;
+    case 'a': return (plus ? O_RDWR : O_WRONLY) | O_CREAT | O_APPEND;
+    }
+    return O_RDONLY;
+}   // modeToFlags
+
+// ----------------------------------------------------------------------------
+/** Opens the file. A manifest is opened read-write if it is written, since
+ *  an existing manifest must be read first. An empty file that is written
+ *  becomes a new checkpoint, a file that is neither empty nor a manifest
+ *  is accessed directly.
+ *  \return The file descriptor of the file, or -1 on error.
+ */
+int CheckpointFileObject::openFile(int flags, mode_t mode)
+{
+    m_open_flags  = flags;
+    m_writable    = (flags & O_ACCMODE)!=O_RDONLY;
+    m_passthrough = false;
+    m_position    = 0;
+    m_size        = 0;
+    m_eof         = false;
+    m_error       = 0;
+    m_block_index = -1;
+    m_block_dirty = false;
+    m_written_bytes = 0;
+    m_open_time   = now();
+    m_chain       = 0;
+    m_own_source  = NO_SOURCE;
+    m_entries.clear();
+    m_previous.clear();
+    m_previous_name.clear();
+    m_sources.clear();
+    m_source_filedes.clear();
+
+    int os_flags = (flags & ~(O_ACCMODE|O_APPEND))
+                 | (m_writable ? O_RDWR : O_RDONLY);
+    m_filedes = OS::open(getFilename().c_str(), os_flags, mode);
+    if(m_filedes<0)
+        return -1;
+
+    ManifestHeader header;
+    struct stat64 buf;
+    if(readManifest(m_filedes, &header, &m_sources, &m_entries))
+    {
+        m_block_size = header.m_block_size;
+        m_size       = header.m_size;
+        m_chain      = header.m_chain;
+        m_source_filedes.resize(m_sources.size(), -1);
+    }
+    else if(m_writable && ::fstat64(m_filedes, &buf)==0 && buf.st_size==0)
+    {
+        m_block_size = m_default_block_size;
+        loadPrevious();
+    }
+    else
+    {
+        m_passthrough = true;
+        m_size = ::fstat64(m_filedes, &buf)==0 ? buf.st_size : 0;
+        return m_filedes;
+    }
+
+    if(m_writable)
+    {
+        std::string name = getFilename().substr(getDirectory().size())
+                         + ".delta";
+        std::vector<std::string>::iterator s =
+            std::find(m_sources.begin(), m_sources.end(), name);
+        m_own_source = s - m_sources.begin();
+        if(s==m_sources.end())
+        {
+            m_sources.push_back(name);
+            m_source_filedes.push_back(-1);
+        }
+        // If the manifest is new, an old delta file of the same name can
+        // not be used by it anymore.
+        int delta_flags = O_RDWR | O_CREAT | (m_entries.empty() ? O_TRUNC
+                                                                : 0);
+        int delta = OS::open((getDirectory()+name).c_str(), delta_flags,
+                             mode);
+        if(delta<0)
+        {
+            printf("Can not open delta file '%s': %s.\n",
+                   (getDirectory()+name).c_str(), strerror(errno));
+            int error = errno;
+            OS::close(m_filedes);
+            m_filedes = -1;
+            errno     = error;
+            return -1;
+        }
+        m_source_filedes[m_own_source] = delta;
+        m_delta_size = ::fstat64(delta, &buf)==0 ? buf.st_size : 0;
+    }
+    return m_filedes;
+}   // openFile
+
+// ----------------------------------------------------------------------------
+/** Returns the file descriptor of a delta file, opening it if necessary.
+ *  \return The file descriptor, or -1 if the file can not be opened.
+ */
+int CheckpointFileObject::getSource(uint32_t source)
+{
+    if(m_source_filedes[source]<0)
+    {
+        std::string name = getDirectory()+m_sources[source];
+        m_source_filedes[source] = OS::open(name.c_str(), O_RDONLY, 0);
+        if(m_source_filedes[source]<0)
+            printf("Checkpoint '%s' needs the missing file '%s'.\n",
+                   getFilename().c_str(), name.c_str());
+    }
+    return m_source_filedes[source];
+}   // getSource
+
+// ----------------------------------------------------------------------------
+/** Reads n bytes starting at offset of a block. Bytes after the stored
+ *  length of the block are zero.
+ *  \return False on error (errno is set).
+ */
+bool CheckpointFileObject::readBlockData(const BlockEntry &entry,
+                                         size_t offset, char *buf, size_t n)
+{
+    size_t stored = 0;
+    if(entry.m_source!=NO_SOURCE && offset<entry.m_length)
+        stored = std::min(n, entry.m_length-offset);
+    if(stored>0)
+    {
+        int filedes = getSource(entry.m_source);
+        if(filedes<0 ||
+           !readFully(filedes, buf, stored, entry.m_offset+offset))
+        {
+            errno = EIO;
+            return false;
+        }
+    }
+    memset(buf+stored, 0, n-stored);
+    return true;
+}   // readBlockData
+
+// ----------------------------------------------------------------------------
+/** Makes the given block the current block. The previous current block is
+ *  written first if it was modified.
+ *  \param overwrite True if the old content does not need to be read,
+ *         since it will be completely overwritten.
+ *  \return False on error.
+ */
+bool CheckpointFileObject::loadBlock(int64_t index, bool overwrite)
+{
+    if(m_block_index==index)
+        return true;
+    if(!flushBlock())
+        return false;
+    if(!m_block)
+        m_block = BufferArena::allocate(m_block_size);
+    m_block_index = -1;
+    if(overwrite || index>=(int64_t)m_entries.size())
+        memset(m_block, 0, m_block_size);
+    else if(!readBlockData(m_entries[index], 0, m_block, m_block_size))
+        return false;
+    m_block_index = index;
+    m_block_dirty = false;
+    return true;
+}   // loadBlock
+
+// ----------------------------------------------------------------------------
+/** Hashes the current block if it was modified. If the same block of this
+ *  or the previous checkpoint has the same hash, the block is not written.
+ *  \return False if writing the block failed.
+ */
+bool CheckpointFileObject::flushBlock()
+{
+    if(m_block_index<0 || !m_block_dirty)
+        return true;
+    m_block_dirty = false;
+    off64_t start = m_block_index*m_block_size;
+    BlockEntry entry;
+    entry.m_length = std::min((off64_t)m_block_size, m_size-start);
+    BlockHash::compute(m_block, entry.m_length, entry.m_hash);
+
+    const BlockEntry *same = NULL;
+    if(m_block_index<(int64_t)m_entries.size())
+        same = &m_entries[m_block_index];
+    if(!same || same->m_source==NO_SOURCE ||
+       same->m_length!=entry.m_length ||
+       memcmp(same->m_hash, entry.m_hash, sizeof(entry.m_hash))!=0)
+    {
+        same = NULL;
+        if(m_block_index<(int64_t)m_previous.size())
+            same = &m_previous[m_block_index];
+    }
+    if(same && same->m_source!=NO_SOURCE &&
+       same->m_length==entry.m_length &&
+       memcmp(same->m_hash, entry.m_hash, sizeof(entry.m_hash))==0)
+    {
+        entry.m_source = same->m_source;
+        entry.m_offset = same->m_offset;
+    }
+    else
+    {
+        int delta = m_source_filedes[m_own_source];
+        if(!writeFully(delta, m_block, entry.m_length, m_delta_size))
+        {
+            m_error = errno;
+            printf("Can not write delta of checkpoint '%s': %s.\n",
+                   getFilename().c_str(), strerror(m_error));
+            return false;
+        }
+        entry.m_source   = m_own_source;
+        entry.m_offset   = m_delta_size;
+        m_delta_size    += entry.m_length;
+        m_written_bytes += entry.m_length;
+    }
+    if(m_block_index>=(int64_t)m_entries.size())
+    {
+        BlockEntry hole;
+        memset(&hole, 0, sizeof(hole));
+        hole.m_source = NO_SOURCE;
+        m_entries.resize(m_block_index+1, hole);
+    }
+    m_entries[m_block_index] = entry;
+    return true;
+}   // flushBlock
+
+// ----------------------------------------------------------------------------
+/** Writes the manifest. Only delta files that are still used are listed;
+ *  an unused delta file of this checkpoint is removed.
+ *  \return False on error.
+ */
+bool CheckpointFileObject::writeManifest()
+{
+    BlockEntry hole;
+    memset(&hole, 0, sizeof(hole));
+    hole.m_source = NO_SOURCE;
+    m_entries.resize((m_size+m_block_size-1)/m_block_size, hole);
+
+    std::vector<uint32_t> map(m_sources.size(), NO_SOURCE);
+    std::vector<std::string> sources;
+    for(unsigned int i=0; i<m_entries.size(); i++)
+    {
+        uint32_t &source = m_entries[i].m_source;
+        if(source==NO_SOURCE)
+            continue;
+        if(map[source]==NO_SOURCE)
+        {
+            map[source] = sources.size();
+            sources.push_back(m_sources[source]);
+        }
+        source = map[source];
+    }
+    if(map[m_own_source]==NO_SOURCE)
+        OS::unlink((getDirectory()+m_sources[m_own_source]).c_str());
+
+    ManifestHeader header;
+    memcpy(header.m_magic, MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC));
+    header.m_size        = m_size;
+    header.m_block_size  = m_block_size;
+    header.m_num_blocks  = m_entries.size();
+    header.m_num_sources = sources.size();
+    header.m_chain       = m_chain;
+    std::string data((const char*)&header, sizeof(header));
+    for(unsigned int i=0; i<sources.size(); i++)
+    {
+        uint32_t length = sources[i].size();
+        data.append((const char*)&length, sizeof(length));
+        data.append(sources[i]);
+    }
+    if(!m_entries.empty())
+        data.append((const char*)&m_entries[0],
+                    m_entries.size()*sizeof(BlockEntry));
+    if(!writeFully(m_filedes, data.data(), data.size(), 0) ||
+       ::ftruncate64(m_filedes, data.size())!=0)
+    {
+        m_error = errno;
+        printf("Can not write manifest of checkpoint '%s': %s.\n",
+               getFilename().c_str(), strerror(m_error));
+        return false;
+    }
+    return true;
+}   // writeManifest
+
+// ----------------------------------------------------------------------------
+/** Sets the file position.
+ *  \return The new position, or -1 on error.
+ */
+off64_t CheckpointFileObject::seek(off64_t offset, int whence)
+{
+    off64_t new_pos;
+    switch(whence)
+    {
+    case SEEK_SET: new_pos = offset;            break;
+    case SEEK_CUR: new_pos = m_position+offset; break;
+    case SEEK_END: new_pos = m_size+offset;     break;
+    default:       errno = EINVAL;              return -1;
+    }
+    if(new_pos<0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    m_position = new_pos;
+    m_eof      = false;
+    return m_position;
+}   // seek
+
+// ----------------------------------------------------------------------------
+ssize_t CheckpointFileObject::write(const void *buf, size_t nbyte)
+{
+    if(m_filedes<0 || !m_writable)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    if(m_error)
+    {
+        errno = m_error;
+        return -1;
+    }
+    if(m_open_flags & O_APPEND)
+        m_position = m_size;
+    if(m_passthrough)
+    {
+        ssize_t n = ::pwrite64(m_filedes, buf, nbyte, m_position);
+        if(n>0)
+        {
+            m_position += n;
+            m_size      = std::max(m_size, m_position);
+        }
+        return n;
+    }
+
+    const char *p = (const char*)buf;
+    size_t left   = nbyte;
+    while(left>0)
+    {
+        int64_t index = m_position/m_block_size;
+        size_t  in    = m_position%m_block_size;
+        size_t  len   = std::min(left, m_block_size-in);
+        // Data beyond the end of the file does not need to be read.
+        bool overwrite = in==0 &&
+                         (len==m_block_size || m_position+len>=m_size);
+        if(!loadBlock(index, overwrite))
+            return -1;
+        memcpy(m_block+in, p, len);
+        m_block_dirty = true;
+        p          += len;
+        left       -= len;
+        m_position += len;
+        m_size      = std::max(m_size, m_position);
+    }
+    return nbyte;
+}   // write
+
+// ----------------------------------------------------------------------------
+ssize_t CheckpointFileObject::read(void *buf, size_t count)
+{
+    if(m_filedes<0 || (m_open_flags & O_ACCMODE)==O_WRONLY)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    if(m_passthrough)
+    {
+        ssize_t n = ::pread64(m_filedes, buf, count, m_position);
+        if(n>0)
+            m_position += n;
+        else if(n==0 && count>0)
+            m_eof = true;
+        return n;
+    }
+    if(m_position>=m_size)
+    {
+        if(count>0)
+            m_eof = true;
+        return 0;
+    }
+
+    size_t n = std::min((off64_t)count, m_size-m_position);
+    char *p  = (char*)buf;
+    size_t left = n;
+    while(left>0)
+    {
+        int64_t index = m_position/m_block_size;
+        size_t  in    = m_position%m_block_size;
+        size_t  len   = std::min(left, m_block_size-in);
+        if(index==m_block_index)
+            memcpy(p, m_block+in, len);
+        else if(index<(int64_t)m_entries.size())
+        {
+            if(!readBlockData(m_entries[index], in, p, len))
+                return n==left ? -1 : (ssize_t)(n-left);
+        }
+        else
+            memset(p, 0, len);
+        p          += len;
+        left       -= len;
+        m_position += len;
+    }
+    return n;
+}   // read
+
+// ----------------------------------------------------------------------------
+/** Reads at most size-1 characters up to and including a newline. */
+char *CheckpointFileObject::fgets(char *s, int size)
+{
+    if(size<=0)
+        return NULL;
+    int count = 0;
+    while(count<size-1)
+    {
+        int wanted = std::min(size-1-count, 256);
+        ssize_t n  = read(s+count, wanted);
+        if(n<=0)
+            break;
+        char *newline = (char*)memchr(s+count, '\n', n);
+        if(newline)
+        {
+            int used = newline - (s+count) + 1;
+            // Undo the read of everything after the newline.
+            m_position -= n-used;
+            m_eof       = false;
+            count      += used;
+            break;
+        }
+        count += n;
+    }
+    if(count==0)
+        return NULL;
+    s[count] = 0;
+    return s;
+}   // fgets
+
+// ----------------------------------------------------------------------------
+/** Writes the last block and the manifest, and closes all files.
+ *  \return 0 on success, -1 on error.
+ */
+int CheckpointFileObject::closeFile()
+{
+    if(m_filedes<0)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    bool ok = true;
+    if(m_writable && !m_passthrough)
+    {
+        ok = m_error==0 && flushBlock();
+        int changed = 0;
+        for(unsigned int i=0; i<m_entries.size(); i++)
+        {
+            if(m_entries[i].m_source==m_own_source)
+                changed++;
+        }
+        ok = ok && writeManifest();
+        if(ok && m_report)
+            printf("Checkpoint '%s': %d of %d blocks changed, %lld of %lld "
+                   "bytes written in %.3f s (previous: %s).\n",
+                   getFilename().c_str(), changed, (int)m_entries.size(),
+                   (long long)m_written_bytes, (long long)m_size,
+                   now()-m_open_time,
+                   m_previous_name.empty() ? "none"
+                                           : m_previous_name.c_str());
+    }
+    int error = m_error;
+    for(unsigned int i=0; i<m_source_filedes.size(); i++)
+    {
+        if(m_source_filedes[i]>=0)
+            OS::close(m_source_filedes[i]);
+    }
+    m_source_filedes.clear();
+    if(OS::close(m_filedes)!=0 && ok)
+    {
+        error = errno;
+        ok    = false;
+    }
+    m_filedes = -1;
+    if(m_block)
+    {
+        BufferArena::free(m_block);
+        m_block = NULL;
+    }
+    m_block_index = -1;
+    if(!ok)
+    {
+        errno = error ? error : EIO;
+        return -1;
+    }
+    return 0;
+}   // closeFile
+
+// ----------------------------------------------------------------------------
+/** Returns the size of the data of a checkpoint that is not open.
+ *  \return False if the file is not a checkpoint.
+ */
+bool CheckpointFileObject::getManifestSize(off64_t *size) const
+{
+    if(m_filedes>=0)
+    {
+        *size = m_size;
+        return !m_passthrough;
+    }
+    int filedes = OS::open(getFilename().c_str(), O_RDONLY, 0);
+    if(filedes<0)
+        return false;
+    ManifestHeader header;
+    bool ok = readFully(filedes, &header, sizeof(header), 0) &&
+              memcmp(header.m_magic, MANIFEST_MAGIC,
+                     sizeof(MANIFEST_MAGIC))==0;
+    OS::close(filedes);
+    if(ok)
+        *size = header.m_size;
+    return ok;
+}   // getManifestSize
+
+// ----------------------------------------------------------------------------
+/** Reports the size of the data of a checkpoint instead of the size of
+ *  the manifest. */
+int CheckpointFileObject::__xstat(int ver, struct stat *buf)
+{
+    int result = OS::__xstat(ver, getFilename().c_str(), buf);
+    off64_t size;
+    if(result==0 && getManifestSize(&size))
+        buf->st_size = size;
+    return result;
+}   // __xstat
+
+// ----------------------------------------------------------------------------
+int CheckpointFileObject::__lxstat(int ver, struct stat *buf)
+{
+    int result = OS::__lxstat(ver, getFilename().c_str(), buf);
+    off64_t size;
+    if(result==0 && S_ISREG(buf->st_mode) && getManifestSize(&size))
+        buf->st_size = size;
+    return result;
+}   // __lxstat
+
+// ----------------------------------------------------------------------------
+int CheckpointFileObject::__fxstat(int ver, struct stat *buf)
+{
+    int result = OS::__fxstat(ver, m_filedes, buf);
+    if(result==0 && !m_passthrough)
+        buf->st_size = m_size;
+    return result;
+}   // __fxstat
+
+// ----------------------------------------------------------------------------
+int CheckpointFileObject::__fxstat64(int ver, struct stat64 *buf)
+{
+    int result = OS::__fxstat64(ver, m_filedes, buf);
+    if(result==0 && !m_passthrough)
+        buf->st_size = m_size;
+    return result;
+}   // __fxstat64
+
+}   // namespace ALIO
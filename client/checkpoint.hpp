@@ -0,0 +1,304 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef HEADER_CHECKPOINT_HPP
+#define HEADER_CHECKPOINT_HPP
+
+#include "client/base_file_object.hpp"
+#include "client/config.hpp"
+#include "tools/os.hpp"
+
+#include <fcntl.h>
+#include <regex.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace ALIO
+{
+class XMLNode;
+
+/** A file object for checkpoints that only writes the blocks that changed
+ *  since the previous checkpoint (<io type="checkpoint" .../>).
+ *  generation is a regular expression with one subexpression that matches
+ *  the generation in the file name, e.g. "restart_([0-9]+)\.dat". Files
+ *  that only differ in the generation are successive checkpoints of the
+ *  same logical file. When a checkpoint is written, the checkpoint with
+ *  the highest smaller generation in the same directory is the previous
+ *  one (generations that are numbers are compared numerically).
+ *  The data is split into blocks (block-size, default 1M), and a hash of
+ *  each block is compared with the hash of the same block of the previous
+ *  checkpoint. Only changed blocks are appended to a delta file (the file
+ *  name with '.delta' appended); the file itself becomes a small manifest
+ *  that lists for each block its hash and the delta file that contains it.
+ *  Reading a manifest transparently reconstructs the data, files that are
+ *  not manifests are read and written unchanged.
+ *  Since a checkpoint can use the delta files of all older generations,
+ *  these must be kept. With full-every="n" every n-th generation is
+ *  written completely, so older files can be removed once a full one was
+ *  written. With report="yes" the number of changed blocks is printed when
+ *  a checkpoint is closed.
+ */
+class CheckpointFileObject : public BaseFileObject
+{
+private:
+    /** Header at the start of a manifest. */
+    struct ManifestHeader
+    {
+        char     m_magic[8];
+        uint64_t m_size;
+        uint32_t m_block_size;
+        uint32_t m_num_blocks;
+        uint32_t m_num_sources;
+        /** Number of generations since a complete checkpoint. */
+        uint32_t m_chain;
+    };   // ManifestHeader
+
+    /** Information about each block of a checkpoint. */
+    struct BlockEntry
+    {
+        uint64_t m_hash[2];
+        /** Offset of the data in the source file. */
+        uint64_t m_offset;
+        /** Index of the delta file containing the block, or NO_SOURCE if
+         *  the block was never written (and is all zeros). */
+        uint32_t m_source;
+        /** Number of bytes in this block. */
+        uint32_t m_length;
+    };   // BlockEntry
+
+    /** Marks a block that was never written. */
+    static const uint32_t NO_SOURCE = 0xffffffff;
+
+    /** The regular expression to find the generation in a file name. */
+    regex_t     m_generation;
+    bool        m_has_generation;
+
+    /** Block size used for new checkpoints. */
+    size_t      m_default_block_size;
+
+    /** Generations after which a complete checkpoint is written, 0 if
+     *  never. */
+    unsigned int m_full_every;
+
+    bool        m_report;
+
+    /** The manifest, or the file itself if it is not a checkpoint. */
+    int         m_filedes;
+
+    /** Flags the file was opened with. */
+    int         m_open_flags;
+
+    /** True if the file is not a checkpoint and is accessed directly. */
+    bool        m_passthrough;
+
+    /** True if the checkpoint is written. */
+    bool        m_writable;
+
+    /** Block size of this checkpoint. */
+    size_t      m_block_size;
+
+    /** Number of generations since the last complete checkpoint. */
+    unsigned int m_chain;
+
+    /** The blocks of this checkpoint. */
+    std::vector<BlockEntry>  m_entries;
+
+    /** The blocks of the previous checkpoint, using the source indices of
+     *  this checkpoint. */
+    std::vector<BlockEntry>  m_previous;
+
+    /** Name of the previous checkpoint (for the report). */
+    std::string m_previous_name;
+
+    /** All delta files used, relative to the directory of the manifest. */
+    std::vector<std::string> m_sources;
+
+    /** Index of the delta file of this checkpoint in m_sources. */
+    uint32_t    m_own_source;
+
+    /** File descriptors of the sources, -1 if not yet opened. */
+    std::vector<int>         m_source_filedes;
+
+    /** Number of bytes in the own delta file. */
+    off64_t     m_delta_size;
+
+    /** The block currently being modified. */
+    char       *m_block;
+    int64_t     m_block_index;
+    bool        m_block_dirty;
+
+    off64_t     m_position;
+    off64_t     m_size;
+    bool        m_eof;
+    int         m_error;
+
+    /** Statistics for the report. */
+    off64_t     m_written_bytes;
+    double      m_open_time;
+
+    std::string getDirectory() const;
+    bool        getGeneration(const std::string &name,
+                              std::string *logical,
+                              std::string *generation) const;
+    std::string findPrevious() const;
+    static bool readManifest(int filedes, ManifestHeader *header,
+                             std::vector<std::string> *sources,
+                             std::vector<BlockEntry> *entries);
+    void        loadPrevious();
+    int         openFile(int flags, mode_t mode);
+    int         modeToFlags(const char *mode) const;
+    int         getSource(uint32_t source);
+    bool        readBlockData(const BlockEntry &entry, size_t offset,
+                              char *buf, size_t n);
+    bool        loadBlock(int64_t index, bool overwrite);
+    bool        flushBlock();
+    bool        writeManifest();
+    bool        getManifestSize(off64_t *size) const;
+    off64_t     seek(off64_t offset, int whence);
+    int         closeFile();
+
+public:
+    /** No static init function needed. */
+    static int init() { return 0; }
+    // ------------------------------------------------------------------------
+    /** No static atExit function needed. */
+    static int atExit() { return 0; }
+    // ------------------------------------------------------------------------
+             CheckpointFileObject(const XMLNode *info);
+    virtual ~CheckpointFileObject();
+
+    // ------------------------------------------------------------------------
+    virtual FILE*  fopen(const char *mode)
+    {
+        if(openFile(modeToFlags(mode), 0666)<0)
+            return NULL;
+        return (FILE*)this;
+    }   // fopen
+    // ------------------------------------------------------------------------
+    virtual FILE*  fopen64(const char *mode)
+    {
+        if(openFile(modeToFlags(mode)|O_LARGEFILE, 0666)<0)
+            return NULL;
+        return (FILE*)this;
+    }   // fopen64
+    // ------------------------------------------------------------------------
+    virtual int setvbuf(char *buf, int mode, size_t size) { return 0; }
+    // ------------------------------------------------------------------------
+    virtual int fseek(long offset, int whence)
+    {
+        return seek(offset, whence)<0 ? -1 : 0;
+    }   // fseek
+    // ------------------------------------------------------------------------
+    virtual int fseeko(off_t offset, int whence)
+    {
+        return seek(offset, whence)<0 ? -1 : 0;
+    }   // fseeko
+    // ------------------------------------------------------------------------
+    virtual int fseeko64(off64_t offset, int whence)
+    {
+        return seek(offset, whence)<0 ? -1 : 0;
+    }   // fseeko64
+    // ------------------------------------------------------------------------
+    virtual long ftell() { return m_position; }
+    // ------------------------------------------------------------------------
+    virtual off_t ftello() { return m_position; }
+    // ------------------------------------------------------------------------
+    virtual off64_t ftello64() { return m_position; }
+    // ------------------------------------------------------------------------
+    /** Blocks are only written once they are complete, so there is nothing
+     *  to flush. */
+    virtual int fflush() { return m_error ? EOF : 0; }
+    // ------------------------------------------------------------------------
+    virtual int ferror() { return m_error!=0; }
+    // ------------------------------------------------------------------------
+    virtual int fileno()
+    {
+        return getIndex()+Config::get()->getMaxFiles();
+    }   // fileno
+    // ------------------------------------------------------------------------
+    virtual size_t fwrite(const void *ptr, size_t size, size_t nmemb)
+    {
+        if(size==0 || nmemb==0) return 0;
+        ssize_t n = write(ptr, size*nmemb);
+        return n<0 ? 0 : n/size;
+    }   // fwrite
+    // ------------------------------------------------------------------------
+    virtual size_t fread(void *ptr, size_t size, size_t nmemb)
+    {
+        if(size==0 || nmemb==0) return 0;
+        ssize_t n = read(ptr, size*nmemb);
+        return n<0 ? 0 : n/size;
+    }   // fread
+    // ------------------------------------------------------------------------
+    virtual int feof() { return m_eof; }
+    // ------------------------------------------------------------------------
+    virtual char *fgets(char *s, int size);
+    // ------------------------------------------------------------------------
+    virtual int fclose()
+    {
+        return closeFile()==0 ? 0 : EOF;
+    }   // fclose
+    // ------------------------------------------------------------------------
+    virtual int open(int flags, mode_t mode)
+    {
+        if(openFile(flags, mode)<0)
+            return -1;
+        return getIndex()+Config::get()->getMaxFiles();
+    }   // open
+    // ------------------------------------------------------------------------
+    virtual int open64(int flags, mode_t mode)
+    {
+        if(openFile(flags|O_LARGEFILE, mode)<0)
+            return -1;
+        return getIndex()+Config::get()->getMaxFiles();
+    }   // open64
+    // ------------------------------------------------------------------------
+    virtual int __xstat(int ver, struct stat *buf);
+    virtual int __fxstat(int ver, struct stat *buf);
+    virtual int __fxstat64(int ver, struct stat64 *buf);
+    virtual int __lxstat(int ver, struct stat *buf);
+    // ------------------------------------------------------------------------
+    virtual off_t lseek(off_t offset, int whence)
+    {
+        return seek(offset, whence);
+    }   // lseek
+    // ------------------------------------------------------------------------
+    virtual off64_t lseek64(off64_t offset, int whence)
+    {
+        return seek(offset, whence);
+    }   // lseek64
+    // ------------------------------------------------------------------------
+    virtual ssize_t write(const void *buf, size_t nbyte);
+    virtual ssize_t read(void *buf, size_t count);
+    // ------------------------------------------------------------------------
+    virtual int close() { return closeFile(); }
+    // ------------------------------------------------------------------------
+    /** Only the manifest is renamed: it refers to its delta file by name.*/
+    virtual int rename(const char *newpath)
+    {
+        return OS::rename(getFilename().c_str(), newpath);
+    }   // rename
+    // ------------------------------------------------------------------------
+    /** Only the manifest is removed: newer generations might still use
+     *  blocks in its delta file. */
+    virtual int unlink() { return OS::unlink(getFilename().c_str()); }
+};   // CheckpointFileObject
+
+}   // namespace ALIO
+#endif
@@ -0,0 +1,996 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "client/compression_decorator.hpp"
+
+#include "client/thread_placement.hpp"
+#include "tools/buffer_arena.hpp"
+#include "tools/string_utils.hpp"
+#include "xml/xml_node.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+namespace ALIO
+{
+
+std::vector<pthread_t> CompressionFileObjectDecorator::m_threads;
+Synchronised< std::deque<CompressRequest*> >
+                       CompressionFileObjectDecorator::m_queue;
+pthread_cond_t         CompressionFileObjectDecorator::m_signal;
+bool                   CompressionFileObjectDecorator::m_quit = false;
+std::set<CompressionFileObjectDecorator*>
+                       CompressionFileObjectDecorator::m_open_files;
+
+/** Marks the start of each block. */
+static const uint32_t BLOCK_MAGIC = 0xa110b10c;
+
+/** Identifies a compressed file (start of the trailer). */
+static const char TRAILER_MAGIC[8] = {'A','L','I','O','C','M','P','1'};
+
+// ----------------------------------------------------------------------------
+static double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec*1.0e-9;
+}   // now
+
+// ----------------------------------------------------------------------------
+/** Initialises the signal for the compression threads. The threads are
+ *  only started once a file object needs them.
+ */
+int CompressionFileObjectDecorator::init()
+{
+    pthread_cond_init(&m_signal, NULL);
+    m_quit = false;
+    return 0;
+}   // init
+
+// ----------------------------------------------------------------------------
+/** Closes all files that are still open for writing (so that their index
+ *  is written), then stops the compression threads.
+ */
+int CompressionFileObjectDecorator::atExit()
+{
+    m_queue.lock();
+    std::set<CompressionFileObjectDecorator*> open_files = m_open_files;
+    m_queue.unlock();
+    std::set<CompressionFileObjectDecorator*>::iterator i;
+    for(i=open_files.begin(); i!=open_files.end(); i++)
+    {
+        if((*i)->m_stream)
+            (*i)->fclose();
+        else
+            (*i)->close();
+    }
+
+    m_queue.lock();
+    m_quit = true;
+    pthread_cond_broadcast(&m_signal);
+    m_queue.unlock();
+    for(unsigned int j=0; j<m_threads.size(); j++)
+        pthread_join(m_threads[j], NULL);
+    m_threads.clear();
+    pthread_cond_destroy(&m_signal);
+    return 0;
+}   // atExit
+
+// ----------------------------------------------------------------------------
+/** Makes sure that at least n compression threads are running. */
+void CompressionFileObjectDecorator::startThreads(unsigned int n)
+{
+    m_queue.lock();
+    while(m_threads.size()<n)
+    {
+        pthread_t thread;
+        int error = pthread_create(&thread, NULL,
+                         &CompressionFileObjectDecorator::compressionLoop,
+                         NULL);
+        if(error)
+        {
+            printf("Can not create compression thread: error %d.\n", error);
+            break;
+        }
+        m_threads.push_back(thread);
+    }
+    m_queue.unlock();
+}   // startThreads
+
+// ----------------------------------------------------------------------------
+/** The main loop of a compression thread: compresses queued blocks till
+ *  the library is unloaded.
+ */
+void *CompressionFileObjectDecorator::compressionLoop(void *obj)
+{
+    ThreadPlacement::pinCurrentThread();
+    while(1)
+    {
+        m_queue.lock();
+        std::deque<CompressRequest*> &queue = m_queue.getData();
+        while(queue.empty() && !m_quit)
+            pthread_cond_wait(&m_signal, m_queue.getMutex());
+        if(queue.empty())
+        {
+            m_queue.unlock();
+            break;
+        }
+        CompressRequest *request = queue.front();
+        queue.pop_front();
+        m_queue.unlock();
+        compressBlock(request);
+    }
+    return NULL;
+}   // compressionLoop
+
+// ----------------------------------------------------------------------------
+/** Compresses one block. If the compressed data is not smaller than the
+ *  input, the input is stored unchanged.
+ */
+void CompressionFileObjectDecorator::compressBlock(CompressRequest *request)
+{
+    double start = now();
+    size_t size  = request->getSize();
+    BlockCodec::Codec codec = request->getCodec();
+    if(codec!=BlockCodec::CODEC_NONE)
+        size = BlockCodec::compress(codec, request->getInput(),
+                                    request->getSize(), request->getOutput());
+    if(size>=request->getSize())
+    {
+        codec = BlockCodec::CODEC_NONE;
+        size  = request->getSize();
+    }
+    request->setResult(codec, size, now()-start);
+    request->done();
+}   // compressBlock
+
+// ----------------------------------------------------------------------------
+/** Constructor. Reads the codec, block size, number of compression threads
+ *  and report flag from the addon node.
+ */
+CompressionFileObjectDecorator::CompressionFileObjectDecorator(
+                                I_FileObject *parent, const XMLNode *info)
+                              : I_FileObjectDecorator(parent, info)
+{
+    m_mode          = MODE_CLOSED;
+    m_stream        = false;
+    m_position      = 0;
+    m_size          = 0;
+    m_file_offset   = 0;
+    m_block         = NULL;
+    m_block_fill    = 0;
+    m_cached_block  = -1;
+    m_cache         = NULL;
+    m_error         = 0;
+    m_eof           = false;
+    m_stored_bytes  = 0;
+    m_compress_time = 0;
+
+    std::string s;
+    m_codec = BlockCodec::CODEC_LZ;
+    if(info->get("codec", &s) && !BlockCodec::parseCodec(s, &m_codec))
+    {
+        printf("Unknown codec '%s' - using lz.\n", s.c_str());
+        m_codec = BlockCodec::CODEC_LZ;
+    }
+
+    int64_t block_size = 1024*1024;
+    if(info->get("block-size", &s) &&
+       (!StringUtils::parseSize(s, &block_size) || block_size<4096 ||
+        block_size>256*1024*1024) )
+    {
+        printf("Invalid block-size '%s' - using 1M.\n", s.c_str());
+        block_size = 1024*1024;
+    }
+    m_block_size = block_size;
+
+    int threads = 2;
+    info->get("threads", &threads);
+    if(threads<0)
+        threads = 0;
+    // Allow two blocks per thread, so that a thread can start on the next
+    // block while the previous one is written.
+    m_max_in_flight = 2*threads;
+    if(threads>0)
+        startThreads(threads);
+
+    m_report = false;
+    info->get("report", &m_report);
+}   // CompressionFileObjectDecorator
+
+// ----------------------------------------------------------------------------
+CompressionFileObjectDecorator::~CompressionFileObjectDecorator()
+{
+    m_queue.lock();
+    m_open_files.erase(this);
+    m_queue.unlock();
+}   // ~CompressionFileObjectDecorator
+
+// ----------------------------------------------------------------------------
+/** Checks an fopen mode: only "r" and "w" are supported, since blocks
+ *  can not be modified or appended to.
+ *  \param write Set to true if the file is written.
+ *  \return False (and sets errno) if the mode is not supported.
+ */
+bool CompressionFileObjectDecorator::checkMode(const char *mode, bool *write)
+{
+    if((mode[0]=='r' || mode[0]=='w') && !strchr(mode, '+'))
+    {
+        *write = mode[0]=='w';
+        return true;
+    }
+    printf("Compressed file '%s' can only be opened with mode 'r' or 'w', "
+           "not '%s'.\n", getFilename().c_str(), mode);
+    errno = EINVAL;
+    return false;
+}   // checkMode
+
+// ----------------------------------------------------------------------------
+/** Checks open flags: a file can only be read, or written after truncating
+ *  it (or creating it exclusively).
+ *  \param write Set to true if the file is written.
+ *  \return False (and sets errno) if the flags are not supported.
+ */
+bool CompressionFileObjectDecorator::checkFlags(int flags, bool *write)
+{
+    int access = flags & O_ACCMODE;
+    if(access==O_RDONLY)
+    {
+        *write = false;
+        return true;
+    }
+    if(access==O_WRONLY && !(flags & O_APPEND) &&
+       ( (flags & O_TRUNC) || (flags & (O_CREAT|O_EXCL))==(O_CREAT|O_EXCL) ) )
+    {
+        *write = true;
+        return true;
+    }
+    printf("Compressed file '%s' can only be opened read-only, or write-only "
+           "with O_TRUNC.\n", getFilename().c_str());
+    errno = EINVAL;
+    return false;
+}   // checkFlags
+
+// ----------------------------------------------------------------------------
+/** Called after the decorated file was opened: resets the state, and reads
+ *  the index if the file is read.
+ *  \return False if the index of a compressed file is corrupt.
+ */
+bool CompressionFileObjectDecorator::openFile(bool write)
+{
+    m_position      = 0;
+    m_size          = 0;
+    m_file_offset   = 0;
+    m_block_fill    = 0;
+    m_cached_block  = -1;
+    m_error         = 0;
+    m_eof           = false;
+    m_stored_bytes  = 0;
+    m_compress_time = 0;
+    m_index.clear();
+    if(write)
+    {
+        m_mode = MODE_WRITE;
+        m_queue.lock();
+        m_open_files.insert(this);
+        m_queue.unlock();
+        return true;
+    }
+    m_mode = MODE_READ;
+    if(readIndex())
+        return true;
+    m_mode = MODE_CLOSED;
+    return false;
+}   // openFile
+
+// ----------------------------------------------------------------------------
+bool CompressionFileObjectDecorator::parentWrite(const void *p, size_t n)
+{
+    if(m_stream)
+    {
+        if(I_FileObjectDecorator::fwrite(p, 1, n)==n)
+            return true;
+        m_error = errno ? errno : EIO;
+        return false;
+    }
+    const char *data = (const char*)p;
+    while(n>0)
+    {
+        ssize_t count = I_FileObjectDecorator::write(data, n);
+        if(count<0 && errno==EINTR)
+            continue;
+        if(count<=0)
+        {
+            m_error = count<0 ? errno : EIO;
+            return false;
+        }
+        data += count;
+        n    -= count;
+    }
+    return true;
+}   // parentWrite
+
+// ----------------------------------------------------------------------------
+/** Reads exactly n bytes from the decorated file.
+ *  \return False on an error or if the file ends early.
+ */
+bool CompressionFileObjectDecorator::parentRead(void *p, size_t n)
+{
+    if(m_stream)
+        return I_FileObjectDecorator::fread(p, 1, n)==n;
+    char *data = (char*)p;
+    while(n>0)
+    {
+        ssize_t count = I_FileObjectDecorator::read(data, n);
+        if(count<0 && errno==EINTR)
+            continue;
+        if(count<=0)
+            return false;
+        data += count;
+        n    -= count;
+    }
+    return true;
+}   // parentRead
+
+// ----------------------------------------------------------------------------
+/** Seeks in the decorated file.
+ *  \return The new position, or -1 on error.
+ */
+off64_t CompressionFileObjectDecorator::parentSeek(off64_t offset,
+                                                   int whence)
+{
+    if(!m_stream)
+        return I_FileObjectDecorator::lseek64(offset, whence);
+    if(I_FileObjectDecorator::fseeko64(offset, whence)!=0)
+        return -1;
+    return I_FileObjectDecorator::ftello64();
+}   // parentSeek
+
+// ----------------------------------------------------------------------------
+/** Reads the trailer and the block index. If the file has no trailer it
+ *  was not written compressed, and all calls are passed on unchanged.
+ *  \return False if the index is corrupt.
+ */
+bool CompressionFileObjectDecorator::readIndex()
+{
+    off64_t file_size = parentSeek(0, SEEK_END);
+    Trailer trailer;
+    if(file_size<(off64_t)sizeof(Trailer) ||
+       parentSeek(file_size-sizeof(Trailer), SEEK_SET)<0 ||
+       !parentRead(&trailer, sizeof(Trailer)) ||
+       memcmp(trailer.m_magic, TRAILER_MAGIC, sizeof(TRAILER_MAGIC))!=0)
+    {
+        m_mode = MODE_PASSTHROUGH;
+        return parentSeek(0, SEEK_SET)==0;
+    }
+
+    off64_t index_size = trailer.m_num_blocks*sizeof(IndexEntry);
+    if(trailer.m_index_offset+index_size+sizeof(Trailer)!=(uint64_t)file_size)
+    {
+        printf("Compressed file '%s' has an invalid index.\n",
+               getFilename().c_str());
+        return false;
+    }
+    m_index.resize(trailer.m_num_blocks);
+    if(trailer.m_num_blocks>0 &&
+       (parentSeek(trailer.m_index_offset, SEEK_SET)<0 ||
+        !parentRead(&m_index[0], index_size) ) )
+    {
+        printf("Can not read index of compressed file '%s'.\n",
+               getFilename().c_str());
+        return false;
+    }
+
+    // Check that the blocks follow each other, and determine the size of
+    // the read buffer.
+    uint64_t raw_offset = 0, max_raw = 0;
+    for(unsigned int i=0; i<m_index.size(); i++)
+    {
+        const IndexEntry &e = m_index[i];
+        if(e.m_raw_offset!=raw_offset || e.m_raw_size==0 ||
+           e.m_file_offset+sizeof(BlockHeader)+e.m_stored_size
+                                             > trailer.m_index_offset)
+        {
+            printf("Compressed file '%s' has an invalid index.\n",
+                   getFilename().c_str());
+            return false;
+        }
+        raw_offset += e.m_raw_size;
+        if(e.m_raw_size>max_raw)
+            max_raw = e.m_raw_size;
+    }
+    if(raw_offset!=trailer.m_size)
+    {
+        printf("Compressed file '%s' has an invalid index.\n",
+               getFilename().c_str());
+        return false;
+    }
+    m_size = trailer.m_size;
+    if(max_raw>0)
+        m_cache = BufferArena::allocate(max_raw);
+    return true;
+}   // readIndex
+
+// ----------------------------------------------------------------------------
+/** Queues the current block for compression (or compresses it directly if
+ *  no compression threads are used), then writes all blocks that are done.
+ */
+void CompressionFileObjectDecorator::submitBlock()
+{
+    if(m_block_fill==0)
+        return;
+    char *output = BufferArena::allocate(
+                              BlockCodec::getMaxCompressedSize(m_block_fill));
+    CompressRequest *request = new CompressRequest(m_codec, m_block,
+                                                   m_block_fill, output);
+    if(m_max_in_flight==0)
+        compressBlock(request);
+    else
+    {
+        m_queue.lock();
+        m_queue.getData().push_back(request);
+        pthread_cond_signal(&m_signal);
+        m_queue.unlock();
+    }
+    m_in_flight.push_back(request);
+    m_block      = NULL;
+    m_block_fill = 0;
+    writeFinished(false);
+}   // submitBlock
+
+// ----------------------------------------------------------------------------
+/** Writes compressed blocks in file order. Blocks that are not yet done are
+ *  only waited for if too many are in flight.
+ *  \param all True if all blocks must be written.
+ */
+void CompressionFileObjectDecorator::writeFinished(bool all)
+{
+    while(!m_in_flight.empty())
+    {
+        CompressRequest *request = m_in_flight.front();
+        if(!all && m_in_flight.size()<=m_max_in_flight && !request->isDone())
+            break;
+        request->wait();
+        m_in_flight.pop_front();
+
+        BlockHeader header;
+        header.m_magic       = BLOCK_MAGIC;
+        header.m_codec       = request->getStoredCodec();
+        header.m_raw_size    = request->getSize();
+        header.m_stored_size = request->getStoredSize();
+        IndexEntry entry;
+        entry.m_raw_offset   = m_index.empty()
+                             ? 0 : m_index.back().m_raw_offset
+                                   + m_index.back().m_raw_size;
+        entry.m_file_offset  = m_file_offset;
+        entry.m_raw_size     = header.m_raw_size;
+        entry.m_stored_size  = header.m_stored_size;
+        // Once an error happened, no more data is written.
+        if(m_error==0 &&
+           parentWrite(&header, sizeof(header)) &&
+           parentWrite(request->getStoredData(), request->getStoredSize()))
+        {
+            m_index.push_back(entry);
+            m_file_offset  += sizeof(header) + header.m_stored_size;
+            m_stored_bytes += sizeof(header) + header.m_stored_size;
+        }
+        m_compress_time += request->getTime();
+        BufferArena::free(request->getInput());
+        BufferArena::free(request->getOutput());
+        delete request;
+    }
+}   // writeFinished
+
+// ----------------------------------------------------------------------------
+/** Adds data to the current block, and submits each full block. */
+ssize_t CompressionFileObjectDecorator::writeData(const void *buf, size_t n)
+{
+    if(m_mode!=MODE_WRITE)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    if(m_error)
+    {
+        errno = m_error;
+        return -1;
+    }
+    const char *data = (const char*)buf;
+    size_t left = n;
+    while(left>0)
+    {
+        if(!m_block)
+            m_block = BufferArena::allocate(m_block_size);
+        size_t count = m_block_size-m_block_fill;
+        if(count>left)
+            count = left;
+        memcpy(m_block+m_block_fill, data, count);
+        m_block_fill += count;
+        data         += count;
+        left         -= count;
+        if(m_block_fill==m_block_size)
+            submitBlock();
+    }
+    m_position += n;
+    m_size      = m_position;
+    return n;
+}   // writeData
+
+// ----------------------------------------------------------------------------
+/** Reads and decompresses block n into the cache.
+ *  \return False if the block can not be read or is corrupt.
+ */
+bool CompressionFileObjectDecorator::loadBlock(unsigned int n)
+{
+    if(m_cached_block==(int)n)
+        return true;
+    m_cached_block = -1;
+    const IndexEntry &entry = m_index[n];
+    BlockHeader header;
+    if(parentSeek(entry.m_file_offset, SEEK_SET)<0 ||
+       !parentRead(&header, sizeof(header)) ||
+       header.m_magic!=BLOCK_MAGIC ||
+       header.m_codec>BlockCodec::CODEC_FLOAT64 ||
+       header.m_raw_size!=entry.m_raw_size ||
+       header.m_stored_size!=entry.m_stored_size)
+    {
+        printf("Can not read block %u of compressed file '%s'.\n", n,
+               getFilename().c_str());
+        m_error = EIO;
+        return false;
+    }
+    BlockCodec::Codec codec = (BlockCodec::Codec)header.m_codec;
+    bool ok;
+    if(codec==BlockCodec::CODEC_NONE)
+        ok = header.m_stored_size==header.m_raw_size &&
+             parentRead(m_cache, header.m_raw_size);
+    else
+    {
+        char *stored = BufferArena::allocate(header.m_stored_size);
+        ok = parentRead(stored, header.m_stored_size) &&
+             BlockCodec::decompress(codec, stored, header.m_stored_size,
+                                    m_cache, header.m_raw_size);
+        BufferArena::free(stored);
+    }
+    if(!ok)
+    {
+        printf("Block %u of compressed file '%s' is corrupt.\n", n,
+               getFilename().c_str());
+        m_error = EIO;
+        return false;
+    }
+    m_cached_block = n;
+    return true;
+}   // loadBlock
+
+// ----------------------------------------------------------------------------
+/** Reads data at the current position, decompressing only the blocks that
+ *  contain it.
+ *  \return The number of bytes read, or -1 on error.
+ */
+ssize_t CompressionFileObjectDecorator::readData(void *buf, size_t n)
+{
+    if(m_mode!=MODE_READ)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    char *data   = (char*)buf;
+    size_t total = 0;
+    while(total<n)
+    {
+        if(m_position>=m_size)
+        {
+            m_eof = true;
+            break;
+        }
+        // Find the last block that starts at or before the position.
+        unsigned int low = 0, high = m_index.size();
+        while(high-low>1)
+        {
+            unsigned int mid = (low+high)/2;
+            if(m_index[mid].m_raw_offset<=(uint64_t)m_position)
+                low = mid;
+            else
+                high = mid;
+        }
+        if(!loadBlock(low))
+        {
+            if(total>0)
+                break;
+            errno = EIO;
+            return -1;
+        }
+        const IndexEntry &entry = m_index[low];
+        size_t offset = m_position - entry.m_raw_offset;
+        size_t count  = entry.m_raw_size - offset;
+        if(count>n-total)
+            count = n-total;
+        memcpy(data+total, m_cache+offset, count);
+        total      += count;
+        m_position += count;
+    }
+    return total;
+}   // readData
+
+// ----------------------------------------------------------------------------
+/** Sets the uncompressed position. While writing only the current position
+ *  can be used.
+ *  \return The new position, or -1 on error.
+ */
+off64_t CompressionFileObjectDecorator::seek(off64_t offset, int whence)
+{
+    off64_t position;
+    switch(whence)
+    {
+    case SEEK_SET: position = offset;            break;
+    case SEEK_CUR: position = m_position+offset; break;
+    case SEEK_END: position = m_size+offset;     break;
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+    if(position<0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if(m_mode==MODE_WRITE && position!=m_position)
+    {
+        errno = ESPIPE;
+        return -1;
+    }
+    m_position = position;
+    m_eof      = false;
+    return m_position;
+}   // seek
+
+// ----------------------------------------------------------------------------
+/** Writes all remaining blocks, the index and the trailer, and frees all
+ *  buffers. The decorated file is not closed.
+ *  \return 0 on success, -1 if any write failed (errno is set).
+ */
+int CompressionFileObjectDecorator::closeFile()
+{
+    Mode mode = m_mode;
+    m_mode    = MODE_CLOSED;
+    if(m_cache)
+    {
+        BufferArena::free(m_cache);
+        m_cache        = NULL;
+        m_cached_block = -1;
+    }
+    if(mode!=MODE_WRITE)
+        return 0;
+
+    m_queue.lock();
+    m_open_files.erase(this);
+    m_queue.unlock();
+
+    submitBlock();
+    writeFinished(true);
+    if(m_block)
+    {
+        BufferArena::free(m_block);
+        m_block = NULL;
+    }
+    if(m_error==0 && !m_index.empty())
+        parentWrite(&m_index[0], m_index.size()*sizeof(IndexEntry));
+    if(m_error==0)
+    {
+        Trailer trailer;
+        memcpy(trailer.m_magic, TRAILER_MAGIC, sizeof(TRAILER_MAGIC));
+        trailer.m_index_offset = m_file_offset;
+        trailer.m_num_blocks   = m_index.size();
+        trailer.m_size         = m_size;
+        parentWrite(&trailer, sizeof(trailer));
+    }
+    m_stored_bytes += m_index.size()*sizeof(IndexEntry) + sizeof(Trailer);
+
+    if(m_report)
+        printf("Compressed '%s': %lld -> %lld bytes (%.2f:1) in %d blocks, "
+               "compression time %.3f s.\n", getFilename().c_str(),
+               (long long)m_size, (long long)m_stored_bytes,
+               m_stored_bytes>0 ? (double)m_size/m_stored_bytes : 0.0,
+               (int)m_index.size(), m_compress_time);
+    if(m_error)
+    {
+        printf("Error writing compressed file '%s': %s.\n",
+               getFilename().c_str(), strerror(m_error));
+        errno = m_error;
+        return -1;
+    }
+    return 0;
+}   // closeFile
+
+// ----------------------------------------------------------------------------
+FILE *CompressionFileObjectDecorator::fopen(const char *mode)
+{
+    bool write;
+    if(!checkMode(mode, &write) || !I_FileObjectDecorator::fopen(mode))
+        return NULL;
+    m_stream = true;
+    if(openFile(write))
+        return (FILE*)this;
+    I_FileObjectDecorator::fclose();
+    errno = EIO;
+    return NULL;
+}   // fopen
+
+// ----------------------------------------------------------------------------
+FILE *CompressionFileObjectDecorator::fopen64(const char *mode)
+{
+    bool write;
+    if(!checkMode(mode, &write) || !I_FileObjectDecorator::fopen64(mode))
+        return NULL;
+    m_stream = true;
+    if(openFile(write))
+        return (FILE*)this;
+    I_FileObjectDecorator::fclose();
+    errno = EIO;
+    return NULL;
+}   // fopen64
+
+// ----------------------------------------------------------------------------
+int CompressionFileObjectDecorator::open(int flags, mode_t mode)
+{
+    bool write;
+    if(!checkFlags(flags, &write))
+        return -1;
+    int filedes = I_FileObjectDecorator::open(flags, mode);
+    if(filedes<0)
+        return filedes;
+    m_stream = false;
+    if(openFile(write))
+        return filedes;
+    I_FileObjectDecorator::close();
+    errno = EIO;
+    return -1;
+}   // open
+
+// ----------------------------------------------------------------------------
+int CompressionFileObjectDecorator::open64(int flags, mode_t mode)
+{
+    bool write;
+    if(!checkFlags(flags, &write))
+        return -1;
+    int filedes = I_FileObjectDecorator::open64(flags, mode);
+    if(filedes<0)
+        return filedes;
+    m_stream = false;
+    if(openFile(write))
+        return filedes;
+    I_FileObjectDecorator::close();
+    errno = EIO;
+    return -1;
+}   // open64
+
+// ----------------------------------------------------------------------------
+int CompressionFileObjectDecorator::fseek(long offset, int whence)
+{
+    if(m_mode==MODE_PASSTHROUGH)
+        return I_FileObjectDecorator::fseek(offset, whence);
+    return seek(offset, whence)<0 ? -1 : 0;
+}   // fseek
+
+// ----------------------------------------------------------------------------
+int CompressionFileObjectDecorator::fseeko(off_t offset, int whence)
+{
+    if(m_mode==MODE_PASSTHROUGH)
+        return I_FileObjectDecorator::fseeko(offset, whence);
+    return seek(offset, whence)<0 ? -1 : 0;
+}   // fseeko
+
+// ----------------------------------------------------------------------------
+int CompressionFileObjectDecorator::fseeko64(off64_t offset, int whence)
+{
+    if(m_mode==MODE_PASSTHROUGH)
+        return I_FileObjectDecorator::fseeko64(offset, whence);
+    return seek(offset, whence)<0 ? -1 : 0;
+}   // fseeko64
+
+// ----------------------------------------------------------------------------
+long CompressionFileObjectDecorator::ftell()
+{
+    if(m_mode==MODE_PASSTHROUGH)
+        return I_FileObjectDecorator::ftell();
+    return m_position;
+}   // ftell
+
+// ----------------------------------------------------------------------------
+off_t CompressionFileObjectDecorator::ftello()
+{
+    if(m_mode==MODE_PASSTHROUGH)
+        return I_FileObjectDecorator::ftello();
+    return m_position;
+}   // ftello
+
+// ----------------------------------------------------------------------------
+off64_t CompressionFileObjectDecorator::ftello64()
+{
+    if(m_mode==MODE_PASSTHROUGH)
+        return I_FileObjectDecorator::ftello64();
+    return m_position;
+}   // ftello64
+
+// ----------------------------------------------------------------------------
+/** Writes all blocks that are already compressed, and waits for the ones
+ *  still being compressed. The partially filled block stays in memory, so
+ *  that frequent flushes do not create many small blocks (a compressed
+ *  file can only be read once it is closed anyway).
+ */
+int CompressionFileObjectDecorator::fflush()
+{
+    if(m_mode==MODE_PASSTHROUGH)
+        return I_FileObjectDecorator::fflush();
+    if(m_mode==MODE_WRITE)
+        writeFinished(true);
+    if(m_error)
+    {
+        errno = m_error;
+        return EOF;
+    }
+    return m_stream ? I_FileObjectDecorator::fflush() : 0;
+}   // fflush
+
+// ----------------------------------------------------------------------------
+int CompressionFileObjectDecorator::ferror()
+{
+    if(m_mode==MODE_PASSTHROUGH)
+        return I_FileObjectDecorator::ferror();
+    return m_error!=0;
+}   // ferror
+
+// ----------------------------------------------------------------------------
+size_t CompressionFileObjectDecorator::fwrite(const void *ptr, size_t size,
+                                              size_t nmemb)
+{
+    if(m_mode==MODE_PASSTHROUGH)
+        return I_FileObjectDecorator::fwrite(ptr, size, nmemb);
+    if(size==0 || nmemb==0)
+        return 0;
+    return writeData(ptr, size*nmemb)<0 ? 0 : nmemb;
+}   // fwrite
+
+// ----------------------------------------------------------------------------
+size_t CompressionFileObjectDecorator::fread(void *ptr, size_t size,
+                                             size_t nmemb)
+{
+    if(m_mode==MODE_PASSTHROUGH)
+        return I_FileObjectDecorator::fread(ptr, size, nmemb);
+    if(size==0 || nmemb==0)
+        return 0;
+    ssize_t count = readData(ptr, size*nmemb);
+    return count<0 ? 0 : count/size;
+}   // fread
+
+// ----------------------------------------------------------------------------
+int CompressionFileObjectDecorator::feof()
+{
+    if(m_mode==MODE_PASSTHROUGH)
+        return I_FileObjectDecorator::feof();
+    return m_eof;
+}   // feof
+
+// ----------------------------------------------------------------------------
+char *CompressionFileObjectDecorator::fgets(char *s, int size)
+{
+    if(m_mode==MODE_PASSTHROUGH)
+        return I_FileObjectDecorator::fgets(s, size);
+    if(size<=0)
+        return NULL;
+    int n = 0;
+    while(n<size-1)
+    {
+        if(readData(s+n, 1)!=1)
+            break;
+        if(s[n++]=='\n')
+            break;
+    }
+    if(n==0)
+        return NULL;
+    s[n] = 0;
+    return s;
+}   // fgets
+
+// ----------------------------------------------------------------------------
+int CompressionFileObjectDecorator::fclose()
+{
+    int result = closeFile();
+    int error  = errno;
+    if(I_FileObjectDecorator::fclose()!=0)
+        return EOF;
+    if(result!=0)
+    {
+        errno = error;
+        return EOF;
+    }
+    return 0;
+}   // fclose
+
+// ----------------------------------------------------------------------------
+/** Reports the uncompressed size of the file. */
+int CompressionFileObjectDecorator::__fxstat(int ver, struct stat *buf)
+{
+    int result = I_FileObjectDecorator::__fxstat(ver, buf);
+    if(result==0 && (m_mode==MODE_READ || m_mode==MODE_WRITE))
+        buf->st_size = m_size;
+    return result;
+}   // __fxstat
+
+// ----------------------------------------------------------------------------
+/** Reports the uncompressed size of the file. */
+int CompressionFileObjectDecorator::__fxstat64(int ver, struct stat64 *buf)
+{
+    int result = I_FileObjectDecorator::__fxstat64(ver, buf);
+    if(result==0 && (m_mode==MODE_READ || m_mode==MODE_WRITE))
+        buf->st_size = m_size;
+    return result;
+}   // __fxstat64
+
+// ----------------------------------------------------------------------------
+off_t CompressionFileObjectDecorator::lseek(off_t offset, int whence)
+{
+    if(m_mode==MODE_PASSTHROUGH)
+        return I_FileObjectDecorator::lseek(offset, whence);
+    return seek(offset, whence);
+}   // lseek
+
+// ----------------------------------------------------------------------------
+off64_t CompressionFileObjectDecorator::lseek64(off64_t offset, int whence)
+{
+    if(m_mode==MODE_PASSTHROUGH)
+        return I_FileObjectDecorator::lseek64(offset, whence);
+    return seek(offset, whence);
+}   // lseek64
+
+// ----------------------------------------------------------------------------
+ssize_t CompressionFileObjectDecorator::write(const void *buf, size_t nbyte)
+{
+    if(m_mode==MODE_PASSTHROUGH)
+        return I_FileObjectDecorator::write(buf, nbyte);
+    return writeData(buf, nbyte);
+}   // write
+
+// ----------------------------------------------------------------------------
+ssize_t CompressionFileObjectDecorator::read(void *buf, size_t count)
+{
+    if(m_mode==MODE_PASSTHROUGH)
+        return I_FileObjectDecorator::read(buf, count);
+    return readData(buf, count);
+}   // read
+
+// ----------------------------------------------------------------------------
+int CompressionFileObjectDecorator::close()
+{
+    int result = closeFile();
+    int error  = errno;
+    if(I_FileObjectDecorator::close()!=0)
+        return -1;
+    if(result!=0)
+    {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}   // close
+
+}   // namespace ALIO
@@ -0,0 +1,202 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef HEADER_COMPRESSION_DECORATOR_HPP
+#define HEADER_COMPRESSION_DECORATOR_HPP
+
+#include "client/i_file_object_decorator.hpp"
+#include "client/request.hpp"
+#include "tools/block_codec.hpp"
+#include "tools/synchronised.hpp"
+
+#include <deque>
+#include <pthread.h>
+#include <set>
+#include <stdint.h>
+#include <vector>
+
+namespace ALIO
+{
+
+/** A decorator that compresses the data before it is passed on to the
+ *  file object it decorates (<addon type="compress" .../>). The data is
+ *  split into blocks (block-size, default 1M), which are compressed by a
+ *  pool of compression threads (threads, default 2) while the application
+ *  continues writing. The blocks are written in order, each preceded by a
+ *  small header; at close an index of all blocks and a trailer are
+ *  appended. Reads use the index to decompress only the blocks needed, so
+ *  random access is possible. Files without the trailer are read
+ *  unchanged.
+ *  codec selects the compression: "lz" (default, a fast LZ77 variant),
+ *  "float32" or "float64" (lossless, better for smooth floating point
+ *  data), or "none". Blocks that do not get smaller are stored raw.
+ *  Files must be written sequentially (seeks to other positions fail with
+ *  ESPIPE), and can not be opened for reading and writing at once. Files
+ *  still open at exit are closed, so that their index is written.
+ *  With report="yes" the compression ratio and time are printed at close.
+ */
+class CompressionFileObjectDecorator : public I_FileObjectDecorator
+{
+private:
+    /** How the file is currently used. */
+    enum Mode {MODE_CLOSED, MODE_WRITE, MODE_READ, MODE_PASSTHROUGH};
+
+    /** Header stored in front of each block. */
+    struct BlockHeader
+    {
+        uint32_t m_magic;
+        uint32_t m_codec;
+        uint32_t m_raw_size;
+        uint32_t m_stored_size;
+    };   // BlockHeader
+
+    /** One index entry per block. */
+    struct IndexEntry
+    {
+        uint64_t m_raw_offset;
+        uint64_t m_file_offset;
+        uint32_t m_raw_size;
+        uint32_t m_stored_size;
+    };   // IndexEntry
+
+    /** The trailer at the end of a compressed file. */
+    struct Trailer
+    {
+        char     m_magic[8];
+        uint64_t m_index_offset;
+        uint64_t m_num_blocks;
+        uint64_t m_size;
+    };   // Trailer
+
+    Mode              m_mode;
+
+    /** True if the file was opened with fopen (otherwise with open). */
+    bool              m_stream;
+
+    /** Codec and uncompressed size of a block. */
+    BlockCodec::Codec m_codec;
+    size_t            m_block_size;
+
+    /** Maximum number of blocks being compressed for this file. */
+    unsigned int      m_max_in_flight;
+
+    bool              m_report;
+
+    /** Logical (uncompressed) position and size of the file. */
+    off64_t           m_position;
+    off64_t           m_size;
+
+    /** Position in the decorated file at which the next block is written. */
+    off64_t           m_file_offset;
+
+    /** The block currently being filled by the application. */
+    char             *m_block;
+    size_t            m_block_fill;
+
+    /** Blocks being compressed, in file order. */
+    std::deque<CompressRequest*> m_in_flight;
+
+    /** All blocks written or read from the file index. */
+    std::vector<IndexEntry> m_index;
+
+    /** Index of the block in m_cache, -1 if none. */
+    int               m_cached_block;
+
+    /** The last block decompressed for reading. */
+    char             *m_cache;
+
+    /** The first error when writing to the decorated file. */
+    int               m_error;
+
+    bool              m_eof;
+
+    /** Statistics for the report. */
+    off64_t           m_stored_bytes;
+    double            m_compress_time;
+
+    /** The compression threads. */
+    static std::vector<pthread_t> m_threads;
+
+    /** Blocks to be compressed. The lock also protects m_quit. */
+    static Synchronised< std::deque<CompressRequest*> > m_queue;
+
+    /** Signals the compression threads that a block was queued. */
+    static pthread_cond_t m_signal;
+
+    /** Set at exit to stop the compression threads. */
+    static bool           m_quit;
+
+    /** All files open for writing, so they can be closed at exit. Protected
+     *  by the lock of m_queue. */
+    static std::set<CompressionFileObjectDecorator*> m_open_files;
+
+    static void  startThreads(unsigned int n);
+    static void *compressionLoop(void *obj);
+    static void  compressBlock(CompressRequest *request);
+
+    bool    checkMode(const char *mode, bool *write);
+    bool    checkFlags(int flags, bool *write);
+    bool    openFile(bool write);
+    bool    parentWrite(const void *p, size_t n);
+    bool    parentRead(void *p, size_t n);
+    off64_t parentSeek(off64_t offset, int whence);
+    bool    readIndex();
+    ssize_t writeData(const void *buf, size_t n);
+    ssize_t readData(void *buf, size_t n);
+    off64_t seek(off64_t offset, int whence);
+    void    submitBlock();
+    void    writeFinished(bool all);
+    bool    loadBlock(unsigned int n);
+    int     closeFile();
+
+public:
+    static int init();
+    static int atExit();
+
+             CompressionFileObjectDecorator(I_FileObject *parent,
+                                            const XMLNode *info);
+    virtual ~CompressionFileObjectDecorator();
+
+    virtual FILE   *fopen(const char *mode);
+    virtual FILE   *fopen64(const char *mode);
+    virtual int     open(int flags, mode_t mode);
+    virtual int     open64(int flags, mode_t mode);
+    virtual int     fseek(long offset, int whence);
+    virtual int     fseeko(off_t offset, int whence);
+    virtual int     fseeko64(off64_t offset, int whence);
+    virtual long    ftell();
+    virtual off_t   ftello();
+    virtual off64_t ftello64();
+    virtual int     fflush();
+    virtual int     ferror();
+    virtual size_t  fwrite(const void *ptr, size_t size, size_t nmemb);
+    virtual size_t  fread(void *ptr, size_t size, size_t nmemb);
+    virtual int     feof();
+    virtual char   *fgets(char *s, int size);
+    virtual int     fclose();
+    virtual int     __fxstat(int ver, struct stat *buf);
+    virtual int     __fxstat64(int ver, struct stat64 *buf);
+    virtual off_t   lseek(off_t offset, int whence);
+    virtual off64_t lseek64(off64_t offset, int whence);
+    virtual ssize_t write(const void *buf, size_t nbyte);
+    virtual ssize_t read(void *buf, size_t count);
+    virtual int     close();
+};   // CompressionFileObjectDecorator
+
+}   // namespace ALIO
+#endif
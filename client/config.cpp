@@ -18,7 +18,9 @@
 
 #include "client/config.hpp"
 #include "client/standard_file_object.hpp"
+#include "client/thread_placement.hpp"
 
+#include "tools/buffer_arena.hpp"
 #include "tools/os.hpp"
 #include "xml/xml_node.hpp"
 
@@ -96,7 +98,22 @@ void Config::readConfig(const XMLNode *root)
     // For each file pattern create the "file object" info object:
     for(unsigned int i=0; i<config->getNumNodes(); i++)
     {
-        FileObjectInfo *foi = new FileObjectInfo(config->getNode(i));
+        const XMLNode *node = config->getNode(i);
+        if(node->getName()=="arena")
+        {
+            std::string huge_pages;
+            if(node->get("huge-pages", &huge_pages) &&
+               !BufferArena::setHugePageMode(huge_pages.c_str()))
+                printf("Invalid huge-pages value '%s' - ignored.\n",
+                       huge_pages.c_str());
+            continue;
+        }
+        if(node->getName()=="threads")
+        {
+            ThreadPlacement::readConfig(node);
+            continue;
+        }
+        FileObjectInfo *foi = new FileObjectInfo(node);
         m_all_file_object_info.push_back(foi);
     }
 
@@ -0,0 +1,673 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "client/container_file_object.hpp"
+
+#include "client/config.hpp"
+#include "tools/buffer_arena.hpp"
+#include "tools/os.hpp"
+#include "tools/string_utils.hpp"
+#include "xml/xml_node.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ALIO
+{
+
+Synchronised< std::map<std::string, ContainerArchive*> >
+                                   ContainerFileObject::m_containers;
+std::set<ContainerFileObject*>     ContainerFileObject::m_open_files;
+
+// ----------------------------------------------------------------------------
+int ContainerFileObject::init()
+{
+    return 0;
+}   // init
+
+// ----------------------------------------------------------------------------
+/** Writes the buffered data of all files that are still open, and closes
+ *  the containers.
+ */
+int ContainerFileObject::atExit()
+{
+    m_containers.lock();
+    std::set<ContainerFileObject*>::iterator i;
+    for(i=m_open_files.begin(); i!=m_open_files.end(); i++)
+        (*i)->flushPending();
+    std::map<std::string, ContainerArchive*> &containers =
+        m_containers.getData();
+    std::map<std::string, ContainerArchive*>::iterator c;
+    for(c=containers.begin(); c!=containers.end(); c++)
+    {
+        if(c->second)
+            OS::close(c->second->getFiledes());
+    }
+    m_containers.unlock();
+    return 0;
+}   // atExit
+
+// ----------------------------------------------------------------------------
+ContainerFileObject::ContainerFileObject(const XMLNode *info)
+                   : BaseFileObject(info)
+{
+    m_archive        = NULL;
+    m_pending        = NULL;
+    m_pending_fill   = 0;
+    m_pending_offset = 0;
+    m_position       = 0;
+    m_readable       = false;
+    m_writable       = false;
+    m_append         = false;
+    m_eof            = false;
+    m_error          = false;
+    m_buffer_size    = 1024*1024;
+
+    if(!info->get("container", &m_container_path))
+    {
+        printf("No container specified for container io - aborting.\n");
+        exit(-1);
+    }
+    std::string s;
+    if(info->get("buffer-size", &s))
+    {
+        int64_t size;
+        if(StringUtils::parseSize(s, &size) && size>=0)
+            m_buffer_size = size;
+        else
+            printf("Invalid buffer-size '%s' - using 1M.\n", s.c_str());
+    }
+}   // ContainerFileObject
+
+// ----------------------------------------------------------------------------
+ContainerFileObject::~ContainerFileObject()
+{
+    if(m_archive)
+        closeFile();
+}   // ~ContainerFileObject
+
+// ----------------------------------------------------------------------------
+/** Converts an fopen mode to open flags.
+ *  \return False (and sets errno) if the mode is invalid.
+ */
+bool ContainerFileObject::modeToFlags(const char *mode, int *flags)
+{
+    switch(mode[0])
+    {
+    case 'r': *flags = O_RDONLY;                   break;
+    case 'w': *flags = O_WRONLY|O_CREAT|O_TRUNC;   break;
+    case 'a': *flags = O_WRONLY|O_CREAT|O_APPEND;  break;
+    default:
+        errno = EINVAL;
+        return false;
+    }
+    if(strchr(mode, '+'))
+        *flags = (*flags & ~O_ACCMODE) | O_RDWR;
+    if(strchr(mode, 'x'))
+        *flags |= O_EXCL;
+    return true;
+}   // modeToFlags
+
+// ----------------------------------------------------------------------------
+/** Returns the container with the given path, opening it and reading its
+ *  index when it is first used. The lock must be held.
+ *  \return The container, or NULL (and errno set) if it can not be used.
+ */
+ContainerArchive *ContainerFileObject::getArchive(const std::string &path)
+{
+    std::map<std::string, ContainerArchive*> &containers =
+        m_containers.getData();
+    std::map<std::string, ContainerArchive*>::iterator i =
+        containers.find(path);
+    if(i!=containers.end())
+        return i->second;
+
+    int filedes = OS::open(path.c_str(), O_RDWR|O_CREAT, 0644);
+    if(filedes<0)
+    {
+        printf("Can not open container '%s': %s.\n", path.c_str(),
+               strerror(errno));
+        return NULL;
+    }
+    ContainerArchive *archive = new ContainerArchive();
+    if(!archive->load(filedes))
+    {
+        printf("Can not read container '%s': %s.\n", path.c_str(),
+               strerror(errno));
+        OS::close(filedes);
+        delete archive;
+        return NULL;
+    }
+    containers[path] = archive;
+    return archive;
+}   // getArchive
+
+// ----------------------------------------------------------------------------
+/** Opens the file in the container, creating or truncating it depending on
+ *  the flags.
+ *  \return False (and sets errno) if the file can not be opened.
+ */
+bool ContainerFileObject::openFile(int flags)
+{
+    int access = flags & O_ACCMODE;
+    m_containers.lock();
+    ContainerArchive *archive = getArchive(m_container_path);
+    if(!archive)
+    {
+        m_containers.unlock();
+        errno = EIO;
+        return false;
+    }
+    const ContainerArchive::Entry *entry = archive->find(getFilename());
+    bool ok = true;
+    if(!entry)
+    {
+        if(!(flags & O_CREAT))
+        {
+            errno = ENOENT;
+            ok    = false;
+        }
+        else
+            ok = archive->truncate(getFilename());
+    }
+    else if((flags & (O_CREAT|O_EXCL))==(O_CREAT|O_EXCL))
+    {
+        errno = EEXIST;
+        ok    = false;
+    }
+    else if((flags & O_TRUNC) && access!=O_RDONLY && entry->m_size>0)
+        ok = archive->truncate(getFilename());
+    if(ok)
+        m_open_files.insert(this);
+    m_containers.unlock();
+    if(!ok)
+        return false;
+
+    m_archive        = archive;
+    m_pending_fill   = 0;
+    m_pending_offset = 0;
+    m_position       = 0;
+    m_readable       = access!=O_WRONLY;
+    m_writable       = access!=O_RDONLY;
+    m_append         = (flags & O_APPEND)!=0;
+    m_eof            = false;
+    m_error          = false;
+    if(m_writable && m_buffer_size>0)
+        m_pending = BufferArena::allocate(m_buffer_size);
+    return true;
+}   // openFile
+
+// ----------------------------------------------------------------------------
+/** Writes the buffered data of the file and closes it. */
+int ContainerFileObject::closeFile()
+{
+    if(!m_archive)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    m_containers.lock();
+    bool ok = flushPending();
+    m_open_files.erase(this);
+    m_containers.unlock();
+    if(m_pending)
+        BufferArena::free(m_pending);
+    m_pending = NULL;
+    m_archive = NULL;
+    return ok ? 0 : -1;
+}   // closeFile
+
+// ----------------------------------------------------------------------------
+/** Appends the buffered data as one segment to the container. The lock
+ *  must be held.
+ *  \return False (and sets errno) if writing failed.
+ */
+bool ContainerFileObject::flushPending()
+{
+    if(m_pending_fill==0)
+        return true;
+    bool ok = m_archive->writeData(getFilename(), m_pending_offset,
+                                   m_pending, m_pending_fill);
+    m_pending_fill = 0;
+    if(!ok)
+        m_error = true;
+    return ok;
+}   // flushPending
+
+// ----------------------------------------------------------------------------
+/** Returns the size of the file including buffered data. The lock must be
+ *  held.
+ */
+off64_t ContainerFileObject::getSize()
+{
+    const ContainerArchive::Entry *entry = m_archive->find(getFilename());
+    off64_t size = entry ? entry->m_size : 0;
+    if(m_pending_fill>0 && m_pending_offset+(off64_t)m_pending_fill>size)
+        size = m_pending_offset+m_pending_fill;
+    return size;
+}   // getSize
+
+// ----------------------------------------------------------------------------
+/** Writes data to the file, collecting contiguous writes in the buffer.
+ *  \return The number of bytes written, or -1 (and errno set).
+ */
+ssize_t ContainerFileObject::writeData(const void *buf, size_t n)
+{
+    if(!m_archive || !m_writable)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    const char *p = (const char*)buf;
+    m_containers.lock();
+    if(m_append)
+        m_position = getSize();
+    if(m_pending_fill>0 &&
+       (m_pending_offset+(off64_t)m_pending_fill!=m_position ||
+        m_pending_fill+n>m_buffer_size) )
+    {
+        if(!flushPending())
+        {
+            m_containers.unlock();
+            return -1;
+        }
+    }
+    if(n>=m_buffer_size)
+    {
+        // Too large for the buffer, so it is written as its own segment.
+        if(!m_archive->writeData(getFilename(), m_position, p, n))
+        {
+            m_containers.unlock();
+            return -1;
+        }
+    }
+    else
+    {
+        if(m_pending_fill==0)
+            m_pending_offset = m_position;
+        memcpy(m_pending+m_pending_fill, p, n);
+        m_pending_fill += n;
+    }
+    m_position += n;
+    m_containers.unlock();
+    return n;
+}   // writeData
+
+// ----------------------------------------------------------------------------
+/** Reads data of the file; parts that were never written read as zeros.
+ *  \return The number of bytes read, or -1 (and errno set).
+ */
+ssize_t ContainerFileObject::readData(void *buf, size_t n)
+{
+    if(!m_archive || !m_readable)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    m_containers.lock();
+    if(!flushPending())
+    {
+        m_containers.unlock();
+        return -1;
+    }
+    ssize_t count = 0;
+    const ContainerArchive::Entry *entry = m_archive->find(getFilename());
+    if(entry)
+        count = m_archive->read(*entry, (char*)buf, n, m_position);
+    m_containers.unlock();
+    if(count>0)
+        m_position += count;
+    return count;
+}   // readData
+
+// ----------------------------------------------------------------------------
+/** Changes the position.
+ *  \return The new position, or -1 (and errno set).
+ */
+off64_t ContainerFileObject::seek(off64_t offset, int whence)
+{
+    if(!m_archive)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    off64_t base;
+    switch(whence)
+    {
+    case SEEK_SET: base = 0;          break;
+    case SEEK_CUR: base = m_position; break;
+    case SEEK_END:
+        m_containers.lock();
+        base = getSize();
+        m_containers.unlock();
+        break;
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+    if(base+offset<0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    m_position = base+offset;
+    m_eof      = false;
+    return m_position;
+}   // seek
+
+// ----------------------------------------------------------------------------
+/** Fills a stat structure for the file with the name of this object. The
+ *  times are those of the container.
+ */
+template<typename T>
+int ContainerFileObject::statEntry(T *buf)
+{
+    m_containers.lock();
+    ContainerArchive *archive = m_archive ? m_archive
+                                          : getArchive(m_container_path);
+    const ContainerArchive::Entry *entry =
+        archive ? archive->find(getFilename()) : NULL;
+    if(!entry)
+    {
+        m_containers.unlock();
+        errno = ENOENT;
+        return -1;
+    }
+    struct stat64 container;
+    if(::fstat64(archive->getFiledes(), &container)!=0)
+        memset(&container, 0, sizeof(container));
+    memset(buf, 0, sizeof(T));
+    buf->st_mode    = S_IFREG | 0644;
+    buf->st_nlink   = 1;
+    buf->st_uid     = container.st_uid;
+    buf->st_gid     = container.st_gid;
+    buf->st_size    = entry->m_size;
+    if(archive==m_archive && m_pending_fill>0 &&
+       m_pending_offset+(off64_t)m_pending_fill>(off64_t)entry->m_size)
+        buf->st_size = m_pending_offset+m_pending_fill;
+    buf->st_blksize = container.st_blksize;
+    buf->st_blocks  = (buf->st_size+511)/512;
+    buf->st_atime   = container.st_atime;
+    buf->st_mtime   = container.st_mtime;
+    buf->st_ctime   = container.st_ctime;
+    m_containers.unlock();
+    return 0;
+}   // statEntry
+
+// ----------------------------------------------------------------------------
+FILE *ContainerFileObject::fopen(const char *mode)
+{
+    int flags;
+    if(!modeToFlags(mode, &flags) || !openFile(flags))
+        return NULL;
+    return (FILE*)this;
+}   // fopen
+
+// ----------------------------------------------------------------------------
+FILE *ContainerFileObject::fopen64(const char *mode)
+{
+    return fopen(mode);
+}   // fopen64
+
+// ----------------------------------------------------------------------------
+int ContainerFileObject::fseek(long offset, int whence)
+{
+    return seek(offset, whence)<0 ? -1 : 0;
+}   // fseek
+
+// ----------------------------------------------------------------------------
+int ContainerFileObject::fseeko(off_t offset, int whence)
+{
+    return seek(offset, whence)<0 ? -1 : 0;
+}   // fseeko
+
+// ----------------------------------------------------------------------------
+int ContainerFileObject::fseeko64(off64_t offset, int whence)
+{
+    return seek(offset, whence)<0 ? -1 : 0;
+}   // fseeko64
+
+// ----------------------------------------------------------------------------
+long ContainerFileObject::ftell()
+{
+    return m_position;
+}   // ftell
+
+// ----------------------------------------------------------------------------
+off_t ContainerFileObject::ftello()
+{
+    return m_position;
+}   // ftello
+
+// ----------------------------------------------------------------------------
+off64_t ContainerFileObject::ftello64()
+{
+    return m_position;
+}   // ftello64
+
+// ----------------------------------------------------------------------------
+int ContainerFileObject::fflush()
+{
+    if(!m_archive)
+        return 0;
+    m_containers.lock();
+    bool ok = flushPending();
+    m_containers.unlock();
+    return ok ? 0 : EOF;
+}   // fflush
+
+// ----------------------------------------------------------------------------
+int ContainerFileObject::fileno()
+{
+    return getIndex()+Config::get()->getMaxFiles();
+}   // fileno
+
+// ----------------------------------------------------------------------------
+size_t ContainerFileObject::fwrite(const void *ptr, size_t size, size_t nmemb)
+{
+    if(size==0 || nmemb==0)
+        return 0;
+    ssize_t n = writeData(ptr, size*nmemb);
+    if(n<(ssize_t)(size*nmemb))
+        m_error = true;
+    return n<0 ? 0 : n/size;
+}   // fwrite
+
+// ----------------------------------------------------------------------------
+size_t ContainerFileObject::fread(void *ptr, size_t size, size_t nmemb)
+{
+    if(size==0 || nmemb==0)
+        return 0;
+    ssize_t n = readData(ptr, size*nmemb);
+    if(n<0)
+    {
+        m_error = true;
+        return 0;
+    }
+    if(n<(ssize_t)(size*nmemb))
+        m_eof = true;
+    return n/size;
+}   // fread
+
+// ----------------------------------------------------------------------------
+char *ContainerFileObject::fgets(char *s, int size)
+{
+    if(size<=0)
+        return NULL;
+    int n = 0;
+    while(n<size-1)
+    {
+        ssize_t count = readData(s+n, 1);
+        if(count<=0)
+        {
+            if(count<0) m_error = true;
+            else        m_eof   = true;
+            break;
+        }
+        if(s[n++]=='\n')
+            break;
+    }
+    if(n==0)
+        return NULL;
+    s[n] = 0;
+    return s;
+}   // fgets
+
+// ----------------------------------------------------------------------------
+int ContainerFileObject::fclose()
+{
+    return closeFile()==0 ? 0 : EOF;
+}   // fclose
+
+// ----------------------------------------------------------------------------
+int ContainerFileObject::open(int flags, mode_t mode)
+{
+    if(!openFile(flags))
+        return -1;
+    return getIndex()+Config::get()->getMaxFiles();
+}   // open
+
+// ----------------------------------------------------------------------------
+int ContainerFileObject::open64(int flags, mode_t mode)
+{
+    return open(flags, mode);
+}   // open64
+
+// ----------------------------------------------------------------------------
+int ContainerFileObject::__xstat(int ver, struct stat *buf)
+{
+    return statEntry(buf);
+}   // __xstat
+
+// ----------------------------------------------------------------------------
+int ContainerFileObject::__lxstat(int ver, struct stat *buf)
+{
+    return statEntry(buf);
+}   // __lxstat
+
+// ----------------------------------------------------------------------------
+int ContainerFileObject::__fxstat(int ver, struct stat *buf)
+{
+    if(!m_archive)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    return statEntry(buf);
+}   // __fxstat
+
+// ----------------------------------------------------------------------------
+int ContainerFileObject::__fxstat64(int ver, struct stat64 *buf)
+{
+    if(!m_archive)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    return statEntry(buf);
+}   // __fxstat64
+
+// ----------------------------------------------------------------------------
+off_t ContainerFileObject::lseek(off_t offset, int whence)
+{
+    return seek(offset, whence);
+}   // lseek
+
+// ----------------------------------------------------------------------------
+off64_t ContainerFileObject::lseek64(off64_t offset, int whence)
+{
+    return seek(offset, whence);
+}   // lseek64
+
+// ----------------------------------------------------------------------------
+ssize_t ContainerFileObject::write(const void *buf, size_t nbyte)
+{
+    return writeData(buf, nbyte);
+}   // write
+
+// ----------------------------------------------------------------------------
+ssize_t ContainerFileObject::read(void *buf, size_t count)
+{
+    return readData(buf, count);
+}   // read
+
+// ----------------------------------------------------------------------------
+int ContainerFileObject::close()
+{
+    return closeFile();
+}   // close
+
+// ----------------------------------------------------------------------------
+/** Writes the buffered data of all open files with the given name, so that
+ *  it is not written under the old name after a rename or remove. The lock
+ *  must be held.
+ */
+void ContainerFileObject::flushFile(const std::string &name)
+{
+    std::set<ContainerFileObject*>::iterator i;
+    for(i=m_open_files.begin(); i!=m_open_files.end(); i++)
+    {
+        if((*i)->getFilename()==name)
+            (*i)->flushPending();
+    }
+}   // flushFile
+
+// ----------------------------------------------------------------------------
+/** Renames a file in the container, replacing an existing file with the new
+ *  name. Files that are not in the container are renamed on disk.
+ */
+int ContainerFileObject::rename(const char *newpath)
+{
+    m_containers.lock();
+    ContainerArchive *archive = getArchive(m_container_path);
+    if(!archive || !archive->find(getFilename()))
+    {
+        m_containers.unlock();
+        return OS::rename(getFilename().c_str(), newpath);
+    }
+    flushFile(getFilename());
+    bool ok = getFilename()==newpath ||
+              archive->rename(getFilename(), newpath);
+    m_containers.unlock();
+    return ok ? 0 : -1;
+}   // rename
+
+// ----------------------------------------------------------------------------
+/** Removes a file from the container. Files that are not in the container
+ *  are removed on disk.
+ */
+int ContainerFileObject::unlink()
+{
+    m_containers.lock();
+    ContainerArchive *archive = getArchive(m_container_path);
+    if(!archive || !archive->find(getFilename()))
+    {
+        m_containers.unlock();
+        return OS::unlink(getFilename().c_str());
+    }
+    flushFile(getFilename());
+    bool ok = archive->remove(getFilename());
+    m_containers.unlock();
+    return ok ? 0 : -1;
+}   // unlink
+
+}   // namespace ALIO
@@ -0,0 +1,137 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef HEADER_CONTAINER_FILE_OBJECT_HPP
+#define HEADER_CONTAINER_FILE_OBJECT_HPP
+
+#include "client/base_file_object.hpp"
+#include "tools/container_archive.hpp"
+#include "tools/synchronised.hpp"
+
+#include <map>
+#include <set>
+#include <string>
+
+namespace ALIO
+{
+
+/** A file object that stores many small files in one shared container file
+ *  (<io type="container" container="path" .../>), so that a job creating
+ *  thousands of files only creates, opens and closes one file on the file
+ *  system. Each file is stored as a sequence of data segments in the
+ *  container (see ContainerArchive); open, read, write, stat, rename and
+ *  unlink operate on the index of the container in memory. The container
+ *  is opened and its index read once per process, when the first file is
+ *  opened. Writes are collected in a buffer per file (buffer-size, default
+ *  1M) and appended as one segment when the buffer is full, when a write
+ *  is not contiguous, and on read, seek, flush and close. Files that are
+ *  not in the container can not be opened for reading; rename and unlink
+ *  of such files are done on disk. The tool unpack lists or extracts the
+ *  files of a container. Only one process may write to a container.
+ */
+class ContainerFileObject : public BaseFileObject
+{
+private:
+    /** All containers by path. The lock protects all containers and
+     *  m_open_files. */
+    static Synchronised< std::map<std::string, ContainerArchive*> >
+                                         m_containers;
+
+    /** All open files, so they can be flushed at exit. */
+    static std::set<ContainerFileObject*> m_open_files;
+
+    /** Path of the container and size of the write buffer. */
+    std::string       m_container_path;
+    size_t            m_buffer_size;
+
+    /** The container while the file is open. */
+    ContainerArchive *m_archive;
+
+    /** Data not yet written to the container, which belongs at
+     *  m_pending_offset in the file. */
+    char             *m_pending;
+    size_t            m_pending_fill;
+    off64_t           m_pending_offset;
+
+    off64_t           m_position;
+    bool              m_readable;
+    bool              m_writable;
+    bool              m_append;
+    bool              m_eof;
+    bool              m_error;
+
+    static bool modeToFlags(const char *mode, int *flags);
+    static ContainerArchive *getArchive(const std::string &path);
+    static void flushFile(const std::string &name);
+
+    bool    openFile(int flags);
+    int     closeFile();
+    bool    flushPending();
+    off64_t getSize();
+    ssize_t writeData(const void *buf, size_t n);
+    ssize_t readData(void *buf, size_t n);
+    off64_t seek(off64_t offset, int whence);
+    template<typename T> int statEntry(T *buf);
+
+public:
+    static int init();
+    static int atExit();
+
+             ContainerFileObject(const XMLNode *info);
+    virtual ~ContainerFileObject();
+
+    virtual FILE   *fopen(const char *mode);
+    virtual FILE   *fopen64(const char *mode);
+    virtual int     fseek(long offset, int whence);
+    virtual int     fseeko(off_t offset, int whence);
+    virtual int     fseeko64(off64_t offset, int whence);
+    virtual long    ftell();
+    virtual off_t   ftello();
+    virtual off64_t ftello64();
+    virtual int     fflush();
+    virtual size_t  fwrite(const void *ptr, size_t size, size_t nmemb);
+    virtual size_t  fread(void *ptr, size_t size, size_t nmemb);
+    virtual char   *fgets(char *s, int size);
+    virtual int     fclose();
+    virtual int     open(int flags, mode_t mode);
+    virtual int     open64(int flags, mode_t mode);
+    virtual int     __xstat(int ver, struct stat *buf);
+    virtual int     __fxstat(int ver, struct stat *buf);
+    virtual int     __fxstat64(int ver, struct stat64 *buf);
+    virtual int     __lxstat(int ver, struct stat *buf);
+    virtual off_t   lseek(off_t offset, int whence);
+    virtual off64_t lseek64(off64_t offset, int whence);
+    virtual ssize_t write(const void *buf, size_t nbyte);
+    virtual ssize_t read(void *buf, size_t count);
+    virtual int     close();
+    virtual int     rename(const char *newpath);
+    virtual int     unlink();
+
+    // ------------------------------------------------------------------------
+    virtual int     setvbuf(char *buf, int mode, size_t size) { return 0; }
+    // ------------------------------------------------------------------------
+    virtual int     ferror() { return m_error ? 1 : 0; }
+    // ------------------------------------------------------------------------
+    virtual int     feof() { return m_eof ? 1 : 0; }
+    // ------------------------------------------------------------------------
+    /** There is no OS file descriptor, so the ALIO descriptor is returned.*/
+    virtual int     fileno();
+};   // ContainerFileObject
+
+}   // namespace ALIO
+#endif
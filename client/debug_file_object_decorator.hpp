@@ -560,6 +560,16 @@ public:
         return result;
     }
 
+// ------------------------------------------------------------------------
+    virtual int unlink()
+    {
+        bool enable = m_enable & DO_MISC;
+        if(enable) header("unlink()");
+        int result = I_FileObjectDecorator::unlink();
+        if(enable) log(" = %d\n", result);
+        return result;
+    }
+
 // ------------------------------------------------------------------------
 
 };
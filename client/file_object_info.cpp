@@ -19,13 +19,20 @@
 #include "client/file_object_info.hpp"
 
 #include "client/buffered.hpp"
+#include "client/burst_buffer.hpp"
+#include "client/checkpoint.hpp"
+#include "client/compression_decorator.hpp"
+#include "client/container_file_object.hpp"
 #include "client/debug_file_object_decorator.hpp"
+#include "client/memory_file_object.hpp"
 #include "client/mirror.hpp"
 #include "client/null_file_object.hpp"
 #ifdef USE_MPI
 #include "client/remote.hpp"
 #endif
 #include "client/standard_file_object.hpp"
+#include "client/striped_file_object.hpp"
+#include "client/thread_buffer_decorator.hpp"
 #include "client/timer_file_object_decorator.hpp"
 
 #include "tools/string_utils.hpp"
@@ -53,6 +60,14 @@ int FileObjectInfo::init()
  */
 int FileObjectInfo::atExit()
 {
+    // Thread buffers must be merged before the file objects below them
+    // write their data. The same applies to compressed files, which are
+    // closed (writing their index) through the io type below them, so this
+    // must happen before e.g. the IO thread or MPI are shut down.
+    if(m_all_needed_types & IO_TYPE_THREAD_BUFFER)
+        ThreadBufferFileObjectDecorator::atExit();
+    if(m_all_needed_types & IO_TYPE_COMPRESS)
+        CompressionFileObjectDecorator::atExit();
     if(m_all_needed_types & IO_TYPE_STANDARD) StandardFileObject       ::atExit();
 #ifdef USE_MPI
     if(m_all_needed_types & IO_TYPE_REMOTE  ) Remote                   ::atExit();
@@ -62,6 +77,11 @@ int FileObjectInfo::atExit()
     if(m_all_needed_types & IO_TYPE_TIMER   ) TimerFileObjectDecorator ::atExit();
     if(m_all_needed_types & IO_TYPE_DEBUG   ) DebugFileObjectDecorator ::atExit();
     if(m_all_needed_types & IO_TYPE_BUFFERED) BufferedFileObject       ::atExit();
+    if(m_all_needed_types & IO_TYPE_BURST   ) BurstBufferFileObject    ::atExit();
+    if(m_all_needed_types & IO_TYPE_CHECKPOINT) CheckpointFileObject::atExit();
+    if(m_all_needed_types & IO_TYPE_MEMORY  ) MemoryFileObject         ::atExit();
+    if(m_all_needed_types & IO_TYPE_STRIPE  ) StripedFileObject        ::atExit();
+    if(m_all_needed_types & IO_TYPE_CONTAINER) ContainerFileObject     ::atExit();
     return 0;
 }   // atExit
 
@@ -80,6 +100,14 @@ int FileObjectInfo::callAllStaticInitFunctions()
     if(m_all_needed_types & IO_TYPE_TIMER   ) TimerFileObjectDecorator ::init();
     if(m_all_needed_types & IO_TYPE_DEBUG   ) DebugFileObjectDecorator ::init();
     if(m_all_needed_types & IO_TYPE_BUFFERED) BufferedFileObject       ::init();
+    if(m_all_needed_types & IO_TYPE_BURST   ) BurstBufferFileObject    ::init();
+    if(m_all_needed_types & IO_TYPE_COMPRESS) CompressionFileObjectDecorator::init();
+    if(m_all_needed_types & IO_TYPE_CHECKPOINT) CheckpointFileObject::init();
+    if(m_all_needed_types & IO_TYPE_MEMORY  ) MemoryFileObject         ::init();
+    if(m_all_needed_types & IO_TYPE_STRIPE  ) StripedFileObject        ::init();
+    if(m_all_needed_types & IO_TYPE_CONTAINER) ContainerFileObject     ::init();
+    if(m_all_needed_types & IO_TYPE_THREAD_BUFFER)
+        ThreadBufferFileObjectDecorator::init();
     return 0;
 }   // callAllStaticInitFunctions
 
@@ -130,6 +158,31 @@ FileObjectInfo::FileObjectInfo(const XMLNode *node)
         m_io_types.push_back(IO_TYPE_BUFFERED);
         m_all_needed_types |= IO_TYPE_BUFFERED;
     }
+    else if(s=="burst")
+    {
+        m_io_types.push_back(IO_TYPE_BURST);
+        m_all_needed_types |= IO_TYPE_BURST;
+    }
+    else if(s=="checkpoint")
+    {
+        m_io_types.push_back(IO_TYPE_CHECKPOINT);
+        m_all_needed_types |= IO_TYPE_CHECKPOINT;
+    }
+    else if(s=="memory")
+    {
+        m_io_types.push_back(IO_TYPE_MEMORY);
+        m_all_needed_types |= IO_TYPE_MEMORY;
+    }
+    else if(s=="stripe")
+    {
+        m_io_types.push_back(IO_TYPE_STRIPE);
+        m_all_needed_types |= IO_TYPE_STRIPE;
+    }
+    else if(s=="container")
+    {
+        m_io_types.push_back(IO_TYPE_CONTAINER);
+        m_all_needed_types |= IO_TYPE_CONTAINER;
+    }
     else
     {
         printf("Invalid io '%s' for pattern '%s'- using standard.\n", 
@@ -172,6 +225,16 @@ FileObjectInfo::FileObjectInfo(const XMLNode *node)
             m_io_types.push_back(IO_TYPE_DEBUG);
             m_all_needed_types |= IO_TYPE_DEBUG;
         }
+        else if(decorator=="compress")
+        {
+            m_io_types.push_back(IO_TYPE_COMPRESS);
+            m_all_needed_types |= IO_TYPE_COMPRESS;
+        }
+        else if(decorator=="thread-buffer")
+        {
+            m_io_types.push_back(IO_TYPE_THREAD_BUFFER);
+            m_all_needed_types |= IO_TYPE_THREAD_BUFFER;
+        }
         else
         {
             printf("Invalid config entry '%s' found - aborting.\n",
@@ -212,6 +275,15 @@ I_FileObject *FileObjectInfo::createFileObject(const std::string &filename) cons
     case IO_TYPE_REMOTE   : fo = new Remote(m_io_xml_info[0]);             break;
 #endif
     case IO_TYPE_BUFFERED : fo = new BufferedFileObject(m_io_xml_info[0]); break;
+    case IO_TYPE_BURST    : fo = new BurstBufferFileObject(m_io_xml_info[0]); break;
+    case IO_TYPE_CHECKPOINT:
+        fo = new CheckpointFileObject(m_io_xml_info[0]);
+        break;
+    case IO_TYPE_MEMORY   : fo = new MemoryFileObject(m_io_xml_info[0]);   break;
+    case IO_TYPE_STRIPE   : fo = new StripedFileObject(m_io_xml_info[0]);  break;
+    case IO_TYPE_CONTAINER:
+        fo = new ContainerFileObject(m_io_xml_info[0]);
+        break;
     default:
         printf("No final first type found - this shouldn't happen.\n");
         exit(-1);
@@ -228,6 +300,12 @@ I_FileObject *FileObjectInfo::createFileObject(const std::string &filename) cons
             fo = new DebugFileObjectDecorator(fo, m_io_xml_info[i]); break;
         case IO_TYPE_MIRROR : 
             fo = new MirrorFileObjectDecorator(fo, m_io_xml_info[i]); break;
+        case IO_TYPE_COMPRESS :
+            fo = new CompressionFileObjectDecorator(fo, m_io_xml_info[i]);
+            break;
+        case IO_TYPE_THREAD_BUFFER :
+            fo = new ThreadBufferFileObjectDecorator(fo, m_io_xml_info[i]);
+            break;
         default:
             printf("Incorrect decorator found - ignored.\n");
         }
@@ -48,7 +48,14 @@ private:
             IO_TYPE_DEBUG    = 0x008,     /** Decorator: print debug info.*/
             IO_TYPE_MIRROR   = 0x010,     /** Decorator: mirroring. */
             IO_TYPE_TIMER    = 0x020,     /** Decorator: Collect timing information. */
-            IO_TYPE_BUFFERED = 0x040      /** Decorator: use memory as buffer. */
+            IO_TYPE_BUFFERED = 0x040,     /** Decorator: use memory as buffer. */
+            IO_TYPE_BURST    = 0x080,     /** Stage files in a local directory. */
+            IO_TYPE_COMPRESS = 0x100,     /** Decorator: compress blocks. */
+            IO_TYPE_CHECKPOINT = 0x200,   /** Only write changed blocks. */
+            IO_TYPE_THREAD_BUFFER = 0x400,/** Decorator: per-thread buffers. */
+            IO_TYPE_MEMORY   = 0x800,     /** Keep files in memory. */
+            IO_TYPE_STRIPE   = 0x1000,    /** Stripe over several files. */
+            IO_TYPE_CONTAINER= 0x2000     /** Many files in one container. */
     } IOType; 
 
     /** The original string for the regex, only to make debugging easier. */
@@ -86,6 +86,7 @@ public:
     virtual ssize_t read(void *buf, size_t count) = 0;
     virtual int     close() = 0;
     virtual int     rename(const char *newpath) = 0;
+    virtual int     unlink() = 0;
 };   // IFileObject
 
 }   // namespace ALIO
@@ -171,6 +171,8 @@ public:
     {
         return m_parent->rename(newpath);
     }
+    // ------------------------------------------------------------------------
+    virtual int unlink() { return m_parent->unlink(); }
 
 };   // IFileObject
 
@@ -46,7 +46,9 @@ extern "C" void __attribute__((constructor)) my_init(void)
 // ============================================================================
 /** The destructor, called when unloading this shared library.
  *  It destroys the config object, which in turn will all all
- *  static atExit functions of all file objects.
+ *  static atExit functions of all file objects. This writes all cached
+ *  data and waits for all asynchronous closes, so no data is lost if the
+ *  application exits while files are still being closed.
  */
 
 extern "C" void __attribute__((destructor)) my_exit(void)
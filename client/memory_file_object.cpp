@@ -0,0 +1,780 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "client/memory_file_object.hpp"
+
+#include "client/config.hpp"
+#include "tools/buffer_arena.hpp"
+#include "tools/os.hpp"
+#include "tools/string_utils.hpp"
+#include "xml/xml_node.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace ALIO
+{
+
+Synchronised< std::map<std::string, MemoryFileObject::File*> >
+                                      MemoryFileObject::m_files;
+std::list<MemoryFileObject::Extent*>  MemoryFileObject::m_lru;
+bool                 MemoryFileObject::m_configured  = false;
+size_t               MemoryFileObject::m_extent_size = 1024*1024;
+off64_t              MemoryFileObject::m_limit       = 0;
+off64_t              MemoryFileObject::m_memory_used = 0;
+std::string          MemoryFileObject::m_spill_dir;
+int                  MemoryFileObject::m_spill_fd    = -1;
+off64_t              MemoryFileObject::m_spill_end   = 0;
+std::vector<off64_t> MemoryFileObject::m_free_slots;
+
+// ----------------------------------------------------------------------------
+int MemoryFileObject::init()
+{
+    return 0;
+}   // init
+
+// ----------------------------------------------------------------------------
+/** Closes the spill file (which was already removed). */
+int MemoryFileObject::atExit()
+{
+    m_files.lock();
+    if(m_spill_fd>=0)
+        OS::close(m_spill_fd);
+    m_spill_fd = -1;
+    m_files.unlock();
+    return 0;
+}   // atExit
+
+// ----------------------------------------------------------------------------
+/** Constructor. The first memory object reads the store settings (limit,
+ *  extent-size and spill-dir) from its io node.
+ */
+MemoryFileObject::MemoryFileObject(const XMLNode *info)
+                : BaseFileObject(info)
+{
+    m_file     = NULL;
+    m_position = 0;
+    m_readable = false;
+    m_writable = false;
+    m_append   = false;
+    m_eof      = false;
+    m_error    = false;
+
+    m_files.lock();
+    if(!m_configured)
+    {
+        m_configured = true;
+        std::string s;
+        int64_t size;
+        if(info->get("extent-size", &s))
+        {
+            if(StringUtils::parseSize(s, &size) && size>=4096 &&
+               size<=256*1024*1024)
+                m_extent_size = size;
+            else
+                printf("Invalid extent-size '%s' - using 1M.\n", s.c_str());
+        }
+        if(info->get("limit", &s))
+        {
+            if(StringUtils::parseSize(s, &size) && size>=0)
+                m_limit = size;
+            else
+                printf("Invalid memory limit '%s' - ignored.\n", s.c_str());
+        }
+        info->get("spill-dir", &m_spill_dir);
+        if(m_limit>0 && m_spill_dir.empty())
+            printf("Memory limit without spill-dir - the limit is "
+                   "ignored.\n");
+    }
+    m_files.unlock();
+}   // MemoryFileObject
+
+// ----------------------------------------------------------------------------
+MemoryFileObject::~MemoryFileObject()
+{
+    if(m_file)
+        closeFile();
+}   // ~MemoryFileObject
+
+// ----------------------------------------------------------------------------
+/** Converts an fopen mode to open flags.
+ *  \return False (and sets errno) if the mode is invalid.
+ */
+bool MemoryFileObject::modeToFlags(const char *mode, int *flags)
+{
+    switch(mode[0])
+    {
+    case 'r': *flags = O_RDONLY;                   break;
+    case 'w': *flags = O_WRONLY|O_CREAT|O_TRUNC;   break;
+    case 'a': *flags = O_WRONLY|O_CREAT|O_APPEND;  break;
+    default:
+        errno = EINVAL;
+        return false;
+    }
+    if(strchr(mode, '+'))
+        *flags = (*flags & ~O_ACCMODE) | O_RDWR;
+    if(strchr(mode, 'x'))
+        *flags |= O_EXCL;
+    return true;
+}   // modeToFlags
+
+// ----------------------------------------------------------------------------
+/** Returns the file with the given name, or NULL. The lock must be held. */
+MemoryFileObject::File *MemoryFileObject::findFile(const std::string &name)
+{
+    std::map<std::string, File*> &files = m_files.getData();
+    std::map<std::string, File*>::iterator i = files.find(name);
+    return i==files.end() ? NULL : i->second;
+}   // findFile
+
+// ----------------------------------------------------------------------------
+/** Frees all extents of a file and the file itself. The lock must be held.
+ */
+void MemoryFileObject::freeFile(File *file)
+{
+    truncate(file, 0);
+    delete file;
+}   // freeFile
+
+// ----------------------------------------------------------------------------
+/** Changes the size of a file. Extents after the end are freed, and the
+ *  rest of the last extent is cleared, so that it reads as zeros if the
+ *  file grows again. The lock must be held.
+ */
+void MemoryFileObject::truncate(File *file, off64_t size)
+{
+    off64_t first_free = (size+m_extent_size-1)/m_extent_size;
+    std::map<off64_t, Extent*>::iterator i =
+        file->m_extents.lower_bound(first_free);
+    while(i!=file->m_extents.end())
+    {
+        Extent *extent = i->second;
+        if(extent->m_data)
+        {
+            BufferArena::free(extent->m_data);
+            m_lru.erase(extent->m_lru);
+            m_memory_used -= m_extent_size;
+        }
+        if(extent->m_slot>=0)
+            m_free_slots.push_back(extent->m_slot);
+        delete extent;
+        file->m_extents.erase(i++);
+    }
+    size_t tail = size % m_extent_size;
+    if(tail>0 && size<file->m_size)
+    {
+        i = file->m_extents.find(size/m_extent_size);
+        if(i!=file->m_extents.end() && makeResident(i->second))
+            memset(i->second->m_data+tail, 0, m_extent_size-tail);
+    }
+    file->m_size  = size;
+    file->m_mtime = time(NULL);
+}   // truncate
+
+// ----------------------------------------------------------------------------
+/** Makes sure that an extent is in memory, reading it back from the spill
+ *  file if necessary, and marks it as most recently used. The lock must be
+ *  held.
+ *  \return False (and sets errno) if the extent can not be loaded.
+ */
+bool MemoryFileObject::makeResident(Extent *extent)
+{
+    if(extent->m_data)
+    {
+        m_lru.splice(m_lru.begin(), m_lru, extent->m_lru);
+        return true;
+    }
+    char *data = BufferArena::allocate(m_extent_size);
+    if(!data)
+    {
+        errno = ENOMEM;
+        return false;
+    }
+    if(extent->m_slot<0)
+        memset(data, 0, m_extent_size);
+    else
+    {
+        size_t done = 0;
+        while(done<m_extent_size)
+        {
+            ssize_t n = ::pread64(m_spill_fd, data+done, m_extent_size-done,
+                                  extent->m_slot+done);
+            if(n<0 && errno==EINTR) continue;
+            if(n<=0)
+            {
+                if(n==0) errno = EIO;
+                BufferArena::free(data);
+                return false;
+            }
+            done += n;
+        }
+    }
+    extent->m_data = data;
+    m_lru.push_front(extent);
+    extent->m_lru  = m_lru.begin();
+    m_memory_used += m_extent_size;
+    enforceLimit(extent);
+    return true;
+}   // makeResident
+
+// ----------------------------------------------------------------------------
+/** Writes an extent to the spill file and frees its memory. The spill
+ *  file is created when it is first needed. The lock must be held.
+ *  \return False if the extent can not be spilled.
+ */
+bool MemoryFileObject::spill(Extent *extent)
+{
+    if(m_spill_fd<0)
+    {
+        if(m_spill_dir.empty())
+            return false;
+        std::string path = m_spill_dir+"/alio-memory-XXXXXX";
+        std::vector<char> name(path.begin(), path.end());
+        name.push_back(0);
+        m_spill_fd = mkstemp(&name[0]);
+        if(m_spill_fd<0)
+        {
+            printf("Can not create spill file in '%s': %s - memory limit "
+                   "ignored.\n", m_spill_dir.c_str(), strerror(errno));
+            m_spill_dir.clear();
+            return false;
+        }
+        OS::unlink(&name[0]);
+    }
+    if(extent->m_slot<0)
+    {
+        if(m_free_slots.empty())
+        {
+            extent->m_slot = m_spill_end;
+            m_spill_end   += m_extent_size;
+        }
+        else
+        {
+            extent->m_slot = m_free_slots.back();
+            m_free_slots.pop_back();
+        }
+    }
+    size_t done = 0;
+    while(done<m_extent_size)
+    {
+        ssize_t n = ::pwrite64(m_spill_fd, extent->m_data+done,
+                               m_extent_size-done, extent->m_slot+done);
+        if(n<0 && errno==EINTR) continue;
+        if(n<=0)
+        {
+            printf("Can not write to spill file: %s.\n", strerror(errno));
+            return false;
+        }
+        done += n;
+    }
+    BufferArena::free(extent->m_data);
+    extent->m_data = NULL;
+    m_lru.erase(extent->m_lru);
+    m_memory_used -= m_extent_size;
+    return true;
+}   // spill
+
+// ----------------------------------------------------------------------------
+/** Spills the least recently used extents till the memory used is below
+ *  the limit.
+ *  \param keep An extent that is about to be used and must stay in memory.
+ */
+void MemoryFileObject::enforceLimit(Extent *keep)
+{
+    if(m_limit==0)
+        return;
+    while(m_memory_used>m_limit && !m_lru.empty())
+    {
+        Extent *extent = m_lru.back();
+        if(extent==keep || !spill(extent))
+            break;
+    }
+}   // enforceLimit
+
+// ----------------------------------------------------------------------------
+/** Opens the file in the store, creating or truncating it depending on
+ *  the flags.
+ *  \return False (and sets errno) if the file can not be opened.
+ */
+bool MemoryFileObject::openFile(int flags)
+{
+    int access = flags & O_ACCMODE;
+    m_files.lock();
+    File *file = findFile(getFilename());
+    if(!file)
+    {
+        if(!(flags & O_CREAT))
+        {
+            m_files.unlock();
+            errno = ENOENT;
+            return false;
+        }
+        file             = new File();
+        file->m_size     = 0;
+        file->m_open     = 0;
+        file->m_unlinked = false;
+        file->m_mtime    = time(NULL);
+        m_files.getData()[getFilename()] = file;
+    }
+    else if((flags & (O_CREAT|O_EXCL))==(O_CREAT|O_EXCL))
+    {
+        m_files.unlock();
+        errno = EEXIST;
+        return false;
+    }
+    else if((flags & O_TRUNC) && access!=O_RDONLY)
+        truncate(file, 0);
+    file->m_open++;
+    m_files.unlock();
+
+    m_file     = file;
+    m_position = 0;
+    m_readable = access!=O_WRONLY;
+    m_writable = access!=O_RDONLY;
+    m_append   = (flags & O_APPEND)!=0;
+    m_eof      = false;
+    m_error    = false;
+    return true;
+}   // openFile
+
+// ----------------------------------------------------------------------------
+/** Closes the file. A file that was removed while open is freed now. */
+int MemoryFileObject::closeFile()
+{
+    if(!m_file)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    m_files.lock();
+    m_file->m_open--;
+    if(m_file->m_open==0 && m_file->m_unlinked)
+        freeFile(m_file);
+    m_files.unlock();
+    m_file = NULL;
+    return 0;
+}   // closeFile
+
+// ----------------------------------------------------------------------------
+/** Copies data into the extents of the file.
+ *  \return The number of bytes written, or -1 (and errno set).
+ */
+ssize_t MemoryFileObject::writeData(const void *buf, size_t n)
+{
+    if(!m_file || !m_writable)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    const char *p = (const char*)buf;
+    size_t done = 0;
+    m_files.lock();
+    if(m_append)
+        m_position = m_file->m_size;
+    while(done<n)
+    {
+        off64_t index  = m_position / m_extent_size;
+        size_t  offset = m_position % m_extent_size;
+        size_t  count  = m_extent_size-offset;
+        if(count>n-done)
+            count = n-done;
+        Extent *&extent = m_file->m_extents[index];
+        if(!extent)
+        {
+            extent         = new Extent();
+            extent->m_data = NULL;
+            extent->m_slot = -1;
+        }
+        if(!makeResident(extent))
+            break;
+        memcpy(extent->m_data+offset, p+done, count);
+        done       += count;
+        m_position += count;
+    }
+    if(m_position>m_file->m_size)
+        m_file->m_size = m_position;
+    m_file->m_mtime = time(NULL);
+    m_files.unlock();
+    return done>0 || n==0 ? (ssize_t)done : -1;
+}   // writeData
+
+// ----------------------------------------------------------------------------
+/** Copies data from the extents of the file; holes read as zeros.
+ *  \return The number of bytes read, or -1 (and errno set).
+ */
+ssize_t MemoryFileObject::readData(void *buf, size_t n)
+{
+    if(!m_file || !m_readable)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    char *p = (char*)buf;
+    size_t done = 0;
+    m_files.lock();
+    if(m_position>=m_file->m_size)
+        n = 0;
+    else if((off64_t)n>m_file->m_size-m_position)
+        n = m_file->m_size-m_position;
+    while(done<n)
+    {
+        off64_t index  = m_position / m_extent_size;
+        size_t  offset = m_position % m_extent_size;
+        size_t  count  = m_extent_size-offset;
+        if(count>n-done)
+            count = n-done;
+        std::map<off64_t, Extent*>::iterator i =
+            m_file->m_extents.find(index);
+        if(i==m_file->m_extents.end())
+            memset(p+done, 0, count);
+        else if(makeResident(i->second))
+            memcpy(p+done, i->second->m_data+offset, count);
+        else
+            break;
+        done       += count;
+        m_position += count;
+    }
+    m_files.unlock();
+    return done>0 || n==0 ? (ssize_t)done : -1;
+}   // readData
+
+// ----------------------------------------------------------------------------
+/** Changes the position.
+ *  \return The new position, or -1 (and errno set).
+ */
+off64_t MemoryFileObject::seek(off64_t offset, int whence)
+{
+    if(!m_file)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    off64_t base;
+    switch(whence)
+    {
+    case SEEK_SET: base = 0;          break;
+    case SEEK_CUR: base = m_position; break;
+    case SEEK_END:
+        m_files.lock();
+        base = m_file->m_size;
+        m_files.unlock();
+        break;
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+    if(base+offset<0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    m_position = base+offset;
+    m_eof      = false;
+    return m_position;
+}   // seek
+
+// ----------------------------------------------------------------------------
+/** Fills a stat structure for a file. The lock must be held. */
+template<typename T>
+int MemoryFileObject::statFile(const File *file, T *buf)
+{
+    memset(buf, 0, sizeof(T));
+    buf->st_mode    = S_IFREG | 0644;
+    buf->st_nlink   = file->m_unlinked ? 0 : 1;
+    buf->st_uid     = getuid();
+    buf->st_gid     = getgid();
+    buf->st_size    = file->m_size;
+    buf->st_blksize = m_extent_size;
+    buf->st_blocks  = file->m_extents.size()*(m_extent_size/512);
+    buf->st_atime   = file->m_mtime;
+    buf->st_mtime   = file->m_mtime;
+    buf->st_ctime   = file->m_mtime;
+    return 0;
+}   // statFile
+
+// ----------------------------------------------------------------------------
+/** Stats the file with the name of this object. */
+template<typename T>
+int MemoryFileObject::statName(T *buf)
+{
+    m_files.lock();
+    File *file = findFile(getFilename());
+    int result = -1;
+    if(file)
+        result = statFile(file, buf);
+    else
+        errno = ENOENT;
+    m_files.unlock();
+    return result;
+}   // statName
+
+// ----------------------------------------------------------------------------
+FILE *MemoryFileObject::fopen(const char *mode)
+{
+    int flags;
+    if(!modeToFlags(mode, &flags) || !openFile(flags))
+        return NULL;
+    return (FILE*)this;
+}   // fopen
+
+// ----------------------------------------------------------------------------
+FILE *MemoryFileObject::fopen64(const char *mode)
+{
+    return fopen(mode);
+}   // fopen64
+
+// ----------------------------------------------------------------------------
+int MemoryFileObject::fseek(long offset, int whence)
+{
+    return seek(offset, whence)<0 ? -1 : 0;
+}   // fseek
+
+// ----------------------------------------------------------------------------
+int MemoryFileObject::fseeko(off_t offset, int whence)
+{
+    return seek(offset, whence)<0 ? -1 : 0;
+}   // fseeko
+
+// ----------------------------------------------------------------------------
+int MemoryFileObject::fseeko64(off64_t offset, int whence)
+{
+    return seek(offset, whence)<0 ? -1 : 0;
+}   // fseeko64
+
+// ----------------------------------------------------------------------------
+long MemoryFileObject::ftell()
+{
+    return m_position;
+}   // ftell
+
+// ----------------------------------------------------------------------------
+off_t MemoryFileObject::ftello()
+{
+    return m_position;
+}   // ftello
+
+// ----------------------------------------------------------------------------
+off64_t MemoryFileObject::ftello64()
+{
+    return m_position;
+}   // ftello64
+
+// ----------------------------------------------------------------------------
+int MemoryFileObject::fileno()
+{
+    return getIndex()+Config::get()->getMaxFiles();
+}   // fileno
+
+// ----------------------------------------------------------------------------
+size_t MemoryFileObject::fwrite(const void *ptr, size_t size, size_t nmemb)
+{
+    if(size==0 || nmemb==0)
+        return 0;
+    ssize_t n = writeData(ptr, size*nmemb);
+    if(n<(ssize_t)(size*nmemb))
+        m_error = true;
+    return n<0 ? 0 : n/size;
+}   // fwrite
+
+// ----------------------------------------------------------------------------
+size_t MemoryFileObject::fread(void *ptr, size_t size, size_t nmemb)
+{
+    if(size==0 || nmemb==0)
+        return 0;
+    ssize_t n = readData(ptr, size*nmemb);
+    if(n<0)
+    {
+        m_error = true;
+        return 0;
+    }
+    if(n<(ssize_t)(size*nmemb))
+        m_eof = true;
+    return n/size;
+}   // fread
+
+// ----------------------------------------------------------------------------
+char *MemoryFileObject::fgets(char *s, int size)
+{
+    if(size<=0)
+        return NULL;
+    int n = 0;
+    while(n<size-1)
+    {
+        ssize_t count = readData(s+n, 1);
+        if(count<=0)
+        {
+            if(count<0) m_error = true;
+            else        m_eof   = true;
+            break;
+        }
+        if(s[n++]=='\n')
+            break;
+    }
+    if(n==0)
+        return NULL;
+    s[n] = 0;
+    return s;
+}   // fgets
+
+// ----------------------------------------------------------------------------
+int MemoryFileObject::fclose()
+{
+    return closeFile()==0 ? 0 : EOF;
+}   // fclose
+
+// ----------------------------------------------------------------------------
+int MemoryFileObject::open(int flags, mode_t mode)
+{
+    if(!openFile(flags))
+        return -1;
+    return getIndex()+Config::get()->getMaxFiles();
+}   // open
+
+// ----------------------------------------------------------------------------
+int MemoryFileObject::open64(int flags, mode_t mode)
+{
+    return open(flags, mode);
+}   // open64
+
+// ----------------------------------------------------------------------------
+int MemoryFileObject::__xstat(int ver, struct stat *buf)
+{
+    return statName(buf);
+}   // __xstat
+
+// ----------------------------------------------------------------------------
+int MemoryFileObject::__lxstat(int ver, struct stat *buf)
+{
+    return statName(buf);
+}   // __lxstat
+
+// ----------------------------------------------------------------------------
+int MemoryFileObject::__fxstat(int ver, struct stat *buf)
+{
+    if(!m_file)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    m_files.lock();
+    int result = statFile(m_file, buf);
+    m_files.unlock();
+    return result;
+}   // __fxstat
+
+// ----------------------------------------------------------------------------
+int MemoryFileObject::__fxstat64(int ver, struct stat64 *buf)
+{
+    if(!m_file)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    m_files.lock();
+    int result = statFile(m_file, buf);
+    m_files.unlock();
+    return result;
+}   // __fxstat64
+
+// ----------------------------------------------------------------------------
+off_t MemoryFileObject::lseek(off_t offset, int whence)
+{
+    return seek(offset, whence);
+}   // lseek
+
+// ----------------------------------------------------------------------------
+off64_t MemoryFileObject::lseek64(off64_t offset, int whence)
+{
+    return seek(offset, whence);
+}   // lseek64
+
+// ----------------------------------------------------------------------------
+ssize_t MemoryFileObject::write(const void *buf, size_t nbyte)
+{
+    return writeData(buf, nbyte);
+}   // write
+
+// ----------------------------------------------------------------------------
+ssize_t MemoryFileObject::read(void *buf, size_t count)
+{
+    return readData(buf, count);
+}   // read
+
+// ----------------------------------------------------------------------------
+int MemoryFileObject::close()
+{
+    return closeFile();
+}   // close
+
+// ----------------------------------------------------------------------------
+/** Renames a file in the store, replacing an existing file with the new
+ *  name. Files that are not in the store are renamed on disk.
+ */
+int MemoryFileObject::rename(const char *newpath)
+{
+    m_files.lock();
+    std::map<std::string, File*> &files = m_files.getData();
+    File *file = findFile(getFilename());
+    if(!file)
+    {
+        m_files.unlock();
+        return OS::rename(getFilename().c_str(), newpath);
+    }
+    File *old = findFile(newpath);
+    if(old!=file)
+    {
+        if(old)
+        {
+            if(old->m_open==0)
+                freeFile(old);
+            else
+                old->m_unlinked = true;
+        }
+        files[newpath] = file;
+        files.erase(getFilename());
+    }
+    m_files.unlock();
+    return 0;
+}   // rename
+
+// ----------------------------------------------------------------------------
+/** Removes a file from the store and frees its memory (once it is no
+ *  longer open). Files that are not in the store are removed on disk.
+ */
+int MemoryFileObject::unlink()
+{
+    m_files.lock();
+    File *file = findFile(getFilename());
+    if(!file)
+    {
+        m_files.unlock();
+        return OS::unlink(getFilename().c_str());
+    }
+    m_files.getData().erase(getFilename());
+    if(file->m_open==0)
+        freeFile(file);
+    else
+        file->m_unlinked = true;
+    m_files.unlock();
+    return 0;
+}   // unlink
+
+}   // namespace ALIO
@@ -0,0 +1,164 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef HEADER_MEMORY_FILE_OBJECT_HPP
+#define HEADER_MEMORY_FILE_OBJECT_HPP
+
+#include "client/base_file_object.hpp"
+#include "tools/synchronised.hpp"
+
+#include <list>
+#include <map>
+#include <string>
+#include <time.h>
+#include <vector>
+
+namespace ALIO
+{
+
+/** A file object that keeps the file in memory (<io type="memory" .../>),
+ *  intended for scratch files that are reread by the same process and then
+ *  deleted. The content is stored in extents (extent-size, default 1M);
+ *  extents that were never written are holes and read as zeros. All
+ *  memory files of the process share one store, so a file written and
+ *  closed can be opened again, renamed, and removed with unlink, which
+ *  frees its memory without any disk IO.
+ *  If the memory used exceeds limit (default: no limit), the least
+ *  recently used extents are spilled to a scratch file in spill-dir, and
+ *  read back when they are accessed again. The scratch file is removed as
+ *  soon as it is created, so it disappears when the process ends. limit,
+ *  extent-size and spill-dir are taken from the first memory io node
+ *  used. Files that are not in the store can not be opened for reading.
+ */
+class MemoryFileObject : public BaseFileObject
+{
+private:
+    /** One extent of a file. */
+    struct Extent
+    {
+        /** The data, NULL if the extent is spilled. */
+        char    *m_data;
+        /** Position in the spill file, or -1 if it was never spilled. */
+        off64_t  m_slot;
+        /** Position in m_lru if the extent is in memory. */
+        std::list<Extent*>::iterator m_lru;
+    };   // Extent
+
+    /** A file in the store. */
+    struct File
+    {
+        /** The extents, indexed by offset/extent size. */
+        std::map<off64_t, Extent*> m_extents;
+        off64_t  m_size;
+        /** Number of objects that have the file open. */
+        int      m_open;
+        /** True if the file was removed while it was open. */
+        bool     m_unlinked;
+        time_t   m_mtime;
+    };   // File
+
+    /** All files by name. The lock protects all static data. */
+    static Synchronised< std::map<std::string, File*> > m_files;
+
+    /** All extents in memory, most recently used first. */
+    static std::list<Extent*> m_lru;
+
+    static bool        m_configured;
+    static size_t      m_extent_size;
+    static off64_t     m_limit;
+    static off64_t     m_memory_used;
+    static std::string m_spill_dir;
+
+    /** The spill file, and its unused slots. */
+    static int         m_spill_fd;
+    static off64_t     m_spill_end;
+    static std::vector<off64_t> m_free_slots;
+
+    /** The file while it is open. */
+    File    *m_file;
+    off64_t  m_position;
+    bool     m_readable;
+    bool     m_writable;
+    bool     m_append;
+    bool     m_eof;
+    bool     m_error;
+
+    static bool  modeToFlags(const char *mode, int *flags);
+    static void  freeFile(File *file);
+    static void  truncate(File *file, off64_t size);
+    static bool  makeResident(Extent *extent);
+    static bool  spill(Extent *extent);
+    static void  enforceLimit(Extent *keep);
+    static File *findFile(const std::string &name);
+
+    bool    openFile(int flags);
+    int     closeFile();
+    ssize_t writeData(const void *buf, size_t n);
+    ssize_t readData(void *buf, size_t n);
+    off64_t seek(off64_t offset, int whence);
+    template<typename T> int statFile(const File *file, T *buf);
+    template<typename T> int statName(T *buf);
+
+public:
+    static int init();
+    static int atExit();
+
+             MemoryFileObject(const XMLNode *info);
+    virtual ~MemoryFileObject();
+
+    virtual FILE   *fopen(const char *mode);
+    virtual FILE   *fopen64(const char *mode);
+    virtual int     fseek(long offset, int whence);
+    virtual int     fseeko(off_t offset, int whence);
+    virtual int     fseeko64(off64_t offset, int whence);
+    virtual long    ftell();
+    virtual off_t   ftello();
+    virtual off64_t ftello64();
+    virtual size_t  fwrite(const void *ptr, size_t size, size_t nmemb);
+    virtual size_t  fread(void *ptr, size_t size, size_t nmemb);
+    virtual char   *fgets(char *s, int size);
+    virtual int     fclose();
+    virtual int     open(int flags, mode_t mode);
+    virtual int     open64(int flags, mode_t mode);
+    virtual int     __xstat(int ver, struct stat *buf);
+    virtual int     __fxstat(int ver, struct stat *buf);
+    virtual int     __fxstat64(int ver, struct stat64 *buf);
+    virtual int     __lxstat(int ver, struct stat *buf);
+    virtual off_t   lseek(off_t offset, int whence);
+    virtual off64_t lseek64(off64_t offset, int whence);
+    virtual ssize_t write(const void *buf, size_t nbyte);
+    virtual ssize_t read(void *buf, size_t count);
+    virtual int     close();
+    virtual int     rename(const char *newpath);
+    virtual int     unlink();
+
+    // ------------------------------------------------------------------------
+    virtual int     setvbuf(char *buf, int mode, size_t size) { return 0; }
+    // ------------------------------------------------------------------------
+    virtual int     fflush() { return 0; }
+    // ------------------------------------------------------------------------
+    virtual int     ferror() { return m_error ? 1 : 0; }
+    // ------------------------------------------------------------------------
+    virtual int     feof() { return m_eof ? 1 : 0; }
+    // ------------------------------------------------------------------------
+    /** There is no OS file descriptor, so the ALIO descriptor is returned.*/
+    virtual int     fileno();
+};   // MemoryFileObject
+
+}   // namespace ALIO
+#endif
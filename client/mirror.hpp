@@ -283,6 +283,12 @@ public:
         return result;
     }
     // ------------------------------------------------------------------------
+    virtual int unlink()
+    {
+        m_mirror->unlink();
+        return I_FileObjectDecorator::unlink();
+    }
+    // ------------------------------------------------------------------------
 
 };   // IFileObject
 
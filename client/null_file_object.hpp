@@ -102,6 +102,8 @@ public:
     virtual int close() { return 0; }
     // ------------------------------------------------------------------------
     virtual int rename(const char* newpath) {return 0;}
+    // ------------------------------------------------------------------------
+    virtual int unlink() { return 0; }
 };   // NullFileObject
 
 };   // namespace ALIO
@@ -20,10 +20,14 @@
 #include "client/remote.hpp"
 
 #include "client/config.hpp"
+#include "tools/buffer_arena.hpp"
 #include "tools/message.hpp"
+#include "tools/string_utils.hpp"
+#include "xml/xml_node.hpp"
 
 #include "mpi.h"
 
+#include <algorithm>
 #include <errno.h>
 
 namespace ALIO
@@ -31,6 +35,9 @@ namespace ALIO
 
 bool     Remote::m_connected = false;
 MPI_Comm Remote::m_intercomm;
+std::map<int, Remote*> Remote::m_writers;
+CompoundMessage       *Remote::m_batch = NULL;
+Remote::ReadAhead      Remote::m_read_ahead;
 
 /** Static init functions called once at startup.  Note that we CAN NOT call 
  *  Remote::connectToServer here: This would call MPI_Init, which in turns 
@@ -39,7 +46,8 @@ MPI_Comm Remote::m_intercomm;
  */
 int Remote::init()
 {
-    m_connected = false;
+    m_connected         = false;
+    m_read_ahead.m_file = NULL;
     return 0;
 }   // init
 
@@ -53,6 +61,22 @@ int Remote::atExit()
     MPI_Initialized(&flag);
     if(flag)
     {
+        // Wait for all writes, so that the server does not get a quit
+        // while writes are still queued.
+        if(m_read_ahead.m_file)
+            m_read_ahead.m_file->discardReadCache(/*rewind*/false);
+        flushBatch();
+        while(!m_writers.empty())
+            m_writers.begin()->second->drainWrites();
+
+        // Tell the server that this client exits (index -1), so that it
+        // closes all files of this client and disconnects as well.
+        Message_quit m(-1);
+        MPI_Send(m.getData(), m.getLen(), MPI_CHAR, 0, 1, m_intercomm);
+        MPI_Comm_disconnect(&m_intercomm);
+        m_connected = false;
+        delete m_batch;
+        m_batch = NULL;
         MPI_Finalize();
         printf("Disconnected.\n");
     }
@@ -73,10 +97,10 @@ int Remote::connectToServer()
     // -------------------------------------
     std::string config_dir = ALIO::OS::getConfigDir();
 
-    char buffer[256];
+    char port_name[MPI_MAX_PORT_NAME+1];
     FILE *port_file = ALIO::OS::fopen("server.dat", "r");
-    bzero(port_name, MPI_MAX_PORT_NAME);
-    ALIO::OS::fread(buffer, 1, 256, port_file);
+    bzero(port_name, MPI_MAX_PORT_NAME+1);
+    ALIO::OS::fread(port_name, 1, MPI_MAX_PORT_NAME, port_file);
     ALIO::OS::fclose(port_file);
 
     // No access to argc/argv here - so just make some fields up
@@ -94,6 +118,7 @@ int Remote::connectToServer()
     printf("Connected.\n");
 
     m_connected = true;
+    m_batch     = new CompoundMessage();
     return 0;
     
 }   // connectToServer
@@ -105,6 +130,53 @@ int Remote::connectToServer()
  */
 Remote::Remote(const XMLNode *info) : BaseFileObject(info)
 {
+    m_max_in_flight = 8;
+    m_in_flight     = 0;
+    m_write_error   = 0;
+    int32_t n;
+    if(info->get("in-flight", &n))
+    {
+        if(n>=1)
+            m_max_in_flight = n;
+        else
+            printf("Invalid in-flight '%d' - using 8.\n", n);
+    }
+    m_zero_copy_size = 64*1024;
+    std::string s;
+    if(info->get("zero-copy", &s))
+    {
+        int64_t size;
+        if(StringUtils::parseSize(s, &size) && size>=0)
+            m_zero_copy_size = size;
+        else
+            printf("Invalid zero-copy '%s' - using 64K.\n", s.c_str());
+    }
+    m_batch_size = 16*1024;
+    if(info->get("batch-size", &s))
+    {
+        int64_t size;
+        if(StringUtils::parseSize(s, &size) && size>=0)
+            m_batch_size = size;
+        else
+            printf("Invalid batch-size '%s' - using 16K.\n", s.c_str());
+    }
+    // The read cache and read-ahead are only used if enabled in the config.
+    m_read_block_size = 0;
+    if(info->get("read-cache", &s))
+    {
+        int64_t size;
+        if(StringUtils::parseSize(s, &size) && size>=0)
+            m_read_block_size = size;
+        else
+            printf("Invalid read-cache '%s' - disabled.\n", s.c_str());
+    }
+    m_read_ahead_enabled = false;
+    info->get("read-ahead", &m_read_ahead_enabled);
+    m_read_buffer  = NULL;
+    m_ahead_buffer = NULL;
+    m_read_pos     = 0;
+    m_read_end     = 0;
+    m_read_stream  = true;
     if(!m_connected)
         connectToServer();
 };   // Remote
@@ -114,25 +186,492 @@ Remote::~Remote()
 {
     if(m_connected)
     {
+        discardReadCache(/*rewind*/false);
         Message_quit m(getIndex());
-        MPI_Send(m.getData(), m.getLen(), MPI_CHAR, 0, 1, m_intercomm);
+        queueMessage(&m);
     }
+    BufferArena::free(m_read_buffer);
+    BufferArena::free(m_ahead_buffer);
 }   // ~Remote
 
+// ----------------------------------------------------------------------------
+/** Sends all batched requests as one compound frame. */
+void Remote::flushBatch()
+{
+    if(!m_batch || m_batch->empty())
+        return;
+    MPI_Send(m_batch->getData(), m_batch->getLen(), MPI_CHAR, 0, 1,
+             m_intercomm);
+    m_batch->clear();
+}   // flushBatch
+
+// ----------------------------------------------------------------------------
+/** Adds a request to the batch. If it does not fit anymore, the batch is
+ *  sent first.
+ *  \return False if the request can not be batched (it is bigger than
+ *          batch-size, or batching is disabled).
+ */
+bool Remote::addToBatch(Message *m)
+{
+    size_t space = CompoundMessage::getSpace(m);
+    if(m_batch->getLen()+space>m_batch_size)
+    {
+        flushBatch();
+        if(CompoundMessage::HEADER_SIZE+space>m_batch_size)
+            return false;
+    }
+    m_batch->add(m);
+    return true;
+}   // addToBatch
+
+// ----------------------------------------------------------------------------
+/** Sends a request that has no answer. It is batched if possible. */
+void Remote::queueMessage(Message *m)
+{
+    if(!addToBatch(m))
+        MPI_Send(m->getData(), m->getLen(), MPI_CHAR, 0, 1, m_intercomm);
+}   // queueMessage
+
+// ----------------------------------------------------------------------------
+/** Sends a request that the server answers. Batched requests are sent in
+ *  the same frame, in front of this request.
+ */
+void Remote::sendRequest(Message *m)
+{
+    if(!m_batch->empty() && addToBatch(m))
+    {
+        flushBatch();
+        return;
+    }
+    flushBatch();
+    MPI_Send(m->getData(), m->getLen(), MPI_CHAR, 0, 1, m_intercomm);
+}   // sendRequest
+
+// ----------------------------------------------------------------------------
+/** Receives one write acknowledgement (of any file) from the server, and
+ *  gives the credit back to the file.
+ */
+void Remote::receiveAck()
+{
+    char buffer[ReplyMessage::DATA_OFFSET];
+    MPI_Status status;
+    MPI_Recv(buffer, sizeof(buffer), MPI_CHAR, 0, ACK_TAG, m_intercomm,
+             &status);
+    int len;
+    MPI_Get_count(&status, MPI_CHAR, &len);
+    if(!Message::isValid(buffer, len))
+    {
+        printf("Invalid write acknowledgement - ignored.\n");
+        return;
+    }
+    ReplyMessage m(buffer, len);
+    std::map<int, Remote*>::iterator i = m_writers.find(m.getIndex());
+    if(i==m_writers.end())
+        return;
+    Remote *remote = i->second;
+    remote->m_in_flight--;
+    if(m.getResult()<0 && remote->m_write_error==0)
+        remote->m_write_error = m.getStatus() ? m.getStatus() : EIO;
+}   // receiveAck
+
+// ----------------------------------------------------------------------------
+/** Checks a received answer, which must be for the given request (same
+ *  request ID and type).
+ *  \param len Size of the whole answer.
+ *  \return The result of the request, errno is set if it failed (EPROTO
+ *          if the answer is not for the request).
+ */
+int64_t Remote::checkReply(uint32_t request_id, int type, const char *header,
+                           int len)
+{
+    if(!Message::isValid(header, len) || len<(int)ReplyMessage::DATA_OFFSET)
+    {
+        printf("Invalid answer for request %u.\n", request_id);
+        errno = EPROTO;
+        return -1;
+    }
+    ReplyMessage reply(header, ReplyMessage::DATA_OFFSET);
+    if(reply.getRequestId()!=request_id || reply.getType()!=type)
+    {
+        printf("Answer for request %u received instead of %u.\n",
+               reply.getRequestId(), request_id);
+        errno = EPROTO;
+        return -1;
+    }
+    if(reply.getStatus())
+        errno = reply.getStatus();
+    return reply.getResult();
+}   // checkReply
+
+// ----------------------------------------------------------------------------
+/** Receives the answer to a request. The data of the answer (if any) is
+ *  received directly into data.
+ *  \return The result of the request, errno is set if it failed.
+ */
+int64_t Remote::receiveReply(Message *request, void *data, size_t data_len)
+{
+    return receiveReply(request->getRequestId(), request->getType(), data,
+                        data_len);
+}   // receiveReply
+
+// ----------------------------------------------------------------------------
+/** Receives the answer to the request with the given ID and type. */
+int64_t Remote::receiveReply(uint32_t request_id, int type, void *data,
+                             size_t data_len)
+{
+    char header[ReplyMessage::DATA_OFFSET];
+    MPI_Status status;
+    int len;
+    if(data_len>0)
+    {
+        MPI_Datatype type;
+        createPartsType(header, sizeof(header), data, data_len, &type);
+        MPI_Recv(MPI_BOTTOM, 1, type, 0, 9, m_intercomm, &status);
+        MPI_Get_elements(&status, type, &len);
+        MPI_Type_free(&type);
+    }
+    else
+    {
+        MPI_Recv(header, sizeof(header), MPI_CHAR, 0, 9, m_intercomm,
+                 &status);
+        MPI_Get_count(&status, MPI_CHAR, &len);
+    }
+    return checkReply(request_id, type, header, len);
+}   // receiveReply
+
+// ----------------------------------------------------------------------------
+/** Requests n bytes from the current position of the file, with fread if
+ *  stream is true, otherwise with read.
+ *  \param read_ahead If true, the answer is sent with READ_AHEAD_TAG.
+ */
+void Remote::requestBlock(bool stream, size_t n, bool read_ahead,
+                          uint32_t *request_id, int *type)
+{
+    uint8_t flags = read_ahead ? Message::FLAG_READ_AHEAD : 0;
+    if(stream)
+    {
+        Message_fread m(getIndex(), (size_t)1, n);
+        m.setFlags(flags);
+        sendRequest(&m);
+        *request_id = m.getRequestId();
+        *type       = m.getType();
+    }
+    else
+    {
+        Message_read m(getIndex(), n);
+        m.setFlags(flags);
+        sendRequest(&m);
+        *request_id = m.getRequestId();
+        *type       = m.getType();
+    }
+}   // requestBlock
+
+// ----------------------------------------------------------------------------
+/** Reads the next block into the (empty) read cache.
+ *  \return Number of bytes read, or -1 (and errno set).
+ */
+ssize_t Remote::fillReadCache(bool stream)
+{
+    size_t size = ReplyMessage::DATA_OFFSET+m_read_block_size;
+    if(!m_read_buffer)
+        m_read_buffer = BufferArena::allocate(size);
+    uint32_t request_id;
+    int      type;
+    requestBlock(stream, m_read_block_size, /*read_ahead*/false,
+                 &request_id, &type);
+    MPI_Status status;
+    MPI_Recv(m_read_buffer, size, MPI_CHAR, 0, 9, m_intercomm, &status);
+    int len;
+    MPI_Get_count(&status, MPI_CHAR, &len);
+    return checkReply(request_id, type, m_read_buffer, len);
+}   // fillReadCache
+
+// ----------------------------------------------------------------------------
+/** Requests the block after the cached block in the background, unless
+ *  another file reads ahead already.
+ */
+void Remote::startReadAhead()
+{
+    if(!m_read_ahead_enabled || m_read_ahead.m_file)
+        return;
+    size_t size = ReplyMessage::DATA_OFFSET+m_read_block_size;
+    if(!m_ahead_buffer)
+        m_ahead_buffer = BufferArena::allocate(size);
+    requestBlock(m_read_stream, m_read_block_size, /*read_ahead*/true,
+                 &m_read_ahead.m_request_id, &m_read_ahead.m_type);
+    MPI_Irecv(m_ahead_buffer, size, MPI_CHAR, 0, READ_AHEAD_TAG, m_intercomm,
+              &m_read_ahead.m_request);
+    m_read_ahead.m_file = this;
+    m_read_ahead.m_done = false;
+}   // startReadAhead
+
+// ----------------------------------------------------------------------------
+/** Waits for the answer to the read-ahead request of this file. */
+void Remote::waitReadAhead()
+{
+    assert(m_read_ahead.m_file==this);
+    if(m_read_ahead.m_done)
+        return;
+    MPI_Status status;
+    MPI_Wait(&m_read_ahead.m_request, &status);
+    int len;
+    MPI_Get_count(&status, MPI_CHAR, &len);
+    m_read_ahead.m_result = checkReply(m_read_ahead.m_request_id,
+                                       m_read_ahead.m_type, m_ahead_buffer,
+                                       len);
+    m_read_ahead.m_error  = errno;
+    m_read_ahead.m_done   = true;
+}   // waitReadAhead
+
+// ----------------------------------------------------------------------------
+/** Returns by how many bytes the position of the file on the server is
+ *  ahead of the application, because of cached or read-ahead data.
+ */
+int64_t Remote::getUnreadBytes()
+{
+    int64_t unread = m_read_end-m_read_pos;
+    if(m_read_ahead.m_file==this)
+    {
+        waitReadAhead();
+        if(m_read_ahead.m_result>0)
+            unread += m_read_ahead.m_result;
+    }
+    return unread;
+}   // getUnreadBytes
+
+// ----------------------------------------------------------------------------
+/** Discards the read cache and the data read ahead.
+ *  \param rewind If true, the position of the file on the server is moved
+ *         back to the position of the application.
+ *  \return 0, or -1 (and errno set) if the position can not be restored.
+ */
+int Remote::discardReadCache(bool rewind)
+{
+    int64_t unread = getUnreadBytes();
+    if(m_read_ahead.m_file==this)
+        m_read_ahead.m_file = NULL;
+    m_read_pos = 0;
+    m_read_end = 0;
+    if(!rewind || unread==0)
+        return 0;
+
+    int64_t result;
+    if(m_read_stream)
+    {
+        Message_fseek_off64_t m(getIndex(), (off64_t)-unread, SEEK_CUR);
+        sendRequest(&m);
+        result = receiveReply(&m);
+    }
+    else
+    {
+        Message_lseek_off64_t m(getIndex(), (off64_t)-unread, SEEK_CUR);
+        sendRequest(&m);
+        result = receiveReply(&m);
+    }
+    return result==-1 ? -1 : 0;
+}   // discardReadCache
+
+// ----------------------------------------------------------------------------
+/** Reads through the read cache. Reads of at least a block that find the
+ *  cache empty are received directly into the buffer.
+ *  \param stream True for fread, false for read.
+ *  \return Number of bytes read, or -1 (and errno set) if nothing was read
+ *          because of an error.
+ */
+ssize_t Remote::readCached(char *buffer, size_t n, bool stream)
+{
+    if(stream!=m_read_stream)
+    {
+        discardReadCache(/*rewind*/true);
+        m_read_stream = stream;
+    }
+
+    size_t done = 0;
+    while(done<n)
+    {
+        if(m_read_pos<m_read_end)
+        {
+            size_t count = std::min(n-done, m_read_end-m_read_pos);
+            memcpy(buffer+done,
+                   m_read_buffer+ReplyMessage::DATA_OFFSET+m_read_pos, count);
+            m_read_pos += count;
+            done       += count;
+            continue;
+        }
+
+        // The cache is empty. If it contained a block before, which was
+        // read completely, the file is read sequentially.
+        bool sequential = m_read_end>0;
+        int64_t result;
+        if(m_read_ahead.m_file==this)
+        {
+            waitReadAhead();
+            m_read_ahead.m_file = NULL;
+            std::swap(m_read_buffer, m_ahead_buffer);
+            result = m_read_ahead.m_result;
+            if(result<0)
+                errno = m_read_ahead.m_error;
+        }
+        else if(n-done>=m_read_block_size)
+        {
+            // Big reads are received directly into the buffer.
+            uint32_t request_id;
+            int      type;
+            requestBlock(stream, n-done, /*read_ahead*/false, &request_id,
+                         &type);
+            result = receiveReply(request_id, type, buffer+done, n-done);
+            if(result<0)
+                return done>0 ? done : -1;
+            return done+result;
+        }
+        else
+            result = fillReadCache(stream);
+
+        m_read_pos = 0;
+        m_read_end = result>0 ? result : 0;
+        if(result<0)
+            return done>0 ? done : -1;
+        if(result==0)
+            break;   // end of file
+        if(sequential && result==(int64_t)m_read_block_size)
+            startReadAhead();
+    }
+    return done;
+}   // readCached
+
+// ----------------------------------------------------------------------------
+/** Creates a datatype that describes two separate buffers (at absolute
+ *  addresses, so it is used with MPI_BOTTOM). Since it consists only of
+ *  MPI_CHAR it matches a contiguous buffer on the other side. The caller
+ *  must free the type.
+ */
+void Remote::createPartsType(const void *header, int header_len,
+                             const void *data, size_t data_len,
+                             MPI_Datatype *type)
+{
+    int      lengths[2] = { header_len, (int)data_len };
+    MPI_Aint addresses[2];
+    MPI_Get_address((void*)header, &addresses[0]);
+    MPI_Get_address((void*)data,   &addresses[1]);
+    MPI_Type_create_hindexed(2, lengths, addresses, MPI_CHAR, type);
+    MPI_Type_commit(type);
+}   // createPartsType
+
+// ----------------------------------------------------------------------------
+/** Sends a write message. If the maximum number of writes is in flight,
+ *  this waits for an acknowledgement first. A message with a payload is
+ *  sent without copying the payload, and this only returns once MPI does
+ *  not need the payload anymore. Other messages are batched, or sent
+ *  without blocking, and the message buffer is freed once the send is
+ *  complete.
+ */
+void Remote::sendWrite(Message *m)
+{
+    if(m_in_flight>=m_max_in_flight)
+    {
+        // Writes that wait for their acknowledgement might still be in
+        // the batch.
+        flushBatch();
+        while(m_in_flight>=m_max_in_flight)
+            receiveAck();
+    }
+
+    if(m->getPayload())
+    {
+        flushBatch();
+        MPI_Datatype type;
+        createPartsType(m->getData(), m->getLen(), m->getPayload(),
+                        m->getPayloadSize(), &type);
+        MPI_Send(MPI_BOTTOM, 1, type, 0, 1, m_intercomm);
+        MPI_Type_free(&type);
+    }
+    else if(!addToBatch(m))
+    {
+        PendingSend send;
+        int len       = m->getLen();
+        send.m_buffer = m->release();
+        MPI_Isend(send.m_buffer, len, MPI_CHAR, 0, 1, m_intercomm,
+                  &send.m_request);
+        m_sends.push_back(send);
+    }
+    m_in_flight++;
+    m_writers[getIndex()] = this;
+
+    // Pick up acknowledgements that already arrived, so that errors are
+    // reported early, and free the buffers of completed sends.
+    int flag = 1;
+    while(flag)
+    {
+        MPI_Status status;
+        MPI_Iprobe(0, ACK_TAG, m_intercomm, &flag, &status);
+        if(flag)
+            receiveAck();
+    }
+    completeSends(/*wait*/false);
+}   // sendWrite
+
+// ----------------------------------------------------------------------------
+/** Frees the buffers of completed sends, in order.
+ *  \param wait If true, waits till all sends are complete.
+ */
+void Remote::completeSends(bool wait)
+{
+    while(!m_sends.empty())
+    {
+        MPI_Status status;
+        if(wait)
+            MPI_Wait(&m_sends.front().m_request, &status);
+        else
+        {
+            int done = 0;
+            MPI_Test(&m_sends.front().m_request, &done, &status);
+            if(!done)
+                break;
+        }
+        BufferArena::free(m_sends.front().m_buffer);
+        m_sends.pop_front();
+    }
+}   // completeSends
+
+// ----------------------------------------------------------------------------
+/** Waits till all writes of this file are acknowledged.
+ *  \return 0, or -1 (and errno set) if a write failed.
+ */
+int Remote::drainWrites()
+{
+    flushBatch();
+    while(m_in_flight>0)
+        receiveAck();
+    completeSends(/*wait*/true);
+    m_writers.erase(getIndex());
+    return reportWriteError() ? -1 : 0;
+}   // drainWrites
+
+// ----------------------------------------------------------------------------
+/** Reports a write error of an earlier write (once).
+ *  \return True (and errno set) if an error was reported.
+ */
+bool Remote::reportWriteError()
+{
+    if(m_write_error==0)
+        return false;
+    errno         = m_write_error;
+    m_write_error = 0;
+    return true;
+}   // reportWriteError
+
 // ----------------------------------------------------------------------------
 FILE* Remote:: fopen(const char *mode)
 { 
     Message_fopen m(getIndex(), getFilename(), mode);
-
-    MPI_Send(m.getData(), m.getLen(), MPI_CHAR, 0, 1, m_intercomm);
+    queueMessage(&m);
     return (FILE*)this;
 }   // fopen
 // ----------------------------------------------------------------------------
 FILE* Remote:: fopen64(const char *mode)
 {
     Message_fopen64 m(getIndex(), getFilename(), mode);
-
-    MPI_Send(m.getData(), m.getLen(), MPI_CHAR, 0, 1, m_intercomm);
+    queueMessage(&m);
     return (FILE*)this;
 }   // fopen
 
@@ -150,22 +689,14 @@ int Remote::setvbuf(char *buf, int mode, size_t size)
 #define FSEEK(NAME, TYPE, MESSAGE_TYPE)                               \
 int Remote::NAME(TYPE offset, int whence)                             \
 {                                                                     \
+    /* The server is ahead of the application by the cached data. */  \
+    int64_t unread = getUnreadBytes();                                \
+    discardReadCache(/*rewind*/false);                                \
+    if(whence==SEEK_CUR)                                              \
+        offset -= unread;                                             \
     MESSAGE_TYPE m(getIndex(), offset, whence);                       \
-    MPI_Send(m.getData(), m.getLen(), MPI_CHAR, 0, 1, m_intercomm);   \
-    MPI_Status status;                                                \
-                                                                      \
-    int result;                                                       \
-                                                                      \
-    int recv_len = sizeof(m_index)+m.getSize(result)+m.getSize(errno)+2*sizeof(int); \
-    char *msg    = new char[recv_len];                                \
-    int *p       = (int *)msg;                                        \
-    MPI_Recv(msg, recv_len, MPI_CHAR, 0, 9, m_intercomm, &status);    \
-                                                                      \
-    result = p[0];                                                    \
-    if(result==-1)                                                    \
-        errno = (int)(p[1]);                                          \
-    delete msg;                                                       \
-    return result;                                                    \
+    sendRequest(&m);                                                  \
+    return (int)receiveReply(&m);                                     \
 }
 
 FSEEK(fseek,    long,    Message_fseek_long   );
@@ -178,20 +709,10 @@ FSEEK(fseeko64, off64_t, Message_fseek_off64_t);
 TYPE Remote::NAME()                                                  \
 {                                                                    \
     MESSAGE m(getIndex());                                           \
-    MPI_Send(m.getData(), m.getLen(), MPI_CHAR, 0, 1, m_intercomm);  \
-                                                                     \
-    MPI_Status status;                                               \
-    TYPE result=0;                                                   \
-                                                                     \
-    int recv_len = m.getSize(result)+m.getSize(errno);               \
-    char *msg = new char[recv_len];                                  \
-    TYPE *p = (TYPE*)msg;                                            \
-    MPI_Recv(msg, recv_len, MPI_CHAR, 0, 9, m_intercomm, &status);   \
-                                                                     \
-    result = p[0];                                                   \
-    if(result==-1)                                                   \
-        errno = (int)(p[1]);                                         \
-    delete msg;                                                      \
+    sendRequest(&m);                                                 \
+    TYPE result = (TYPE)receiveReply(&m);                            \
+    if(result!=-1)                                                   \
+        result -= getUnreadBytes();                                  \
     return result;                                                   \
 }   
 
@@ -202,28 +723,14 @@ TELL(ftello64, off64_t, Message_ftello64)
 // ----------------------------------------------------------------------------
 int Remote::fflush()
 {
-    // Ignored for now.
-    return 0;
+    return drainWrites()==0 ? 0 : EOF;
 }   // fflush
 // ----------------------------------------------------------------------------
 int Remote::ferror()
 {
     Message_ferror m(getIndex());
-    MPI_Send(m.getData(), m.getLen(), MPI_CHAR, 0, 1, m_intercomm);
-
-    MPI_Status status;
-    int result;
-
-    int recv_len = m.getSize(result)+m.getSize(errno);
-    char *msg = new char[recv_len];
-    long *p = (off_t*)msg;
-    MPI_Recv(msg, recv_len, MPI_CHAR, 0, 9, m_intercomm, &status);
-    
-    result = p[0];
-    if(result==-1)
-        errno = (int)(p[1]);
-    delete msg;
-    return result;
+    sendRequest(&m);
+    return (int)receiveReply(&m);
 }   // ferror
 // ----------------------------------------------------------------------------
 int Remote::fileno()
@@ -234,44 +741,54 @@ int Remote::fileno()
 // ----------------------------------------------------------------------------
 size_t Remote::fwrite(const void *ptr,size_t size, size_t nmemb)
 {
+    if(reportWriteError() || discardReadCache(/*rewind*/true)==-1)
+        return 0;
     // The two separate elements size and nmemb are unnecessary, but
     // might help in debugging.
-    Message_fwrite m(getIndex(), size, nmemb, ptr, size*nmemb);
-    MPI_Send(m.getData(), m.getLen(), MPI_CHAR, 0, 1, m_intercomm);
+    Message_fwrite m(getIndex(), size, nmemb, ptr, size*nmemb,
+                     /*copy*/size*nmemb<m_zero_copy_size);
+    sendWrite(&m);
     return nmemb;
 }   // fwrite
 
 // ----------------------------------------------------------------------------
 size_t Remote::fread(void *ptr,size_t size, size_t nmemb)
 {
+    if(m_read_block_size>0 && size>0)
+    {
+        ssize_t n = readCached((char*)ptr, size*nmemb, /*stream*/true);
+        return n>0 ? n/size : 0;
+    }
     Message_fread  m(getIndex(), size, nmemb);
-    MPI_Send(m.getData(), m.getLen(), MPI_CHAR, 0, 1, m_intercomm);
-    int recv_len = size*nmemb+5+sizeof(size_t)+2*sizeof(int);
-    char *msg = new char[recv_len];
-    int *p = (int*)msg;
-    MPI_Status status;
-    MPI_Recv(msg, recv_len, MPI_CHAR, 0, 9, m_intercomm, &status);
-    assert(p[0]==Message::MSG_FREAD_ANSWER);
-    assert(p[1] == getIndex());
-    int result = (size_t)(msg[8]);
-    memcpy(ptr, msg+16, result);
-    delete msg;
-    return result;
+    sendRequest(&m);
+    int64_t result = receiveReply(&m, ptr, size*nmemb);
+    return result>0 ? (size_t)result : 0;
 }   // fread
 
 // ----------------------------------------------------------------------------
 int Remote::fclose()
 {
-    Message_fclose msg_close(getIndex());
-    MPI_Send(msg_close.getData(), msg_close.getLen(), MPI_CHAR, 0, 1, m_intercomm);
-        return 0;
+    discardReadCache(/*rewind*/false);
+    int write_result = drainWrites();
+    int write_error  = errno;
+    Message_fclose m(getIndex());
+    sendRequest(&m);
+
+    int result = (int)receiveReply(&m);
+    if(result!=EOF && write_result==-1)
+    {
+        errno  = write_error;
+        result = EOF;
+    }
+
+    return result;
 }   // fclose
 
 // ----------------------------------------------------------------------------
 int Remote::feof()
 {
     Message_feof msg_eof(getIndex());
-    MPI_Send(msg_eof.getData(), msg_eof.getLen(), MPI_CHAR, 0, 1, m_intercomm);
+    sendRequest(&msg_eof);
     assert(false);
     return false;
 }   // feof
@@ -280,7 +797,7 @@ char *Remote::fgets(char *s, int size)
 {
     Message_fgets msg_fgets(getIndex(), size);
 
-    MPI_Send(msg_fgets.getData(), msg_fgets.getLen(), MPI_CHAR, 0, 1, m_intercomm);
+    sendRequest(&msg_fgets);
     assert(false);
     return NULL;
 }   // fgets
@@ -289,82 +806,54 @@ char *Remote::fgets(char *s, int size)
 int Remote::open(int flags, mode_t mode)
 {
     Message_open m(getIndex(), getFilename(), flags, mode);
-
-    MPI_Send(m.getData(), m.getLen(), MPI_CHAR, 0, 1, m_intercomm);
+    queueMessage(&m);
     return getIndex()+Config::get()->getMaxFiles();
 }   // open
 // ----------------------------------------------------------------------------
 int Remote::open64(int flags, mode_t mode)
 {
     Message_open64 m(getIndex(), getFilename(), flags, mode);
-
-    MPI_Send(m.getData(), m.getLen(), MPI_CHAR, 0, 1, m_intercomm);
+    queueMessage(&m);
     return getIndex()+Config::get()->getMaxFiles();
 }   // open
 
 // ----------------------------------------------------------------------------
-#define XSTAT(NAME, TYPE, TAG)                                       \
+/** Stat by name sends the file name, so that it also works for files that
+ *  are not open on the server. */
+#define XSTAT(NAME, TYPE, MESSAGE_TYPE)                              \
 int Remote::NAME(int ver, TYPE *buf)                                 \
 {                                                                    \
-    Message_stat m(getIndex());                                      \
-    MPI_Send(m.getData(), m.getLen(), MPI_CHAR, 0, 1, m_intercomm);  \
-                                                                     \
-    MPI_Status status;                                               \
-    char *msg = new char[sizeof(TYPE) + 2*sizeof(int) + 1];          \
-    MPI_Recv(msg, sizeof(TYPE)+2*sizeof(int), MPI_CHAR, 0, 9,        \
-             m_intercomm, &status);                                  \
-    int *p    = (int *)msg;                                          \
-    memcpy(buf, p+2, sizeof(TYPE));                                  \
-    int result = p[0];                                               \
-    if(result)                                                       \
-        errno = p[1];                                                \
-    delete msg;                                                      \
-    return result;                                                   \
-}                                                                    \
+    MESSAGE_TYPE m(getIndex(), getFilename());                       \
+    sendRequest(&m);                                                 \
+    return (int)receiveReply(&m, buf, sizeof(TYPE));                 \
+}   // NAME
 
-    //FIXME: stat takes a filename as parameter - 
-XSTAT(__xstat,    struct stat,   MSG___XSTAT );
-XSTAT(__fxstat,   struct stat,   MSG___FXSTAT);
-XSTAT(__fxstat64, struct stat64, MSG___FXSTAT64);
+XSTAT(__xstat,  struct stat, Message_stat );
+XSTAT(__lxstat, struct stat, Message_lstat);
 
 // ----------------------------------------------------------------------------
-int Remote::__lxstat(int ver, struct stat *buf)
-{
-    Message_stat m(getIndex());
-    MPI_Send(m.getData(), m.getLen(), MPI_CHAR, 0, 1, m_intercomm);
+#define FXSTAT(NAME, TYPE, MESSAGE_TYPE)                             \
+int Remote::NAME(int ver, TYPE *buf)                                 \
+{                                                                    \
+    MESSAGE_TYPE m(getIndex());                                      \
+    sendRequest(&m);                                                 \
+    return (int)receiveReply(&m, buf, sizeof(TYPE));                 \
+}   // NAME
 
-    MPI_Status status;
-    char *msg = new char[sizeof(struct stat) + 2*sizeof(int)];
-    MPI_Recv(msg, sizeof(struct stat)+2*sizeof(int), MPI_CHAR, 0, 9, 
-             m_intercomm, &status);
-    int *p    = (int *)msg;
-    memcpy(buf, p+2, sizeof(struct stat));
-    int result = p[0];
-    if(result)
-        errno = p[1];
-    delete msg;
-    return result;
-}   // fstat
+FXSTAT(__fxstat,   struct stat,   Message_fstat  );
+FXSTAT(__fxstat64, struct stat64, Message_fstat64);
 
 // ----------------------------------------------------------------------------
 #define LSEEK(NAME, TYPE, TAG, MESSAGE_TYPE)                         \
 TYPE Remote::NAME(TYPE offset, int whence)                           \
 {                                                                    \
+    int64_t unread = getUnreadBytes();                               \
+    discardReadCache(/*rewind*/false);                               \
+    if(whence==SEEK_CUR)                                             \
+        offset -= unread;                                            \
     MESSAGE_TYPE m(getIndex(),offset, whence);                       \
-    MPI_Send(m.getData(), m.getLen(), MPI_CHAR, 0, 1, m_intercomm);  \
-    MPI_Status status;                                               \
-    TYPE result;                                                     \
-                                                                     \
-    int recv_len = m.getSize(result)+m.getSize(errno);               \
-    char *msg = new char[recv_len];                                  \
-    off_t *p = (TYPE *)msg;                                          \
-    MPI_Recv(msg, recv_len, MPI_CHAR, 0, 9, m_intercomm, &status);   \
-                                                                     \
-    result = p[0];                                                   \
-    if(result==(off_t)-1)                                            \
-        errno = (int)(p[1]);                                         \
-    delete msg;                                                      \
-    return result;                                                   \
+    sendRequest(&m);                                                 \
+    return (TYPE)receiveReply(&m);                                   \
 }   // SEEK
 
 LSEEK(lseek,   off_t,   MSG_LSEEK  , Message_lseek_off_t);
@@ -373,45 +862,39 @@ LSEEK(lseek64, off64_t, MSG_LSEEK64, Message_lseek_off64_t);
 // ----------------------------------------------------------------------------
 ssize_t Remote::write(const void *buf, size_t nbyte)
 {
-    Message_write m(getIndex(), nbyte, buf, nbyte);
-
-    MPI_Send(m.getData(), m.getLen(), MPI_CHAR, 0, 1, m_intercomm);
+    if(reportWriteError() || discardReadCache(/*rewind*/true)==-1)
+        return -1;
+    Message_write m(getIndex(), nbyte, buf, nbyte,
+                    /*copy*/nbyte<m_zero_copy_size);
+    sendWrite(&m);
     return nbyte;
 }   // write
 
 // ----------------------------------------------------------------------------
 ssize_t Remote::read(void *buf, size_t count)
 {
+    if(m_read_block_size>0)
+        return readCached((char*)buf, count, /*stream*/false);
     Message_read m(getIndex(), count);
-    MPI_Send(m.getData(), m.getLen(), MPI_CHAR, 0, 1, m_intercomm);
-
-    ssize_t result;
-    MPI_Status status;
-    int recv_len = m.getSize(errno)+m.getSize(result)+count;
-    char *msg    = new char[recv_len];
-    ssize_t *p   = (ssize_t*)msg;
-    MPI_Recv(msg, recv_len, MPI_CHAR, 0, 9, m_intercomm, &status);
-    result = p[0];
-    if(result ==-1)
-        memcpy(p+1, &errno, sizeof(errno));
-    memcpy(buf, msg+m.getSize(errno)+m.getSize(result), result);
-    delete msg;
-    return result;
+    sendRequest(&m);
+    return (ssize_t)receiveReply(&m, buf, count);
 }   // read
 
 // ----------------------------------------------------------------------------
 int Remote::close()
 {
+    discardReadCache(/*rewind*/false);
+    int write_result = drainWrites();
+    int write_error  = errno;
     Message_close m(getIndex());
-    MPI_Send(m.getData(), m.getLen(), MPI_CHAR, 0, 1, m_intercomm);
+    sendRequest(&m);
     
-    int result;
-    int msg[2];
-    MPI_Status status;
-    MPI_Recv(msg, 2, MPI_INT, 0, 9, m_intercomm, &status);
-    result = msg[0];
-    if(result ==-1)
-        errno = msg[1];
+    int result = (int)receiveReply(&m);
+    if(result!=-1 && write_result==-1)
+    {
+        errno  = write_error;
+        result = -1;
+    }
     
     return result;
 }   // close
@@ -420,10 +903,20 @@ int Remote::close()
 int Remote::rename(const char *newpath)
 {
     Message_rename m(getIndex(), getFilename(), newpath);
-    MPI_Send(m.getData(), m.getLen(), MPI_CHAR, 0, 1, m_intercomm);
-    return 0;
+    sendRequest(&m);
+    return (int)receiveReply(&m);
 }   // rename
 
+// ----------------------------------------------------------------------------
+/** The file is removed by the server, after all earlier requests of this
+ *  process (e.g. writes to the file) are executed. */
+int Remote::unlink()
+{
+    Message_unlink m(getIndex(), getFilename());
+    sendRequest(&m);
+    return (int)receiveReply(&m);
+}   // unlink
+
 
 }   // namespace ALIO
 
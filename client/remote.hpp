@@ -24,14 +24,43 @@
 #include "client/base_file_object.hpp"
 #include "tools/os.hpp"
 
+class CompoundMessage;
+class Message;
+
 #include "mpi.h"
 
+#include <deque>
+#include <map>
 #include <string>
 
 namespace ALIO
 {
 class XMLNode;
 
+/** A file object that sends all requests to the IO server. Writes are
+ *  sent with non-blocking sends and return immediately. The server
+ *  acknowledges each write; at most in-flight (default 8) writes per file
+ *  are unacknowledged, after that a write waits for an acknowledgement
+ *  (credit-based flow control), so a fast client can not flood the server.
+ *  A write error reported by the server is returned by the next write,
+ *  fflush, fclose or close.
+ *  Writes of at least zero-copy bytes (default 64K) are sent directly from
+ *  the application's buffer (the message header and the data are
+ *  described by one MPI datatype), and return once MPI does not need the
+ *  buffer anymore. Smaller writes are copied. Reads receive the data
+ *  directly into the application's buffer.
+ *  Requests without an answer (opens, small writes, closes of streams)
+ *  are collected in a compound frame of up to batch-size bytes
+ *  (default 16K, 0 disables batching), which is sent together with the
+ *  next request that needs an answer, so such a sequence needs only one
+ *  round trip.
+ *  With read-cache="64K", small reads are served from a read cache: the
+ *  file is read in blocks of that size (the default 0 disables the cache).
+ *  With read-ahead="yes" as well, the next block of a file that is read
+ *  sequentially is requested in the background (only one file of a
+ *  process reads ahead at a time). Seeks, tells and writes take the data
+ *  read ahead of the application into account.
+ */
 class Remote : public BaseFileObject
 {
     /** True if the connection to the server was established.
@@ -42,6 +71,104 @@ class Remote : public BaseFileObject
      */
     static MPI_Comm m_intercomm;
 
+    /** Requests of all files that are not sent yet, in order. */
+    static CompoundMessage *m_batch;
+
+    /** Tag of the write acknowledgements sent by the server. */
+    static const int ACK_TAG = 10;
+
+    /** Tag of the answers to read-ahead requests. */
+    static const int READ_AHEAD_TAG = 11;
+
+    /** The read-ahead request of the process. */
+    struct ReadAhead
+    {
+        /** The file that reads ahead, NULL if none. */
+        Remote     *m_file;
+        MPI_Request m_request;
+        uint32_t    m_request_id;
+        int         m_type;
+        /** True once the answer is received. */
+        bool        m_done;
+        /** Number of bytes read ahead, or -1 (and m_error) on error. */
+        int64_t     m_result;
+        int         m_error;
+    };   // ReadAhead
+
+    static ReadAhead m_read_ahead;
+
+    /** All files with unacknowledged writes by index, so that an
+     *  acknowledgement can be given to its file. */
+    static std::map<int, Remote*> m_writers;
+
+    /** A write sent with MPI_Isend that might not be complete yet. */
+    struct PendingSend
+    {
+        MPI_Request m_request;
+        char       *m_buffer;
+    };   // PendingSend
+
+    std::deque<PendingSend> m_sends;
+
+    /** Maximum number of unacknowledged writes. */
+    unsigned int    m_max_in_flight;
+
+    /** Number of writes not yet acknowledged by the server. */
+    unsigned int    m_in_flight;
+
+    /** The first write error reported by the server, 0 if none. */
+    int             m_write_error;
+
+    /** Minimum size of a write that is sent without copying. */
+    size_t          m_zero_copy_size;
+
+    /** Maximum size of a compound frame, 0 if requests are not batched. */
+    size_t          m_batch_size;
+
+    /** Size of the blocks of the read cache, 0 if reads are not cached. */
+    size_t          m_read_block_size;
+
+    bool            m_read_ahead_enabled;
+
+    /** The cached block, the answer header is stored in front of the
+     *  data. The application did not read [m_read_pos, m_read_end) yet. */
+    char           *m_read_buffer;
+    size_t          m_read_pos;
+    size_t          m_read_end;
+
+    /** Buffer for the block read ahead. */
+    char           *m_ahead_buffer;
+
+    /** True if the cache was filled with fread, false if with read. */
+    bool            m_read_stream;
+
+    static void     receiveAck();
+    static void     flushBatch();
+    static void     createPartsType(const void *header, int header_len,
+                                    const void *data, size_t data_len,
+                                    MPI_Datatype *type);
+    static int64_t  checkReply(uint32_t request_id, int type,
+                               const char *header, int len);
+    int64_t         receiveReply(Message *request, void *data=NULL,
+                                 size_t data_len=0);
+    int64_t         receiveReply(uint32_t request_id, int type, void *data,
+                                 size_t data_len);
+    ssize_t         readCached(char *buffer, size_t n, bool stream);
+    void            requestBlock(bool stream, size_t n, bool read_ahead,
+                                 uint32_t *request_id, int *type);
+    ssize_t         fillReadCache(bool stream);
+    void            startReadAhead();
+    void            waitReadAhead();
+    int64_t         getUnreadBytes();
+    int             discardReadCache(bool rewind);
+    bool            addToBatch(Message *m);
+    void            queueMessage(Message *m);
+    void            sendRequest(Message *m);
+    void            sendWrite(Message *m);
+    void            completeSends(bool wait);
+    int             drainWrites();
+    bool            reportWriteError();
+
 public:
     static int      init();
     static int      atExit();
@@ -78,6 +205,7 @@ public:
     virtual ssize_t read(void *buf, size_t count);
     virtual int     close();
     virtual int     rename(const char *newpath);
+    virtual int     unlink();
 
 };   // Remote
 
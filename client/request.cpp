@@ -18,44 +18,177 @@
 
 #include "client/request.hpp"
 
+#include <limits.h>
+#include <linux/futex.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
+namespace
+{
+    // The request allocator: each thread has a cache with one free list
+    // for each size class (multiples of 16 bytes). A block starts with a
+    // header that stores the owning cache and the size class. A block that
+    // is freed by the owning thread goes back into its free list; a block
+    // freed by another thread (typically the IO thread) is pushed onto a
+    // lock-free 'returned' stack of the owner, which the owner takes over
+    // as a whole once its free list is empty. Since only the owner ever
+    // removes blocks from this stack (all at once), there is no ABA issue.
+    // Caches are never freed, so a request can still be freed after the
+    // thread that allocated it has finished.
+
+    const size_t NUM_SIZE_CLASSES = 16;
+    const size_t SIZE_CLASS_BYTES = 16;
+
+    struct RequestCache;
+
+    union BlockHeader
+    {
+        struct
+        {
+            RequestCache *m_owner;
+            unsigned int  m_size_class;
+        } m_info;
+        // Keeps the request following the header 16-byte aligned.
+        char m_padding[16];
+    };   // BlockHeader
+
+    struct FreeBlock
+    {
+        FreeBlock *m_next;
+    };   // FreeBlock
+
+    struct RequestCache
+    {
+        /** Blocks that can be allocated, only used by the owner thread. */
+        FreeBlock *m_free[NUM_SIZE_CLASSES];
+        /** Blocks freed by other threads. */
+        FreeBlock *m_returned[NUM_SIZE_CLASSES];
+    };   // RequestCache
+
+    __thread RequestCache *g_request_cache = NULL;
+
+    // ------------------------------------------------------------------------
+    RequestCache *getRequestCache()
+    {
+        if(!g_request_cache)
+            g_request_cache = (RequestCache*)calloc(1, sizeof(RequestCache));
+        return g_request_cache;
+    }   // getRequestCache
+}   // namespace
+
+// ----------------------------------------------------------------------------
 Request::Request(RequestType type)
 {
     m_type = type;
 }   // Request::Request
 
+// ----------------------------------------------------------------------------
+/** Allocates a request from the free list of the calling thread. Requests
+ *  bigger than the largest size class are allocated with malloc.
+ */
+void *Request::operator new(size_t size)
+{
+    size_t total      = size + sizeof(BlockHeader);
+    size_t size_class = (total+SIZE_CLASS_BYTES-1)/SIZE_CLASS_BYTES - 1;
+    BlockHeader *header;
+    if(size_class>=NUM_SIZE_CLASSES)
+    {
+        header = (BlockHeader*)malloc(total);
+        header->m_info.m_owner = NULL;
+    }
+    else
+    {
+        RequestCache *cache = getRequestCache();
+        FreeBlock *block    = cache->m_free[size_class];
+        if(!block)
+            block = __atomic_exchange_n(&cache->m_returned[size_class], NULL,
+                                        __ATOMIC_ACQUIRE);
+        if(block)
+        {
+            cache->m_free[size_class] = block->m_next;
+            header = (BlockHeader*)block;
+        }
+        else
+            header = (BlockHeader*)malloc((size_class+1)*SIZE_CLASS_BYTES);
+        header->m_info.m_owner = cache;
+    }
+    if(!header)
+    {
+        printf("Can not allocate request of %ld bytes.\n", (long)size);
+        abort();
+    }
+    header->m_info.m_size_class = size_class;
+    return header+1;
+}   // operator new
+
+// ----------------------------------------------------------------------------
+/** Returns a request to the free list of the thread that allocated it. */
+void Request::operator delete(void *p)
+{
+    if(!p) return;
+    BlockHeader *header      = (BlockHeader*)p - 1;
+    RequestCache *owner      = header->m_info.m_owner;
+    unsigned int  size_class = header->m_info.m_size_class;
+    if(!owner)
+    {
+        free(header);
+        return;
+    }
+    FreeBlock *block = (FreeBlock*)header;
+    if(owner==g_request_cache)
+    {
+        block->m_next = owner->m_free[size_class];
+        owner->m_free[size_class] = block;
+        return;
+    }
+    FreeBlock *top = __atomic_load_n(&owner->m_returned[size_class],
+                                     __ATOMIC_RELAXED);
+    do
+    {
+        block->m_next = top;
+    } while(!__atomic_compare_exchange_n(&owner->m_returned[size_class],
+                                         &top, block, /*weak*/true,
+                                         __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}   // operator delete
+
 // ========================================================================
 BlockingRequest::BlockingRequest(RequestType type)
                : Request(type)
 {
-    pthread_cond_init (&m_signal_done,  NULL);
-    m_done.setAtomic(false);
-};   // BlockingRequest
+    m_state = 0;
+}   // BlockingRequest
 
 // ----------------------------------------------------------------------------
+/** Waits till the IO thread has called done() for this request.
+ */
 void BlockingRequest::wait()
 {
-    printf("Request %d wait called.\n", getType());
-    m_done.lock();
-    while(!m_done.getData())
+    while(1)
     {
-        printf("Request %d waiting.\n", getType());
-        pthread_cond_wait(&m_signal_done, m_done.getMutex());
+        int state = __atomic_load_n(&m_state, __ATOMIC_ACQUIRE);
+        if(state==1)
+            return;
+        // Announce that a thread is waiting, so that done() wakes it up.
+        if(state==0 &&
+           !__atomic_compare_exchange_n(&m_state, &state, 2, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+            continue;
+        syscall(SYS_futex, &m_state, FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
     }
-    m_done.unlock();
-    printf("Request %d wait exiting.\n", getType());
 }   // wait
 
 // ----------------------------------------------------------------------------
+/** Called from the IO thread when the request is finished. After setting
+ *  the state the waiting thread might already free this request, but a
+ *  futex wake on memory that was reused is harmless: waiters always check
+ *  their state again.
+ */
 void BlockingRequest::done()
 {
-    printf("Request %d done called.\n", getType());
-    m_done.setAtomic(true);
-    pthread_cond_signal(&m_signal_done);
-    printf("Request %d done exiting.\n", getType());
+    if(__atomic_exchange_n(&m_state, 1, __ATOMIC_RELEASE)==2)
+        syscall(SYS_futex, &m_state, FUTEX_WAKE_PRIVATE, INT_MAX, NULL,
+                NULL, 0);
 }   // done
 // ----------------------------------------------------------------------------
-// ----------------------------------------------------------------------------
-
-
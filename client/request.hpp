@@ -19,22 +19,40 @@
 #ifndef HEADER_REQUEST_HPP
 #define HEADER_REQUEST_HPP
 
-#include "tools/synchronised.hpp"
-#include <pthread.h>
+#include "tools/block_codec.hpp"
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <vector>
+
+namespace ALIO
+{
+    class BufferedFileObject;
+    class WriteChunk;
+}
 
 /** A request class used to send commands from the application to the
- *  IO thread.
+ *  IO thread. Requests are allocated from per-thread free lists (see
+ *  operator new), so queueing a request does not need malloc. A request
+ *  can be deleted by any thread, it is then returned to the free list of
+ *  the thread that allocated it. Data is never copied into a request,
+ *  requests only point to (pooled) buffers.
  */
 class Request
 {
 public:
     /** The various types of requests. */
-    enum RequestType {RQ_QUIT, RQ_OPEN};
+    enum RequestType {RQ_QUIT, RQ_WRITE, RQ_READ, RQ_PREFETCH, RQ_FLUSH,
+                      RQ_FSYNC, RQ_CLOSE, RQ_BARRIER, RQ_COMPRESS,
+                      RQ_STRIPE};
 private:
     /** The various types of requests. */
     RequestType m_type;
 public:
     Request(RequestType type);
+    virtual ~Request() {}
+    static void *operator new(size_t size);
+    static void  operator delete(void *p);
     // ------------------------------------------------------------------------
     RequestType getType() const { return m_type; }
     // ------------------------------------------------------------------------
@@ -44,21 +62,335 @@ public:
 
 // ============================================================================
 /** A blocking request: the application thread can wait for this request
- *  to be finished (and potentially get status information back).
+ *  to be finished (and potentially get status information back). Instead
+ *  of a condition variable per request a single futex word is used, so
+ *  creating a blocking request is cheap, and done() only needs a system
+ *  call if a thread is actually waiting.
  */
 class BlockingRequest : public Request
 {
 private:
-    /** Flag to indicate when the request is done. */
-    Synchronised<bool>  m_done;
-
-    /** For signaling between the two threads. */
-    pthread_cond_t m_signal_done;
+    /** 0 while the request is not done, 1 once it is done, and 2 if it is
+     *  not done and a thread is (about to start) waiting. */
+    int m_state;
 public:
     BlockingRequest(RequestType type);
     void         wait();
     virtual void done();
-
+    // ------------------------------------------------------------------------
+    /** Returns true if done() was already called. */
+    bool isDone() const
+    {
+        return __atomic_load_n(&m_state, __ATOMIC_ACQUIRE)==1;
+    }   // isDone
 };   // class BlockingRequest
 
+// ============================================================================
+/** A request to write the content of a chunk to disk. The IO thread takes
+ *  ownership of the chunk and frees it once it is written.
+ */
+class WriteRequest : public Request
+{
+private:
+    /** The file object to which the chunk belongs. */
+    ALIO::BufferedFileObject *m_file_object;
+
+    /** The data to write. */
+    ALIO::WriteChunk         *m_chunk;
+
+    /** Number of asynchronous writes for this chunk that have not yet
+     *  completed. Only accessed by the IO thread. */
+    int                       m_outstanding;
+public:
+    WriteRequest(ALIO::BufferedFileObject *file_object,
+                 ALIO::WriteChunk *chunk)
+        : Request(RQ_WRITE)
+    {
+        m_file_object = file_object;
+        m_chunk       = chunk;
+        m_outstanding = 0;
+    }   // WriteRequest
+    // ------------------------------------------------------------------------
+    ALIO::BufferedFileObject *getFileObject() { return m_file_object; }
+    // ------------------------------------------------------------------------
+    ALIO::WriteChunk *getChunk() { return m_chunk; }
+    // ------------------------------------------------------------------------
+    void addOutstanding() { m_outstanding++; }
+    // ------------------------------------------------------------------------
+    /** Called when an asynchronous write completed.
+     *  \return The number of writes still outstanding. */
+    int removeOutstanding() { return --m_outstanding; }
+};   // class WriteRequest
+
+// ============================================================================
+/** A request to read data of a file into a buffer. Since it is handled
+ *  after all previously queued writes, the data read is up to date. The
+ *  application waits for it.
+ */
+class ReadRequest : public BlockingRequest
+{
+private:
+    /** The file object to read from. */
+    ALIO::BufferedFileObject *m_file_object;
+
+    /** Where to store the data. */
+    char                     *m_buffer;
+
+    /** Number of bytes to read. */
+    size_t                    m_size;
+
+    /** File offset to read from. */
+    off64_t                   m_offset;
+
+    /** Number of bytes read, or -1 on error. */
+    ssize_t                   m_result;
+
+    /** The errno value if the read failed. */
+    int                       m_error;
+public:
+    ReadRequest(ALIO::BufferedFileObject *file_object, char *buffer,
+                size_t size, off64_t offset, RequestType type=RQ_READ)
+        : BlockingRequest(type)
+    {
+        m_file_object = file_object;
+        m_buffer      = buffer;
+        m_size        = size;
+        m_offset      = offset;
+        m_result      = 0;
+        m_error       = 0;
+    }   // ReadRequest
+    // ------------------------------------------------------------------------
+    ALIO::BufferedFileObject *getFileObject() { return m_file_object; }
+    // ------------------------------------------------------------------------
+    char   *getBuffer() { return m_buffer;  }
+    // ------------------------------------------------------------------------
+    size_t  getSize() const { return m_size;    }
+    // ------------------------------------------------------------------------
+    off64_t getOffset() const { return m_offset;  }
+    // ------------------------------------------------------------------------
+    ssize_t getResult() const { return m_result;  }
+    // ------------------------------------------------------------------------
+    int     getError() const { return m_error;   }
+    // ------------------------------------------------------------------------
+    /** Called from the IO thread to store the result of the read. */
+    void setResult(ssize_t result, int error)
+    {
+        m_result = result;
+        m_error  = error;
+    }   // setResult
+};   // class ReadRequest
+
+// ============================================================================
+/** A read of a whole chunk into a pooled buffer before the application
+ *  needs the data (read-ahead). The application only waits for it once it
+ *  actually reads from the chunk.
+ */
+class PrefetchRequest : public ReadRequest
+{
+public:
+    PrefetchRequest(ALIO::BufferedFileObject *file_object, char *buffer,
+                    size_t size, off64_t offset)
+        : ReadRequest(file_object, buffer, size, offset, RQ_PREFETCH)
+    {
+    }   // PrefetchRequest
+};   // class PrefetchRequest
+
+// ============================================================================
+/** Waits till all previously queued writes of one file are done. */
+class FlushRequest : public BlockingRequest
+{
+private:
+    /** The file object to flush. */
+    ALIO::BufferedFileObject *m_file_object;
+public:
+    FlushRequest(ALIO::BufferedFileObject *file_object)
+        : BlockingRequest(RQ_FLUSH)
+    {
+        m_file_object = file_object;
+    }   // FlushRequest
+    // ------------------------------------------------------------------------
+    ALIO::BufferedFileObject *getFileObject() { return m_file_object; }
+};   // class FlushRequest
+
+// ============================================================================
+/** A request to write all data of a file to stable storage. It is handled
+ *  after all previously queued writes for the file, and the application
+ *  thread waits for it.
+ */
+class FsyncRequest : public BlockingRequest
+{
+private:
+    /** The file object to sync. */
+    ALIO::BufferedFileObject *m_file_object;
+public:
+    FsyncRequest(ALIO::BufferedFileObject *file_object)
+        : BlockingRequest(RQ_FSYNC)
+    {
+        m_file_object = file_object;
+    }   // FsyncRequest
+    // ------------------------------------------------------------------------
+    ALIO::BufferedFileObject *getFileObject() { return m_file_object; }
+};   // class FsyncRequest
+
+// ============================================================================
+/** A request to close a file once all previously queued writes for it are
+ *  done. The application does not wait for it.
+ */
+class CloseRequest : public Request
+{
+private:
+    /** The file object that is closed. */
+    ALIO::BufferedFileObject *m_file_object;
+
+    /** The file descriptor to close. */
+    int                       m_filedes;
+public:
+    CloseRequest(ALIO::BufferedFileObject *file_object, int filedes)
+        : Request(RQ_CLOSE)
+    {
+        m_file_object = file_object;
+        m_filedes     = filedes;
+    }   // CloseRequest
+    // ------------------------------------------------------------------------
+    ALIO::BufferedFileObject *getFileObject() { return m_file_object; }
+    // ------------------------------------------------------------------------
+    int getFiledes() const { return m_filedes; }
+};   // class CloseRequest
+
+// ============================================================================
+/** Waits till all previously queued requests (of all files) are done. */
+class BarrierRequest : public BlockingRequest
+{
+public:
+    BarrierRequest() : BlockingRequest(RQ_BARRIER) {}
+};   // class BarrierRequest
+
+// ============================================================================
+/** A request to compress one block, handled by the compression threads.
+ *  The application waits for it before it writes the compressed data.
+ */
+class CompressRequest : public BlockingRequest
+{
+private:
+    /** The codec to use. */
+    ALIO::BlockCodec::Codec m_codec;
+
+    /** The uncompressed data. */
+    char   *m_input;
+
+    /** Number of bytes of uncompressed data. */
+    size_t  m_size;
+
+    /** Buffer for the compressed data. */
+    char   *m_output;
+
+    /** Codec of the stored data: CODEC_NONE if compression did not reduce
+     *  the size, in which case the input is stored. */
+    ALIO::BlockCodec::Codec m_stored_codec;
+
+    /** Number of bytes to store. */
+    size_t  m_stored_size;
+
+    /** Time in seconds used to compress the block. */
+    double  m_time;
+public:
+    CompressRequest(ALIO::BlockCodec::Codec codec, char *input, size_t size,
+                    char *output)
+        : BlockingRequest(RQ_COMPRESS)
+    {
+        m_codec        = codec;
+        m_input        = input;
+        m_size         = size;
+        m_output       = output;
+        m_stored_codec = ALIO::BlockCodec::CODEC_NONE;
+        m_stored_size  = size;
+        m_time         = 0;
+    }   // CompressRequest
+    // ------------------------------------------------------------------------
+    ALIO::BlockCodec::Codec getCodec() const { return m_codec; }
+    // ------------------------------------------------------------------------
+    char  *getInput()  { return m_input;  }
+    // ------------------------------------------------------------------------
+    size_t getSize() const { return m_size; }
+    // ------------------------------------------------------------------------
+    char  *getOutput() { return m_output; }
+    // ------------------------------------------------------------------------
+    /** Returns the data to store (compressed data or the input). */
+    const char *getStoredData() const
+    {
+        return m_stored_codec==ALIO::BlockCodec::CODEC_NONE ? m_input
+                                                            : m_output;
+    }   // getStoredData
+    // ------------------------------------------------------------------------
+    ALIO::BlockCodec::Codec getStoredCodec() const { return m_stored_codec; }
+    // ------------------------------------------------------------------------
+    size_t getStoredSize() const { return m_stored_size; }
+    // ------------------------------------------------------------------------
+    double getTime() const { return m_time; }
+    // ------------------------------------------------------------------------
+    /** Called from a compression thread to store the result. */
+    void setResult(ALIO::BlockCodec::Codec codec, size_t size, double t)
+    {
+        m_stored_codec = codec;
+        m_stored_size  = size;
+        m_time         = t;
+    }   // setResult
+};   // class CompressRequest
+
+// ============================================================================
+/** A request to read or write the parts of one backing file of a striped
+ *  file that are affected by one application call. It is handled by a
+ *  stripe IO thread, and the application waits for it.
+ */
+class StripeRequest : public BlockingRequest
+{
+public:
+    /** A contiguous part of the application buffer and its position in
+     *  the backing file. */
+    struct Segment
+    {
+        char    *m_data;
+        size_t   m_size;
+        off64_t  m_offset;
+    };   // Segment
+private:
+    /** The backing file. */
+    int                  m_filedes;
+
+    /** True for a write, false for a read. */
+    bool                 m_write;
+
+    std::vector<Segment> m_segments;
+
+    /** The errno value if the transfer failed, 0 otherwise. */
+    int                  m_error;
+public:
+    StripeRequest(int filedes, bool write)
+        : BlockingRequest(RQ_STRIPE)
+    {
+        m_filedes = filedes;
+        m_write   = write;
+        m_error   = 0;
+    }   // StripeRequest
+    // ------------------------------------------------------------------------
+    void addSegment(char *data, size_t size, off64_t offset)
+    {
+        Segment s;
+        s.m_data   = data;
+        s.m_size   = size;
+        s.m_offset = offset;
+        m_segments.push_back(s);
+    }   // addSegment
+    // ------------------------------------------------------------------------
+    int  getFiledes() const { return m_filedes; }
+    // ------------------------------------------------------------------------
+    bool isWrite() const { return m_write; }
+    // ------------------------------------------------------------------------
+    const std::vector<Segment> &getSegments() const { return m_segments; }
+    // ------------------------------------------------------------------------
+    int  getError() const { return m_error; }
+    // ------------------------------------------------------------------------
+    void setError(int error) { m_error = error; }
+};   // class StripeRequest
+
 #endif
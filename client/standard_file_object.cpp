@@ -0,0 +1,193 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "client/standard_file_object.hpp"
+
+#include "xml/xml_node.hpp"
+
+#include <errno.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace ALIO;
+
+// ----------------------------------------------------------------------------
+StandardFileObject::StandardFileObject(const XMLNode *info)
+                  : BaseFileObject(info)
+{
+    m_file       = NULL;
+    m_filedes    = -1;
+    m_sparse     = false;
+    m_disk_end   = 0;
+    m_sparse_end = 0;
+    std::string sparse, sparse_block;
+    info->get("sparse", &sparse);
+    info->get("sparse-block-size", &sparse_block);
+    if(!m_fill.parse(sparse, sparse_block))
+        printf("Invalid sparse '%s' or sparse-block-size '%s' - not "
+               "skipping blocks.\n", sparse.c_str(), sparse_block.c_str());
+}   // StandardFileObject
+
+// ----------------------------------------------------------------------------
+/** Called after a file was opened: enables skipping of fill blocks unless
+ *  the file is appended to (where the position is not under our control).
+ */
+void StandardFileObject::startSparse(bool append)
+{
+    m_sparse     = m_fill.isEnabled() && !append;
+    m_sparse_end = 0;
+    m_disk_end   = 0;
+    if(!m_sparse)
+        return;
+    struct stat64 s;
+    if(::fstat64(m_filedes, &s)==0)
+        m_disk_end = s.st_size;
+}   // startSparse
+
+// ----------------------------------------------------------------------------
+/** Writes n bytes at the current position (which is offset).
+ *  \return The number of bytes written.
+ */
+size_t StandardFileObject::writeRaw(const char *p, size_t n, off64_t offset)
+{
+    size_t done = 0;
+    if(m_file)
+        done = OS::fwrite(p, 1, n, m_file);
+    else
+    {
+        while(done<n)
+        {
+            ssize_t w = OS::write(m_filedes, p+done, n-done);
+            if(w<0 && errno==EINTR) continue;
+            if(w<=0) break;
+            done += w;
+        }
+    }
+    if(offset+(off64_t)done>m_disk_end)
+        m_disk_end = offset+done;
+    return done;
+}   // writeRaw
+
+// ----------------------------------------------------------------------------
+/** Writes n bytes at the current position, but seeks over aligned blocks
+ *  that only contain the fill value. Blocks inside data that is already on
+ *  disk are punched out instead; if that is not supported they are written.
+ *  \return The number of bytes written (including skipped blocks).
+ */
+size_t StandardFileObject::writeSparse(const char *p, size_t n)
+{
+    off64_t pos = m_file ? OS::ftello64(m_file)
+                         : OS::lseek64(m_filedes, 0, SEEK_CUR);
+    if(pos<0)
+        return writeRaw(p, n, 0);
+
+    std::vector<FillPattern::Range> runs;
+    m_fill.findFillRuns(p, n, pos, &runs);
+    size_t done = 0;
+    for(unsigned int i=0; i<runs.size(); i++)
+    {
+        size_t start = (size_t)(runs[i].first  - pos);
+        size_t end   = (size_t)(runs[i].second - pos);
+        if(start>done)
+        {
+            done += writeRaw(p+done, start-done, pos+done);
+            if(done<start)
+                return done;
+        }
+        off64_t punch_end = runs[i].second<m_disk_end ? runs[i].second
+                                                      : m_disk_end;
+        if(runs[i].first<punch_end)
+        {
+            // Buffered data could be written into the hole later.
+            if(m_file)
+                OS::fflush(m_file);
+            if(!FillPattern::punchHole(m_filedes, runs[i].first,
+                                       punch_end-runs[i].first))
+                continue;   // The run is written with the next data
+        }
+        off64_t r = m_file ? OS::fseeko64(m_file, runs[i].second, SEEK_SET)
+                           : OS::lseek64(m_filedes, runs[i].second, SEEK_SET);
+        if(r<0)
+            continue;
+        done = end;
+        if(runs[i].second>m_sparse_end)
+            m_sparse_end = runs[i].second;
+    }
+    if(done<n)
+        done += writeRaw(p+done, n-done, pos+done);
+    return done;
+}   // writeSparse
+
+// ----------------------------------------------------------------------------
+/** Extends the file if the last blocks written were skipped, so that it
+ *  has the size the application expects.
+ *  \return 0 on success, -1 on error.
+ */
+int StandardFileObject::finishSparse()
+{
+    if(m_sparse_end<=m_disk_end)
+        return 0;
+    if(m_file)
+        OS::fflush(m_file);
+    struct stat64 s;
+    if(::fstat64(m_filedes, &s)!=0)
+        return -1;
+    if(s.st_size<m_sparse_end && ::ftruncate64(m_filedes, m_sparse_end)!=0)
+        return -1;
+    m_disk_end = m_sparse_end;
+    return 0;
+}   // finishSparse
+
+// ----------------------------------------------------------------------------
+/** Extends the file (see finishSparse) before it is closed.
+ *  \return 0 on success, otherwise the errno of the failed call.
+ */
+int StandardFileObject::closeSparse()
+{
+    if(!m_sparse || finishSparse()==0)
+        return 0;
+    return errno ? errno : EIO;
+}   // closeSparse
+
+// ----------------------------------------------------------------------------
+/** Called after a read that returned less than requested: returns the fill
+ *  value for the skipped blocks at the end of the file that are not on disk
+ *  yet, and moves the position behind them.
+ *  \param done   Number of bytes that were read from disk.
+ *  \param count  Number of bytes requested.
+ *  \param offset Position before the read.
+ *  \return The number of bytes read including the fill value.
+ */
+size_t StandardFileObject::readSparseTail(char *buf, size_t done,
+                                          size_t count, off64_t offset)
+{
+    off64_t start = offset+done;
+    if(start>=m_sparse_end || done>=count)
+        return done;
+    size_t n = count-done;
+    if((off64_t)n>m_sparse_end-start)
+        n = (size_t)(m_sparse_end-start);
+    off64_t r = m_file ? OS::fseeko64(m_file, start+n, SEEK_SET)
+                       : OS::lseek64(m_filedes, start+n, SEEK_SET);
+    if(r<0)
+        return done;
+    m_fill.fill(buf+done, n, start);
+    return done+n;
+}   // readSparseTail
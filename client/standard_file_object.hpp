@@ -21,12 +21,25 @@
 
 #include "client/base_file_object.hpp"
 #include "client/config.hpp"
+#include "tools/fill_pattern.hpp"
 #include "tools/os.hpp"
 
 #include <string>
+#include <string.h>
 
 namespace ALIO
 {
+class XMLNode;
+
+/** A file object that passes all calls on to the OS. With sparse="zero"
+ *  (or a fill value like sparse="float64:1e20") aligned blocks
+ *  (sparse-block-size, default 64K) that only contain zeros or the fill
+ *  value are skipped with a seek, so the file becomes sparse. Skipped
+ *  blocks inside existing data are deallocated with a punched hole, and
+ *  the file is extended to its size when it is flushed or closed; until
+ *  then seeks, fstat and reads use that size. Files opened for appending
+ *  are written unchanged.
+ */
 class StandardFileObject : public BaseFileObject
 {
 protected:
@@ -36,6 +49,34 @@ protected:
     /** The original file descriptor. */
     int  m_filedes;
 
+private:
+    /** Detects blocks that do not need to be written. */
+    FillPattern m_fill;
+
+    /** True if fill blocks are skipped for the open file. */
+    bool    m_sparse;
+
+    /** End of the data written to disk: skipped blocks before it must be
+     *  punched out. */
+    off64_t m_disk_end;
+
+    /** End of the last skipped block; the file is extended to it when it
+     *  is flushed or closed. Until then it is the logical end of the file
+     *  if it is behind m_disk_end. */
+    off64_t m_sparse_end;
+
+    void    startSparse(bool append);
+    size_t  writeSparse(const char *p, size_t n);
+    size_t  writeRaw(const char *p, size_t n, off64_t offset);
+    size_t  readSparseTail(char *buf, size_t done, size_t count,
+                           off64_t offset);
+    int     finishSparse();
+    int     closeSparse();
+
+    // ------------------------------------------------------------------------
+    /** True if skipped blocks at the end of the file are not on disk yet. */
+    bool hasSparseTail() const { return m_sparse_end>m_disk_end; }
+
 public:
 
     /** No static init function needed. */
@@ -44,11 +85,7 @@ public:
     /** No static atExit function needed. */
     static int atExit() { return 0; }
     // ------------------------------------------------------------------------
-    StandardFileObject(const XMLNode *info) : BaseFileObject(info)
-    {
-        m_file     = NULL; 
-        m_filedes  = -1;
-    };   // StandardFileObject
+    StandardFileObject(const XMLNode *info);
 
     // ------------------------------------------------------------------------
     virtual ~StandardFileObject()
@@ -64,6 +101,7 @@ public:
         // We need to save the original filedes, in case that the
         // program uses fileno to get the file descriptor.
         m_filedes = OS::fileno(m_file);
+        startSparse(strchr(mode, 'a')!=NULL);
         return (FILE*)this;
     }   // fopen
 
@@ -76,6 +114,7 @@ public:
         // We need to save the original filedes, in case that the
         // program uses fileno to get the file descriptor.
         m_filedes = OS::fileno(m_file);
+        startSparse(strchr(mode, 'a')!=NULL);
         return (FILE*)this;
     }   // fopen
 
@@ -87,16 +126,22 @@ public:
     // ------------------------------------------------------------------------
     virtual int fseek(long offset, int whence)
     {
+        if(whence==SEEK_END && hasSparseTail())
+            return OS::fseeko64(m_file, m_sparse_end+offset, SEEK_SET);
         return OS::fseek(m_file, offset, whence);
     }   // fseeko
     // ------------------------------------------------------------------------
     virtual int fseeko(off_t offset, int whence)
     {
+        if(whence==SEEK_END && hasSparseTail())
+            return OS::fseeko64(m_file, m_sparse_end+offset, SEEK_SET);
         return OS::fseeko(m_file, offset, whence);
     }   // fseek
     // ------------------------------------------------------------------------
     virtual int fseeko64(off64_t offset, int whence)
     {
+        if(whence==SEEK_END && hasSparseTail())
+            return OS::fseeko64(m_file, m_sparse_end+offset, SEEK_SET);
         return OS::fseeko64(m_file, offset, whence);
     }   // fseeko64
     // ------------------------------------------------------------------------
@@ -117,7 +162,10 @@ public:
     // ------------------------------------------------------------------------
     virtual int fflush()
     {
-        return OS::fflush(m_file);
+        int result = OS::fflush(m_file);
+        if(result==0 && m_sparse && finishSparse()!=0)
+            result = EOF;
+        return result;
     }   // fflush
     // ------------------------------------------------------------------------
     virtual int ferror()
@@ -136,13 +184,30 @@ public:
     // ------------------------------------------------------------------------
     virtual size_t fwrite(const void *ptr,size_t size, size_t nmemb)
     {
-        return OS::fwrite(ptr, size, nmemb, m_file);
+        if(!m_sparse)
+            return OS::fwrite(ptr, size, nmemb, m_file);
+        if(size==0 || nmemb==0) return 0;
+        return writeSparse((const char*)ptr, size*nmemb)/size;
     }   // f_write
 
     // ------------------------------------------------------------------------
     virtual size_t fread(void *ptr,size_t size, size_t nmemb)
     {
-        return OS::fread(ptr, size, nmemb, m_file);
+        if(!m_fill.needsFill() && !hasSparseTail())
+            return OS::fread(ptr, size, nmemb, m_file);
+        off64_t offset = OS::ftello64(m_file);
+        size_t n = OS::fread(ptr, size, nmemb, m_file);
+        if(n>0 && offset>=0)
+            m_fill.fillHoles(m_filedes, (char*)ptr, n*size, offset);
+        if(n<nmemb && offset>=0 && hasSparseTail())
+        {
+            // A partial element was read as well, so use the position.
+            off64_t end = OS::ftello64(m_file);
+            if(end>=offset)
+                n = readSparseTail((char*)ptr, (size_t)(end-offset),
+                                   size*nmemb, offset) / size;
+        }
+        return n;
     }   // f_read
 
     // ------------------------------------------------------------------------
@@ -158,9 +223,15 @@ public:
     // ------------------------------------------------------------------------
     virtual int fclose()
     {
+        int sparse_error = closeSparse();
         int error = OS::fclose(m_file);
         if(!error)
             m_file = NULL;
+        if(sparse_error)
+        {
+            errno = sparse_error;
+            return EOF;
+        }
         return error;
     }   // fclose
 
@@ -168,12 +239,16 @@ public:
     virtual int open(int flags, mode_t mode)
     {
         m_filedes = OS::open(getFilename().c_str(), flags, mode);
+        if(m_filedes>=0)
+            startSparse((flags & O_APPEND)!=0);
         return getIndex()+Config::get()->getMaxFiles();
     }   // open
     // ------------------------------------------------------------------------
     virtual int open64(int flags, mode_t mode)
     {
         m_filedes = OS::open64(getFilename().c_str(), flags, mode);
+        if(m_filedes>=0)
+            startSparse((flags & O_APPEND)!=0);
         return getIndex()+Config::get()->getMaxFiles();
     }   // open
     // ------------------------------------------------------------------------
@@ -184,12 +259,18 @@ public:
     // ------------------------------------------------------------------------
     virtual int __fxstat(int ver, struct stat *buf)
     {
-        return OS::__fxstat(ver, m_filedes, buf);
+        int result = OS::__fxstat(ver, m_filedes, buf);
+        if(result==0 && hasSparseTail() && buf->st_size<m_sparse_end)
+            buf->st_size = m_sparse_end;
+        return result;
     }   // fstat
     // ------------------------------------------------------------------------
     virtual int __fxstat64(int ver, struct stat64 *buf)
     {
-        return OS::__fxstat64(ver, m_filedes, buf);
+        int result = OS::__fxstat64(ver, m_filedes, buf);
+        if(result==0 && hasSparseTail() && buf->st_size<m_sparse_end)
+            buf->st_size = m_sparse_end;
+        return result;
     }   // fstat
     // ------------------------------------------------------------------------
     virtual int __lxstat(int ver, struct stat *buf)
@@ -199,27 +280,49 @@ public:
     // ------------------------------------------------------------------------
     virtual off_t lseek(off_t offset, int whence)
     {
+        if(whence==SEEK_END && hasSparseTail())
+            return OS::lseek(m_filedes, m_sparse_end+offset, SEEK_SET);
         return OS::lseek(m_filedes, offset, whence);
     }   // lseek
     // ------------------------------------------------------------------------
     virtual off64_t lseek64(off64_t offset, int whence)
     {
+        if(whence==SEEK_END && hasSparseTail())
+            return OS::lseek64(m_filedes, m_sparse_end+offset, SEEK_SET);
         return OS::lseek64(m_filedes, offset, whence);
     }   // lseek64
     // ------------------------------------------------------------------------
     virtual ssize_t write(const void *buf, size_t nbyte)
     {
-        return OS::write(m_filedes, buf, nbyte);
+        if(!m_sparse)
+            return OS::write(m_filedes, buf, nbyte);
+        size_t n = writeSparse((const char*)buf, nbyte);
+        return n==0 && nbyte>0 ? -1 : (ssize_t)n;
     }   // write
     // ------------------------------------------------------------------------
     virtual ssize_t read(void *buf, size_t count)
     {
-        return OS::read(m_filedes, buf, count);
+        if(!m_fill.needsFill() && !hasSparseTail())
+            return OS::read(m_filedes, buf, count);
+        off64_t offset = OS::lseek64(m_filedes, 0, SEEK_CUR);
+        ssize_t n = OS::read(m_filedes, buf, count);
+        if(n>0 && offset>=0)
+            m_fill.fillHoles(m_filedes, (char*)buf, n, offset);
+        if(n>=0 && (size_t)n<count && offset>=0)
+            n = readSparseTail((char*)buf, n, count, offset);
+        return n;
     }   // read
     // ------------------------------------------------------------------------
     virtual int close()
     {
-        return OS::close(m_filedes);
+        int sparse_error = closeSparse();
+        int error = OS::close(m_filedes);
+        if(sparse_error)
+        {
+            errno = sparse_error;
+            return -1;
+        }
+        return error;
     }   // close
     // ------------------------------------------------------------------------
     virtual int rename(const char *newpath)
@@ -227,6 +330,8 @@ public:
         return OS::rename(getFilename().c_str(), newpath);
     }
     // ------------------------------------------------------------------------
+    virtual int unlink() { return OS::unlink(getFilename().c_str()); }
+    // ------------------------------------------------------------------------
 
 
 };   // StandardFileObject
@@ -0,0 +1,835 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "client/striped_file_object.hpp"
+
+#include "client/config.hpp"
+#include "client/thread_placement.hpp"
+#include "tools/os.hpp"
+#include "tools/string_utils.hpp"
+#include "xml/xml_node.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ALIO
+{
+
+std::vector<pthread_t> StripedFileObject::m_threads;
+Synchronised< std::deque<StripeRequest*> > StripedFileObject::m_queue;
+pthread_cond_t         StripedFileObject::m_signal;
+bool                   StripedFileObject::m_quit = false;
+std::set<StripedFileObject*> StripedFileObject::m_open_files;
+
+/** Stripe size used for plain files, so that all data maps to the first
+ *  (and only) backing file. */
+static const uint64_t PLAIN_STRIPE_SIZE = 1ULL<<62;
+
+// ----------------------------------------------------------------------------
+/** Returns the part of a path after the last '/'. */
+static std::string getBasename(const std::string &path)
+{
+    size_t slash = path.rfind('/');
+    return slash==std::string::npos ? path : path.substr(slash+1);
+}   // getBasename
+
+// ----------------------------------------------------------------------------
+/** Returns the part of a path up to and including the last '/'. */
+static std::string getDirname(const std::string &path)
+{
+    size_t slash = path.rfind('/');
+    return slash==std::string::npos ? "" : path.substr(0, slash+1);
+}   // getDirname
+
+// ----------------------------------------------------------------------------
+/** Returns the name of backing file n of a file. */
+static std::string getStripeName(const std::string &base, unsigned int n)
+{
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), ".%u", n);
+    return base+suffix;
+}   // getStripeName
+
+// ----------------------------------------------------------------------------
+/** Initialises the signal for the IO threads. The threads are only started
+ *  once a file object needs them.
+ */
+int StripedFileObject::init()
+{
+    pthread_cond_init(&m_signal, NULL);
+    m_quit = false;
+    return 0;
+}   // init
+
+// ----------------------------------------------------------------------------
+/** Closes all files that are still open for writing (so that their layout
+ *  is written), then stops the IO threads.
+ */
+int StripedFileObject::atExit()
+{
+    m_queue.lock();
+    std::set<StripedFileObject*> open_files = m_open_files;
+    m_queue.unlock();
+    std::set<StripedFileObject*>::iterator i;
+    for(i=open_files.begin(); i!=open_files.end(); i++)
+        (*i)->closeFile();
+
+    m_queue.lock();
+    m_quit = true;
+    pthread_cond_broadcast(&m_signal);
+    m_queue.unlock();
+    for(unsigned int j=0; j<m_threads.size(); j++)
+        pthread_join(m_threads[j], NULL);
+    m_threads.clear();
+    pthread_cond_destroy(&m_signal);
+    return 0;
+}   // atExit
+
+// ----------------------------------------------------------------------------
+/** Makes sure that at least n IO threads are running. */
+void StripedFileObject::startThreads(unsigned int n)
+{
+    m_queue.lock();
+    while(m_threads.size()<n)
+    {
+        pthread_t thread;
+        int error = pthread_create(&thread, NULL, &StripedFileObject::ioLoop,
+                                   NULL);
+        if(error)
+        {
+            printf("Can not create stripe IO thread: error %d.\n", error);
+            break;
+        }
+        m_threads.push_back(thread);
+    }
+    m_queue.unlock();
+}   // startThreads
+
+// ----------------------------------------------------------------------------
+/** The main loop of an IO thread: handles queued requests till the
+ *  library is unloaded.
+ */
+void *StripedFileObject::ioLoop(void *obj)
+{
+    ThreadPlacement::pinCurrentThread();
+    while(1)
+    {
+        m_queue.lock();
+        std::deque<StripeRequest*> &queue = m_queue.getData();
+        while(queue.empty() && !m_quit)
+            pthread_cond_wait(&m_signal, m_queue.getMutex());
+        if(queue.empty())
+        {
+            m_queue.unlock();
+            break;
+        }
+        StripeRequest *request = queue.front();
+        queue.pop_front();
+        m_queue.unlock();
+        transferSegments(request);
+        request->done();
+    }
+    return NULL;
+}   // ioLoop
+
+// ----------------------------------------------------------------------------
+/** Reads or writes all segments of a request. Data after the end of a
+ *  backing file reads as zeros (another stripe of the file is longer).
+ */
+void StripedFileObject::transferSegments(StripeRequest *request)
+{
+    const std::vector<StripeRequest::Segment> &segments =
+        request->getSegments();
+    for(unsigned int i=0; i<segments.size(); i++)
+    {
+        char   *p      = segments[i].m_data;
+        size_t  n      = segments[i].m_size;
+        off64_t offset = segments[i].m_offset;
+        while(n>0)
+        {
+            ssize_t count = request->isWrite()
+                          ? ::pwrite64(request->getFiledes(), p, n, offset)
+                          : ::pread64 (request->getFiledes(), p, n, offset);
+            if(count<0 && errno==EINTR)
+                continue;
+            if(count<0 || (count==0 && request->isWrite()))
+            {
+                request->setError(count<0 ? errno : EIO);
+                return;
+            }
+            if(count==0)
+            {
+                memset(p, 0, n);
+                break;
+            }
+            p      += count;
+            n      -= count;
+            offset += count;
+        }
+    }
+}   // transferSegments
+
+// ----------------------------------------------------------------------------
+/** Constructor. Reads the number of stripes, stripe size, directories and
+ *  number of IO threads from the io node.
+ */
+StripedFileObject::StripedFileObject(const XMLNode *info)
+                 : BaseFileObject(info)
+{
+    m_layout_fd = -1;
+    m_plain     = false;
+    m_dirty     = false;
+    m_position  = 0;
+    m_readable  = false;
+    m_writable  = false;
+    m_append    = false;
+    m_stream    = false;
+    m_eof       = false;
+    m_error     = false;
+
+    int count = 4;
+    info->get("count", &count);
+    if(count<1 || count>1024)
+    {
+        printf("Invalid stripe count %d - using 4.\n", count);
+        count = 4;
+    }
+    m_count = count;
+
+    std::string s;
+    int64_t stripe_size = 1024*1024;
+    if(info->get("stripe-size", &s) &&
+       (!StringUtils::parseSize(s, &stripe_size) || stripe_size<4096) )
+    {
+        printf("Invalid stripe-size '%s' - using 1M.\n", s.c_str());
+        stripe_size = 1024*1024;
+    }
+    m_stripe_size = stripe_size;
+
+    if(info->get("directories", &s))
+    {
+        std::vector<std::string> dirs = StringUtils::split(s, ',');
+        for(unsigned int i=0; i<dirs.size(); i++)
+            if(!dirs[i].empty())
+                m_directories.push_back(dirs[i]);
+    }
+
+    int threads = m_count;
+    info->get("threads", &threads);
+    if(threads<0)  threads = 0;
+    if(threads>64) threads = 64;
+    if(threads>0)
+        startThreads(threads);
+}   // StripedFileObject
+
+// ----------------------------------------------------------------------------
+StripedFileObject::~StripedFileObject()
+{
+    m_queue.lock();
+    m_open_files.erase(this);
+    m_queue.unlock();
+}   // ~StripedFileObject
+
+// ----------------------------------------------------------------------------
+/** Converts an fopen mode to open flags.
+ *  \return False (and sets errno) if the mode is invalid.
+ */
+bool StripedFileObject::modeToFlags(const char *mode, int *flags)
+{
+    switch(mode[0])
+    {
+    case 'r': *flags = O_RDONLY;                   break;
+    case 'w': *flags = O_WRONLY|O_CREAT|O_TRUNC;   break;
+    case 'a': *flags = O_WRONLY|O_CREAT|O_APPEND;  break;
+    default:
+        errno = EINVAL;
+        return false;
+    }
+    if(strchr(mode, '+'))
+        *flags = (*flags & ~O_ACCMODE) | O_RDWR;
+    if(strchr(mode, 'x'))
+        *flags |= O_EXCL;
+    return true;
+}   // modeToFlags
+
+// ----------------------------------------------------------------------------
+/** Creates new (empty) backing files and writes the layout.
+ *  \return False (and sets errno) if a backing file can not be created.
+ */
+bool StripedFileObject::createStripes(int flags, mode_t mode)
+{
+    std::string base = getBasename(getFilename());
+    m_layout.m_stripe_size = m_stripe_size;
+    m_layout.m_size        = 0;
+    m_layout.m_names.clear();
+    for(unsigned int i=0; i<m_count; i++)
+    {
+        std::string name = getStripeName(base, i);
+        if(!m_directories.empty())
+            name = m_directories[i % m_directories.size()]+"/"+name;
+        m_layout.m_names.push_back(name);
+    }
+    int access = m_readable ? O_RDWR : O_WRONLY;
+    for(unsigned int i=0; i<m_count; i++)
+    {
+        std::string path = m_layout.getPath(i, getFilename());
+        int fd = OS::open(path.c_str(), access|O_CREAT|O_TRUNC, mode);
+        if(fd<0)
+        {
+            printf("Can not create stripe '%s': %s.\n", path.c_str(),
+                   strerror(errno));
+            return false;
+        }
+        m_fds.push_back(fd);
+    }
+    m_dirty = true;
+    return writeLayout()==0;
+}   // createStripes
+
+// ----------------------------------------------------------------------------
+/** Opens the backing files of an existing striped file.
+ *  \return False (and sets errno) if a backing file can not be opened.
+ */
+bool StripedFileObject::openStripes(int flags)
+{
+    int access = m_writable ? (m_readable ? O_RDWR : O_WRONLY) : O_RDONLY;
+    for(unsigned int i=0; i<m_layout.m_names.size(); i++)
+    {
+        std::string path = m_layout.getPath(i, getFilename());
+        int fd = OS::open(path.c_str(), access|(m_writable ? O_CREAT : 0),
+                          0644);
+        if(fd<0)
+        {
+            printf("Can not open stripe '%s': %s.\n", path.c_str(),
+                   strerror(errno));
+            return false;
+        }
+        m_fds.push_back(fd);
+    }
+    return true;
+}   // openStripes
+
+// ----------------------------------------------------------------------------
+/** Opens the layout file and the backing files. An empty or truncated
+ *  file becomes a new striped file; an existing file that is not striped
+ *  is used as it is.
+ *  \return False (and sets errno) if the file can not be opened.
+ */
+bool StripedFileObject::openFile(int flags, mode_t mode)
+{
+    int access = flags & O_ACCMODE;
+    m_readable = access!=O_WRONLY;
+    m_writable = access!=O_RDONLY;
+    m_append   = (flags & O_APPEND)!=0;
+    m_position = 0;
+    m_eof      = false;
+    m_error    = false;
+    m_plain    = false;
+    m_dirty    = false;
+    m_fds.clear();
+
+    // The layout is read even if the file is only written.
+    m_layout_fd = OS::open(getFilename().c_str(),
+                           (flags & (O_CREAT|O_EXCL)) |
+                           (m_writable ? O_RDWR : O_RDONLY), mode);
+    if(m_layout_fd<0)
+        return false;
+
+    struct stat64 buf;
+    bool ok;
+    if(::fstat64(m_layout_fd, &buf)!=0)
+        ok = false;
+    else if(StripeLayout::isLayout(m_layout_fd))
+    {
+        ok = m_layout.read(m_layout_fd);
+        if(!ok)
+            errno = EINVAL;
+        else if(m_writable && (flags & O_TRUNC))
+        {
+            for(unsigned int i=0; i<m_layout.m_names.size(); i++)
+                OS::unlink(m_layout.getPath(i, getFilename()).c_str());
+            ok = createStripes(flags, mode);
+        }
+        else
+            ok = openStripes(flags);
+    }
+    else if(m_writable && (buf.st_size==0 || (flags & O_TRUNC)))
+        ok = ::ftruncate64(m_layout_fd, 0)==0 && createStripes(flags, mode);
+    else
+    {
+        m_plain                = true;
+        m_layout.m_stripe_size = PLAIN_STRIPE_SIZE;
+        m_layout.m_size        = buf.st_size;
+        m_layout.m_names.assign(1, getFilename());
+        m_fds.push_back(m_layout_fd);
+        ok = true;
+    }
+    if(!ok)
+    {
+        int error = errno;
+        for(unsigned int i=0; i<m_fds.size(); i++)
+            if(m_fds[i]!=m_layout_fd)
+                OS::close(m_fds[i]);
+        m_fds.clear();
+        OS::close(m_layout_fd);
+        m_layout_fd = -1;
+        errno = error;
+        return false;
+    }
+    if(m_writable)
+    {
+        m_queue.lock();
+        m_open_files.insert(this);
+        m_queue.unlock();
+    }
+    return true;
+}   // openFile
+
+// ----------------------------------------------------------------------------
+/** Writes the layout if the size changed.
+ *  \return 0 on success, -1 (and errno set) on error.
+ */
+int StripedFileObject::writeLayout()
+{
+    if(m_plain || !m_dirty)
+        return 0;
+    if(!m_layout.write(m_layout_fd))
+        return -1;
+    m_dirty = false;
+    return 0;
+}   // writeLayout
+
+// ----------------------------------------------------------------------------
+/** Writes the layout and closes all files. */
+int StripedFileObject::closeFile()
+{
+    if(m_layout_fd<0)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    int result = writeLayout();
+    int error  = errno;
+    for(unsigned int i=0; i<m_fds.size(); i++)
+    {
+        if(m_fds[i]!=m_layout_fd && OS::close(m_fds[i])!=0 && result==0)
+        {
+            result = -1;
+            error  = errno;
+        }
+    }
+    m_fds.clear();
+    if(OS::close(m_layout_fd)!=0 && result==0)
+    {
+        result = -1;
+        error  = errno;
+    }
+    m_layout_fd = -1;
+    m_queue.lock();
+    m_open_files.erase(this);
+    m_queue.unlock();
+    errno = error;
+    return result;
+}   // closeFile
+
+// ----------------------------------------------------------------------------
+/** Reads or writes n bytes at the current position. The data is split by
+ *  backing file; if several backing files are involved, all but one are
+ *  handled by the IO threads while the calling thread does the remaining
+ *  one.
+ *  \return The number of bytes transferred, or -1 (and errno set).
+ */
+ssize_t StripedFileObject::transfer(char *buf, size_t n, bool write)
+{
+    if(m_layout_fd<0 || (write ? !m_writable : !m_readable))
+    {
+        errno = EBADF;
+        return -1;
+    }
+    if(write && m_append)
+        m_position = m_layout.m_size;
+    if(!write)
+    {
+        if(m_position>=(off64_t)m_layout.m_size)
+            n = 0;
+        else if(n>m_layout.m_size-m_position)
+            n = m_layout.m_size-m_position;
+    }
+    if(n==0)
+        return 0;
+
+    std::vector<StripeRequest*> requests(m_fds.size(), (StripeRequest*)NULL);
+    size_t  done     = 0;
+    off64_t position = m_position;
+    while(done<n)
+    {
+        unsigned int stripe;
+        off64_t      backing;
+        size_t       count;
+        m_layout.map(position, &stripe, &backing, &count);
+        if(count>n-done)
+            count = n-done;
+        if(!requests[stripe])
+            requests[stripe] = new StripeRequest(m_fds[stripe], write);
+        requests[stripe]->addSegment(buf+done, count, backing);
+        done     += count;
+        position += count;
+    }
+
+    StripeRequest *own = NULL;
+    std::vector<StripeRequest*> queued;
+    for(unsigned int i=0; i<requests.size(); i++)
+    {
+        if(!requests[i]) continue;
+        if(!own || m_threads.empty())
+        {
+            transferSegments(requests[i]);
+            if(!own) own = requests[i];
+            else     requests[i]->done();
+        }
+        else
+            queued.push_back(requests[i]);
+    }
+    if(!queued.empty())
+    {
+        m_queue.lock();
+        for(unsigned int i=0; i<queued.size(); i++)
+            m_queue.getData().push_back(queued[i]);
+        pthread_cond_broadcast(&m_signal);
+        m_queue.unlock();
+    }
+    int error = 0;
+    for(unsigned int i=0; i<requests.size(); i++)
+    {
+        if(!requests[i]) continue;
+        if(requests[i]!=own)
+            requests[i]->wait();
+        if(!error)
+            error = requests[i]->getError();
+        delete requests[i];
+    }
+    if(error)
+    {
+        errno = error;
+        return -1;
+    }
+    m_position = position;
+    if(write && m_position>(off64_t)m_layout.m_size)
+    {
+        m_layout.m_size = m_position;
+        m_dirty         = true;
+    }
+    return n;
+}   // transfer
+
+// ----------------------------------------------------------------------------
+/** Changes the position.
+ *  \return The new position, or -1 (and errno set).
+ */
+off64_t StripedFileObject::seek(off64_t offset, int whence)
+{
+    off64_t base;
+    switch(whence)
+    {
+    case SEEK_SET: base = 0;               break;
+    case SEEK_CUR: base = m_position;      break;
+    case SEEK_END: base = m_layout.m_size; break;
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+    if(m_layout_fd<0 || base+offset<0)
+    {
+        errno = m_layout_fd<0 ? EBADF : EINVAL;
+        return -1;
+    }
+    m_position = base+offset;
+    m_eof      = false;
+    return m_position;
+}   // seek
+
+// ----------------------------------------------------------------------------
+/** Replaces the size of the layout file with the logical size, and the
+ *  number of blocks with the sum of all backing files.
+ */
+template<typename T>
+void StripedFileObject::adjustStat(T *buf)
+{
+    if(m_plain)
+        return;
+    buf->st_size = m_layout.m_size;
+    for(unsigned int i=0; i<m_fds.size(); i++)
+    {
+        struct stat64 s;
+        if(::fstat64(m_fds[i], &s)==0)
+            buf->st_blocks += s.st_blocks;
+    }
+}   // adjustStat
+
+// ----------------------------------------------------------------------------
+FILE *StripedFileObject::fopen(const char *mode)
+{
+    int flags;
+    if(!modeToFlags(mode, &flags) || !openFile(flags, 0666))
+        return NULL;
+    m_stream = true;
+    return (FILE*)this;
+}   // fopen
+
+// ----------------------------------------------------------------------------
+FILE *StripedFileObject::fopen64(const char *mode)
+{
+    return fopen(mode);
+}   // fopen64
+
+// ----------------------------------------------------------------------------
+int StripedFileObject::fseek(long offset, int whence)
+{
+    return seek(offset, whence)<0 ? -1 : 0;
+}   // fseek
+
+// ----------------------------------------------------------------------------
+int StripedFileObject::fseeko(off_t offset, int whence)
+{
+    return seek(offset, whence)<0 ? -1 : 0;
+}   // fseeko
+
+// ----------------------------------------------------------------------------
+int StripedFileObject::fseeko64(off64_t offset, int whence)
+{
+    return seek(offset, whence)<0 ? -1 : 0;
+}   // fseeko64
+
+// ----------------------------------------------------------------------------
+long StripedFileObject::ftell()
+{
+    return m_position;
+}   // ftell
+
+// ----------------------------------------------------------------------------
+off_t StripedFileObject::ftello()
+{
+    return m_position;
+}   // ftello
+
+// ----------------------------------------------------------------------------
+off64_t StripedFileObject::ftello64()
+{
+    return m_position;
+}   // ftello64
+
+// ----------------------------------------------------------------------------
+int StripedFileObject::fflush()
+{
+    return writeLayout()==0 ? 0 : EOF;
+}   // fflush
+
+// ----------------------------------------------------------------------------
+size_t StripedFileObject::fwrite(const void *ptr, size_t size, size_t nmemb)
+{
+    if(size==0 || nmemb==0)
+        return 0;
+    ssize_t n = transfer((char*)ptr, size*nmemb, /*write*/true);
+    if(n<0)
+    {
+        m_error = true;
+        return 0;
+    }
+    return n/size;
+}   // fwrite
+
+// ----------------------------------------------------------------------------
+size_t StripedFileObject::fread(void *ptr, size_t size, size_t nmemb)
+{
+    if(size==0 || nmemb==0)
+        return 0;
+    ssize_t n = transfer((char*)ptr, size*nmemb, /*write*/false);
+    if(n<0)
+    {
+        m_error = true;
+        return 0;
+    }
+    if(n<(ssize_t)(size*nmemb))
+        m_eof = true;
+    return n/size;
+}   // fread
+
+// ----------------------------------------------------------------------------
+char *StripedFileObject::fgets(char *s, int size)
+{
+    if(size<=0)
+        return NULL;
+    int n = 0;
+    while(n<size-1)
+    {
+        ssize_t count = transfer(s+n, 1, /*write*/false);
+        if(count<=0)
+        {
+            if(count<0) m_error = true;
+            else        m_eof   = true;
+            break;
+        }
+        if(s[n++]=='\n')
+            break;
+    }
+    if(n==0)
+        return NULL;
+    s[n] = 0;
+    return s;
+}   // fgets
+
+// ----------------------------------------------------------------------------
+int StripedFileObject::fclose()
+{
+    return closeFile()==0 ? 0 : EOF;
+}   // fclose
+
+// ----------------------------------------------------------------------------
+int StripedFileObject::open(int flags, mode_t mode)
+{
+    if(!openFile(flags, mode))
+        return -1;
+    m_stream = false;
+    return getIndex()+Config::get()->getMaxFiles();
+}   // open
+
+// ----------------------------------------------------------------------------
+int StripedFileObject::open64(int flags, mode_t mode)
+{
+    return open(flags, mode);
+}   // open64
+
+// ----------------------------------------------------------------------------
+/** Stats a file by name, reporting the logical size of striped files. */
+int StripedFileObject::__xstat(int ver, struct stat *buf)
+{
+    if(OS::__xstat(ver, getFilename().c_str(), buf)!=0)
+        return -1;
+    int fd = OS::open(getFilename().c_str(), O_RDONLY, 0);
+    StripeLayout layout;
+    if(fd>=0 && layout.read(fd))
+        buf->st_size = layout.m_size;
+    if(fd>=0)
+        OS::close(fd);
+    return 0;
+}   // __xstat
+
+// ----------------------------------------------------------------------------
+int StripedFileObject::__lxstat(int ver, struct stat *buf)
+{
+    return __xstat(ver, buf);
+}   // __lxstat
+
+// ----------------------------------------------------------------------------
+int StripedFileObject::__fxstat(int ver, struct stat *buf)
+{
+    if(OS::__fxstat(ver, m_layout_fd, buf)!=0)
+        return -1;
+    adjustStat(buf);
+    return 0;
+}   // __fxstat
+
+// ----------------------------------------------------------------------------
+int StripedFileObject::__fxstat64(int ver, struct stat64 *buf)
+{
+    if(OS::__fxstat64(ver, m_layout_fd, buf)!=0)
+        return -1;
+    adjustStat(buf);
+    return 0;
+}   // __fxstat64
+
+// ----------------------------------------------------------------------------
+off_t StripedFileObject::lseek(off_t offset, int whence)
+{
+    return seek(offset, whence);
+}   // lseek
+
+// ----------------------------------------------------------------------------
+off64_t StripedFileObject::lseek64(off64_t offset, int whence)
+{
+    return seek(offset, whence);
+}   // lseek64
+
+// ----------------------------------------------------------------------------
+ssize_t StripedFileObject::write(const void *buf, size_t nbyte)
+{
+    return transfer((char*)buf, nbyte, /*write*/true);
+}   // write
+
+// ----------------------------------------------------------------------------
+ssize_t StripedFileObject::read(void *buf, size_t count)
+{
+    return transfer((char*)buf, count, /*write*/false);
+}   // read
+
+// ----------------------------------------------------------------------------
+int StripedFileObject::close()
+{
+    return closeFile();
+}   // close
+
+// ----------------------------------------------------------------------------
+/** Renames a striped file: the backing files are renamed to match the new
+ *  name (staying in their directories), and the layout is updated.
+ */
+int StripedFileObject::rename(const char *newpath)
+{
+    int fd = OS::open(getFilename().c_str(), O_RDWR, 0);
+    StripeLayout layout;
+    if(fd>=0 && layout.read(fd))
+    {
+        std::string base = getBasename(newpath);
+        StripeLayout renamed = layout;
+        for(unsigned int i=0; i<layout.m_names.size(); i++)
+        {
+            std::string old_path = layout.getPath(i, getFilename());
+            renamed.m_names[i]   = getDirname(layout.m_names[i])
+                                 + getStripeName(base, i);
+            std::string new_path = renamed.getPath(i, newpath);
+            if(OS::rename(old_path.c_str(), new_path.c_str())!=0)
+                printf("Can not rename stripe '%s' to '%s': %s.\n",
+                       old_path.c_str(), new_path.c_str(), strerror(errno));
+        }
+        renamed.write(fd);
+    }
+    if(fd>=0)
+        OS::close(fd);
+    return OS::rename(getFilename().c_str(), newpath);
+}   // rename
+
+// ----------------------------------------------------------------------------
+/** Removes the layout and all backing files. */
+int StripedFileObject::unlink()
+{
+    int fd = OS::open(getFilename().c_str(), O_RDONLY, 0);
+    StripeLayout layout;
+    if(fd>=0 && layout.read(fd))
+    {
+        for(unsigned int i=0; i<layout.m_names.size(); i++)
+            OS::unlink(layout.getPath(i, getFilename()).c_str());
+    }
+    if(fd>=0)
+        OS::close(fd);
+    return OS::unlink(getFilename().c_str());
+}   // unlink
+
+}   // namespace ALIO
@@ -0,0 +1,155 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef HEADER_STRIPED_FILE_OBJECT_HPP
+#define HEADER_STRIPED_FILE_OBJECT_HPP
+
+#include "client/base_file_object.hpp"
+#include "client/request.hpp"
+#include "tools/stripe_layout.hpp"
+#include "tools/synchronised.hpp"
+
+#include <deque>
+#include <pthread.h>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace ALIO
+{
+
+/** A file object that spreads one logical file over several backing files
+ *  (<io type="stripe" .../>), e.g. on different disks or OSTs, to get
+ *  their aggregate bandwidth. The file is split into stripes (stripe-size,
+ *  default 1M) that are assigned round-robin to count (default 4) backing
+ *  files. The backing files are called NAME.0, NAME.1, ... and are
+ *  created in the directories listed in directories (comma separated, used
+ *  round-robin), or next to the file. The logical file itself only
+ *  contains the layout (see StripeLayout), which is updated on flush and
+ *  close. Calls that touch several backing files are split, and the parts
+ *  are transferred concurrently by a pool of IO threads (threads, default
+ *  count). stat reports the logical size. Existing files that are not
+ *  striped are accessed unchanged. The tool unstripe converts a striped
+ *  file back into a plain file.
+ */
+class StripedFileObject : public BaseFileObject
+{
+private:
+    /** Configuration. */
+    unsigned int              m_count;
+    uint64_t                  m_stripe_size;
+    std::vector<std::string>  m_directories;
+
+    /** The layout file (or the plain file if it is not striped). */
+    int                       m_layout_fd;
+
+    /** The backing files. */
+    std::vector<int>          m_fds;
+
+    StripeLayout              m_layout;
+
+    /** True if the file is a plain file that is accessed unchanged. */
+    bool                      m_plain;
+
+    /** True if the layout needs to be written. */
+    bool                      m_dirty;
+
+    off64_t                   m_position;
+    bool                      m_readable;
+    bool                      m_writable;
+    bool                      m_append;
+    bool                      m_stream;
+    bool                      m_eof;
+    bool                      m_error;
+
+    /** The IO threads. */
+    static std::vector<pthread_t> m_threads;
+
+    /** Requests for the IO threads. The lock also protects m_quit and
+     *  m_open_files. */
+    static Synchronised< std::deque<StripeRequest*> > m_queue;
+
+    /** Signals the IO threads that a request was queued. */
+    static pthread_cond_t     m_signal;
+
+    static bool               m_quit;
+
+    /** All files open for writing, so that their layout is written at
+     *  exit. */
+    static std::set<StripedFileObject*> m_open_files;
+
+    static void  startThreads(unsigned int n);
+    static void *ioLoop(void *obj);
+    static void  transferSegments(StripeRequest *request);
+    static bool  modeToFlags(const char *mode, int *flags);
+
+    bool    openFile(int flags, mode_t mode);
+    bool    createStripes(int flags, mode_t mode);
+    bool    openStripes(int flags);
+    int     writeLayout();
+    int     closeFile();
+    ssize_t transfer(char *buf, size_t n, bool write);
+    off64_t seek(off64_t offset, int whence);
+    template<typename T> void adjustStat(T *buf);
+
+public:
+    static int init();
+    static int atExit();
+
+             StripedFileObject(const XMLNode *info);
+    virtual ~StripedFileObject();
+
+    virtual FILE   *fopen(const char *mode);
+    virtual FILE   *fopen64(const char *mode);
+    virtual int     fseek(long offset, int whence);
+    virtual int     fseeko(off_t offset, int whence);
+    virtual int     fseeko64(off64_t offset, int whence);
+    virtual long    ftell();
+    virtual off_t   ftello();
+    virtual off64_t ftello64();
+    virtual int     fflush();
+    virtual size_t  fwrite(const void *ptr, size_t size, size_t nmemb);
+    virtual size_t  fread(void *ptr, size_t size, size_t nmemb);
+    virtual char   *fgets(char *s, int size);
+    virtual int     fclose();
+    virtual int     open(int flags, mode_t mode);
+    virtual int     open64(int flags, mode_t mode);
+    virtual int     __xstat(int ver, struct stat *buf);
+    virtual int     __fxstat(int ver, struct stat *buf);
+    virtual int     __fxstat64(int ver, struct stat64 *buf);
+    virtual int     __lxstat(int ver, struct stat *buf);
+    virtual off_t   lseek(off_t offset, int whence);
+    virtual off64_t lseek64(off64_t offset, int whence);
+    virtual ssize_t write(const void *buf, size_t nbyte);
+    virtual ssize_t read(void *buf, size_t count);
+    virtual int     close();
+    virtual int     rename(const char *newpath);
+    virtual int     unlink();
+
+    // ------------------------------------------------------------------------
+    virtual int     setvbuf(char *buf, int mode, size_t size) { return 0; }
+    // ------------------------------------------------------------------------
+    virtual int     ferror() { return m_error ? 1 : 0; }
+    // ------------------------------------------------------------------------
+    virtual int     feof() { return m_eof ? 1 : 0; }
+    // ------------------------------------------------------------------------
+    virtual int     fileno() { return m_layout_fd; }
+};   // StripedFileObject
+
+}   // namespace ALIO
+#endif
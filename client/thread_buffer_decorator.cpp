@@ -0,0 +1,627 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "client/thread_buffer_decorator.hpp"
+
+#include "tools/buffer_arena.hpp"
+#include "tools/string_utils.hpp"
+#include "xml/xml_node.hpp"
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace ALIO
+{
+
+pthread_mutex_t ThreadBufferFileObjectDecorator::m_buffers_lock
+                                               = PTHREAD_MUTEX_INITIALIZER;
+std::set<ThreadBufferFileObjectDecorator*>
+                ThreadBufferFileObjectDecorator::m_open_files;
+
+namespace
+{
+    pthread_once_t g_key_once = PTHREAD_ONCE_INIT;
+    pthread_key_t  g_key;
+
+    /** The buffers of the current thread (the entries are of type
+     *  ThreadBuffer, which is private to the decorator). */
+    __thread std::vector<void*> *g_thread_buffers = NULL;
+}   // namespace
+
+// ----------------------------------------------------------------------------
+int ThreadBufferFileObjectDecorator::init()
+{
+    return 0;
+}   // init
+
+// ----------------------------------------------------------------------------
+/** Merges the buffers of all files that are still open into the files, so
+ *  that no data is lost (the main thread does not call threadExit).
+ */
+int ThreadBufferFileObjectDecorator::atExit()
+{
+    pthread_mutex_lock(&m_buffers_lock);
+    std::set<ThreadBufferFileObjectDecorator*> open_files = m_open_files;
+    pthread_mutex_unlock(&m_buffers_lock);
+    std::set<ThreadBufferFileObjectDecorator*>::iterator i;
+    for(i=open_files.begin(); i!=open_files.end(); i++)
+    {
+        (*i)->mergeAll(/*complete_only*/false);
+        pthread_mutex_lock(&(*i)->m_lock);
+        (*i)->I_FileObjectDecorator::fflush();
+        pthread_mutex_unlock(&(*i)->m_lock);
+    }
+    return 0;
+}   // atExit
+
+// ----------------------------------------------------------------------------
+/** Called when a thread that used thread buffers exits: merges its buffers
+ *  into their files and frees them.
+ */
+void ThreadBufferFileObjectDecorator::threadExit(void *data)
+{
+    std::vector<void*> *list = (std::vector<void*>*)data;
+    pthread_mutex_lock(&m_buffers_lock);
+    for(unsigned int i=0; i<list->size(); i++)
+    {
+        ThreadBuffer *tb = (ThreadBuffer*)(*list)[i];
+        ThreadBufferFileObjectDecorator *owner =
+            __atomic_load_n(&tb->m_owner, __ATOMIC_ACQUIRE);
+        if(owner)
+        {
+            pthread_mutex_lock(&tb->m_lock);
+            owner->mergeBuffer(tb, tb->m_fill);
+            pthread_mutex_unlock(&tb->m_lock);
+            std::vector<ThreadBuffer*> &buffers = owner->m_buffers;
+            for(unsigned int j=0; j<buffers.size(); j++)
+            {
+                if(buffers[j]!=tb) continue;
+                buffers.erase(buffers.begin()+j);
+                break;
+            }
+            BufferArena::free(tb->m_data);
+        }
+        pthread_mutex_destroy(&tb->m_lock);
+        delete tb;
+    }
+    pthread_mutex_unlock(&m_buffers_lock);
+    delete list;
+    if(g_thread_buffers==list)
+        g_thread_buffers = NULL;
+}   // threadExit
+
+// ----------------------------------------------------------------------------
+void ThreadBufferFileObjectDecorator::createKey()
+{
+    pthread_key_create(&g_key, threadExit);
+}   // createKey
+
+// ----------------------------------------------------------------------------
+/** Constructor. Reads the buffer size and record mode from the addon node.
+ */
+ThreadBufferFileObjectDecorator::ThreadBufferFileObjectDecorator(
+                                 I_FileObject *parent, const XMLNode *info)
+                               : I_FileObjectDecorator(parent, info)
+{
+    m_stream = false;
+    m_error  = 0;
+    pthread_mutex_init(&m_lock, NULL);
+
+    std::string s;
+    int64_t size = 1024*1024;
+    if(info->get("size", &s) &&
+       (!StringUtils::parseSize(s, &size) || size<4096 ||
+        size>256*1024*1024) )
+    {
+        printf("Invalid thread buffer size '%s' - using 1M.\n", s.c_str());
+        size = 1024*1024;
+    }
+    m_size = size;
+
+    m_fortran_records = false;
+    if(info->get("records", &s))
+    {
+        if(s=="fortran")
+            m_fortran_records = true;
+        else if(s!="none")
+            printf("Invalid records '%s' - using none.\n", s.c_str());
+    }
+}   // ThreadBufferFileObjectDecorator
+
+// ----------------------------------------------------------------------------
+ThreadBufferFileObjectDecorator::~ThreadBufferFileObjectDecorator()
+{
+    releaseBuffers();
+    pthread_mutex_destroy(&m_lock);
+}   // ~ThreadBufferFileObjectDecorator
+
+// ----------------------------------------------------------------------------
+/** Returns the buffer of the calling thread for this file, and creates it
+ *  if necessary. Only the creation needs a lock.
+ */
+ThreadBufferFileObjectDecorator::ThreadBuffer *
+                            ThreadBufferFileObjectDecorator::getThreadBuffer()
+{
+    std::vector<void*> *list = g_thread_buffers;
+    if(list)
+    {
+        for(unsigned int i=0; i<list->size(); i++)
+        {
+            ThreadBuffer *tb = (ThreadBuffer*)(*list)[i];
+            if(__atomic_load_n(&tb->m_owner, __ATOMIC_ACQUIRE)==this)
+                return tb;
+        }
+        // Remove the buffers of files that were closed.
+        unsigned int n = 0;
+        for(unsigned int i=0; i<list->size(); i++)
+        {
+            ThreadBuffer *tb = (ThreadBuffer*)(*list)[i];
+            if(__atomic_load_n(&tb->m_owner, __ATOMIC_ACQUIRE))
+            {
+                (*list)[n++] = tb;
+                continue;
+            }
+            pthread_mutex_destroy(&tb->m_lock);
+            delete tb;
+        }
+        list->resize(n);
+    }
+    else
+    {
+        pthread_once(&g_key_once, createKey);
+        list = new std::vector<void*>();
+        g_thread_buffers = list;
+    }
+
+    ThreadBuffer *tb = new ThreadBuffer();
+    tb->m_data = BufferArena::allocate(m_size);
+    if(!tb->m_data)
+    {
+        delete tb;
+        return NULL;
+    }
+    pthread_mutex_init(&tb->m_lock, NULL);
+    tb->m_capacity = m_size;
+    tb->m_fill     = 0;
+    tb->m_complete = 0;
+    tb->m_owner    = this;
+    list->push_back(tb);
+    pthread_mutex_lock(&m_buffers_lock);
+    m_buffers.push_back(tb);
+    pthread_mutex_unlock(&m_buffers_lock);
+    // The key only triggers threadExit, the data is read via
+    // g_thread_buffers. Setting it again with the same value is cheap.
+    pthread_setspecific(g_key, list);
+    return tb;
+}   // getThreadBuffer
+
+// ----------------------------------------------------------------------------
+bool ThreadBufferFileObjectDecorator::parentWrite(const char *p, size_t n)
+{
+    if(m_stream)
+    {
+        if(I_FileObjectDecorator::fwrite(p, 1, n)==n)
+            return true;
+        m_error = errno ? errno : EIO;
+        return false;
+    }
+    while(n>0)
+    {
+        ssize_t count = I_FileObjectDecorator::write(p, n);
+        if(count<0 && errno==EINTR)
+            continue;
+        if(count<=0)
+        {
+            m_error = count<0 ? errno : EIO;
+            return false;
+        }
+        p += count;
+        n -= count;
+    }
+    return true;
+}   // parentWrite
+
+// ----------------------------------------------------------------------------
+/** Writes the first n bytes of a thread buffer to the decorated file and
+ *  moves the rest to the front. The lock of the buffer must be held.
+ */
+void ThreadBufferFileObjectDecorator::mergeBuffer(ThreadBuffer *tb, size_t n)
+{
+    if(n==0)
+        return;
+    pthread_mutex_lock(&m_lock);
+    parentWrite(tb->m_data, n);
+    pthread_mutex_unlock(&m_lock);
+    memmove(tb->m_data, tb->m_data+n, tb->m_fill-n);
+    tb->m_fill    -= n;
+    tb->m_complete = tb->m_complete>n ? tb->m_complete-n : 0;
+}   // mergeBuffer
+
+// ----------------------------------------------------------------------------
+/** Merges the buffers of all threads into the file.
+ *  \param complete_only If true, incomplete Fortran records are kept.
+ */
+void ThreadBufferFileObjectDecorator::mergeAll(bool complete_only)
+{
+    pthread_mutex_lock(&m_buffers_lock);
+    for(unsigned int i=0; i<m_buffers.size(); i++)
+    {
+        ThreadBuffer *tb = m_buffers[i];
+        pthread_mutex_lock(&tb->m_lock);
+        mergeBuffer(tb, complete_only ? tb->m_complete : tb->m_fill);
+        pthread_mutex_unlock(&tb->m_lock);
+    }
+    pthread_mutex_unlock(&m_buffers_lock);
+}   // mergeAll
+
+// ----------------------------------------------------------------------------
+/** Frees the buffers of all threads, and marks them as no longer in use so
+ *  that the threads remove them from their lists.
+ */
+void ThreadBufferFileObjectDecorator::releaseBuffers()
+{
+    pthread_mutex_lock(&m_buffers_lock);
+    for(unsigned int i=0; i<m_buffers.size(); i++)
+    {
+        BufferArena::free(m_buffers[i]->m_data);
+        m_buffers[i]->m_data = NULL;
+        __atomic_store_n(&m_buffers[i]->m_owner,
+                         (ThreadBufferFileObjectDecorator*)NULL,
+                         __ATOMIC_RELEASE);
+    }
+    m_buffers.clear();
+    m_open_files.erase(this);
+    pthread_mutex_unlock(&m_buffers_lock);
+}   // releaseBuffers
+
+// ----------------------------------------------------------------------------
+/** Appends the data of one write call to a thread buffer, and updates the
+ *  end of the complete data: the whole buffer, or the end of the last
+ *  complete Fortran record.
+ */
+void ThreadBufferFileObjectDecorator::appendRecords(ThreadBuffer *tb,
+                                                    const char *p, size_t n)
+{
+    memcpy(tb->m_data+tb->m_fill, p, n);
+    tb->m_fill += n;
+    if(!m_fortran_records)
+    {
+        tb->m_complete = tb->m_fill;
+        return;
+    }
+    while(tb->m_fill-tb->m_complete>=sizeof(int32_t))
+    {
+        int32_t marker;
+        memcpy(&marker, tb->m_data+tb->m_complete, sizeof(marker));
+        // Negative markers are used for sub-records of large records.
+        uint64_t length = marker<0 ? -(int64_t)marker : marker;
+        uint64_t record = length + 2*sizeof(int32_t);
+        if(tb->m_complete+record>tb->m_fill)
+            break;
+        tb->m_complete += record;
+    }
+}   // appendRecords
+
+// ----------------------------------------------------------------------------
+/** Writes n bytes into the buffer of the calling thread, merging the
+ *  buffer into the file if it is full. Writes that are bigger than the
+ *  buffer are passed on directly.
+ *  \return n, or -1 (and errno set) if writing to the file failed.
+ */
+ssize_t ThreadBufferFileObjectDecorator::bufferedWrite(const void *p, size_t n)
+{
+    if(n==0)
+        return 0;
+    ThreadBuffer *tb = getThreadBuffer();
+    if(!tb)
+    {
+        pthread_mutex_lock(&m_lock);
+        parentWrite((const char*)p, n);
+        pthread_mutex_unlock(&m_lock);
+    }
+    else
+    {
+        pthread_mutex_lock(&tb->m_lock);
+        if(tb->m_fill+n>tb->m_capacity)
+            mergeBuffer(tb, tb->m_complete);
+        if(tb->m_fill==0 && n>=tb->m_capacity && !m_fortran_records)
+        {
+            pthread_mutex_lock(&m_lock);
+            parentWrite((const char*)p, n);
+            pthread_mutex_unlock(&m_lock);
+        }
+        else
+        {
+            if(tb->m_fill+n>tb->m_capacity)
+            {
+                // An incomplete record does not fit: grow the buffer.
+                size_t capacity = 2*tb->m_capacity;
+                if(capacity<tb->m_fill+n)
+                    capacity = tb->m_fill+n;
+                char *data = BufferArena::allocate(capacity);
+                memcpy(data, tb->m_data, tb->m_fill);
+                BufferArena::free(tb->m_data);
+                tb->m_data     = data;
+                tb->m_capacity = capacity;
+            }
+            appendRecords(tb, (const char*)p, n);
+        }
+        pthread_mutex_unlock(&tb->m_lock);
+    }
+    if(m_error)
+    {
+        errno = m_error;
+        return -1;
+    }
+    return n;
+}   // bufferedWrite
+
+// ----------------------------------------------------------------------------
+void ThreadBufferFileObjectDecorator::openFile(bool stream)
+{
+    m_stream = stream;
+    m_error  = 0;
+    pthread_mutex_lock(&m_buffers_lock);
+    m_open_files.insert(this);
+    pthread_mutex_unlock(&m_buffers_lock);
+}   // openFile
+
+// ----------------------------------------------------------------------------
+/** Merges all buffers into the file and frees them.
+ *  \return 0, or the first error when writing to the file.
+ */
+int ThreadBufferFileObjectDecorator::closeFile()
+{
+    mergeAll(/*complete_only*/false);
+    releaseBuffers();
+    return m_error;
+}   // closeFile
+
+// ----------------------------------------------------------------------------
+FILE *ThreadBufferFileObjectDecorator::fopen(const char *mode)
+{
+    if(!I_FileObjectDecorator::fopen(mode))
+        return NULL;
+    openFile(true);
+    return (FILE*)this;
+}   // fopen
+
+// ----------------------------------------------------------------------------
+FILE *ThreadBufferFileObjectDecorator::fopen64(const char *mode)
+{
+    if(!I_FileObjectDecorator::fopen64(mode))
+        return NULL;
+    openFile(true);
+    return (FILE*)this;
+}   // fopen64
+
+// ----------------------------------------------------------------------------
+int ThreadBufferFileObjectDecorator::open(int flags, mode_t mode)
+{
+    int filedes = I_FileObjectDecorator::open(flags, mode);
+    if(filedes>=0)
+        openFile(false);
+    return filedes;
+}   // open
+
+// ----------------------------------------------------------------------------
+int ThreadBufferFileObjectDecorator::open64(int flags, mode_t mode)
+{
+    int filedes = I_FileObjectDecorator::open64(flags, mode);
+    if(filedes>=0)
+        openFile(false);
+    return filedes;
+}   // open64
+
+// ----------------------------------------------------------------------------
+int ThreadBufferFileObjectDecorator::fseek(long offset, int whence)
+{
+    mergeAll(/*complete_only*/true);
+    pthread_mutex_lock(&m_lock);
+    int result = I_FileObjectDecorator::fseek(offset, whence);
+    pthread_mutex_unlock(&m_lock);
+    return result;
+}   // fseek
+
+// ----------------------------------------------------------------------------
+int ThreadBufferFileObjectDecorator::fseeko(off_t offset, int whence)
+{
+    mergeAll(/*complete_only*/true);
+    pthread_mutex_lock(&m_lock);
+    int result = I_FileObjectDecorator::fseeko(offset, whence);
+    pthread_mutex_unlock(&m_lock);
+    return result;
+}   // fseeko
+
+// ----------------------------------------------------------------------------
+int ThreadBufferFileObjectDecorator::fseeko64(off64_t offset, int whence)
+{
+    mergeAll(/*complete_only*/true);
+    pthread_mutex_lock(&m_lock);
+    int result = I_FileObjectDecorator::fseeko64(offset, whence);
+    pthread_mutex_unlock(&m_lock);
+    return result;
+}   // fseeko64
+
+// ----------------------------------------------------------------------------
+long ThreadBufferFileObjectDecorator::ftell()
+{
+    mergeAll(/*complete_only*/true);
+    pthread_mutex_lock(&m_lock);
+    long result = I_FileObjectDecorator::ftell();
+    pthread_mutex_unlock(&m_lock);
+    return result;
+}   // ftell
+
+// ----------------------------------------------------------------------------
+off_t ThreadBufferFileObjectDecorator::ftello()
+{
+    mergeAll(/*complete_only*/true);
+    pthread_mutex_lock(&m_lock);
+    off_t result = I_FileObjectDecorator::ftello();
+    pthread_mutex_unlock(&m_lock);
+    return result;
+}   // ftello
+
+// ----------------------------------------------------------------------------
+off64_t ThreadBufferFileObjectDecorator::ftello64()
+{
+    mergeAll(/*complete_only*/true);
+    pthread_mutex_lock(&m_lock);
+    off64_t result = I_FileObjectDecorator::ftello64();
+    pthread_mutex_unlock(&m_lock);
+    return result;
+}   // ftello64
+
+// ----------------------------------------------------------------------------
+int ThreadBufferFileObjectDecorator::fflush()
+{
+    mergeAll(/*complete_only*/true);
+    pthread_mutex_lock(&m_lock);
+    int result = I_FileObjectDecorator::fflush();
+    pthread_mutex_unlock(&m_lock);
+    if(m_error)
+    {
+        errno = m_error;
+        return EOF;
+    }
+    return result;
+}   // fflush
+
+// ----------------------------------------------------------------------------
+size_t ThreadBufferFileObjectDecorator::fwrite(const void *ptr, size_t size,
+                                               size_t nmemb)
+{
+    if(size==0 || nmemb==0)
+        return 0;
+    return bufferedWrite(ptr, size*nmemb)<0 ? 0 : nmemb;
+}   // fwrite
+
+// ----------------------------------------------------------------------------
+size_t ThreadBufferFileObjectDecorator::fread(void *ptr, size_t size,
+                                              size_t nmemb)
+{
+    mergeAll(/*complete_only*/true);
+    pthread_mutex_lock(&m_lock);
+    size_t result = I_FileObjectDecorator::fread(ptr, size, nmemb);
+    pthread_mutex_unlock(&m_lock);
+    return result;
+}   // fread
+
+// ----------------------------------------------------------------------------
+char *ThreadBufferFileObjectDecorator::fgets(char *s, int size)
+{
+    mergeAll(/*complete_only*/true);
+    pthread_mutex_lock(&m_lock);
+    char *result = I_FileObjectDecorator::fgets(s, size);
+    pthread_mutex_unlock(&m_lock);
+    return result;
+}   // fgets
+
+// ----------------------------------------------------------------------------
+int ThreadBufferFileObjectDecorator::fclose()
+{
+    int error = closeFile();
+    pthread_mutex_lock(&m_lock);
+    int result = I_FileObjectDecorator::fclose();
+    pthread_mutex_unlock(&m_lock);
+    if(result!=0)
+        return EOF;
+    if(error)
+    {
+        errno = error;
+        return EOF;
+    }
+    return 0;
+}   // fclose
+
+// ----------------------------------------------------------------------------
+int ThreadBufferFileObjectDecorator::__fxstat(int ver, struct stat *buf)
+{
+    mergeAll(/*complete_only*/true);
+    pthread_mutex_lock(&m_lock);
+    int result = I_FileObjectDecorator::__fxstat(ver, buf);
+    pthread_mutex_unlock(&m_lock);
+    return result;
+}   // __fxstat
+
+// ----------------------------------------------------------------------------
+int ThreadBufferFileObjectDecorator::__fxstat64(int ver, struct stat64 *buf)
+{
+    mergeAll(/*complete_only*/true);
+    pthread_mutex_lock(&m_lock);
+    int result = I_FileObjectDecorator::__fxstat64(ver, buf);
+    pthread_mutex_unlock(&m_lock);
+    return result;
+}   // __fxstat64
+
+// ----------------------------------------------------------------------------
+off_t ThreadBufferFileObjectDecorator::lseek(off_t offset, int whence)
+{
+    mergeAll(/*complete_only*/true);
+    pthread_mutex_lock(&m_lock);
+    off_t result = I_FileObjectDecorator::lseek(offset, whence);
+    pthread_mutex_unlock(&m_lock);
+    return result;
+}   // lseek
+
+// ----------------------------------------------------------------------------
+off64_t ThreadBufferFileObjectDecorator::lseek64(off64_t offset, int whence)
+{
+    mergeAll(/*complete_only*/true);
+    pthread_mutex_lock(&m_lock);
+    off64_t result = I_FileObjectDecorator::lseek64(offset, whence);
+    pthread_mutex_unlock(&m_lock);
+    return result;
+}   // lseek64
+
+// ----------------------------------------------------------------------------
+ssize_t ThreadBufferFileObjectDecorator::write(const void *buf, size_t nbyte)
+{
+    return bufferedWrite(buf, nbyte);
+}   // write
+
+// ----------------------------------------------------------------------------
+ssize_t ThreadBufferFileObjectDecorator::read(void *buf, size_t count)
+{
+    mergeAll(/*complete_only*/true);
+    pthread_mutex_lock(&m_lock);
+    ssize_t result = I_FileObjectDecorator::read(buf, count);
+    pthread_mutex_unlock(&m_lock);
+    return result;
+}   // read
+
+// ----------------------------------------------------------------------------
+int ThreadBufferFileObjectDecorator::close()
+{
+    int error = closeFile();
+    pthread_mutex_lock(&m_lock);
+    int result = I_FileObjectDecorator::close();
+    pthread_mutex_unlock(&m_lock);
+    if(result!=0)
+        return -1;
+    if(error)
+    {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}   // close
+
+}   // namespace ALIO
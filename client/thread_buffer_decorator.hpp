@@ -0,0 +1,135 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef HEADER_THREAD_BUFFER_DECORATOR_HPP
+#define HEADER_THREAD_BUFFER_DECORATOR_HPP
+
+#include "client/i_file_object_decorator.hpp"
+
+#include <pthread.h>
+#include <set>
+#include <vector>
+
+namespace ALIO
+{
+
+/** A decorator that lets several threads write to the same file without
+ *  serialising them (<addon type="thread-buffer" .../>). Each thread
+ *  appends its writes to a private buffer for the file (size, default
+ *  1M); only when the buffer is full is it passed on to the decorated file
+ *  object, protected by a lock. All buffers are merged into the file at
+ *  flush points (fflush, seeks, ftell, reads, stat and close), and when a
+ *  thread exits. A single write call is never split, so the data of one
+ *  call stays contiguous in the file, but the order of the data written
+ *  by different threads is (as without this decorator) undefined.
+ *  With records="fortran" the buffers are only merged at the boundaries
+ *  of Fortran sequential unformatted records (a 4 byte length before and
+ *  after the data), so a record written in several calls is never
+ *  interleaved with data from other threads. A buffer grows if a single
+ *  record is bigger than its size.
+ */
+class ThreadBufferFileObjectDecorator : public I_FileObjectDecorator
+{
+private:
+    /** The buffer of one thread for one file. */
+    struct ThreadBuffer
+    {
+        /** The file this buffer belongs to, NULL once the file was
+         *  closed. Accessed atomically. */
+        ThreadBufferFileObjectDecorator *m_owner;
+        /** Protects the buffer against flushes from other threads. */
+        pthread_mutex_t m_lock;
+        char   *m_data;
+        size_t  m_capacity;
+        size_t  m_fill;
+        /** End of the last complete write call or record, i.e. the
+         *  amount of data that can be merged into the file. */
+        size_t  m_complete;
+    };   // ThreadBuffer
+
+    /** Size of a new thread buffer. */
+    size_t  m_size;
+
+    /** True if the buffers are only merged at Fortran record boundaries. */
+    bool    m_fortran_records;
+
+    /** True if the file was opened with fopen (otherwise with open). */
+    bool    m_stream;
+
+    /** The first error when writing to the decorated file. */
+    int     m_error;
+
+    /** Serialises the calls to the decorated file object. */
+    pthread_mutex_t m_lock;
+
+    /** The buffers of all threads that wrote to this file. Protected by
+     *  m_buffers_lock. */
+    std::vector<ThreadBuffer*> m_buffers;
+
+    /** Protects m_buffers of all files and m_open_files. */
+    static pthread_mutex_t m_buffers_lock;
+
+    /** All open files, so that their buffers can be merged at exit. */
+    static std::set<ThreadBufferFileObjectDecorator*> m_open_files;
+
+    static void  createKey();
+    static void  threadExit(void *data);
+    ThreadBuffer *getThreadBuffer();
+    void    appendRecords(ThreadBuffer *tb, const char *p, size_t n);
+    void    mergeBuffer(ThreadBuffer *tb, size_t n);
+    void    mergeAll(bool complete_only);
+    bool    parentWrite(const char *p, size_t n);
+    ssize_t bufferedWrite(const void *p, size_t n);
+    void    releaseBuffers();
+    void    openFile(bool stream);
+    int     closeFile();
+
+public:
+    static int init();
+    static int atExit();
+
+             ThreadBufferFileObjectDecorator(I_FileObject *parent,
+                                             const XMLNode *info);
+    virtual ~ThreadBufferFileObjectDecorator();
+
+    virtual FILE   *fopen(const char *mode);
+    virtual FILE   *fopen64(const char *mode);
+    virtual int     open(int flags, mode_t mode);
+    virtual int     open64(int flags, mode_t mode);
+    virtual int     fseek(long offset, int whence);
+    virtual int     fseeko(off_t offset, int whence);
+    virtual int     fseeko64(off64_t offset, int whence);
+    virtual long    ftell();
+    virtual off_t   ftello();
+    virtual off64_t ftello64();
+    virtual int     fflush();
+    virtual size_t  fwrite(const void *ptr, size_t size, size_t nmemb);
+    virtual size_t  fread(void *ptr, size_t size, size_t nmemb);
+    virtual char   *fgets(char *s, int size);
+    virtual int     fclose();
+    virtual int     __fxstat(int ver, struct stat *buf);
+    virtual int     __fxstat64(int ver, struct stat64 *buf);
+    virtual off_t   lseek(off_t offset, int whence);
+    virtual off64_t lseek64(off64_t offset, int whence);
+    virtual ssize_t write(const void *buf, size_t nbyte);
+    virtual ssize_t read(void *buf, size_t count);
+    virtual int     close();
+};   // ThreadBufferFileObjectDecorator
+
+}   // namespace ALIO
+#endif
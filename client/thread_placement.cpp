@@ -0,0 +1,259 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "client/thread_placement.hpp"
+
+#include "tools/os.hpp"
+#include "tools/string_utils.hpp"
+#include "xml/xml_node.hpp"
+
+#include <dirent.h>
+#include <errno.h>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace ALIO
+{
+
+std::vector<int>             ThreadPlacement::m_cpus;
+ThreadPlacement::NumaPolicy  ThreadPlacement::m_numa_policy = NUMA_NONE;
+int                          ThreadPlacement::m_num_nodes   = 1;
+int                          ThreadPlacement::m_worker_node = -1;
+
+/** Maximum number of NUMA nodes supported when binding memory. */
+static const int MAX_NODES = 256;
+
+// ----------------------------------------------------------------------------
+/** Reads a (small) file from sysfs. The OS functions are used, since the
+ *  application's functions might be handled by ALIO.
+ *  \return False if the file can not be read.
+ */
+bool ThreadPlacement::readSysFile(const std::string &name,
+                                  std::string *content)
+{
+    int fd = OS::open(name.c_str(), O_RDONLY, 0);
+    if(fd<0)
+        return false;
+    char buffer[4096];
+    ssize_t n = OS::read(fd, buffer, sizeof(buffer)-1);
+    OS::close(fd);
+    if(n<0)
+        return false;
+    buffer[n] = 0;
+    *content = buffer;
+    return true;
+}   // readSysFile
+
+// ----------------------------------------------------------------------------
+/** Determines the NUMA node of each CPU (-1 if unknown) and the number of
+ *  NUMA nodes.
+ */
+void ThreadPlacement::getNodesOfCpus(std::vector<int> *node_of_cpu)
+{
+    DIR *dir = opendir("/sys/devices/system/node");
+    if(!dir)
+        return;
+    struct dirent *entry;
+    while((entry=readdir(dir))!=NULL)
+    {
+        int node;
+        if(strncmp(entry->d_name, "node", 4)!=0 ||
+           !StringUtils::parseString(entry->d_name+4, &node))
+            continue;
+        if(node+1>m_num_nodes)
+            m_num_nodes = node+1;
+        std::string cpulist;
+        std::vector<int> cpus;
+        if(!readSysFile(std::string("/sys/devices/system/node/")
+                        +entry->d_name+"/cpulist", &cpulist) ||
+           !StringUtils::parseList(cpulist, &cpus))
+            continue;
+        for(unsigned int i=0; i<cpus.size(); i++)
+        {
+            if(cpus[i]>=(int)node_of_cpu->size())
+                node_of_cpu->resize(cpus[i]+1, -1);
+            (*node_of_cpu)[cpus[i]] = node;
+        }
+    }
+    closedir(dir);
+}   // getNodesOfCpus
+
+// ----------------------------------------------------------------------------
+/** Reads the threads node of the config file. This is called from the
+ *  constructor of the library, i.e. before the application could change
+ *  its CPU binding, and before any ALIO thread is started.
+ */
+void ThreadPlacement::readConfig(const XMLNode *node)
+{
+    std::vector<int> node_of_cpu;
+    getNodesOfCpus(&node_of_cpu);
+
+    std::string s;
+    if(node->get("numa", &s))
+    {
+        if(s=="producer")
+            m_numa_policy = NUMA_PRODUCER;
+        else if(s=="worker")
+            m_numa_policy = NUMA_WORKER;
+        else if(s!="none")
+            printf("Unknown numa policy '%s' - using none.\n", s.c_str());
+    }
+
+    std::vector<int> cpus;
+    bool have_cpus = node->get("cpus", &s)!=0;
+    if(have_cpus && !StringUtils::parseList(s, &cpus))
+    {
+        printf("Invalid cpus '%s' - ignored.\n", s.c_str());
+        have_cpus = false;
+        cpus.clear();
+    }
+    bool avoid_app_cpus = false;
+    node->get("avoid-app-cpus", &avoid_app_cpus);
+    if(!have_cpus && !avoid_app_cpus)
+        return;
+
+    if(!have_cpus)
+    {
+        if(!readSysFile("/sys/devices/system/cpu/online", &s) ||
+           !StringUtils::parseList(s, &cpus))
+        {
+            for(int i=0; i<sysconf(_SC_NPROCESSORS_ONLN); i++)
+                cpus.push_back(i);
+        }
+    }
+
+    if(avoid_app_cpus)
+    {
+        cpu_set_t app;
+        CPU_ZERO(&app);
+        sched_getaffinity(0, sizeof(app), &app);
+        std::vector<int> free_cpus, local_cpus;
+        for(unsigned int i=0; i<cpus.size(); i++)
+        {
+            if(cpus[i]<CPU_SETSIZE && CPU_ISSET(cpus[i], &app))
+                continue;
+            free_cpus.push_back(cpus[i]);
+            // Check if this CPU shares a NUMA node with the application.
+            int n = cpus[i]<(int)node_of_cpu.size() ? node_of_cpu[cpus[i]]
+                                                     : -1;
+            for(int j=0; n>=0 && j<(int)node_of_cpu.size(); j++)
+            {
+                if(node_of_cpu[j]==n && CPU_ISSET(j, &app))
+                {
+                    local_cpus.push_back(cpus[i]);
+                    break;
+                }
+            }
+        }
+        if(free_cpus.empty())
+        {
+            printf("All ALIO cpus are used by the application - "
+                   "not avoiding them.\n");
+        }
+        else
+            cpus = (!have_cpus && !local_cpus.empty()) ? local_cpus
+                                                        : free_cpus;
+    }
+    m_cpus = cpus;
+}   // readConfig
+
+// ----------------------------------------------------------------------------
+/** Pins the calling thread to the CPUs configured for ALIO threads. */
+void ThreadPlacement::pinCurrentThread()
+{
+    if(m_cpus.empty())
+        return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(unsigned int i=0; i<m_cpus.size(); i++)
+    {
+        if(m_cpus[i]<CPU_SETSIZE)
+            CPU_SET(m_cpus[i], &set);
+    }
+    int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if(error)
+        printf("Can not pin ALIO thread: %s.\n", strerror(error));
+}   // pinCurrentThread
+
+// ----------------------------------------------------------------------------
+/** Called by the IO thread when it starts: pins the thread, and stores its
+ *  NUMA node for the worker placement policy.
+ */
+void ThreadPlacement::registerWorker()
+{
+    pinCurrentThread();
+    __atomic_store_n(&m_worker_node, getCurrentNode(), __ATOMIC_RELEASE);
+}   // registerWorker
+
+// ----------------------------------------------------------------------------
+/** Returns the NUMA node the calling thread is currently running on. */
+int ThreadPlacement::getCurrentNode()
+{
+    unsigned int cpu, node;
+    if(syscall(SYS_getcpu, &cpu, &node, NULL)!=0)
+        return -1;
+    return node;
+}   // getCurrentNode
+
+// ----------------------------------------------------------------------------
+/** Returns the NUMA node on which a new buffer should be allocated by the
+ *  calling thread, or -1 if the placement should be left to the kernel.
+ */
+int ThreadPlacement::getBufferNode()
+{
+    if(m_num_nodes<2)
+        return -1;
+    switch(m_numa_policy)
+    {
+    case NUMA_PRODUCER: return getCurrentNode();
+    case NUMA_WORKER:   return __atomic_load_n(&m_worker_node,
+                                               __ATOMIC_ACQUIRE);
+    default:            return -1;
+    }
+}   // getBufferNode
+
+// ----------------------------------------------------------------------------
+/** Sets the memory policy of a (not yet touched) buffer so that its pages
+ *  are allocated on the given node. Errors are only reported once, the
+ *  memory is then placed by the kernel.
+ */
+void ThreadPlacement::bindToNode(void *p, size_t size, int node)
+{
+    if(node<0 || node>=MAX_NODES)
+        return;
+    unsigned long mask[MAX_NODES/(8*sizeof(unsigned long))];
+    memset(mask, 0, sizeof(mask));
+    mask[node/(8*sizeof(unsigned long))] |=
+        1UL << (node%(8*sizeof(unsigned long)));
+    if(syscall(SYS_mbind, p, size, MPOL_PREFERRED, mask, MAX_NODES, 0)!=0)
+    {
+        static bool reported = false;
+        if(!reported)
+            printf("Can not bind buffer to NUMA node %d: %s.\n", node,
+                   strerror(errno));
+        reported = true;
+    }
+}   // bindToNode
+
+}   // namespace ALIO
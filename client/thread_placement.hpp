@@ -0,0 +1,77 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef HEADER_THREAD_PLACEMENT_HPP
+#define HEADER_THREAD_PLACEMENT_HPP
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+namespace ALIO
+{
+class XMLNode;
+
+/** Controls on which CPUs the threads started by ALIO run, and on which
+ *  NUMA node the IO buffers are allocated. It is configured with a threads
+ *  node in the client section of alio.xml, e.g.:
+ *    <threads cpus="6,7" avoid-app-cpus="yes" numa="worker" />
+ *  cpus lists the CPUs ALIO threads can use (default: all online CPUs).
+ *  With avoid-app-cpus="yes" the CPUs the application is bound to at
+ *  startup (e.g. by the MPI launcher) are removed from this set; if no
+ *  cpus are given, CPUs on the NUMA nodes of the application are then
+ *  preferred. Without both attributes ALIO threads are not pinned.
+ *  numa selects where buffers are placed: "producer" (node of the thread
+ *  filling the buffer, i.e. the application), "worker" (node of the IO
+ *  thread), or "none" (default, the kernel's first-touch placement).
+ */
+class ThreadPlacement
+{
+public:
+    enum NumaPolicy {NUMA_NONE, NUMA_PRODUCER, NUMA_WORKER};
+
+private:
+    /** The CPUs ALIO threads are pinned to, empty if they are not pinned. */
+    static std::vector<int> m_cpus;
+
+    /** Where buffers are allocated. */
+    static NumaPolicy       m_numa_policy;
+
+    /** Number of NUMA nodes of this machine. */
+    static int              m_num_nodes;
+
+    /** The NUMA node the IO thread runs on, -1 if not known (yet). */
+    static int              m_worker_node;
+
+    static bool readSysFile(const std::string &name, std::string *content);
+    static void getNodesOfCpus(std::vector<int> *node_of_cpu);
+
+public:
+    static void readConfig(const XMLNode *node);
+    static void pinCurrentThread();
+    static void registerWorker();
+    static int  getCurrentNode();
+    static int  getBufferNode();
+    static void bindToNode(void *p, size_t size, int node);
+    // ------------------------------------------------------------------------
+    /** Returns the CPUs ALIO threads are pinned to (empty if not pinned). */
+    static const std::vector<int> &getCpus() { return m_cpus; }
+};   // ThreadPlacement
+
+}   // namespace ALIO
+#endif
@@ -324,6 +324,14 @@ public:
         return result;
     }
     // ------------------------------------------------------------------------
+    virtual int unlink()
+    {
+        m_timer_data->start(TIMER_MISC);
+        int result = I_FileObjectDecorator::unlink();
+        m_timer_data->stop(TIMER_MISC);
+        return result;
+    }
+    // ------------------------------------------------------------------------
 
 };   // TimeFileObjectDecorator
 
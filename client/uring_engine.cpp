@@ -0,0 +1,375 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "client/uring_engine.hpp"
+
+#include <assert.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_IO_URING
+#  include <linux/io_uring.h>
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#endif
+
+namespace ALIO
+{
+
+// ----------------------------------------------------------------------------
+UringEngine::UringEngine()
+{
+    m_ring_fd      = -1;
+    m_sq_head      = m_sq_tail = m_sq_mask = m_sq_array = NULL;
+    m_cq_head      = m_cq_tail = m_cq_mask = NULL;
+    m_sq_entries   = 0;
+    m_sqes         = NULL;
+    m_cqes         = NULL;
+    m_sq_ring      = m_cq_ring = NULL;
+    m_sq_ring_size = m_cq_ring_size = m_sqes_size = 0;
+    m_tail         = 0;
+    m_to_submit    = 0;
+    m_in_flight    = 0;
+}   // UringEngine
+
+#ifdef HAVE_IO_URING
+
+// ----------------------------------------------------------------------------
+/** Closing the ring also unregisters all buffers. All operations must
+ *  have completed before the engine is destroyed.
+ */
+UringEngine::~UringEngine()
+{
+    if(m_sqes)
+        munmap(m_sqes, m_sqes_size);
+    if(m_cq_ring && m_cq_ring!=m_sq_ring)
+        munmap(m_cq_ring, m_cq_ring_size);
+    if(m_sq_ring)
+        munmap(m_sq_ring, m_sq_ring_size);
+    if(m_ring_fd>=0)
+        close(m_ring_fd);
+}   // ~UringEngine
+
+// ----------------------------------------------------------------------------
+/** Creates the ring and maps the submission and completion queues.
+ *  \param depth Number of submission queue entries.
+ *  \return True if successful, false if io_uring is not available
+ *          (errno is set in this case).
+ */
+bool UringEngine::init(unsigned int depth)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    m_ring_fd = syscall(__NR_io_uring_setup, depth, &params);
+    if(m_ring_fd<0)
+        return false;
+
+    m_sq_ring_size = params.sq_off.array + params.sq_entries*sizeof(unsigned);
+    m_cq_ring_size = params.cq_off.cqes
+                   + params.cq_entries*sizeof(struct io_uring_cqe);
+    bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP)!=0;
+    if(single_mmap)
+    {
+        if(m_cq_ring_size>m_sq_ring_size)
+            m_sq_ring_size = m_cq_ring_size;
+        m_cq_ring_size = m_sq_ring_size;
+    }
+    m_sq_ring = mmap(NULL, m_sq_ring_size, PROT_READ|PROT_WRITE,
+                     MAP_SHARED|MAP_POPULATE, m_ring_fd, IORING_OFF_SQ_RING);
+    if(m_sq_ring==MAP_FAILED)
+    {
+        m_sq_ring = NULL;
+        return false;
+    }
+    if(single_mmap)
+        m_cq_ring = m_sq_ring;
+    else
+    {
+        m_cq_ring = mmap(NULL, m_cq_ring_size, PROT_READ|PROT_WRITE,
+                         MAP_SHARED|MAP_POPULATE, m_ring_fd,
+                         IORING_OFF_CQ_RING);
+        if(m_cq_ring==MAP_FAILED)
+        {
+            m_cq_ring = NULL;
+            return false;
+        }
+    }
+    m_sqes_size = params.sq_entries*sizeof(struct io_uring_sqe);
+    void *sqes  = mmap(NULL, m_sqes_size, PROT_READ|PROT_WRITE,
+                       MAP_SHARED|MAP_POPULATE, m_ring_fd, IORING_OFF_SQES);
+    if(sqes==MAP_FAILED)
+        return false;
+    m_sqes = (struct io_uring_sqe*)sqes;
+
+    char *sq = (char*)m_sq_ring;
+    m_sq_head    = (unsigned*)(sq+params.sq_off.head);
+    m_sq_tail    = (unsigned*)(sq+params.sq_off.tail);
+    m_sq_mask    = (unsigned*)(sq+params.sq_off.ring_mask);
+    m_sq_array   = (unsigned*)(sq+params.sq_off.array);
+    m_sq_entries = params.sq_entries;
+    char *cq = (char*)m_cq_ring;
+    m_cq_head    = (unsigned*)(cq+params.cq_off.head);
+    m_cq_tail    = (unsigned*)(cq+params.cq_off.tail);
+    m_cq_mask    = (unsigned*)(cq+params.cq_off.ring_mask);
+    m_cqes       = (struct io_uring_cqe*)(cq+params.cq_off.cqes);
+
+    // Each submission queue slot always uses the entry with the same index.
+    for(unsigned int i=0; i<m_sq_entries; i++)
+        m_sq_array[i] = i;
+    m_tail = *m_sq_tail;
+    return true;
+}   // init
+
+// ----------------------------------------------------------------------------
+/** Registers the given buffers with the kernel, replacing all previously
+ *  registered buffers. Must only be called when no operation is pending.
+ *  \return True if successful. On error no buffers are registered, and
+ *          all writes use normal (non-fixed) buffers.
+ */
+bool UringEngine::registerBuffers(const std::vector<struct iovec> &buffers)
+{
+    assert(getNumPending()==0);
+    if(!m_buffers.empty())
+    {
+        syscall(__NR_io_uring_register, m_ring_fd,
+                IORING_UNREGISTER_BUFFERS, NULL, 0);
+        m_buffers.clear();
+        m_registered.clear();
+    }
+    if(buffers.empty())
+        return true;
+    int result = syscall(__NR_io_uring_register, m_ring_fd,
+                         IORING_REGISTER_BUFFERS, &buffers[0],
+                         (unsigned)buffers.size());
+    if(result<0)
+        return false;
+    m_buffers = buffers;
+    for(unsigned int i=0; i<m_buffers.size(); i++)
+        m_registered[(const char*)m_buffers[i].iov_base] = i;
+    return true;
+}   // registerBuffers
+
+// ----------------------------------------------------------------------------
+/** Restricts the kernel worker threads of this ring (which handle
+ *  operations that can not be done inline, e.g. buffered writes that
+ *  block) to the given CPUs.
+ *  \return False if this is not supported by the kernel.
+ */
+bool UringEngine::setWorkerAffinity(const std::vector<int> &cpus)
+{
+    // IORING_REGISTER_IOWQ_AFF, which is not defined in older headers.
+    const unsigned int register_iowq_aff = 17;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(unsigned int i=0; i<cpus.size(); i++)
+    {
+        if(cpus[i]<CPU_SETSIZE)
+            CPU_SET(cpus[i], &set);
+    }
+    return syscall(__NR_io_uring_register, m_ring_fd, register_iowq_aff,
+                   &set, sizeof(set))==0;
+}   // setWorkerAffinity
+
+// ----------------------------------------------------------------------------
+/** Returns the index of the registered buffer that contains [p, p+n),
+ *  or -1 if there is none.
+ */
+int UringEngine::findRegistered(const char *p, size_t n) const
+{
+    std::map<const char*, int>::const_iterator i = m_registered.upper_bound(p);
+    if(i==m_registered.begin())
+        return -1;
+    --i;
+    const struct iovec &v = m_buffers[i->second];
+    if(p+n > (const char*)v.iov_base+v.iov_len)
+        return -1;
+    return i->second;
+}   // findRegistered
+
+// ----------------------------------------------------------------------------
+/** Returns a cleared submission queue entry. If the queue is full, all
+ *  queued operations are submitted and waited for first (calling the
+ *  callback for each of them).
+ */
+struct io_uring_sqe *UringEngine::getSqe(CompletionCallback callback)
+{
+    // Limiting the number of pending operations to the queue size also
+    // makes sure that the (larger) completion queue can never overflow.
+    if(getNumPending()>=m_sq_entries)
+        submitAndWaitAll(callback);
+    struct io_uring_sqe *sqe = &m_sqes[m_tail & *m_sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}   // getSqe
+
+// ----------------------------------------------------------------------------
+/** Makes the entry returned by the last getSqe() call visible to the
+ *  kernel. */
+void UringEngine::commitSqe()
+{
+    m_tail++;
+    __atomic_store_n(m_sq_tail, m_tail, __ATOMIC_RELEASE);
+    m_to_submit++;
+}   // commitSqe
+
+// ----------------------------------------------------------------------------
+/** Queues a write of n bytes at the given offset. The write is submitted
+ *  with the next submitAndWaitAll() call. If the data is in a registered
+ *  buffer, a fixed-buffer write is used.
+ */
+void UringEngine::queueWrite(int fd, const char *p, size_t n, off64_t offset,
+                             void *user_data, CompletionCallback callback)
+{
+    struct io_uring_sqe *sqe = getSqe(callback);
+    int index = findRegistered(p, n);
+    if(index>=0)
+    {
+        sqe->opcode    = IORING_OP_WRITE_FIXED;
+        sqe->buf_index = index;
+    }
+    else
+        sqe->opcode    = IORING_OP_WRITE;
+    sqe->fd        = fd;
+    sqe->addr      = (unsigned long)p;
+    sqe->len       = n;
+    sqe->off       = offset;
+    sqe->user_data = (unsigned long)user_data;
+    commitSqe();
+}   // queueWrite
+
+// ----------------------------------------------------------------------------
+/** Queues an fsync of the file. The fsync is flagged with IOSQE_IO_DRAIN,
+ *  so the kernel only starts it once all previously submitted operations
+ *  (in particular all writes to this file) have completed.
+ */
+void UringEngine::queueFsync(int fd, void *user_data,
+                             CompletionCallback callback)
+{
+    struct io_uring_sqe *sqe = getSqe(callback);
+    sqe->opcode    = IORING_OP_FSYNC;
+    sqe->flags     = IOSQE_IO_DRAIN;
+    sqe->fd        = fd;
+    sqe->user_data = (unsigned long)user_data;
+    commitSqe();
+}   // queueFsync
+
+// ----------------------------------------------------------------------------
+/** Calls the callback for all available completion queue entries. */
+void UringEngine::reap(CompletionCallback callback)
+{
+    unsigned head = *m_cq_head;
+    unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+    while(head!=tail)
+    {
+        struct io_uring_cqe *cqe = &m_cqes[head & *m_cq_mask];
+        void *user_data = (void*)(unsigned long)cqe->user_data;
+        int   result    = cqe->res;
+        head++;
+        __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+        m_in_flight--;
+        callback(user_data, result);
+    }
+}   // reap
+
+// ----------------------------------------------------------------------------
+/** Removes all entries that the kernel has not accepted from the submission
+ *  queue, and reports them as failed with the given error.
+ */
+void UringEngine::cancelUnsubmitted(int error, CompletionCallback callback)
+{
+    std::vector<void*> cancelled;
+    while(m_to_submit>0)
+    {
+        m_tail--;
+        m_to_submit--;
+        struct io_uring_sqe *sqe = &m_sqes[m_tail & *m_sq_mask];
+        cancelled.push_back((void*)(unsigned long)sqe->user_data);
+    }
+    __atomic_store_n(m_sq_tail, m_tail, __ATOMIC_RELEASE);
+    // Report in submission order.
+    for(unsigned int i=cancelled.size(); i>0; i--)
+        callback(cancelled[i-1], -error);
+}   // cancelUnsubmitted
+
+// ----------------------------------------------------------------------------
+/** Submits all queued operations and waits till all operations have
+ *  completed. The callback is called once for each operation.
+ */
+void UringEngine::submitAndWaitAll(CompletionCallback callback)
+{
+    while(getNumPending()>0)
+    {
+        int result = syscall(__NR_io_uring_enter, m_ring_fd, m_to_submit,
+                             1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if(result<0)
+        {
+            if(errno==EINTR)
+                continue;
+            if((errno==EAGAIN || errno==EBUSY) && m_in_flight>0)
+            {
+                // Out of resources: wait for completions, then try again.
+                syscall(__NR_io_uring_enter, m_ring_fd, 0, 1,
+                        IORING_ENTER_GETEVENTS, NULL, 0);
+                reap(callback);
+                continue;
+            }
+            printf("io_uring_enter failed: %s.\n", strerror(errno));
+            cancelUnsubmitted(errno, callback);
+            if(m_in_flight==0)
+                break;
+            continue;
+        }
+        m_to_submit -= result;
+        m_in_flight += result;
+        reap(callback);
+    }
+}   // submitAndWaitAll
+
+#else
+
+// ----------------------------------------------------------------------------
+// Without io_uring support init() always fails, so none of the other
+// functions will ever be called.
+UringEngine::~UringEngine() {}
+bool UringEngine::init(unsigned int depth) { errno = ENOSYS; return false; }
+bool UringEngine::registerBuffers(const std::vector<struct iovec> &buffers)
+{
+    return false;
+}   // registerBuffers
+bool UringEngine::setWorkerAffinity(const std::vector<int> &cpus)
+{
+    return false;
+}   // setWorkerAffinity
+void UringEngine::queueWrite(int fd, const char *p, size_t n, off64_t offset,
+                             void *user_data, CompletionCallback callback)
+{
+    callback(user_data, -ENOSYS);
+}   // queueWrite
+void UringEngine::queueFsync(int fd, void *user_data,
+                             CompletionCallback callback)
+{
+    callback(user_data, -ENOSYS);
+}   // queueFsync
+void UringEngine::submitAndWaitAll(CompletionCallback callback) {}
+
+#endif
+
+}   // namespace ALIO
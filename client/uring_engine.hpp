@@ -0,0 +1,112 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef HEADER_URING_ENGINE_HPP
+#define HEADER_URING_ENGINE_HPP
+
+#include <map>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <vector>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace ALIO
+{
+
+/** A minimal wrapper around a Linux io_uring instance, using the raw
+ *  system calls (so no liburing is needed). It is used by the IO thread
+ *  of the buffered file object to submit many writes and fsyncs with a
+ *  single system call. Buffers can be registered with the kernel, writes
+ *  from a registered buffer then use IORING_OP_WRITE_FIXED, which avoids
+ *  mapping the user pages for each write.
+ *  If ALIO is compiled without io_uring support, or the kernel does not
+ *  support it, init() returns false and the caller must use normal IO.
+ *  An engine must only be used by one thread.
+ */
+class UringEngine
+{
+public:
+    /** Called for each completed operation with the user data and the
+     *  result (number of bytes or -errno). */
+    typedef void (*CompletionCallback)(void *user_data, int result);
+
+private:
+    /** File descriptor of the ring. */
+    int       m_ring_fd;
+
+    /** Pointers into the mmapped submission queue ring. */
+    unsigned *m_sq_head, *m_sq_tail, *m_sq_mask, *m_sq_array;
+
+    /** Number of entries in the submission queue. */
+    unsigned  m_sq_entries;
+
+    /** The submission queue entries. */
+    io_uring_sqe *m_sqes;
+
+    /** Pointers into the mmapped completion queue ring. */
+    unsigned *m_cq_head, *m_cq_tail, *m_cq_mask;
+
+    /** The completion queue entries. */
+    io_uring_cqe *m_cqes;
+
+    /** The mmapped areas, so they can be unmapped. */
+    void     *m_sq_ring, *m_cq_ring;
+    size_t    m_sq_ring_size, m_cq_ring_size, m_sqes_size;
+
+    /** Local copy of the submission queue tail. */
+    unsigned  m_tail;
+
+    /** Number of entries queued, but not yet submitted to the kernel. */
+    unsigned  m_to_submit;
+
+    /** Number of submitted operations that have not completed yet. */
+    unsigned  m_in_flight;
+
+    /** The registered buffers. */
+    std::vector<struct iovec> m_buffers;
+
+    /** Maps the start address of each registered buffer to its index
+     *  in m_buffers. */
+    std::map<const char*, int> m_registered;
+
+    io_uring_sqe *getSqe(CompletionCallback callback);
+    void          commitSqe();
+    int           findRegistered(const char *p, size_t n) const;
+    void          reap(CompletionCallback callback);
+    void          cancelUnsubmitted(int error, CompletionCallback callback);
+
+public:
+                  UringEngine();
+                 ~UringEngine();
+    bool          init(unsigned int depth);
+    bool          registerBuffers(const std::vector<struct iovec> &buffers);
+    bool          setWorkerAffinity(const std::vector<int> &cpus);
+    void          queueWrite(int fd, const char *p, size_t n, off64_t offset,
+                             void *user_data, CompletionCallback callback);
+    void          queueFsync(int fd, void *user_data,
+                             CompletionCallback callback);
+    void          submitAndWaitAll(CompletionCallback callback);
+    // ------------------------------------------------------------------------
+    /** Returns the number of operations queued or in flight. */
+    unsigned int  getNumPending() const { return m_to_submit+m_in_flight; }
+};   // UringEngine
+
+}   // namespace ALIO
+#endif
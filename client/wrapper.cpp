@@ -413,5 +413,162 @@ int rename(const char *oldpath, const char *newpath) __THROW
 
 }   // rename
 // ----------------------------------------------------------------------------
+int unlink(const char *pathname) __THROW
+{
+    ALIO::Config *config   = ALIO::Config::get();
+    ALIO::I_FileObject *fo = NULL;
+
+    if(!config || !(fo=config->createFileObject(pathname)))
+    {
+        if(!ALIO::OS::unlink)
+        {
+            ALIO::OS::t_unlink fc =
+                (ALIO::OS::t_unlink)dlsym(RTLD_NEXT, "unlink");
+            return fc(pathname);
+        }
+        return ALIO::OS::unlink(pathname);
+    }
+
+    return fo->unlink();
+
+}   // unlink
+
+// ----------------------------------------------------------------------------
+int __xstat(int ver, const char *pathname, struct stat *buf) __THROW
+{
+    ALIO::Config *config   = ALIO::Config::get();
+    ALIO::I_FileObject *fo = NULL;
+
+    if(!config || !(fo=config->createFileObject(pathname)))
+    {
+        if(!ALIO::OS::__xstat)
+        {
+            ALIO::OS::t___xstat fc =
+                (ALIO::OS::t___xstat)dlsym(RTLD_NEXT, "__xstat");
+            return fc(ver, pathname, buf);
+        }
+        return ALIO::OS::__xstat(ver, pathname, buf);
+    }
+
+    return fo->__xstat(ver, buf);
+
+}   // __xstat
+
+// ----------------------------------------------------------------------------
+int __lxstat(int ver, const char *pathname, struct stat *buf) __THROW
+{
+    ALIO::Config *config   = ALIO::Config::get();
+    ALIO::I_FileObject *fo = NULL;
+
+    if(!config || !(fo=config->createFileObject(pathname)))
+    {
+        if(!ALIO::OS::__lxstat)
+        {
+            ALIO::OS::t___lxstat fc =
+                (ALIO::OS::t___lxstat)dlsym(RTLD_NEXT, "__lxstat");
+            return fc(ver, pathname, buf);
+        }
+        return ALIO::OS::__lxstat(ver, pathname, buf);
+    }
+
+    return fo->__lxstat(ver, buf);
+
+}   // __lxstat
+
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2,33)
+// ----------------------------------------------------------------------------
+// Since glibc 2.33 stat, lstat and fstat are real functions instead of
+// inline wrappers around __xstat, __lxstat and __fxstat, so they are
+// intercepted as well.
+// The headers no longer define the version that these pass to __xstat.
+#if defined(__x86_64__)
+#  define ALIO_STAT_VER 1
+#elif defined(__i386__)
+#  define ALIO_STAT_VER 3
+#else
+#  define ALIO_STAT_VER 0
+#endif
+// ----------------------------------------------------------------------------
+int stat(const char *pathname, struct stat *buf) __THROW
+{
+    ALIO::Config *config   = ALIO::Config::get();
+    ALIO::I_FileObject *fo = NULL;
+
+    if(!config || !(fo=config->createFileObject(pathname)))
+    {
+        if(!ALIO::OS::stat)
+        {
+            ALIO::OS::t_stat fc = (ALIO::OS::t_stat)dlsym(RTLD_NEXT, "stat");
+            return fc(pathname, buf);
+        }
+        return ALIO::OS::stat(pathname, buf);
+    }
+
+    return fo->__xstat(ALIO_STAT_VER, buf);
+
+}   // stat
+
+// ----------------------------------------------------------------------------
+int lstat(const char *pathname, struct stat *buf) __THROW
+{
+    ALIO::Config *config   = ALIO::Config::get();
+    ALIO::I_FileObject *fo = NULL;
+
+    if(!config || !(fo=config->createFileObject(pathname)))
+    {
+        if(!ALIO::OS::lstat)
+        {
+            ALIO::OS::t_stat fc = (ALIO::OS::t_stat)dlsym(RTLD_NEXT, "lstat");
+            return fc(pathname, buf);
+        }
+        return ALIO::OS::lstat(pathname, buf);
+    }
+
+    return fo->__lxstat(ALIO_STAT_VER, buf);
+
+}   // lstat
+
+// ----------------------------------------------------------------------------
+int fstat(int filedes, struct stat *buf) __THROW
+{
+    ALIO::Config *config   = ALIO::Config::get();
+    ALIO::I_FileObject *fo = NULL;
+
+    if(!config || !(fo=config->getFileObject(filedes)))
+    {
+        if(!ALIO::OS::fstat)
+        {
+            ALIO::OS::t_fstat fc = (ALIO::OS::t_fstat)dlsym(RTLD_NEXT, "fstat");
+            return fc(filedes, buf);
+        }
+        return ALIO::OS::fstat(filedes, buf);
+    }
+
+    return fo->__fxstat(ALIO_STAT_VER, buf);
+
+}   // fstat
+
+// ----------------------------------------------------------------------------
+int fstat64(int filedes, struct stat64 *buf) __THROW
+{
+    ALIO::Config *config   = ALIO::Config::get();
+    ALIO::I_FileObject *fo = NULL;
+
+    if(!config || !(fo=config->getFileObject(filedes)))
+    {
+        if(!ALIO::OS::fstat64)
+        {
+            ALIO::OS::t_fstat64 fc =
+                (ALIO::OS::t_fstat64)dlsym(RTLD_NEXT, "fstat64");
+            return fc(filedes, buf);
+        }
+        return ALIO::OS::fstat64(filedes, buf);
+    }
+
+    return fo->__fxstat64(ALIO_STAT_VER, buf);
+
+}   // fstat64
+#endif
+// ----------------------------------------------------------------------------
 
 }
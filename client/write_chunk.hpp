@@ -0,0 +1,127 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef HEADER_WRITE_CHUNK_HPP
+#define HEADER_WRITE_CHUNK_HPP
+
+#include "client/aligned_buffer_pool.hpp"
+#include "tools/extent_map.hpp"
+
+#include <algorithm>
+#include <string.h>
+#include <sys/types.h>
+
+namespace ALIO
+{
+
+/** An aligned part of a file that collects small writes before they are
+ *  written to disk. A chunk covers the file range [offset, offset+size),
+ *  where offset is a multiple of size. Each write is copied into the
+ *  chunk's buffer, and the written ranges are stored in an extent map.
+ *  This way out-of-order writes (e.g. patching a header after the data
+ *  was written) just add another extent instead of forcing a write.
+ */
+class WriteChunk
+{
+private:
+    /** File offset of the first byte of this chunk. */
+    off64_t   m_offset;
+
+    /** Size of this chunk in bytes. */
+    size_t    m_size;
+
+    /** The buffer for the chunk data. */
+    char     *m_data;
+
+    /** The pool from which m_data was allocated. */
+    AlignedBufferPool *m_pool;
+
+    /** Which parts of m_data contain data written by the application,
+     *  relative to the beginning of the chunk. */
+    ExtentMap m_dirty;
+
+public:
+    /** Creates a chunk. The (page aligned) buffer is taken from the pool,
+     *  whose buffer size is the chunk size. */
+    WriteChunk(off64_t offset, AlignedBufferPool *pool)
+    {
+        m_offset = offset;
+        m_pool   = pool;
+        m_size   = pool->getBufferSize();
+        m_data   = pool->allocate();
+    }   // WriteChunk
+    // ------------------------------------------------------------------------
+    ~WriteChunk()
+    {
+        m_pool->free(m_data);
+    }   // ~WriteChunk
+    // ------------------------------------------------------------------------
+    /** Copies n bytes into this chunk.
+     *  \param offset Offset relative to the start of the chunk.
+     *  \param buf The data to copy.
+     *  \param n Number of bytes, offset+n must not exceed the chunk size.
+     */
+    void write(size_t offset, const void *buf, size_t n)
+    {
+        assert(offset+n<=m_size);
+        memcpy(m_data+offset, buf, n);
+        m_dirty.add(offset, offset+n);
+    }   // write
+    // ------------------------------------------------------------------------
+    /** Copies all data in this chunk that falls into the file range
+     *  [file_offset, file_offset+n) into buf. Parts of buf that are not
+     *  covered by dirty data in this chunk are not modified. */
+    void overlay(off64_t file_offset, char *buf, size_t n) const
+    {
+        off64_t start = file_offset - m_offset;
+        off64_t end   = start + n;
+        ExtentMap::const_iterator i = m_dirty.firstIntersecting(start);
+        for(; i!=m_dirty.end() && i->first<end; i++)
+        {
+            off64_t s = std::max(start, i->first );
+            off64_t e = std::min(end,   i->second);
+            memcpy(buf+(s-start), m_data+s, e-s);
+        }
+    }   // overlay
+    // ------------------------------------------------------------------------
+    /** True if the whole chunk was written, i.e. it can be written to disk
+     *  with a single aligned write. */
+    bool isFull() const { return m_dirty.getNumBytes()==(off64_t)m_size; }
+    // ------------------------------------------------------------------------
+    /** Returns the file offset of the first byte of this chunk. */
+    off64_t getOffset() const { return m_offset; }
+    // ------------------------------------------------------------------------
+    /** Returns the size of this chunk. */
+    size_t getSize() const { return m_size; }
+    // ------------------------------------------------------------------------
+    /** Returns the number of bytes written into this chunk. */
+    off64_t getNumDirtyBytes() const { return m_dirty.getNumBytes(); }
+    // ------------------------------------------------------------------------
+    /** Returns the ranges (relative to the chunk start) that were written. */
+    const ExtentMap &getDirty() const { return m_dirty; }
+    // ------------------------------------------------------------------------
+    /** Returns the chunk buffer. */
+    const char *getData() const { return m_data; }
+    // ------------------------------------------------------------------------
+    /** Returns the chunk buffer. This is used to complete partially written
+     *  blocks with data from disk before an aligned write. */
+    char *getData() { return m_data; }
+};   // WriteChunk
+
+}   // namespace ALIO
+#endif
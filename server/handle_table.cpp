@@ -0,0 +1,110 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "server/handle_table.hpp"
+
+#include "server/write_aggregator.hpp"
+
+#include <unistd.h>
+#include <vector>
+
+// ----------------------------------------------------------------------------
+/** Closes all files that are still open. */
+HandleTable::~HandleTable()
+{
+    HandleMap &handles = m_handles.getData();
+    for(HandleMap::iterator i=handles.begin(); i!=handles.end(); i++)
+        closeHandle(i->second);
+}   // ~HandleTable
+
+// ----------------------------------------------------------------------------
+/** Closes the file of a handle (if it is still open) and frees the handle.
+ *  Data buffered by the write aggregator is written first.
+ */
+void HandleTable::closeHandle(FileHandle *handle)
+{
+    if(handle->m_aggregator) WriteAggregator::release(handle->m_aggregator);
+    if(handle->m_file)       fclose(handle->m_file);
+    if(handle->m_filedes>=0) close(handle->m_filedes);
+    delete handle;
+}   // closeHandle
+
+// ----------------------------------------------------------------------------
+/** Creates the handle for a file that is being opened. If the client
+ *  still has a file open with the same index (i.e. it never closed it),
+ *  that file is closed first.
+ */
+FileHandle *HandleTable::create(int client, int index)
+{
+    remove(client, index);
+    FileHandle *handle = new FileHandle();
+    m_handles.lock();
+    m_handles.getData()[Key(client, index)] = handle;
+    m_handles.unlock();
+    return handle;
+}   // create
+
+// ----------------------------------------------------------------------------
+/** Returns the handle of a file, or NULL if the client has no file open
+ *  with this index.
+ */
+FileHandle *HandleTable::find(int client, int index) const
+{
+    m_handles.lock();
+    const HandleMap &handles = m_handles.getData();
+    HandleMap::const_iterator i = handles.find(Key(client, index));
+    FileHandle *handle = i==handles.end() ? NULL : i->second;
+    m_handles.unlock();
+    return handle;
+}   // find
+
+// ----------------------------------------------------------------------------
+/** Closes a file (if it is still open) and removes its handle. */
+void HandleTable::remove(int client, int index)
+{
+    m_handles.lock();
+    HandleMap &handles = m_handles.getData();
+    HandleMap::iterator i = handles.find(Key(client, index));
+    if(i==handles.end())
+    {
+        m_handles.unlock();
+        return;
+    }
+    FileHandle *handle = i->second;
+    handles.erase(i);
+    m_handles.unlock();
+    closeHandle(handle);
+}   // remove
+
+// ----------------------------------------------------------------------------
+/** Closes all files of a client, e.g. when it disconnects. */
+void HandleTable::removeClient(int client)
+{
+    std::vector<FileHandle*> removed;
+    m_handles.lock();
+    HandleMap &handles = m_handles.getData();
+    HandleMap::iterator i = handles.lower_bound(Key(client, 0));
+    while(i!=handles.end() && i->first.first==client)
+    {
+        removed.push_back(i->second);
+        handles.erase(i++);
+    }
+    m_handles.unlock();
+    for(unsigned int j=0; j<removed.size(); j++)
+        closeHandle(removed[j]);
+}   // removeClient
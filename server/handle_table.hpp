@@ -0,0 +1,82 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef HEADER_HANDLE_TABLE_HPP
+#define HEADER_HANDLE_TABLE_HPP
+
+#include "tools/synchronised.hpp"
+
+#include <map>
+#include <stdio.h>
+#include <string>
+#include <utility>
+
+class WriteAggregator;
+
+/** One file opened by a client on the server. A file is either opened
+ *  with fopen (m_file is set) or with open (m_filedes is set).
+ */
+struct FileHandle
+{
+    FILE        *m_file;
+    int          m_filedes;
+    std::string  m_filename;
+
+    /** The fopen mode or the open flags used. */
+    std::string  m_mode;
+    int          m_flags;
+
+    /** The aggregator shared by all handles of this file, NULL if writes
+     *  are not aggregated. */
+    WriteAggregator *m_aggregator;
+
+    /** True if the writes of this handle are buffered in m_aggregator. */
+    bool         m_aggregated;
+
+    FileHandle() : m_file(NULL), m_filedes(-1), m_flags(0),
+                   m_aggregator(NULL), m_aggregated(false) {}
+};   // FileHandle
+
+// ============================================================================
+/** The files opened on the server, keyed by the client and the index of
+ *  the file object on the client. This allows one server to serve many
+ *  open files of many clients at the same time. The table can be used by
+ *  several threads, but each handle only by one thread at a time.
+ */
+class HandleTable
+{
+private:
+    typedef std::pair<int, int> Key;
+    typedef std::map<Key, FileHandle*> HandleMap;
+
+    Synchronised<HandleMap> m_handles;
+
+    static void closeHandle(FileHandle *handle);
+
+public:
+                ~HandleTable();
+    FileHandle  *create(int client, int index);
+    FileHandle  *find(int client, int index) const;
+    void         remove(int client, int index);
+    void         removeClient(int client);
+    // ------------------------------------------------------------------------
+    /** Returns the number of open files. */
+    size_t       size() const { return m_handles.getData().size(); }
+};   // HandleTable
+
+#endif
@@ -19,11 +19,14 @@
 
 
 #include "server/server.hpp"
+#include "server/write_aggregator.hpp"
 #include "tools/mpi_communication.hpp"
 #include "tools/message.hpp"
 #include "tools/os.hpp"
+#include "tools/string_utils.hpp"
 
 #include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
 
 
@@ -40,8 +43,24 @@ int main(int argc, char **argv)
 #endif
 
     std::string if_name = (argc>=2) ? argv[1] : "eth0";
+    int num_threads     = (argc>=3) ? atoi(argv[2]) : 4;
+    if(num_threads<1)
+        num_threads = 1;
+
+    // Optional window and stripe size for aggregating writes to shared
+    // files, e.g. "64M" and "1M" (see WriteAggregator). A window of 0
+    // (the default) disables the aggregation.
+    int64_t window = 0, stripe_size = 1024*1024;
+    if( (argc>=4 && !ALIO::StringUtils::parseSize(argv[3], &window     )) ||
+        (argc>=5 && !ALIO::StringUtils::parseSize(argv[4], &stripe_size))   )
+    {
+        printf("Usage: %s [INTERFACE [THREADS [WINDOW [STRIPE_SIZE]]]]\n",
+               argv[0]);
+        return 1;
+    }
+    WriteAggregator::init(window, stripe_size);
         
-    Server *server = new Server(if_name, communication);
+    Server *server = new Server(if_name, communication, num_threads);
 
 }   // main
 
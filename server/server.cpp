@@ -18,12 +18,15 @@
 
 
 #include "server/server.hpp"
+#include "server/write_aggregator.hpp"
+#include "tools/buffer_arena.hpp"
 #include "tools/i_communication.hpp"
 #include "tools/message.hpp"
 #include "tools/os.hpp"
 
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <ifaddrs.h>
 #include <netinet/in.h>
 #include <pthread.h>
@@ -33,6 +36,7 @@
 #include <string>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 /** Starts the server. The server listens on a socket in a separate thread
@@ -40,18 +44,30 @@
  *  back to the client (e.g. MPI port string), and inform the main thread
  *  to accept a new incomming connection. This is a work around for MPI's
  *  blocking MPI_Accept call :(
+ *  The main thread then serves all connected clients, see mainLoop(), and
+ *  a pool of IO threads executes the requests.
  *
  *  \param if_name Name of the interface on which to listen.
  *  \param communication A communication object to communicate with a client.
+ *  \param num_threads Number of IO threads.
  */
-Server::Server(const std::string &if_name, ICommunication *communication )
+Server::Server(const std::string &if_name, ICommunication *communication,
+               unsigned int num_threads)
 {
     m_config_dir    = ALIO::OS::getConfigDir();
-    m_file          = NULL;
-    m_filedes       = 0;
     m_communication = communication;
     m_if_name       = if_name;
-    m_new_connection_available.setAtomic(0);
+    m_pending_connections.setAtomic(0);
+
+    // The port must be open before the connection thread hands out the
+    // port name to clients.
+    m_communication->openPort();
+
+    FILE *port_file = ALIO::OS::fopen("alio_config.dat", "w");
+    char *port_name = m_communication->getPortName();
+
+    ALIO::OS::fwrite(port_name, 1, strlen(port_name), port_file);
+    ALIO::OS::fclose(port_file);
 
     // Spawn of a thread that will handle incoming connection requests.
     // This is necessary e.g. in the case of MPI since the MPI_Comm_accept
@@ -64,42 +80,334 @@ Server::Server(const std::string &if_name, ICommunication *communication )
     pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
     pthread_t *thread_id = new pthread_t();
 
-
     int error = pthread_create(thread_id, &attr,
                                &Server::handleConnectionRequests,  this);
+    if(error)
+    {
+        printf("Can not start the connection thread: %s.\n",
+               strerror(error));
+        return;
+    }
 
-    sleep(5000);
-    m_communication->openPort();
-
-    FILE *port_file = ALIO::OS::fopen("alio_config.dat", "w");
-    char *port_name = m_communication->getPortName();
-
-    ALIO::OS::fwrite(port_name, 1, strlen(port_name), port_file);
-    ALIO::OS::fclose(port_file);
+    pthread_cond_init(&m_work_signal, NULL);
+    pthread_cond_init(&m_done_signal, NULL);
+    for(unsigned int i=0; i<num_threads; i++)
+    {
+        pthread_t thread;
+        if(pthread_create(&thread, NULL, &Server::ioLoop, this)==0)
+            m_threads.push_back(thread);
+    }
+    if(m_threads.empty())
+    {
+        printf("Can not start any IO thread.\n");
+        return;
+    }
 
+    mainLoop();
+}   // Server
 
+// ----------------------------------------------------------------------------
+/** The communication thread. New clients are accepted as soon as the
+ *  connection thread has announced them. The clients are checked for
+ *  messages without blocking and round-robin, so that all clients are
+ *  served fairly. Received requests are handed to the IO threads, and
+ *  their answers are sent when they are executed. This is the only thread
+ *  that communicates with the clients. When there is nothing to do, the
+ *  server waits for answers between checks, doubling the time up to 1ms,
+ *  so that an idle server does not keep a core busy.
+ *  A compound frame is split into its messages, which are queued in order
+ *  like separately received requests. The client only puts a request that
+ *  is answered at the end of a frame, so a frame gets one answer.
+ */
+void Server::mainLoop()
+{
+    long delay = MIN_IDLE_DELAY;
     while(1)
     {
-        if(m_new_connection_available.getAtomic()==1)
+        while(m_pending_connections.getAtomic()>0)
         {
             m_communication->waitForConnection();
-            m_new_connection_available.setAtomic(2);
-
+            m_pending_connections.lock();
+            m_pending_connections.getData()--;
+            m_pending_connections.unlock();
         }
-        else if (m_new_connection_available.getAtomic()==2)
+
+        bool busy = false;
+        if(m_communication->pollForMessage())
         {
-            if(m_communication->waitForMessage())
+            ServerJob *job   = new ServerJob();
+            job->m_client    = m_communication->getClientId();
+            job->m_buffer    = m_communication->receive();
+            job->m_len       = m_communication->getMessageLength();
+            job->m_index     = Message::peekIndex(job->m_buffer);
+            job->m_reply     = NULL;
+            job->m_reply_len = 0;
+            job->m_reply_tag = 9;
+            if(!Message::isValid(job->m_buffer, job->m_len))
+            {
+                printf("Invalid message from client %d - ignored.\n",
+                       job->m_client);
+                ALIO::BufferArena::free(job->m_buffer);
+                delete job;
+            }
+            else if(Message::peekType(job->m_buffer)==Message::MSG_COMPOUND)
+            {
+                submitCompound(job->m_client, job->m_buffer, job->m_len);
+                ALIO::BufferArena::free(job->m_buffer);
+                delete job;
+            }
+            else if(Message::peekType(job->m_buffer)==Message::MSG_QUIT &&
+                    job->m_index<0)
             {
-                printf("Error waiting for message.\n");
-                return;
+                // The client exits, it is disconnected once all its
+                // requests are finished.
+                m_exiting_clients.insert(job->m_client);
+                ALIO::BufferArena::free(job->m_buffer);
+                delete job;
             }
-            char *buffer = m_communication->receive();
-            handleRequest(buffer);
-        }   // new_connection_available==2
+            else
+            {
+                m_jobs_per_client[job->m_client]++;
+                scheduleJob(job);
+            }
+            busy = true;
+        }
 
+        if(sendAnswers(busy ? 0 : delay))
+            busy = true;
+        disconnectExitingClients();
+
+        if(busy)
+            delay = MIN_IDLE_DELAY;
+        else if(delay<MAX_IDLE_DELAY)
+            delay *= 2;
     }   // while
+}   // mainLoop
 
-}   // Server
+// ----------------------------------------------------------------------------
+/** Queues the messages of a compound frame as separate jobs, in order. */
+void Server::submitCompound(int client, const char *buffer, int len)
+{
+    int pos = 0, msg_len;
+    const char *msg;
+    while( (msg=CompoundMessage::getMessage(buffer, len, &pos, &msg_len)) )
+    {
+        if(!Message::isValid(msg, msg_len))
+        {
+            printf("Invalid message from client %d - ignored.\n", client);
+            continue;
+        }
+        ServerJob *job   = new ServerJob();
+        job->m_client    = client;
+        job->m_buffer    = ALIO::BufferArena::allocate(msg_len);
+        memcpy(job->m_buffer, msg, msg_len);
+        job->m_len       = msg_len;
+        job->m_index     = Message::peekIndex(job->m_buffer);
+        job->m_reply     = NULL;
+        job->m_reply_len = 0;
+        job->m_reply_tag = 9;
+        m_jobs_per_client[client]++;
+        scheduleJob(job);
+    }
+}   // submitCompound
+
+// ----------------------------------------------------------------------------
+/** Returns true if a job accesses a file by its name (open, stat, rename,
+ *  unlink), and not through the handle of an open file.
+ */
+bool Server::isNameRequest(const ServerJob *job)
+{
+    switch(Message::peekType(job->m_buffer))
+    {
+    case Message::MSG_FOPEN:   case Message::MSG_FOPEN64:
+    case Message::MSG_OPEN:    case Message::MSG_OPEN64:
+    case Message::MSG___XSTAT: case Message::MSG___LXSTAT:
+    case Message::MSG_RENAME:  case Message::MSG_UNLINK:
+        return true;
+    default:
+        return false;
+    }
+}   // isNameRequest
+
+// ----------------------------------------------------------------------------
+/** Hands a job to the IO threads, unless it has to wait for other jobs of
+ *  its client. Jobs are only kept in order per file, but a request that
+ *  uses a file name can depend on requests for other files of the client
+ *  (e.g. an open of a file that was just renamed, or an unlink of a file
+ *  that still has writes queued). So such a request is only executed once
+ *  all earlier jobs of the client are finished, and later jobs of the
+ *  client wait till it is finished. Only used by the communication thread.
+ */
+void Server::scheduleJob(ServerJob *job)
+{
+    int client = job->m_client;
+    if(m_held_jobs.find(client)==m_held_jobs.end() &&
+       m_name_request_clients.find(client)==m_name_request_clients.end() &&
+       !isNameRequest(job))
+    {
+        submitJob(job);
+        return;
+    }
+    m_held_jobs[client].push_back(job);
+    releaseHeldJobs(client);
+}   // scheduleJob
+
+// ----------------------------------------------------------------------------
+/** Submits the waiting jobs of a client that do not need to wait anymore,
+ *  see scheduleJob().
+ */
+void Server::releaseHeldJobs(int client)
+{
+    std::map<int, std::deque<ServerJob*> >::iterator i =
+        m_held_jobs.find(client);
+    if(i==m_held_jobs.end())
+        return;
+    std::deque<ServerJob*> &held = i->second;
+    while(!held.empty() &&
+          m_name_request_clients.find(client)==m_name_request_clients.end())
+    {
+        ServerJob *job = held.front();
+        if(isNameRequest(job))
+        {
+            // m_jobs_per_client also counts the waiting jobs.
+            if(m_jobs_per_client[client]>(int)held.size())
+                break;
+            m_name_request_clients.insert(client);
+        }
+        held.pop_front();
+        submitJob(job);
+    }
+    if(held.empty())
+        m_held_jobs.erase(i);
+}   // releaseHeldJobs
+
+// ----------------------------------------------------------------------------
+/** Queues a job for the IO threads. */
+void Server::submitJob(ServerJob *job)
+{
+    FileKey key(job->m_client, job->m_index);
+    m_queues.lock();
+    FileQueue &queue = m_queues.getData()[key];
+    queue.m_jobs.push_back(job);
+    // Otherwise the file is already ready, or an IO thread will make it
+    // ready again when it finishes the current job.
+    if(!queue.m_busy && queue.m_jobs.size()==1)
+    {
+        m_ready.push_back(key);
+        pthread_cond_signal(&m_work_signal);
+    }
+    m_queues.unlock();
+}   // submitJob
+
+// ----------------------------------------------------------------------------
+/** Sends the answers of all executed jobs and frees the jobs.
+ *  \param timeout Time (in ns) to wait for a job to finish if none is
+ *         finished yet.
+ *  \return True if any job was finished.
+ */
+bool Server::sendAnswers(long timeout)
+{
+    m_queues.lock();
+    if(m_done.empty() && timeout>0)
+    {
+        struct timespec t;
+        clock_gettime(CLOCK_REALTIME, &t);
+        t.tv_nsec += timeout;
+        if(t.tv_nsec>=1000000000)
+        {
+            t.tv_sec++;
+            t.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&m_done_signal, m_queues.getMutex(), &t);
+    }
+    std::deque<ServerJob*> done;
+    done.swap(m_done);
+    m_queues.unlock();
+
+    for(unsigned int i=0; i<done.size(); i++)
+    {
+        ServerJob *job = done[i];
+        if(job->m_reply)
+        {
+            m_communication->sendToClient(job->m_client, job->m_reply,
+                                          job->m_reply_len,
+                                          job->m_reply_tag);
+            ALIO::BufferArena::free(job->m_reply);
+        }
+        int client = job->m_client;
+        if(--m_jobs_per_client[client]==0)
+            m_jobs_per_client.erase(client);
+        if(isNameRequest(job))
+            m_name_request_clients.erase(client);
+        ALIO::BufferArena::free(job->m_buffer);
+        delete job;
+        releaseHeldJobs(client);
+    }
+    return !done.empty();
+}   // sendAnswers
+
+// ----------------------------------------------------------------------------
+/** Closes all files of clients that exit and disconnects them, once all
+ *  their requests are finished.
+ */
+void Server::disconnectExitingClients()
+{
+    std::set<int>::iterator i = m_exiting_clients.begin();
+    while(i!=m_exiting_clients.end())
+    {
+        if(m_jobs_per_client.find(*i)!=m_jobs_per_client.end())
+        {
+            i++;
+            continue;
+        }
+        m_handles.removeClient(*i);
+        m_communication->disconnectClient(*i);
+        m_exiting_clients.erase(i++);
+    }
+}   // disconnectExitingClients
+
+// ----------------------------------------------------------------------------
+void *Server::ioLoop(void *obj)
+{
+    ((Server*)obj)->_ioLoop();
+    return NULL;
+}   // ioLoop
+
+// ----------------------------------------------------------------------------
+/** An IO thread: executes one job of a ready file at a time. A file is
+ *  only handed to one thread at a time, and after each job it is queued
+ *  again behind the other ready files.
+ */
+void Server::_ioLoop()
+{
+    m_queues.lock();
+    while(1)
+    {
+        while(m_ready.empty())
+            pthread_cond_wait(&m_work_signal, m_queues.getMutex());
+        FileKey key = m_ready.front();
+        m_ready.pop_front();
+        FileQueue &queue = m_queues.getData()[key];
+        ServerJob *job   = queue.m_jobs.front();
+        queue.m_jobs.pop_front();
+        queue.m_busy     = true;
+        m_queues.unlock();
+
+        handleRequest(job);
+
+        m_queues.lock();
+        m_done.push_back(job);
+        queue.m_busy = false;
+        if(queue.m_jobs.empty())
+            m_queues.getData().erase(key);
+        else
+        {
+            m_ready.push_back(key);
+            pthread_cond_signal(&m_work_signal);
+        }
+        pthread_cond_signal(&m_done_signal);
+    }   // while
+}   // _ioLoop
 
 // ----------------------------------------------------------------------------
 /** Static function running with its own thread. It just calls an internal
@@ -215,7 +523,9 @@ void Server::_handleConnectionRequests()
                 perror(NULL);
             }
         }
-        m_new_connection_available.setAtomic(1);
+        m_pending_connections.lock();
+        m_pending_connections.getData()++;
+        m_pending_connections.unlock();
         close(new_connection);
     }   // while(1)
 
@@ -223,32 +533,77 @@ void Server::_handleConnectionRequests()
 }   // handleConnectionRequests
 
 // ----------------------------------------------------------------------------
-/** Waits in a loop for incomming requests.
- *  \return 0 If a quit request was received, 1 in case of error.
+/** Executes one request of a client on an IO thread. The file the request
+ *  is for is found in the handle table using the client and the index of
+ *  the file object on the client. Requests for a file that is not open
+ *  fail with EBADF. An answer is stored in the job, and sent by the
+ *  communication thread.
  */
-int Server::handleRequest(char *buffer)
+void Server::handleRequest(ServerJob *job)
 {
-    static int xxx=1;
+    char *buffer = job->m_buffer;
+    int len      = job->m_len;
+    int client   = job->m_client;
+    int index    = job->m_index;
+    Message::MessageType type = Message::peekType(buffer);
+
+    FileHandle *handle = NULL;
+    switch(type)
+    {
+    case Message::MSG_FOPEN:
+    case Message::MSG_FOPEN64:
+    case Message::MSG_OPEN:
+    case Message::MSG_OPEN64:
+        handle = m_handles.create(client, index);
+        break;
+    default:
+        handle = m_handles.find(client, index);
+    }
+    // A closed handle, so that the file functions below fail with EBADF
+    // for files that are not open.
+    FileHandle not_open;
+    if(!handle)
+        handle = &not_open;
+
+    // Data buffered by the write aggregator must be in the file before the
+    // file is read or stat'ed.
+    if(handle->m_aggregator)
+    {
+        switch(type)
+        {
+        case Message::MSG_FSEEK:    case Message::MSG_FSEEKO:
+        case Message::MSG_FSEEKO64: case Message::MSG_FWRITE:
+        case Message::MSG_FREAD:    case Message::MSG_READ:
+        case Message::MSG___XSTAT:  case Message::MSG___FXSTAT:
+        case Message::MSG___FXSTAT64: case Message::MSG___LXSTAT:
+            handle->m_aggregator->flush();
+            break;
+        default:
+            break;
+        }
+    }
 
-    int len = m_communication->getMessageLength();
-    printf("Command %d\n", (Message::MessageType)buffer[0]);
-    switch((Message::MessageType)buffer[0])
+    switch(type)
     {
     case Message::MSG_FOPEN:
         {
-            std::string mode;
-            Message_fopen m(buffer, len, &m_filename, &mode);
-            m_file = fopen(m_filename.c_str(), mode.c_str());
+            Message_fopen m(buffer, len, &handle->m_filename, &handle->m_mode);
+            if(WriteAggregator::isEnabled())
+                WriteAggregator::flushFile(handle->m_filename);
+            handle->m_file = fopen(handle->m_filename.c_str(),
+                                   handle->m_mode.c_str());
+            attachAggregator(handle);
             break;
         }
     case Message::MSG_FOPEN64:
         {
-
-            std::string mode;
-            Message_fopen64 m(buffer, len, &m_filename, &mode);
-            printf("Open64 '%s' mode '%s'\n", m_filename.c_str(), mode.c_str());
-            m_file = fopen64(m_filename.c_str(), mode.c_str());
-            printf("done Open64 '%s' mode '%s'\n", m_filename.c_str(), mode.c_str());
+            Message_fopen64 m(buffer, len, &handle->m_filename,
+                              &handle->m_mode);
+            if(WriteAggregator::isEnabled())
+                WriteAggregator::flushFile(handle->m_filename);
+            handle->m_file = fopen64(handle->m_filename.c_str(),
+                                     handle->m_mode.c_str());
+            attachAggregator(handle);
             break;
         }
     case Message::MSG_FSEEK:
@@ -257,10 +612,13 @@ int Server::handleRequest(char *buffer)
             TYPE offset;                                                \
             int whence;                                                 \
             MESSAGE_TYPE m(buffer, len, &offset, &whence);              \
-            int send_len = m.getSize(whence)+m.getSize(errno);          \
-            int result = NAME(m_file, offset, whence);                  \
-            Message_fseek_answer answer(m.getIndex(), result, errno);   \
-            answer.send(m_communication);
+            int result = -1;                                            \
+            errno      = EBADF;                                         \
+            if(handle->m_file)                                          \
+                result = NAME(handle->m_file, offset, whence);          \
+            ReplyMessage answer(&m);                                    \
+            answer.setResult(result, errno);                            \
+            reply(job, &answer);
 
             FSEEK(fseek, long, Message_fseek_long);
             break;
@@ -281,17 +639,14 @@ int Server::handleRequest(char *buffer)
     case Message::MSG_FTELL:
         {
 #define FTELL(MESSAGE, NAME, TYPE)                             \
-            printf("XXXXXXXXX\n");\
             MESSAGE m(buffer, len);                            \
-            TYPE result;                                       \
-            int send_len = m.getSize(result)+m.getSize(errno); \
-            printf("send len %d\n", send_len); \
-            char *msg    = new char[send_len];                 \
-            TYPE *p      = (TYPE*)msg;                         \
-            p[0]         = NAME(m_file);                       \
-            memcpy(p+1, &errno, sizeof(errno));                \
-            m_communication->send(msg, send_len, 9);           \
-            delete [] msg;
+            TYPE result  = -1;                                 \
+            errno        = EBADF;                              \
+            if(handle->m_file)                                 \
+                result   = NAME(handle->m_file);               \
+            ReplyMessage answer(&m);                           \
+            answer.setResult(result, errno);                   \
+            reply(job, &answer);
 
             FTELL(Message_ftell, ftell, long);
             break;
@@ -312,29 +667,13 @@ int Server::handleRequest(char *buffer)
     case Message::MSG_FERROR:
         {
             Message_ferror m(buffer, len);
-            int n;
-            int send_len = m.getSize(n)+m.getSize(errno);
-            char *msg    = new char[send_len];
-            int *p       = (int*)msg;
-            if(xxx==1)
-            {
-                FILE *f1= fopen("Baxxaxx", "w");
-                fwrite("Hello\n", 1, 6, f1);
-                fclose(f1);
-                xxx++;
-            }
-            else
-            {
-                FILE *f1= fopen("Caxxaxx", "w");
-                fwrite("Hello\n", 1, 6, f1);
-                fclose(f1);
-                xxx++;
-            }
-
-            p[0]         = ferror(m_file);
-            p[1]         = errno;
-            m_communication->send(msg, send_len, 9);
-            delete [] msg;
+            int result   = -1;
+            errno        = EBADF;
+            if(handle->m_file)
+                result   = ferror(handle->m_file);
+            ReplyMessage answer(&m);
+            answer.setResult(result, errno);
+            reply(job, &answer);
             break;
         }   // switch
 
@@ -343,7 +682,16 @@ int Server::handleRequest(char *buffer)
             size_t size, nmemb;
             void *data;
             Message_fwrite m(buffer, len, &size, &nmemb, &data);
-            fwrite(data, size, nmemb, m_file);
+            // Each write is acknowledged, which gives the client a credit
+            // back (and reports errors).
+            int64_t result = -1;
+            errno          = EBADF;
+            if(handle->m_file &&
+               fwrite(data, size, nmemb, handle->m_file)==nmemb)
+                result = (int64_t)size*nmemb;
+            ReplyMessage ack(&m);
+            ack.setResult(result, errno);
+            reply(job, &ack, WRITE_ACK_TAG);
             break;
         }
     case Message::MSG_FREAD:
@@ -351,23 +699,37 @@ int Server::handleRequest(char *buffer)
             size_t size, nmemb;
             Message_fread m(buffer, len, &size, &nmemb);
 
-            size_t result = -1;
-            int answer_size = size*nmemb+sizeof(result);
-            Message_fread_answer m_ans(m.getIndex(), /*dont_allocate*/true);
-            m_ans.allocate(size*nmemb+sizeof(size_t));
-            // Read the file content and write it to the message buffer.
-            // Leave space for the result at the beginning, which is necessary
-            // for the server side to know how many bytes to copy
-            result = fread(m_ans.get()+sizeof(result), size, nmemb, m_file);
-            m_ans.add(result);
-            m_ans.send(m_communication);
-            // Memory in m_ans will be freed when m_ans is freed automatically
+            // The file content is read directly into the answer, and only
+            // the bytes read are sent.
+            size_t result = 0;
+            ReplyMessage answer(&m, size*nmemb);
+            if(handle->m_file)
+                result = fread(answer.getReplyData(), size, nmemb,
+                               handle->m_file);
+            answer.setResult(result, 0, result*size);
+            reply(job, &answer,
+                  m.getFlags() & Message::FLAG_READ_AHEAD ? READ_AHEAD_TAG : 9);
             break;
         }
     case Message::MSG_FCLOSE:
         {
             Message_fclose m(buffer, len);
-            fclose(m_file);
+            int error  = handle->m_aggregator ? handle->m_aggregator->flush()
+                                              : 0;
+            int result = EOF;
+            errno      = EBADF;
+            if(handle->m_file)
+                result = fclose(handle->m_file);
+            handle->m_file = NULL;
+            if(error)
+            {
+                result = EOF;
+                errno  = error;
+            }
+            m_handles.remove(client, index);
+            ReplyMessage answer(&m);
+            answer.setResult(result, errno);
+            reply(job, &answer);
             break;
         }
     case Message::MSG_FEOF:
@@ -386,77 +748,64 @@ int Server::handleRequest(char *buffer)
     case Message::MSG_OPEN:
     case Message::MSG_OPEN64:
         {
-            int flags;
             mode_t mode;
-            Message_open m(buffer, len, &m_filename, &flags, &mode);
+            Message_open m(buffer, len, &handle->m_filename, &handle->m_flags,
+                           &mode);
+            if(WriteAggregator::isEnabled())
+                WriteAggregator::flushFile(handle->m_filename);
             if(m.getType()==Message::MSG_OPEN)
-                m_filedes = open(m_filename.c_str(), flags, mode);
+                handle->m_filedes = open(handle->m_filename.c_str(),
+                                         handle->m_flags, mode);
             else
-                m_filedes = open64(m_filename.c_str(), flags, mode);
+                handle->m_filedes = open64(handle->m_filename.c_str(),
+                                           handle->m_flags, mode);
+            attachAggregator(handle);
             break;
         }
     case Message::MSG___XSTAT:
         {
-#ifdef XX
-#define XSTAT(TYPE, FUNC)                          \
-            Message_stat m(buffer, len);      \
-            int send_len = sizeof(TYPE) + 2*sizeof(int);
-            char *msg    = new char[send_len];
-            int *p       = (int *)msg;
-            p[0]         = FUNC(m_filename.c_str(), (struct stat*)(p+2) );
-            p[1]         = errno;
-            m_communication->send(msg, sizeof(struct stat)+2*sizeof(int), 9);
-            delete [] msg;
-            return false;
-            XSTAT(struct stat, );
-#endif
-            Message_stat m(buffer, len);
-            int send_len = sizeof(struct stat) + 2*sizeof(int);
-            char *msg    = new char[send_len];
-            int *p       = (int *)msg;
-            p[0]         = stat(m_filename.c_str(), (struct stat*)(p+2) );
-            p[1]         = errno;
-            m_communication->send(msg, sizeof(struct stat)+2*sizeof(int), 9);
-            delete [] msg;
+            // The name is sent with the request, since the file does not
+            // need to be open.
+#define STAT_BY_NAME(NAME, MESSAGE_TYPE)                                \
+            std::string filename;                                       \
+            MESSAGE_TYPE m(buffer, len, &filename);                     \
+            if(!handle->m_aggregator && WriteAggregator::isEnabled())   \
+                WriteAggregator::flushFile(filename);                   \
+            ReplyMessage answer(&m, sizeof(struct stat));               \
+            int result = NAME(filename.c_str(),                         \
+                              (struct stat*)answer.getReplyData());     \
+            answer.setResult(result, errno, sizeof(struct stat));       \
+            reply(job, &answer);
+
+            STAT_BY_NAME(stat, Message_stat);
+            break;
+        }
+
+    case Message::MSG___LXSTAT:
+        {
+            STAT_BY_NAME(lstat, Message_lstat);
             break;
         }
         
     case Message::MSG___FXSTAT:
         {
-            Message_stat m(buffer, len);
-            int send_len = sizeof(struct stat) + 2*sizeof(int);
-            char *msg    = new char[send_len];
-            int *p       = (int *)msg;
-            p[0]         = fstat(m_filedes, (struct stat*)(p+2) );
-            p[1]         = errno;
-            m_communication->send(msg, sizeof(struct stat)+2*sizeof(int), 9);
-            delete [] msg;
+            Message_fstat m(buffer, len);
+            ReplyMessage answer(&m, sizeof(struct stat));
+            int result = fstat(getFiledes(handle),
+                               (struct stat*)answer.getReplyData());
+            answer.setResult(result, errno, sizeof(struct stat));
+            reply(job, &answer);
             break;
         }
 
     case Message::MSG___FXSTAT64:
         {
-            Message_stat m(buffer, len);
-            int send_len = sizeof(struct stat64) + 2*sizeof(int);
-            char *msg    = new char[send_len];
-            int *p       = (int *)msg;
-            p[0]         = fstat64(m_filedes, (struct stat64*)(p+2) );
-            p[1]         = errno;
-            m_communication->send(msg, sizeof(struct stat64)+2*sizeof(int), 9);
-            delete [] msg;
-            break;
-        }
-        
-    case Message::MSG___LXSTAT:
-        {
-            Message_stat m(buffer, len);
-            int send_len = sizeof(struct stat) + 2*sizeof(int);
-            char *msg    = new char[send_len];
-            int *p       = (int *)msg;
-            p[0]         = lstat(m_filename.c_str(), (struct stat*)(p+2) );
-            p[1]         = errno;
-            m_communication->send(msg, sizeof(struct stat)+2*sizeof(int), 9);
-            delete [] msg;
+            Message_fstat64 m(buffer, len);
+            ReplyMessage answer(&m, sizeof(struct stat64));
+            int result = fstat64(getFiledes(handle),
+                                 (struct stat64*)answer.getReplyData());
+            answer.setResult(result, errno, sizeof(struct stat64));
+            reply(job, &answer);
             break;
         }
         
@@ -465,13 +814,12 @@ int Server::handleRequest(char *buffer)
             off_t offset;
             int whence;
             Message_lseek_off_t m(buffer, len, &offset, &whence);
-            int send_len = m.getSize(offset)+m.getSize(errno);
-            char *msg    = new char[send_len];
-            off_t *p     = (off_t*)msg;
-            p[0]         = lseek(m_filedes, offset, whence);
-            p[1]         = errno;
-            m_communication->send(msg, send_len, 9);
-            delete [] msg;
+            if(whence==SEEK_END && handle->m_aggregator)
+                handle->m_aggregator->flush();
+            off_t result = lseek(handle->m_filedes, offset, whence);
+            ReplyMessage answer(&m);
+            answer.setResult(result, errno);
+            reply(job, &answer);
             break;
         }   // switch
 
@@ -479,14 +827,13 @@ int Server::handleRequest(char *buffer)
         {
             off64_t offset;
             int whence;
-            Message_lseek_off_t m(buffer, len, &offset, &whence);
-            int send_len = m.getSize(offset)+m.getSize(errno);
-            char *msg    = new char[send_len];
-            off_t *p     = (off_t*)msg;
-            p[0]         = lseek(m_filedes, offset, whence);
-            p[1]         = errno;
-            m_communication->send(msg, send_len, 9);
-            delete [] msg;
+            Message_lseek_off64_t m(buffer, len, &offset, &whence);
+            if(whence==SEEK_END && handle->m_aggregator)
+                handle->m_aggregator->flush();
+            off64_t result = lseek64(handle->m_filedes, offset, whence);
+            ReplyMessage answer(&m);
+            answer.setResult(result, errno);
+            reply(job, &answer);
             break;
         }   // switch
 
@@ -496,7 +843,32 @@ int Server::handleRequest(char *buffer)
             void *data;
             Message_write m(buffer, len, &nbyte, &data);
 
-            write(m_filedes, data, nbyte);
+            int64_t result;
+            if(handle->m_aggregated)
+            {
+                // The file position is moved as if the data was written,
+                // so that seeks and reads of this handle stay correct.
+                off64_t end = lseek64(handle->m_filedes, nbyte, SEEK_CUR);
+                result = -1;
+                if(end>=0)
+                {
+                    int error = handle->m_aggregator->write(end-nbyte, data,
+                                                            nbyte);
+                    if(error==0)
+                        result = nbyte;
+                    errno = error;
+                }
+            }
+            else
+                result = write(handle->m_filedes, data, nbyte);
+            if(result>=0 && result<(int64_t)nbyte)
+            {
+                result = -1;
+                errno  = ENOSPC;
+            }
+            ReplyMessage ack(&m);
+            ack.setResult(result, errno);
+            reply(job, &ack, WRITE_ACK_TAG);
             break;
         }
     case Message::MSG_READ:
@@ -504,38 +876,111 @@ int Server::handleRequest(char *buffer)
             size_t count;
             Message_read m(buffer, len, &count);
 
-            ssize_t result;
-
-            int send_len = m.getSize(result) + m.getSize(errno) + count;
-            char *msg = new char[send_len];
-            ssize_t *p = (ssize_t*)msg;
-            p[0] = read(m_filedes, msg+ m.getSize(result) + m.getSize(errno), count);
-            // We can't assign to p[1], since then 8 bytes would be written
-            memcpy(p+1, &errno, sizeof(errno));
-            m_communication->send(msg, send_len, 9);
-            delete [] msg;
+            // Only the bytes read are sent.
+            ReplyMessage answer(&m, count);
+            ssize_t result = read(handle->m_filedes, answer.getReplyData(),
+                                  count);
+            answer.setResult(result, errno, result>0 ? result : 0);
+            reply(job, &answer,
+                  m.getFlags() & Message::FLAG_READ_AHEAD ? READ_AHEAD_TAG : 9);
             break;
         }
     case Message::MSG_CLOSE:
         {
             Message_close m(buffer, len);
-            int msg[2];
-            msg[0] = close(m_filedes);
-            msg[1] = errno;
-            m_communication->send(msg, 2*sizeof(int), 9);
+            int error  = handle->m_aggregator ? handle->m_aggregator->flush()
+                                              : 0;
+            int result = close(handle->m_filedes);
+            handle->m_filedes = -1;
+            if(error)
+            {
+                result = -1;
+                errno  = error;
+            }
+            m_handles.remove(client, index);
+            ReplyMessage answer(&m);
+            answer.setResult(result, errno);
+            reply(job, &answer);
+            break;
+        }
+    case Message::MSG_RENAME:
+        {
+            std::string oldpath, newpath;
+            Message_rename m(buffer, len, &oldpath, &newpath);
+            if(WriteAggregator::isEnabled())
+                WriteAggregator::flushFile(oldpath);
+            int result = rename(oldpath.c_str(), newpath.c_str());
+            ReplyMessage answer(&m);
+            answer.setResult(result, errno);
+            reply(job, &answer);
+            break;
+        }
+    case Message::MSG_UNLINK:
+        {
+            std::string filename;
+            Message_unlink m(buffer, len, &filename);
+            int result = unlink(filename.c_str());
+            ReplyMessage answer(&m);
+            answer.setResult(result, errno);
+            reply(job, &answer);
             break;
         }
     case Message::MSG_QUIT:
         {
+            // A file object on the client was deleted. A client that
+            // exits is handled by the communication thread.
             Message_quit m(buffer, len);
-            return true;
+            m_handles.remove(client, index);
+            break;
         }
     default:
         {
-            printf("Incorrect type %d found - ignored.\n",
-                   (Message::MessageType)buffer[0]);
+            printf("Incorrect type %d found - ignored.\n", type);
         }
     }   // switch
-    return false;
 }   // handleRequest
 
+// ----------------------------------------------------------------------------
+/** Returns the descriptor of an open file (also of one opened with fopen,
+ *  whose buffered data is flushed first), or -1.
+ */
+int Server::getFiledes(FileHandle *handle)
+{
+    if(!handle->m_file)
+        return handle->m_filedes;
+    fflush(handle->m_file);
+    return fileno(handle->m_file);
+}   // getFiledes
+
+// ----------------------------------------------------------------------------
+/** Connects a file that was just opened to the write aggregator of the
+ *  file (if aggregation is enabled). Writes with open are buffered, unless
+ *  the file is opened for appending or for direct or synchronous IO. Other
+ *  handles only make sure that the buffered data is written before they
+ *  access the file.
+ */
+void Server::attachAggregator(FileHandle *handle)
+{
+    if(!WriteAggregator::isEnabled() ||
+       (!handle->m_file && handle->m_filedes<0))
+        return;
+    int flags = handle->m_flags;
+    handle->m_aggregated = handle->m_filedes>=0 &&
+                           (flags & O_ACCMODE)!=O_RDONLY &&
+                           !(flags & (O_APPEND|O_DIRECT|O_SYNC|O_DSYNC));
+    int filedes = handle->m_file ? fileno(handle->m_file) : handle->m_filedes;
+    handle->m_aggregator = WriteAggregator::acquire(handle->m_filename,
+                                                    filedes,
+                                                    handle->m_aggregated);
+}   // attachAggregator
+
+// ----------------------------------------------------------------------------
+/** Stores the answer to a request. The job takes ownership of the data of
+ *  the answer.
+ */
+void Server::reply(ServerJob *job, Message *answer, int tag)
+{
+    job->m_reply_len = answer->getLen();
+    job->m_reply     = answer->release();
+    job->m_reply_tag = tag;
+}   // reply
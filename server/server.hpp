@@ -16,22 +16,90 @@
 //    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
 //
 
+#include "server/handle_table.hpp"
 #include "../tools/synchronised.hpp"
 
+#include <deque>
+#include <map>
+#include <pthread.h>
+#include <set>
 #include <stdio.h>
 #include <string>
+#include <utility>
+#include <vector>
 
 class ICommunication;
+class Message;
 
+/** A request received from a client, which is executed by an IO thread. */
+struct ServerJob
+{
+    int   m_client;
+    int   m_index;
+    /** The received message. */
+    char *m_buffer;
+    int   m_len;
+    /** The answer to send back to the client, NULL if there is none. */
+    char *m_reply;
+    int   m_reply_len;
+    int   m_reply_tag;
+};   // ServerJob
+
+// ============================================================================
 class Server
 {
 private:
-    FILE *m_file;
+    /** Jobs of one file, in the order in which they were received. */
+    struct FileQueue
+    {
+        std::deque<ServerJob*> m_jobs;
+        /** True while an IO thread executes a job of this file. */
+        bool                   m_busy;
+        FileQueue() : m_busy(false) {}
+    };   // FileQueue
+
+    typedef std::pair<int, int> FileKey;
+
+    /** All files opened by the clients. */
+    HandleTable m_handles;
+
+    /** The IO threads. */
+    std::vector<pthread_t> m_threads;
+
+    /** Queued jobs by file. Only one job of a file is executed at a time,
+     *  which keeps the order of the requests for each file. The lock of
+     *  m_queues protects all job lists. */
+    Synchronised< std::map<FileKey, FileQueue> > m_queues;
+
+    /** Files that have jobs and are not busy, in the order in which they
+     *  are served. */
+    std::deque<FileKey> m_ready;
 
+    /** Executed jobs, whose answers still need to be sent. */
+    std::deque<ServerJob*> m_done;
 
-    int  m_filedes;
+    /** Signals the IO threads that a file is ready. */
+    pthread_cond_t m_work_signal;
 
-    std::string m_filename;
+    /** Signals the communication thread that a job was executed. */
+    pthread_cond_t m_done_signal;
+
+    /** Number of jobs of each client that are not yet finished. Only used
+     *  by the communication thread. */
+    std::map<int, int> m_jobs_per_client;
+
+    /** Jobs of each client that wait for earlier jobs of the client, in
+     *  the order in which they were received (see scheduleJob()). Only
+     *  used by the communication thread. */
+    std::map<int, std::deque<ServerJob*> > m_held_jobs;
+
+    /** Clients that have a request using a file name in progress. Only
+     *  used by the communication thread. */
+    std::set<int> m_name_request_clients;
+
+    /** Clients that exit, which are disconnected once all their jobs are
+     *  finished. */
+    std::set<int> m_exiting_clients;
 
     /** The interface name to use. */
     std::string m_if_name;
@@ -39,18 +107,42 @@ private:
     /** Stores the user's config directory ($HOME/.alio). */
     std::string m_config_dir;
 
-    /** Flag to signal from the receiving thread that a new client 
-     *  tries to connect. */
-    Synchronised<int> m_new_connection_available;
+    /** Number of clients that the connection thread has given the port
+     *  name to, and that still need to be accepted. */
+    Synchronised<int> m_pending_connections;
+
+    /** Tag of write acknowledgements (see Remote). */
+    static const int WRITE_ACK_TAG = 10;
+
+    /** Tag of answers to read-ahead requests (see Remote). */
+    static const int READ_AHEAD_TAG = 11;
+
+    /** Range of the time (in ns) the server sleeps when idle. */
+    static const long MIN_IDLE_DELAY = 1000;
+    static const long MAX_IDLE_DELAY = 1000000;
 
     /** The object used for all communication. */
     ICommunication *m_communication;
 
-    int handleRequest(char *buffer);
+    void handleRequest(ServerJob *job);
+    void attachAggregator(FileHandle *handle);
+    static int getFiledes(FileHandle *handle);
+    void reply(ServerJob *job, Message *answer, int tag=9);
+    void mainLoop();
+    void submitJob(ServerJob *job);
+    void scheduleJob(ServerJob *job);
+    void releaseHeldJobs(int client);
+    static bool isNameRequest(const ServerJob *job);
+    void submitCompound(int client, const char *buffer, int len);
+    bool sendAnswers(long timeout);
+    void disconnectExitingClients();
 
+    static void *ioLoop(void *obj);
+    void _ioLoop();
     static void *handleConnectionRequests(void *obj);
     void _handleConnectionRequests();
 
 public:
-    Server(const std::string &if_name, ICommunication *communication);
+    Server(const std::string &if_name, ICommunication *communication,
+           unsigned int num_threads);
 };   // class Server
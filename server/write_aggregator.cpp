@@ -0,0 +1,350 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "server/write_aggregator.hpp"
+
+#include "tools/buffer_arena.hpp"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+using namespace ALIO;
+
+size_t WriteAggregator::m_window      = 0;
+size_t WriteAggregator::m_stripe_size = 1024*1024;
+Synchronised<WriteAggregator::AggregatorMap> WriteAggregator::m_aggregators;
+
+// ----------------------------------------------------------------------------
+/** Sets the aggregation parameters. Must be called before the first file
+ *  is opened.
+ *  \param window Number of bytes buffered per file before they are
+ *         written, 0 disables the aggregation.
+ *  \param stripe_size Writes are split at multiples of this size (e.g. the
+ *         stripe size of a parallel file system).
+ */
+void WriteAggregator::init(size_t window, size_t stripe_size)
+{
+    m_window      = window;
+    m_stripe_size = stripe_size>0 ? stripe_size : 1;
+}   // init
+
+// ----------------------------------------------------------------------------
+WriteAggregator::WriteAggregator(const std::string &key)
+{
+    m_key      = key;
+    m_buffered = 0;
+    m_filedes  = -1;
+    m_users    = 0;
+    m_error    = 0;
+    pthread_mutex_init(&m_mutex, NULL);
+}   // WriteAggregator
+
+// ----------------------------------------------------------------------------
+WriteAggregator::~WriteAggregator()
+{
+    flushLocked();
+    if(m_filedes>=0)
+        close(m_filedes);
+    pthread_mutex_destroy(&m_mutex);
+}   // ~WriteAggregator
+
+// ----------------------------------------------------------------------------
+/** Returns the name under which the aggregator of a file is stored, so
+ *  that different names of the same file share one aggregator.
+ */
+std::string WriteAggregator::getKey(const std::string &filename)
+{
+    char *path = realpath(filename.c_str(), NULL);
+    if(!path)
+        return filename;
+    std::string key = path;
+    ::free(path);
+    return key;
+}   // getKey
+
+// ----------------------------------------------------------------------------
+/** Returns the aggregator of a file that was just opened, and creates it
+ *  if no other handle has the file open.
+ *  \param filedes Descriptor of the opened file.
+ *  \param writable True if the handle writes through the aggregator. The
+ *         first such handle provides the descriptor used for writing.
+ */
+WriteAggregator *WriteAggregator::acquire(const std::string &filename,
+                                          int filedes, bool writable)
+{
+    std::string key = getKey(filename);
+    m_aggregators.lock();
+    AggregatorMap &all = m_aggregators.getData();
+    AggregatorMap::iterator i = all.find(key);
+    WriteAggregator *aggregator;
+    if(i==all.end())
+    {
+        aggregator = new WriteAggregator(key);
+        all[key]   = aggregator;
+    }
+    else
+        aggregator = i->second;
+    aggregator->m_users++;
+    m_aggregators.unlock();
+
+    if(writable)
+    {
+        pthread_mutex_lock(&aggregator->m_mutex);
+        if(aggregator->m_filedes<0)
+            aggregator->m_filedes = dup(filedes);
+        pthread_mutex_unlock(&aggregator->m_mutex);
+    }
+    return aggregator;
+}   // acquire
+
+// ----------------------------------------------------------------------------
+/** Writes the buffered data and releases the aggregator when a handle is
+ *  closed. The aggregator is deleted with its last handle.
+ */
+void WriteAggregator::release(WriteAggregator *aggregator)
+{
+    aggregator->flush();
+    m_aggregators.lock();
+    bool last = --aggregator->m_users==0;
+    if(last)
+        m_aggregators.getData().erase(aggregator->m_key);
+    m_aggregators.unlock();
+    if(last)
+        delete aggregator;
+}   // release
+
+// ----------------------------------------------------------------------------
+/** Writes the buffered data of a file (if it is open), e.g. before it is
+ *  opened again and possibly truncated.
+ */
+void WriteAggregator::flushFile(const std::string &filename)
+{
+    std::string key = getKey(filename);
+    m_aggregators.lock();
+    AggregatorMap &all = m_aggregators.getData();
+    AggregatorMap::iterator i = all.find(key);
+    if(i!=all.end())
+        i->second->flush();
+    m_aggregators.unlock();
+}   // flushFile
+
+// ----------------------------------------------------------------------------
+/** Buffers the data of a write, and writes all buffered data once more
+ *  than the aggregation window is buffered.
+ *  \return 0, or the errno of a failed write of buffered data.
+ */
+int WriteAggregator::write(off64_t offset, const void *data, size_t size)
+{
+    pthread_mutex_lock(&m_mutex);
+    int error = m_error;
+    if(error==0 && m_filedes<0)
+        error = EBADF;
+    if(error==0)
+    {
+        insert(offset, (const char*)data, size);
+        if(m_buffered>=m_window)
+            error = flushLocked();
+    }
+    pthread_mutex_unlock(&m_mutex);
+    return error;
+}   // write
+
+// ----------------------------------------------------------------------------
+/** Writes all buffered data.
+ *  \return 0, or the errno of a failed write.
+ */
+int WriteAggregator::flush()
+{
+    pthread_mutex_lock(&m_mutex);
+    int error = flushLocked();
+    pthread_mutex_unlock(&m_mutex);
+    return error;
+}   // flush
+
+// ----------------------------------------------------------------------------
+/** Adds a copy of the data to the tree. The parts of earlier extents that
+ *  are overwritten are removed: the head of an extent keeps its buffer,
+ *  a tail is copied into a new one.
+ */
+void WriteAggregator::insert(off64_t offset, const char *data, size_t size)
+{
+    if(size==0)
+        return;
+    off64_t end = offset+size;
+
+    // The first extent that can overlap is the one before offset.
+    ExtentMap::iterator i = m_extents.lower_bound(offset);
+    if(i!=m_extents.begin())
+    {
+        ExtentMap::iterator previous = i;
+        previous--;
+        if(previous->first+(off64_t)previous->second.m_size>offset)
+            i = previous;
+    }
+
+    Extent  head = {NULL, 0}, tail = {NULL, 0};
+    off64_t head_offset = 0;
+    while(i!=m_extents.end() && i->first<end)
+    {
+        off64_t start  = i->first;
+        Extent  extent = i->second;
+        m_extents.erase(i++);
+        m_buffered -= extent.m_size;
+        if(start+(off64_t)extent.m_size>end)
+        {
+            tail.m_size = start+extent.m_size-end;
+            tail.m_data = BufferArena::allocate(tail.m_size);
+            memcpy(tail.m_data, extent.m_data+(end-start), tail.m_size);
+        }
+        if(start<offset)
+        {
+            head        = extent;
+            head.m_size = offset-start;
+            head_offset = start;
+        }
+        else
+            BufferArena::free(extent.m_data);
+    }
+    if(head.m_data)
+    {
+        m_extents[head_offset] = head;
+        m_buffered += head.m_size;
+    }
+    if(tail.m_data)
+    {
+        m_extents[end] = tail;
+        m_buffered += tail.m_size;
+    }
+
+    Extent extent;
+    extent.m_size = size;
+    extent.m_data = BufferArena::allocate(size);
+    memcpy(extent.m_data, data, size);
+    m_extents[offset] = extent;
+    m_buffered += size;
+}   // insert
+
+// ----------------------------------------------------------------------------
+/** Writes all buffered data, one contiguous run of extents at a time, and
+ *  frees it. If a write fails the remaining data is discarded, and the
+ *  error is kept to be reported by later writes and closes.
+ *  \return 0, or the errno of the (first) failed write.
+ */
+int WriteAggregator::flushLocked()
+{
+    ExtentMap::iterator first = m_extents.begin();
+    while(first!=m_extents.end() && m_error==0)
+    {
+        ExtentMap::iterator last = first;
+        off64_t end = first->first+first->second.m_size;
+        for(last++; last!=m_extents.end() && last->first==end; last++)
+            end += last->second.m_size;
+        m_error = writeRun(first, last, end);
+        first = last;
+    }
+
+    for(ExtentMap::iterator i=m_extents.begin(); i!=m_extents.end(); i++)
+        BufferArena::free(i->second.m_data);
+    m_extents.clear();
+    m_buffered = 0;
+    return m_error;
+}   // flushLocked
+
+// ----------------------------------------------------------------------------
+/** Writes the contiguous extents [first, last), which end at file offset
+ *  end. Each pwritev ends at the last stripe boundary in the run (except
+ *  the one writing the rest of the run), so that all but the first and
+ *  last write of a run cover whole stripes.
+ *  \return 0, or the errno of a failed write.
+ */
+int WriteAggregator::writeRun(ExtentMap::iterator first,
+                              ExtentMap::iterator last, off64_t end)
+{
+    struct iovec iov[IOV_MAX];
+
+    // The extent containing pos, and the number of its bytes written.
+    ExtentMap::iterator current = first;
+    size_t  done = 0;
+    off64_t pos  = first->first;
+    while(pos<end)
+    {
+        off64_t limit = end - end%m_stripe_size;
+        if(limit<=pos)
+            limit = end;
+
+        int    n     = 0;
+        size_t bytes = 0;
+        size_t skip  = done;
+        for(ExtentMap::iterator i=current;
+            i!=last && n<IOV_MAX && pos+(off64_t)bytes<limit; i++)
+        {
+            size_t len = i->second.m_size-skip;
+            if(pos+(off64_t)(bytes+len)>limit)
+                len = limit-pos-bytes;
+            iov[n].iov_base = i->second.m_data+skip;
+            iov[n].iov_len  = len;
+            n++;
+            bytes += len;
+            skip   = 0;
+        }
+
+        // If there were too many extents, end at a stripe boundary anyway.
+        off64_t chunk_end = pos+bytes;
+        off64_t boundary  = chunk_end - chunk_end%m_stripe_size;
+        if(chunk_end<limit && boundary>pos)
+        {
+            size_t excess = chunk_end-boundary;
+            while(iov[n-1].iov_len<=excess)
+            {
+                excess -= iov[n-1].iov_len;
+                n--;
+            }
+            iov[n-1].iov_len -= excess;
+        }
+
+        ssize_t written = pwritev64(m_filedes, iov, n, pos);
+        if(written<0 && errno==EINTR)
+            continue;
+        if(written<0)
+            return errno;
+        if(written==0)
+            return ENOSPC;
+
+        pos += written;
+        while(written>0)
+        {
+            size_t left = current->second.m_size-done;
+            if((size_t)written<left)
+            {
+                done   += written;
+                written = 0;
+            }
+            else
+            {
+                written -= left;
+                done     = 0;
+                current++;
+            }
+        }
+    }
+    return 0;
+}   // writeRun
@@ -0,0 +1,110 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef HEADER_WRITE_AGGREGATOR_HPP
+#define HEADER_WRITE_AGGREGATOR_HPP
+
+#include "tools/synchronised.hpp"
+
+#include <map>
+#include <pthread.h>
+#include <string>
+#include <sys/types.h>
+
+/** Collects the writes of all clients to one file on the server, and
+ *  writes them as a few large writes (two-phase collective buffering like
+ *  in ROMIO, but transparent to the POSIX callers). The written pieces
+ *  are kept in a tree sorted by offset, and a later write replaces the
+ *  overlapping parts of earlier ones. When more than the aggregation
+ *  window is buffered, contiguous pieces are written together with
+ *  pwritev, split at stripe boundaries so that each write covers whole
+ *  stripes where possible. All handles of a file share one aggregator,
+ *  and the buffered data is also written before the file is read, stat'ed,
+ *  reopened or closed. An error while writing the buffered data is
+ *  reported by all later writes and closes of the file.
+ *  Aggregation is disabled by default (a window of 0).
+ */
+class WriteAggregator
+{
+private:
+    /** A piece of buffered data, allocated from the BufferArena. */
+    struct Extent
+    {
+        char   *m_data;
+        size_t  m_size;
+    };   // Extent
+
+    typedef std::map<off64_t, Extent> ExtentMap;
+    typedef std::map<std::string, WriteAggregator*> AggregatorMap;
+
+    /** The buffered data, keyed by the file offset. */
+    ExtentMap       m_extents;
+
+    /** Number of bytes in m_extents. */
+    size_t          m_buffered;
+
+    /** A duplicate of the descriptor of the first writer, used to write
+     *  the buffered data. -1 while the file was only opened for reading. */
+    int             m_filedes;
+
+    /** Number of handles using this aggregator. Protected by the lock of
+     *  m_aggregators. */
+    int             m_users;
+
+    /** The first error when writing the buffered data. */
+    int             m_error;
+
+    std::string     m_key;
+
+    /** Protects the buffered data. */
+    pthread_mutex_t m_mutex;
+
+    /** Number of bytes buffered per file before they are written. */
+    static size_t m_window;
+
+    static size_t m_stripe_size;
+
+    /** The aggregators of all open files, keyed by the real path. */
+    static Synchronised<AggregatorMap> m_aggregators;
+
+    static std::string getKey(const std::string &filename);
+
+    void insert(off64_t offset, const char *data, size_t size);
+    int  flushLocked();
+    int  writeRun(ExtentMap::iterator first, ExtentMap::iterator last,
+                  off64_t end);
+
+         WriteAggregator(const std::string &key);
+        ~WriteAggregator();
+
+public:
+    static void init(size_t window, size_t stripe_size);
+    static WriteAggregator *acquire(const std::string &filename,
+                                    int filedes, bool writable);
+    static void release(WriteAggregator *aggregator);
+    static void flushFile(const std::string &filename);
+
+    int  write(off64_t offset, const void *data, size_t size);
+    int  flush();
+
+    // ------------------------------------------------------------------------
+    /** Returns true if writes are aggregated. */
+    static bool isEnabled() { return m_window>0; }
+};   // WriteAggregator
+
+#endif
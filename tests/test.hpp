@@ -0,0 +1,49 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef HEADER_TEST_HPP
+#define HEADER_TEST_HPP
+
+#include <stdio.h>
+
+// A minimal check for the unit tests: a failed check prints the condition
+// and is counted, and main() returns testResult(), so that ctest reports
+// the test as failed.
+
+static int g_num_failed_checks = 0;
+
+#define CHECK(CONDITION)                                                  \
+    do                                                                    \
+    {                                                                     \
+        if(!(CONDITION))                                                  \
+        {                                                                 \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__,       \
+                   #CONDITION);                                           \
+            g_num_failed_checks++;                                        \
+        }                                                                 \
+    } while(0)
+
+// ----------------------------------------------------------------------------
+static int testResult()
+{
+    if(g_num_failed_checks>0)
+        printf("%d check(s) failed.\n", g_num_failed_checks);
+    return g_num_failed_checks>0 ? 1 : 0;
+}   // testResult
+
+#endif
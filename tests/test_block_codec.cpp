@@ -0,0 +1,192 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "tests/test.hpp"
+#include "tools/block_codec.hpp"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+using namespace ALIO;
+
+namespace
+{
+    const BlockCodec::Codec ALL_CODECS[] =
+        { BlockCodec::CODEC_NONE,    BlockCodec::CODEC_LZ,
+          BlockCodec::CODEC_FLOAT32, BlockCodec::CODEC_FLOAT64 };
+
+    // ------------------------------------------------------------------------
+    /** Compresses and decompresses the data with all codecs.
+     *  \return The size of the data compressed with the last codec
+     *          (float64). */
+    size_t roundTrip(const std::vector<char> &data)
+    {
+        size_t n = data.size();
+        std::vector<char> compressed(BlockCodec::getMaxCompressedSize(n));
+        std::vector<char> out(n+1);
+        size_t size = 0;
+        for(unsigned int c=0; c<4; c++)
+        {
+            size = BlockCodec::compress(ALL_CODECS[c], &data[0], n,
+                                        &compressed[0]);
+            CHECK(size<=compressed.size());
+            out[n] = 'x';
+            bool ok = BlockCodec::decompress(ALL_CODECS[c], &compressed[0],
+                                             size, &out[0], n);
+            CHECK(ok);
+            CHECK(n==0 || memcmp(&out[0], &data[0], n)==0);
+            // Nothing is written beyond the raw size.
+            CHECK(out[n]=='x');
+        }
+        return size;
+    }   // roundTrip
+}   // namespace
+
+// ----------------------------------------------------------------------------
+/** Sizes around the edge cases: empty, less than a float word, not a
+ *  multiple of the word size, and lengths needing extra length bytes. */
+static void testSizes()
+{
+    size_t sizes[] = {0, 1, 3, 7, 9, 15, 16, 17, 255, 270, 4095, 65537};
+    for(unsigned int i=0; i<sizeof(sizes)/sizeof(sizes[0]); i++)
+    {
+        std::vector<char> random(sizes[i]+1), runs(sizes[i]+1);
+        for(size_t j=0; j<sizes[i]; j++)
+        {
+            random[j] = (char)rand();
+            runs[j]   = (char)(j/300);
+        }
+        random.resize(sizes[i]);
+        runs.resize(sizes[i]);
+        roundTrip(random);
+        roundTrip(runs);
+    }
+}   // testSizes
+
+// ----------------------------------------------------------------------------
+/** Repeated data compresses, also with matches that overlap their own
+ *  output (offset smaller than the length) and offsets near the limit. */
+static void testCompression()
+{
+    std::vector<char> data(200000);
+    for(size_t i=0; i<data.size(); i++)
+        data[i] = "abc"[i%3];
+    std::vector<char> compressed(BlockCodec::getMaxCompressedSize(data.size()));
+    size_t size = BlockCodec::compress(BlockCodec::CODEC_LZ, &data[0],
+                                       data.size(), &compressed[0]);
+    CHECK(size<data.size()/100);
+    roundTrip(data);
+
+    // A random block repeated at a distance just below the 64K offset limit
+    // and just above it.
+    for(size_t distance=65530; distance<65540; distance+=4)
+    {
+        std::vector<char> far(distance+1000);
+        for(size_t i=0; i<far.size(); i++)
+            far[i] = i<distance ? (char)rand() : far[i-distance];
+        roundTrip(far);
+    }
+}   // testCompression
+
+// ----------------------------------------------------------------------------
+/** A smooth double field compresses better with the float64 codec. */
+static void testFloat()
+{
+    std::vector<double> field(8192);
+    for(size_t i=0; i<field.size(); i++)
+        field[i] = 300.0 + sin(i*0.001);
+    std::vector<char> data((char*)&field[0],
+                           (char*)&field[0]+field.size()*sizeof(double));
+    // Trailing bytes that are not a full word are kept.
+    data.push_back(1);
+    data.push_back(2);
+    std::vector<char> compressed(BlockCodec::getMaxCompressedSize(data.size()));
+    size_t lz = BlockCodec::compress(BlockCodec::CODEC_LZ, &data[0],
+                                     data.size(), &compressed[0]);
+    size_t float64 = roundTrip(data);
+    CHECK(float64<lz);
+}   // testFloat
+
+// ----------------------------------------------------------------------------
+/** Truncated, corrupted or wrongly sized input is rejected (or at least
+ *  decoded without writing beyond the output buffer). */
+static void testCorrupt()
+{
+    std::vector<char> data(10000);
+    for(size_t i=0; i<data.size(); i++)
+        data[i] = (char)(i%7 + (i/1000));
+    std::vector<char> compressed(BlockCodec::getMaxCompressedSize(data.size()));
+    size_t size = BlockCodec::compress(BlockCodec::CODEC_LZ, &data[0],
+                                       data.size(), &compressed[0]);
+    std::vector<char> out(data.size()+1);
+    // A truncated stream can only be accepted if all data was decoded
+    // (i.e. only the final empty literal run is missing).
+    bool truncated_ok = true;
+    for(size_t n=0; n<size; n++)
+    {
+        if(BlockCodec::decompress(BlockCodec::CODEC_LZ, &compressed[0], n,
+                                  &out[0], data.size()))
+            truncated_ok &= memcmp(&out[0], &data[0], data.size())==0;
+    }
+    CHECK(truncated_ok);
+    CHECK(!BlockCodec::decompress(BlockCodec::CODEC_LZ, &compressed[0],
+                                  size/2, &out[0], data.size()));
+    CHECK(!BlockCodec::decompress(BlockCodec::CODEC_LZ, &compressed[0],
+                                  size, &out[0], data.size()-1));
+    CHECK(!BlockCodec::decompress(BlockCodec::CODEC_NONE, &data[0],
+                                  data.size(), &out[0], data.size()-1));
+
+    for(int round=0; round<1000; round++)
+    {
+        std::vector<char> broken(compressed.begin(),
+                                 compressed.begin()+size);
+        broken[rand()%size] = (char)rand();
+        out[data.size()] = 'x';
+        BlockCodec::decompress(BlockCodec::CODEC_LZ, &broken[0], size,
+                               &out[0], data.size());
+        CHECK(out[data.size()]=='x');
+    }
+}   // testCorrupt
+
+// ----------------------------------------------------------------------------
+static void testParse()
+{
+    BlockCodec::Codec codec;
+    CHECK(BlockCodec::parseCodec("none",    &codec) &&
+          codec==BlockCodec::CODEC_NONE);
+    CHECK(BlockCodec::parseCodec("lz",      &codec) &&
+          codec==BlockCodec::CODEC_LZ);
+    CHECK(BlockCodec::parseCodec("float32", &codec) &&
+          codec==BlockCodec::CODEC_FLOAT32);
+    CHECK(BlockCodec::parseCodec("float64", &codec) &&
+          codec==BlockCodec::CODEC_FLOAT64);
+    CHECK(!BlockCodec::parseCodec("zip",    &codec));
+}   // testParse
+
+// ----------------------------------------------------------------------------
+int main()
+{
+    testSizes();
+    testCompression();
+    testFloat();
+    testCorrupt();
+    testParse();
+    return testResult();
+}   // main
@@ -0,0 +1,208 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "tests/test.hpp"
+#include "client/checkpoint.hpp"
+#include "tools/block_hash.hpp"
+#include "tools/os.hpp"
+#include "xml/xml_node.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace ALIO;
+
+// checkpoint.cpp is compiled into this test without the rest of the client
+// library. The file object only uses the config for the descriptors that
+// open() returns, which this test does not call.
+Config *Config::m_config = NULL;
+
+namespace
+{
+    const size_t BLOCK_SIZE = 4096;
+    std::string  g_directory;
+    XMLNode     *g_info = NULL;
+
+    // ------------------------------------------------------------------------
+    std::string getName(int generation)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "ckpt_%d.dat", generation);
+        return g_directory+name;
+    }   // getName
+
+    // ------------------------------------------------------------------------
+    off64_t getFileSize(const std::string &name)
+    {
+        struct stat buf;
+        return stat(name.c_str(), &buf)==0 ? buf.st_size : -1;
+    }   // getFileSize
+
+    // ------------------------------------------------------------------------
+    /** Writes a checkpoint with fwrite in pieces that are not aligned to
+     *  blocks. */
+    bool writeCheckpoint(int generation, const std::vector<char> &data)
+    {
+        CheckpointFileObject file(g_info);
+        file.setFilename(getName(generation));
+        if(!file.fopen("w"))
+            return false;
+        size_t pos = 0;
+        while(pos<data.size())
+        {
+            size_t n = std::min((size_t)1000, data.size()-pos);
+            if(file.fwrite(&data[pos], 1, n)!=n)
+                return false;
+            pos += n;
+        }
+        return file.fclose()==0;
+    }   // writeCheckpoint
+
+    // ------------------------------------------------------------------------
+    /** Reads a checkpoint and compares it with the expected data, reading
+     *  once sequentially and once from an offset in the middle of a block.
+     */
+    bool checkCheckpoint(int generation, const std::vector<char> &data)
+    {
+        CheckpointFileObject file(g_info);
+        file.setFilename(getName(generation));
+        if(!file.fopen("r"))
+            return false;
+        std::vector<char> in(data.size()+10);
+        size_t n = file.fread(&in[0], 1, in.size());
+        bool ok = n==data.size() &&
+                  (n==0 || memcmp(&in[0], &data[0], n)==0);
+        if(data.size()>BLOCK_SIZE+100)
+        {
+            off64_t offset = BLOCK_SIZE+100;
+            ok = ok && file.fseeko64(offset, SEEK_SET)==0 &&
+                 file.fread(&in[0], 1, 200)==200 &&
+                 memcmp(&in[0], &data[offset], 200)==0;
+        }
+        return file.fclose()==0 && ok;
+    }   // checkCheckpoint
+}   // namespace
+
+// ----------------------------------------------------------------------------
+/** Writes successive generations and checks that only changed blocks are
+ *  stored in the delta files, and that all generations read back. */
+static void testGenerations()
+{
+    // 5 full blocks and a partial one.
+    std::vector<char> gen1(5*BLOCK_SIZE+123);
+    for(size_t i=0; i<gen1.size(); i++)
+        gen1[i] = (char)rand();
+    CHECK(writeCheckpoint(1, gen1));
+    CHECK(getFileSize(getName(1)+".delta")==(off64_t)gen1.size());
+    CHECK(checkCheckpoint(1, gen1));
+
+    // One byte at offset 0 and one in block 3 change.
+    std::vector<char> gen2 = gen1;
+    gen2[0]++;
+    gen2[3*BLOCK_SIZE+7]++;
+    CHECK(writeCheckpoint(2, gen2));
+    CHECK(getFileSize(getName(2)+".delta")==2*(off64_t)BLOCK_SIZE);
+    CHECK(checkCheckpoint(2, gen2));
+    CHECK(checkCheckpoint(1, gen1));
+
+    // Unchanged: no delta data is written at all.
+    CHECK(writeCheckpoint(3, gen2));
+    CHECK(getFileSize(getName(3)+".delta")<=0);
+    CHECK(checkCheckpoint(3, gen2));
+
+    // The partial last block grows: only that block is written again.
+    std::vector<char> gen4 = gen2;
+    gen4.resize(gen2.size()+50, 'x');
+    CHECK(writeCheckpoint(4, gen4));
+    CHECK(getFileSize(getName(4)+".delta")==(off64_t)(123+50));
+    CHECK(checkCheckpoint(4, gen4));
+
+    // Shrinking to a whole number of blocks reuses all remaining blocks.
+    std::vector<char> gen5(gen4.begin(), gen4.begin()+2*BLOCK_SIZE);
+    CHECK(writeCheckpoint(5, gen5));
+    CHECK(getFileSize(getName(5)+".delta")<=0);
+    CHECK(checkCheckpoint(5, gen5));
+}   // testGenerations
+
+// ----------------------------------------------------------------------------
+/** The block hash depends on every byte and on the length, also for the
+ *  tail that is not a multiple of 16 bytes. */
+static void testHash()
+{
+    unsigned char data[64];
+    memset(data, 0, sizeof(data));
+    uint64_t hashes[65][2];
+    for(size_t n=0; n<=64; n++)
+        BlockHash::compute(data, n, hashes[n]);
+    bool all_different = true;
+    for(size_t i=0; i<=64; i++)
+        for(size_t j=0; j<i; j++)
+            all_different &= memcmp(hashes[i], hashes[j], 16)!=0;
+    CHECK(all_different);
+
+    bool changes = true;
+    for(size_t i=0; i<40; i++)
+    {
+        uint64_t before[2], after[2];
+        BlockHash::compute(data, 40, before);
+        data[i] ^= 0x80;
+        BlockHash::compute(data, 40, after);
+        data[i] ^= 0x80;
+        changes &= memcmp(before, after, 16)!=0;
+    }
+    CHECK(changes);
+}   // testHash
+
+// ----------------------------------------------------------------------------
+static void testEmpty()
+{
+    std::vector<char> empty;
+    CHECK(writeCheckpoint(100, empty));
+    CHECK(checkCheckpoint(100, empty));
+}   // testEmpty
+
+// ----------------------------------------------------------------------------
+int main()
+{
+    OS::init();
+    char directory[] = "/tmp/alio_test_checkpoint_XXXXXX";
+    if(!mkdtemp(directory))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    g_directory = std::string(directory)+"/";
+    std::string config = g_directory+"io.xml";
+    FILE *f = fopen(config.c_str(), "w");
+    fprintf(f, "<io type=\"checkpoint\" generation=\"ckpt_([0-9]+)\\.dat\" "
+               "block-size=\"%d\" />", (int)BLOCK_SIZE);
+    fclose(f);
+    g_info = new XMLNode(config);
+
+    testHash();
+    testGenerations();
+    testEmpty();
+
+    delete g_info;
+    int result = system(("rm -rf "+g_directory).c_str());
+    (void)result;
+    return testResult();
+}   // main
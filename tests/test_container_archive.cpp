@@ -0,0 +1,242 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "tests/test.hpp"
+#include "tools/container_archive.hpp"
+
+#include <errno.h>
+#include <map>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+using namespace ALIO;
+
+namespace
+{
+    typedef std::map<std::string, std::string> Files;
+
+    // ------------------------------------------------------------------------
+    /** Creates an empty temporary file (which is already unlinked). */
+    int createFile()
+    {
+        char name[] = "/tmp/alio_test_container_XXXXXX";
+        int filedes = mkstemp(name);
+        if(filedes<0)
+            perror("mkstemp");
+        else
+            unlink(name);
+        return filedes;
+    }   // createFile
+
+    // ------------------------------------------------------------------------
+    /** Returns the content of a file in the container. */
+    std::string readAll(const ContainerArchive &archive,
+                        const ContainerArchive::Entry &entry)
+    {
+        std::string data(entry.m_size+10, 'x');
+        ssize_t n = archive.read(entry, &data[0], data.size(), 0);
+        data.resize(n<0 ? 0 : n);
+        return data;
+    }   // readAll
+
+    // ------------------------------------------------------------------------
+    /** Returns true if the container has exactly the expected files. */
+    bool compare(const ContainerArchive &archive, const Files &files)
+    {
+        if(archive.getEntries().size()!=files.size())
+            return false;
+        for(Files::const_iterator i=files.begin(); i!=files.end(); i++)
+        {
+            const ContainerArchive::Entry *entry = archive.find(i->first);
+            if(!entry || entry->m_size!=i->second.size() ||
+               readAll(archive, *entry)!=i->second)
+                return false;
+        }
+        return true;
+    }   // compare
+}   // namespace
+
+// ----------------------------------------------------------------------------
+/** An empty file becomes an empty container, other files are rejected. */
+static void testEmpty()
+{
+    int filedes = createFile();
+    ContainerArchive archive;
+    CHECK(archive.load(filedes));
+    CHECK(archive.getEntries().empty() && archive.getEnd()==8);
+    ContainerArchive reloaded;
+    CHECK(reloaded.load(filedes));
+    CHECK(reloaded.getEntries().empty() && reloaded.getEnd()==8);
+    CHECK(reloaded.find("a")==NULL);
+
+    CHECK(pwrite(filedes, "ALIOXXXX", 8, 0)==8);
+    errno = 0;
+    CHECK(!reloaded.load(filedes) && errno==EINVAL);
+    CHECK(ftruncate(filedes, 3)==0);
+    CHECK(!reloaded.load(filedes));
+    close(filedes);
+}   // testEmpty
+
+// ----------------------------------------------------------------------------
+/** Overlapping writes, holes, partial reads and reads at the end. */
+static void testReadWrite()
+{
+    int filedes = createFile();
+    ContainerArchive archive;
+    CHECK(archive.load(filedes));
+    CHECK(archive.writeData("f", 0, "hello world", 11));
+    CHECK(archive.writeData("f", 6, "WORLD", 5));
+    CHECK(archive.writeData("f", 20, "end", 3));
+    const ContainerArchive::Entry *entry = archive.find("f");
+    CHECK(entry && entry->m_size==23);
+    if(!entry)
+        return;
+    CHECK(readAll(archive, *entry)==
+          std::string("hello WORLD")+std::string(9, '\0')+"end");
+
+    char buf[8];
+    CHECK(archive.read(*entry, buf, 4, 4)==4 && memcmp(buf, "o WO", 4)==0);
+    CHECK(archive.read(*entry, buf, 8, 21)==2 && memcmp(buf, "nd", 2)==0);
+    CHECK(archive.read(*entry, buf, 8, 23)==0);
+    CHECK(archive.read(*entry, buf, 8, 100)==0);
+    close(filedes);
+}   // testReadWrite
+
+// ----------------------------------------------------------------------------
+/** Truncate, remove and rename, and the index after reloading. */
+static void testOperations()
+{
+    int filedes = createFile();
+    ContainerArchive archive;
+    CHECK(archive.load(filedes));
+    Files files;
+
+    CHECK(archive.truncate("empty"));
+    files["empty"] = "";
+    CHECK(archive.writeData("a", 0, "aaaa", 4));
+    files["a"] = "aaaa";
+    CHECK(archive.writeData("b", 0, "bb", 2));
+    files["b"] = "bb";
+    CHECK(compare(archive, files));
+
+    CHECK(archive.truncate("a"));
+    CHECK(archive.writeData("a", 0, "A", 1));
+    files["a"] = "A";
+    CHECK(archive.rename("b", "a"));   // replaces a
+    files["a"] = "bb";
+    files.erase("b");
+    CHECK(archive.remove("empty"));
+    files.erase("empty");
+    CHECK(compare(archive, files));
+
+    ContainerArchive reloaded;
+    CHECK(reloaded.load(filedes));
+    CHECK(compare(reloaded, files));
+    CHECK(reloaded.getEnd()==archive.getEnd());
+    close(filedes);
+}   // testOperations
+
+// ----------------------------------------------------------------------------
+/** A record that was cut off is ignored and overwritten by the next one. */
+static void testCutOff()
+{
+    int filedes = createFile();
+    ContainerArchive archive;
+    CHECK(archive.load(filedes));
+    CHECK(archive.writeData("a", 0, "first", 5));
+    off64_t end = archive.getEnd();
+    CHECK(archive.writeData("a", 0, "second", 6));
+    CHECK(ftruncate(filedes, archive.getEnd()-2)==0);
+
+    Files files;
+    files["a"] = "first";
+    ContainerArchive reloaded;
+    CHECK(reloaded.load(filedes));
+    CHECK(reloaded.getEnd()==end);
+    CHECK(compare(reloaded, files));
+
+    CHECK(reloaded.writeData("b", 0, "new", 3));
+    files["b"] = "new";
+    ContainerArchive again;
+    CHECK(again.load(filedes));
+    CHECK(compare(again, files));
+    close(filedes);
+}   // testCutOff
+
+// ----------------------------------------------------------------------------
+/** Random operations compared with files kept in memory. */
+static void testRandom()
+{
+    int filedes = createFile();
+    ContainerArchive archive;
+    CHECK(archive.load(filedes));
+    Files files;
+    const char *names[] = {"x", "y", "dir/z"};
+    bool same = true;
+    for(int i=0; i<500; i++)
+    {
+        std::string name = names[rand()%3];
+        int op = rand()%10;
+        if(op<7)
+        {
+            uint64_t offset = rand()%100;
+            std::string data(1+rand()%50, (char)('a'+rand()%26));
+            CHECK(archive.writeData(name, offset, data.data(), data.size()));
+            std::string &f = files[name];
+            if(f.size()<offset+data.size())
+                f.resize(offset+data.size(), '\0');
+            f.replace(offset, data.size(), data);
+        }
+        else if(op==7)
+        {
+            CHECK(archive.truncate(name));
+            files[name] = "";
+        }
+        else if(op==8)
+        {
+            CHECK(archive.remove(name));
+            files.erase(name);
+        }
+        else if(files.find(name)!=files.end())
+        {
+            std::string new_name = names[rand()%3];
+            CHECK(archive.rename(name, new_name));
+            std::string data = files[name];
+            files.erase(name);
+            files[new_name] = data;
+        }
+        same = same && compare(archive, files);
+    }
+    CHECK(same);
+    ContainerArchive reloaded;
+    CHECK(reloaded.load(filedes));
+    CHECK(compare(reloaded, files));
+    close(filedes);
+}   // testRandom
+
+// ----------------------------------------------------------------------------
+int main()
+{
+    testEmpty();
+    testReadWrite();
+    testOperations();
+    testCutOff();
+    testRandom();
+    return testResult();
+}   // main
@@ -0,0 +1,121 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "tests/test.hpp"
+#include "tools/extent_map.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+
+using namespace ALIO;
+
+// ----------------------------------------------------------------------------
+/** Overlapping and touching ranges are merged, empty ranges ignored. */
+static void testMerge()
+{
+    ExtentMap map;
+    CHECK(map.empty() && map.getEnd()==0);
+    map.add(10, 10);
+    CHECK(map.empty());
+
+    map.add(0, 4);
+    map.add(8, 12);
+    CHECK(map.getNumExtents()==2 && map.getNumBytes()==8);
+    map.add(4, 8);          // touches both
+    CHECK(map.getNumExtents()==1 && map.getNumBytes()==12);
+    CHECK(map.begin()->first==0 && map.begin()->second==12);
+
+    map.add(20, 30);
+    map.add(25, 40);        // overlaps the end
+    map.add(15, 21);        // overlaps the start
+    CHECK(map.getNumExtents()==2 && map.getNumBytes()==12+25);
+    CHECK(map.getEnd()==40);
+
+    map.add(0, 100);        // covers everything
+    CHECK(map.getNumExtents()==1 && map.getNumBytes()==100);
+
+    map.clear();
+    CHECK(map.empty() && map.getNumBytes()==0);
+}   // testMerge
+
+// ----------------------------------------------------------------------------
+static void testQueries()
+{
+    ExtentMap map;
+    map.add(0, 10);
+    map.add(20, 30);
+    CHECK( map.covers(0, 10));
+    CHECK( map.covers(3, 7));
+    CHECK(!map.covers(5, 11));
+    CHECK(!map.covers(10, 20));
+    CHECK( map.covers(20, 30));
+    CHECK(!map.covers(15, 25));
+
+    CHECK(map.firstIntersecting(0 )->first==0 );
+    CHECK(map.firstIntersecting(9 )->first==0 );
+    CHECK(map.firstIntersecting(10)->first==20);
+    CHECK(map.firstIntersecting(25)->first==20);
+    CHECK(map.firstIntersecting(30)==map.end());
+}   // testQueries
+
+// ----------------------------------------------------------------------------
+/** Adds random ranges and compares the map with a bitmap. */
+static void testRandom()
+{
+    const int N = 1000;
+    for(int round=0; round<100; round++)
+    {
+        ExtentMap map;
+        bool used[N];
+        memset(used, 0, sizeof(used));
+        for(int i=0; i<20; i++)
+        {
+            int start = rand()%N;
+            int end   = start + rand()%(N-start+1);
+            map.add(start, end);
+            for(int j=start; j<end; j++)
+                used[j] = true;
+        }
+        bool same = true;
+        off64_t num_bytes = 0, previous_end = -1;
+        for(ExtentMap::const_iterator i=map.begin(); i!=map.end(); i++)
+        {
+            // Extents must neither overlap nor touch.
+            same = same && i->first>previous_end && i->first<i->second;
+            previous_end = i->second;
+            num_bytes   += i->second - i->first;
+        }
+        for(int j=0; j<N; j++)
+        {
+            ExtentMap::const_iterator i = map.firstIntersecting(j);
+            bool in_map = i!=map.end() && i->first<=j;
+            same = same && in_map==used[j] && map.covers(j, j+1)==used[j];
+        }
+        CHECK(same);
+        CHECK(num_bytes==map.getNumBytes());
+    }
+}   // testRandom
+
+// ----------------------------------------------------------------------------
+int main()
+{
+    testMerge();
+    testQueries();
+    testRandom();
+    return testResult();
+}   // main
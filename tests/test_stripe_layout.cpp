@@ -0,0 +1,155 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "tests/test.hpp"
+#include "tools/stripe_layout.hpp"
+
+#include <set>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <utility>
+
+using namespace ALIO;
+
+namespace
+{
+    // ------------------------------------------------------------------------
+    StripeLayout createLayout(uint64_t stripe_size, unsigned int count)
+    {
+        StripeLayout layout;
+        layout.m_stripe_size = stripe_size;
+        layout.m_size        = 12345;
+        for(unsigned int i=0; i<count; i++)
+        {
+            char name[32];
+            snprintf(name, sizeof(name), "data.%u", i);
+            layout.m_names.push_back(name);
+        }
+        return layout;
+    }   // createLayout
+}   // namespace
+
+// ----------------------------------------------------------------------------
+static void testMap()
+{
+    StripeLayout layout = createLayout(100, 3);
+    unsigned int stripe;
+    off64_t backing;
+    size_t left;
+
+    layout.map(0, &stripe, &backing, &left);
+    CHECK(stripe==0 && backing==0 && left==100);
+    layout.map(99, &stripe, &backing, &left);
+    CHECK(stripe==0 && backing==99 && left==1);
+    layout.map(100, &stripe, &backing, &left);
+    CHECK(stripe==1 && backing==0 && left==100);
+    layout.map(250, &stripe, &backing, &left);
+    CHECK(stripe==2 && backing==50 && left==50);
+    // The second round continues after the first stripe of each file.
+    layout.map(300, &stripe, &backing, &left);
+    CHECK(stripe==0 && backing==100 && left==100);
+    layout.map(1000005, &stripe, &backing, &left);
+    CHECK(stripe==1 && backing==333305 && left==95);
+
+    // Each logical byte has its own place in the backing files, and the
+    // backing files are filled without gaps.
+    std::set< std::pair<unsigned int, off64_t> > used;
+    off64_t end[3] = {0, 0, 0};
+    for(off64_t offset=0; offset<3000; offset++)
+    {
+        layout.map(offset, &stripe, &backing, &left);
+        used.insert(std::make_pair(stripe, backing));
+        if(backing+1>end[stripe])
+            end[stripe] = backing+1;
+    }
+    CHECK(used.size()==3000);
+    CHECK(end[0]+end[1]+end[2]==3000);
+}   // testMap
+
+// ----------------------------------------------------------------------------
+static void testGetPath()
+{
+    StripeLayout layout = createLayout(100, 2);
+    layout.m_names[1] = "/abs/file";
+    CHECK(layout.getPath(0, "/dir/layout")=="/dir/data.0");
+    CHECK(layout.getPath(0, "layout"     )=="data.0"     );
+    CHECK(layout.getPath(1, "/dir/layout")=="/abs/file"  );
+}   // testGetPath
+
+// ----------------------------------------------------------------------------
+/** Writing and reading a layout, including overwriting a longer layout,
+ *  and rejecting damaged layouts. */
+static void testReadWrite()
+{
+    char name[] = "/tmp/alio_test_stripe_XXXXXX";
+    int filedes = mkstemp(name);
+    if(filedes<0)
+    {
+        perror("mkstemp");
+        g_num_failed_checks++;
+        return;
+    }
+    unlink(name);
+
+    StripeLayout empty;
+    CHECK(!StripeLayout::isLayout(filedes));
+    CHECK(!empty.read(filedes));
+
+    StripeLayout layout = createLayout(1024*1024, 4), in;
+    CHECK(layout.write(filedes));
+    CHECK(StripeLayout::isLayout(filedes));
+    CHECK(in.read(filedes));
+    CHECK(in.m_stripe_size==layout.m_stripe_size &&
+          in.m_size==layout.m_size && in.m_names==layout.m_names);
+
+    // A shorter layout truncates the file.
+    StripeLayout shorter = createLayout(4096, 1);
+    CHECK(shorter.write(filedes));
+    CHECK(in.read(filedes) && in.m_names==shorter.m_names &&
+          in.m_stripe_size==4096);
+
+    // A name that is cut off.
+    CHECK(layout.write(filedes));
+    off64_t size = lseek(filedes, 0, SEEK_END);
+    CHECK(ftruncate(filedes, size-1)==0);
+    CHECK(!in.read(filedes));
+    // The previously read layout is not changed by a failed read.
+    CHECK(in.m_names==shorter.m_names);
+
+    // Damaged magic.
+    CHECK(layout.write(filedes));
+    CHECK(pwrite(filedes, "X", 1, 0)==1);
+    CHECK(!StripeLayout::isLayout(filedes));
+    CHECK(!in.read(filedes));
+
+    // A stripe size of 0 is invalid.
+    StripeLayout zero = createLayout(0, 2);
+    CHECK(zero.write(filedes));
+    CHECK(!in.read(filedes));
+    close(filedes);
+}   // testReadWrite
+
+// ----------------------------------------------------------------------------
+int main()
+{
+    testMap();
+    testGetPath();
+    testReadWrite();
+    return testResult();
+}   // main
@@ -0,0 +1,309 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "tools/block_codec.hpp"
+
+#include "tools/buffer_arena.hpp"
+
+#include <stdint.h>
+#include <string.h>
+
+using namespace ALIO;
+
+namespace
+{
+    // Format of the LZ stream: a sequence of a token byte (number of
+    // literals in the high, match length-4 in the low 4 bits), the
+    // literals, a 2 byte little endian offset, and the match. A 15 in one
+    // of the token fields is followed by additional length bytes (255 means
+    // that another byte follows). The last sequence only has literals.
+    const size_t   MIN_MATCH  = 4;
+    const size_t   MAX_OFFSET = 65535;
+    const unsigned HASH_BITS  = 14;
+
+    // ------------------------------------------------------------------------
+    inline uint32_t read32(const unsigned char *p)
+    {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }   // read32
+
+    // ------------------------------------------------------------------------
+    inline unsigned int hash(uint32_t v)
+    {
+        return (v*2654435761U) >> (32-HASH_BITS);
+    }   // hash
+
+    // ------------------------------------------------------------------------
+    inline unsigned char *writeLength(unsigned char *op, size_t len)
+    {
+        while(len>=255)
+        {
+            *op++ = 255;
+            len  -= 255;
+        }
+        *op++ = (unsigned char)len;
+        return op;
+    }   // writeLength
+
+    // ------------------------------------------------------------------------
+    /** Reads an extended length. \return False if the input ends. */
+    inline bool readLength(const unsigned char **ip, const unsigned char *end,
+                           size_t *len)
+    {
+        unsigned char b;
+        do
+        {
+            if(*ip>=end)
+                return false;
+            b     = *(*ip)++;
+            *len += b;
+        } while(b==255);
+        return true;
+    }   // readLength
+
+    // ------------------------------------------------------------------------
+    /** Writes the literals in [literals, literals+num_literals) followed by
+     *  a match (if match_len>0). */
+    unsigned char *writeSequence(unsigned char *op,
+                                 const unsigned char *literals,
+                                 size_t num_literals, size_t offset,
+                                 size_t match_len)
+    {
+        size_t m = match_len>0 ? match_len-MIN_MATCH : 0;
+        *op++ = (unsigned char)(((num_literals<15 ? num_literals : 15) << 4)
+                               | (m<15 ? m : 15));
+        if(num_literals>=15)
+            op = writeLength(op, num_literals-15);
+        memcpy(op, literals, num_literals);
+        op += num_literals;
+        if(match_len==0)
+            return op;
+        *op++ = (unsigned char)(offset & 0xff);
+        *op++ = (unsigned char)(offset >> 8);
+        if(m>=15)
+            op = writeLength(op, m-15);
+        return op;
+    }   // writeSequence
+}   // namespace
+
+// ----------------------------------------------------------------------------
+/** Converts a codec name from the config file ("none", "lz", "float32" or
+ *  "float64").
+ *  \return False if the name is unknown.
+ */
+bool BlockCodec::parseCodec(const std::string &name, Codec *codec)
+{
+    if     (name=="none")    *codec = CODEC_NONE;
+    else if(name=="lz")      *codec = CODEC_LZ;
+    else if(name=="float32") *codec = CODEC_FLOAT32;
+    else if(name=="float64") *codec = CODEC_FLOAT64;
+    else return false;
+    return true;
+}   // parseCodec
+
+// ----------------------------------------------------------------------------
+/** Returns the size of the output buffer needed to compress n bytes. */
+size_t BlockCodec::getMaxCompressedSize(size_t n)
+{
+    return n + n/255 + 64;
+}   // getMaxCompressedSize
+
+// ----------------------------------------------------------------------------
+/** Compresses n bytes.
+ *  \param out Output buffer of at least getMaxCompressedSize(n) bytes.
+ *  \return The number of bytes stored in out.
+ */
+size_t BlockCodec::compress(Codec codec, const char *in, size_t n, char *out)
+{
+    switch(codec)
+    {
+    case CODEC_LZ:
+        return compressLZ((const unsigned char*)in, n, (unsigned char*)out);
+    case CODEC_FLOAT32:
+    case CODEC_FLOAT64:
+        {
+            char *tmp = BufferArena::allocate(n);
+            filterFloat(in, n, tmp, codec==CODEC_FLOAT32 ? 4 : 8);
+            size_t size = compressLZ((const unsigned char*)tmp, n,
+                                     (unsigned char*)out);
+            BufferArena::free(tmp);
+            return size;
+        }
+    default:
+        memcpy(out, in, n);
+        return n;
+    }
+}   // compress
+
+// ----------------------------------------------------------------------------
+/** Decompresses a block.
+ *  \param n Size of the compressed data.
+ *  \param raw_size Size of the uncompressed data.
+ *  \return False if the data is corrupt.
+ */
+bool BlockCodec::decompress(Codec codec, const char *in, size_t n, char *out,
+                            size_t raw_size)
+{
+    switch(codec)
+    {
+    case CODEC_NONE:
+        if(n!=raw_size)
+            return false;
+        memcpy(out, in, n);
+        return true;
+    case CODEC_LZ:
+        return decompressLZ((const unsigned char*)in, n,
+                            (unsigned char*)out, raw_size);
+    case CODEC_FLOAT32:
+    case CODEC_FLOAT64:
+        {
+            char *tmp = BufferArena::allocate(raw_size);
+            bool ok = decompressLZ((const unsigned char*)in, n,
+                                   (unsigned char*)tmp, raw_size);
+            if(ok)
+                unfilterFloat(tmp, raw_size, out,
+                              codec==CODEC_FLOAT32 ? 4 : 8);
+            BufferArena::free(tmp);
+            return ok;
+        }
+    }
+    return false;
+}   // decompress
+
+// ----------------------------------------------------------------------------
+size_t BlockCodec::compressLZ(const unsigned char *in, size_t n,
+                              unsigned char *out)
+{
+    uint32_t table[1<<HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    unsigned char *op = out;
+    size_t anchor = 0, ip = 0;
+    size_t limit  = n>2*MIN_MATCH ? n-2*MIN_MATCH : 0;
+    while(ip<limit)
+    {
+        uint32_t seq = read32(in+ip);
+        unsigned int h = hash(seq);
+        size_t ref = table[h];
+        table[h]   = (uint32_t)ip;
+        if(ref<ip && ip-ref<=MAX_OFFSET && read32(in+ref)==seq)
+        {
+            size_t len = MIN_MATCH;
+            while(ip+len<n && in[ref+len]==in[ip+len])
+                len++;
+            op     = writeSequence(op, in+anchor, ip-anchor, ip-ref, len);
+            ip    += len;
+            anchor = ip;
+        }
+        else
+        {
+            // Skip faster through data that does not compress.
+            ip += 1 + ((ip-anchor)>>6);
+        }
+    }
+    return writeSequence(op, in+anchor, n-anchor, 0, 0) - out;
+}   // compressLZ
+
+// ----------------------------------------------------------------------------
+bool BlockCodec::decompressLZ(const unsigned char *in, size_t n,
+                              unsigned char *out, size_t raw_size)
+{
+    const unsigned char *ip  = in, *end = in+n;
+    unsigned char       *op  = out, *out_end = out+raw_size;
+    while(ip<end)
+    {
+        unsigned int token = *ip++;
+        size_t num_literals = token >> 4;
+        if(num_literals==15 && !readLength(&ip, end, &num_literals))
+            return false;
+        if(num_literals>(size_t)(end-ip) ||
+           num_literals>(size_t)(out_end-op))
+            return false;
+        memcpy(op, ip, num_literals);
+        op += num_literals;
+        ip += num_literals;
+        if(ip==end)
+            break;
+
+        if(end-ip<2)
+            return false;
+        size_t offset = ip[0] | (ip[1]<<8);
+        ip += 2;
+        if(offset==0 || offset>(size_t)(op-out))
+            return false;
+        size_t len = token & 15;
+        if(len==15 && !readLength(&ip, end, &len))
+            return false;
+        len += MIN_MATCH;
+        if(len>(size_t)(out_end-op))
+            return false;
+        const unsigned char *match = op-offset;
+        if(offset>=len)
+            memcpy(op, match, len);
+        else
+        {
+            for(size_t i=0; i<len; i++)
+                op[i] = match[i];
+        }
+        op += len;
+    }
+    return op==out_end;
+}   // decompressLZ
+
+// ----------------------------------------------------------------------------
+/** XORs each word with the previous one, and transposes the bytes of the
+ *  result. Bytes after the last full word are copied unchanged.
+ */
+void BlockCodec::filterFloat(const char *in, size_t n, char *out,
+                             size_t word)
+{
+    size_t num_words = n/word;
+    uint64_t previous = 0;
+    for(size_t i=0; i<num_words; i++)
+    {
+        uint64_t v = 0;
+        memcpy(&v, in+i*word, word);
+        uint64_t x = v ^ previous;
+        previous   = v;
+        const unsigned char *bytes = (const unsigned char*)&x;
+        for(size_t b=0; b<word; b++)
+            out[b*num_words+i] = bytes[b];
+    }
+    memcpy(out+num_words*word, in+num_words*word, n-num_words*word);
+}   // filterFloat
+
+// ----------------------------------------------------------------------------
+/** Reverses filterFloat. */
+void BlockCodec::unfilterFloat(const char *in, size_t n, char *out,
+                               size_t word)
+{
+    size_t num_words = n/word;
+    uint64_t previous = 0;
+    for(size_t i=0; i<num_words; i++)
+    {
+        uint64_t x = 0;
+        unsigned char *bytes = (unsigned char*)&x;
+        for(size_t b=0; b<word; b++)
+            bytes[b] = in[b*num_words+i];
+        previous ^= x;
+        memcpy(out+i*word, &previous, word);
+    }
+    memcpy(out+num_words*word, in+num_words*word, n-num_words*word);
+}   // unfilterFloat
@@ -0,0 +1,62 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef HEADER_BLOCK_CODEC_HPP
+#define HEADER_BLOCK_CODEC_HPP
+
+#include <stddef.h>
+#include <string>
+
+namespace ALIO
+{
+
+/** A simple and fast lossless block compressor (an LZ77 variant similar
+ *  to LZ4: literal runs and matches with 16 bit offsets, found with a
+ *  hash table of 4-byte sequences). The float codecs first XOR each 32 or
+ *  64 bit word with the previous one and then transpose the bytes (all
+ *  first bytes, then all second bytes, ...). For smooth floating point
+ *  fields the XOR leaves mostly zero high bytes, which the transposition
+ *  turns into long runs the LZ stage compresses well. All functions are
+ *  thread-safe.
+ */
+class BlockCodec
+{
+public:
+    /** The codecs. The values are stored in files, so must not change. */
+    enum Codec {CODEC_NONE=0, CODEC_LZ=1, CODEC_FLOAT32=2, CODEC_FLOAT64=3};
+
+private:
+    static size_t compressLZ(const unsigned char *in, size_t n,
+                             unsigned char *out);
+    static bool   decompressLZ(const unsigned char *in, size_t n,
+                               unsigned char *out, size_t raw_size);
+    static void   filterFloat(const char *in, size_t n, char *out,
+                              size_t word);
+    static void   unfilterFloat(const char *in, size_t n, char *out,
+                                size_t word);
+
+public:
+    static bool   parseCodec(const std::string &name, Codec *codec);
+    static size_t getMaxCompressedSize(size_t n);
+    static size_t compress(Codec codec, const char *in, size_t n, char *out);
+    static bool   decompress(Codec codec, const char *in, size_t n,
+                             char *out, size_t raw_size);
+};   // BlockCodec
+
+}   // namespace ALIO
+#endif
@@ -0,0 +1,94 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "tools/block_hash.hpp"
+
+#include <string.h>
+
+using namespace ALIO;
+
+namespace
+{
+    // ------------------------------------------------------------------------
+    inline uint64_t rotl(uint64_t x, int r)
+    {
+        return (x << r) | (x >> (64-r));
+    }   // rotl
+
+    // ------------------------------------------------------------------------
+    inline uint64_t mix(uint64_t k)
+    {
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdULL;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53ULL;
+        k ^= k >> 33;
+        return k;
+    }   // mix
+}   // namespace
+
+// ----------------------------------------------------------------------------
+/** Computes the hash of n bytes.
+ *  \param hash Receives the 128 bit hash.
+ */
+void BlockHash::compute(const void *data, size_t n, uint64_t hash[2])
+{
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+    const unsigned char *p = (const unsigned char*)data;
+    uint64_t h1 = 0, h2 = 0;
+
+    size_t num_blocks = n/16;
+    for(size_t i=0; i<num_blocks; i++)
+    {
+        uint64_t k1, k2;
+        memcpy(&k1, p+i*16,   8);
+        memcpy(&k2, p+i*16+8, 8);
+        k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1 ^= k1;
+        h1  = rotl(h1, 27); h1 += h2; h1 = h1*5+0x52dce729;
+        k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; h2 ^= k2;
+        h2  = rotl(h2, 31); h2 += h1; h2 = h2*5+0x38495ab5;
+    }
+
+    const unsigned char *tail = p+num_blocks*16;
+    uint64_t k1 = 0, k2 = 0;
+    size_t rest = n & 15;
+    for(size_t i=rest; i>8; i--)
+        k2 ^= (uint64_t)tail[i-1] << ((i-9)*8);
+    if(rest>8)
+    {
+        k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; h2 ^= k2;
+    }
+    for(size_t i=(rest<8 ? rest : 8); i>0; i--)
+        k1 ^= (uint64_t)tail[i-1] << ((i-1)*8);
+    if(rest>0)
+    {
+        k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    h1 ^= n;
+    h2 ^= n;
+    h1 += h2;
+    h2 += h1;
+    h1  = mix(h1);
+    h2  = mix(h2);
+    h1 += h2;
+    h2 += h1;
+    hash[0] = h1;
+    hash[1] = h2;
+}   // compute
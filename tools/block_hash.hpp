@@ -0,0 +1,40 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef HEADER_BLOCK_HASH_HPP
+#define HEADER_BLOCK_HASH_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace ALIO
+{
+
+/** A fast 128 bit hash of a block of data (MurmurHash3, x64 128 bit
+ *  variant). It is not cryptographically secure, but collisions between
+ *  different blocks of the same file are practically impossible, so it can
+ *  be used to detect unchanged blocks without comparing the data.
+ */
+class BlockHash
+{
+public:
+    static void compute(const void *data, size_t n, uint64_t hash[2]);
+};   // BlockHash
+
+}   // namespace ALIO
+#endif
@@ -0,0 +1,439 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "tools/buffer_arena.hpp"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace ALIO;
+
+namespace
+{
+    // Each buffer is preceded by a 64-byte header, which keeps the buffer
+    // 64-byte aligned and stores the size class (or, for buffers that are
+    // mapped individually, the mapped size). Size class c contains blocks
+    // (header included) of MIN_BLOCK_SIZE<<c bytes. Free blocks are kept
+    // in per-thread caches; a thread returns half of a cache list to the
+    // global list if it gets too long, and everything when it finishes.
+    // All global state is plain data that is initialised statically, so
+    // the arena can be used before any static constructor has run (which
+    // matters for the preloaded client library).
+
+    const unsigned int NUM_SIZE_CLASSES = 17;            // 64 B .. 4 MB
+    const size_t       MIN_BLOCK_SIZE   = 64;
+    const size_t       SLAB_SIZE        = 2*1024*1024;
+    const size_t       HEADER_SIZE      = 64;
+    const unsigned int LARGE_CLASS      = 0xffffffff;
+    const uint32_t     ARENA_MAGIC      = 0xa110b0f5;
+
+    /** Number of bytes a thread keeps cached for each size class. */
+    const size_t       CACHE_BYTES      = 4*1024*1024;
+
+    union BlockHeader
+    {
+        struct
+        {
+            uint32_t m_magic;
+            uint32_t m_size_class;
+            size_t   m_mapped_size;
+        } m_info;
+        char m_padding[HEADER_SIZE];
+    };   // BlockHeader
+
+    struct FreeBlock
+    {
+        FreeBlock *m_next;
+    };   // FreeBlock
+
+    struct ThreadCache
+    {
+        FreeBlock    *m_free[NUM_SIZE_CLASSES];
+        unsigned int  m_count[NUM_SIZE_CLASSES];
+    };   // ThreadCache
+
+    struct Region
+    {
+        void   *m_base;
+        size_t  m_size;
+    };   // Region
+
+    const unsigned int MAX_HOOKS = 8;
+
+    pthread_mutex_t  g_lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_once_t   g_key_once = PTHREAD_ONCE_INIT;
+    pthread_key_t    g_key;
+    __thread ThreadCache *g_cache = NULL;
+
+    // The following variables are protected by g_lock.
+    FreeBlock       *g_free[NUM_SIZE_CLASSES];
+    char            *g_slab_next[NUM_SIZE_CLASSES];
+    size_t           g_slab_left[NUM_SIZE_CLASSES];
+    BufferArena::HugePageMode g_mode = BufferArena::HP_TRANSPARENT;
+    BufferArena::RegistrationHook g_hooks[MAX_HOOKS];
+    unsigned int     g_num_hooks = 0;
+    Region          *g_regions = NULL;
+    size_t           g_num_regions = 0, g_max_regions = 0;
+
+    // ------------------------------------------------------------------------
+    /** Returns the maximum number of blocks a thread caches for a class. */
+    unsigned int getCacheLimit(unsigned int size_class)
+    {
+        size_t n = CACHE_BYTES / (MIN_BLOCK_SIZE<<size_class);
+        if(n<2)   n = 2;
+        if(n>256) n = 256;
+        return (unsigned int)n;
+    }   // getCacheLimit
+
+    // ------------------------------------------------------------------------
+    /** Returns the smallest size class for a block of the given size, or
+     *  LARGE_CLASS if the block is bigger than the biggest class. */
+    unsigned int getSizeClass(size_t total)
+    {
+        unsigned int size_class = 0;
+        size_t block = MIN_BLOCK_SIZE;
+        while(block<total)
+        {
+            block <<= 1;
+            size_class++;
+            if(size_class>=NUM_SIZE_CLASSES)
+                return LARGE_CLASS;
+        }
+        return size_class;
+    }   // getSizeClass
+
+    // ------------------------------------------------------------------------
+    /** Moves all blocks of a thread cache to the global lists. Called when
+     *  a thread finishes. */
+    void flushCache(void *data)
+    {
+        ThreadCache *cache = (ThreadCache*)data;
+        pthread_mutex_lock(&g_lock);
+        for(unsigned int i=0; i<NUM_SIZE_CLASSES; i++)
+        {
+            while(cache->m_free[i])
+            {
+                FreeBlock *block  = cache->m_free[i];
+                cache->m_free[i]  = block->m_next;
+                block->m_next     = g_free[i];
+                g_free[i]         = block;
+            }
+        }
+        pthread_mutex_unlock(&g_lock);
+        free(cache);
+        if(g_cache==cache)
+            g_cache = NULL;
+    }   // flushCache
+
+    // ------------------------------------------------------------------------
+    void createKey()
+    {
+        pthread_key_create(&g_key, flushCache);
+    }   // createKey
+
+    // ------------------------------------------------------------------------
+    ThreadCache *getCache()
+    {
+        if(!g_cache)
+        {
+            g_cache = (ThreadCache*)calloc(1, sizeof(ThreadCache));
+            pthread_once(&g_key_once, createKey);
+            pthread_setspecific(g_key, g_cache);
+        }
+        return g_cache;
+    }   // getCache
+
+    // ------------------------------------------------------------------------
+    /** Maps a new memory region and calls all registration hooks. Must be
+     *  called with g_lock held.
+     *  \param size Size of the region, a multiple of SLAB_SIZE.
+     */
+    char *mapRegion(size_t size)
+    {
+        void *p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        if(g_mode==BufferArena::HP_HUGETLB)
+        {
+            p = mmap(NULL, size, PROT_READ|PROT_WRITE,
+                     MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+            if(p==MAP_FAILED)
+            {
+                printf("Can not allocate huge pages (%s) - "
+                       "using transparent huge pages.\n", strerror(errno));
+                g_mode = BufferArena::HP_TRANSPARENT;
+            }
+        }
+#endif
+        if(p==MAP_FAILED)
+        {
+            // Map an additional slab, so that the region can be aligned
+            // to the huge page size, then unmap the unused parts.
+            char *raw = (char*)mmap(NULL, size+SLAB_SIZE,
+                                    PROT_READ|PROT_WRITE,
+                                    MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+            if(raw==MAP_FAILED)
+                return NULL;
+            char *aligned = (char*)(((uintptr_t)raw+SLAB_SIZE-1)
+                                    & ~(uintptr_t)(SLAB_SIZE-1));
+            if(aligned>raw)
+                munmap(raw, aligned-raw);
+            size_t tail = (raw+size+SLAB_SIZE) - (aligned+size);
+            if(tail>0)
+                munmap(aligned+size, tail);
+            p = aligned;
+#ifdef MADV_HUGEPAGE
+            if(g_mode==BufferArena::HP_TRANSPARENT)
+                madvise(p, size, MADV_HUGEPAGE);
+#endif
+        }
+
+        if(g_num_regions==g_max_regions)
+        {
+            size_t n = g_max_regions ? 2*g_max_regions : 64;
+            Region *r = (Region*)realloc(g_regions, n*sizeof(Region));
+            if(r)
+            {
+                g_regions     = r;
+                g_max_regions = n;
+            }
+        }
+        if(g_num_regions<g_max_regions)
+        {
+            g_regions[g_num_regions].m_base = p;
+            g_regions[g_num_regions].m_size = size;
+            g_num_regions++;
+        }
+        for(unsigned int i=0; i<g_num_hooks; i++)
+            g_hooks[i](p, size, true);
+        return (char*)p;
+    }   // mapRegion
+
+    // ------------------------------------------------------------------------
+    /** Calls the registration hooks for a region and unmaps it. */
+    void unmapRegion(char *p, size_t size)
+    {
+        pthread_mutex_lock(&g_lock);
+        for(unsigned int i=0; i<g_num_hooks; i++)
+            g_hooks[i](p, size, false);
+        for(size_t i=0; i<g_num_regions; i++)
+        {
+            if(g_regions[i].m_base==p)
+            {
+                g_regions[i] = g_regions[--g_num_regions];
+                break;
+            }
+        }
+        pthread_mutex_unlock(&g_lock);
+        munmap(p, size);
+    }   // unmapRegion
+
+    // ------------------------------------------------------------------------
+    /** Gets a block of the given size class from the global free list or
+     *  a slab, and moves a few more blocks into the thread cache. */
+    FreeBlock *refill(ThreadCache *cache, unsigned int size_class)
+    {
+        size_t block_size = MIN_BLOCK_SIZE<<size_class;
+        unsigned int batch = getCacheLimit(size_class)/2;
+        FreeBlock *result = NULL;
+        pthread_mutex_lock(&g_lock);
+        for(unsigned int i=0; i<=batch; i++)
+        {
+            FreeBlock *block = g_free[size_class];
+            if(block)
+                g_free[size_class] = block->m_next;
+            else
+            {
+                if(g_slab_left[size_class]<block_size)
+                {
+                    size_t slab = block_size>SLAB_SIZE ? 2*block_size
+                                                       : SLAB_SIZE;
+                    char *p = mapRegion(slab);
+                    if(!p) break;
+                    g_slab_next[size_class] = p;
+                    g_slab_left[size_class] = slab;
+                }
+                block = (FreeBlock*)g_slab_next[size_class];
+                g_slab_next[size_class] += block_size;
+                g_slab_left[size_class] -= block_size;
+            }
+            if(!result)
+                result = block;
+            else
+            {
+                block->m_next = cache->m_free[size_class];
+                cache->m_free[size_class] = block;
+                cache->m_count[size_class]++;
+            }
+        }
+        pthread_mutex_unlock(&g_lock);
+        return result;
+    }   // refill
+
+}   // namespace
+
+// ----------------------------------------------------------------------------
+/** Allocates a buffer of at least the given size. Aborts if no memory is
+ *  available (like new[] would).
+ */
+char *BufferArena::allocate(size_t size)
+{
+    size_t total = size + HEADER_SIZE;
+    unsigned int size_class = getSizeClass(total);
+    BlockHeader *header;
+    if(size_class==LARGE_CLASS)
+    {
+        size_t mapped = (total+SLAB_SIZE-1) & ~(SLAB_SIZE-1);
+        pthread_mutex_lock(&g_lock);
+        header = (BlockHeader*)mapRegion(mapped);
+        pthread_mutex_unlock(&g_lock);
+        if(header)
+            header->m_info.m_mapped_size = mapped;
+    }
+    else
+    {
+        ThreadCache *cache = getCache();
+        FreeBlock *block = cache ? cache->m_free[size_class] : NULL;
+        if(block)
+        {
+            cache->m_free[size_class] = block->m_next;
+            cache->m_count[size_class]--;
+        }
+        else if(cache)
+            block = refill(cache, size_class);
+        header = (BlockHeader*)block;
+    }
+    if(!header)
+    {
+        printf("Can not allocate buffer of %ld bytes.\n", (long)size);
+        abort();
+    }
+    header->m_info.m_magic      = ARENA_MAGIC;
+    header->m_info.m_size_class = size_class;
+    return (char*)(header+1);
+}   // allocate
+
+// ----------------------------------------------------------------------------
+/** Frees a buffer allocated with allocate(). NULL is ignored. */
+void BufferArena::free(char *buffer)
+{
+    if(!buffer) return;
+    BlockHeader *header = (BlockHeader*)buffer - 1;
+    if(header->m_info.m_magic!=ARENA_MAGIC)
+    {
+        printf("Freeing buffer %p not allocated by the arena.\n", buffer);
+        abort();
+    }
+    header->m_info.m_magic = 0;
+    unsigned int size_class = header->m_info.m_size_class;
+    if(size_class==LARGE_CLASS)
+    {
+        unmapRegion((char*)header, header->m_info.m_mapped_size);
+        return;
+    }
+
+    ThreadCache *cache = getCache();
+    FreeBlock *block = (FreeBlock*)header;
+    if(!cache)
+    {
+        pthread_mutex_lock(&g_lock);
+        block->m_next = g_free[size_class];
+        g_free[size_class] = block;
+        pthread_mutex_unlock(&g_lock);
+        return;
+    }
+    block->m_next = cache->m_free[size_class];
+    cache->m_free[size_class] = block;
+    cache->m_count[size_class]++;
+
+    unsigned int limit = getCacheLimit(size_class);
+    if(cache->m_count[size_class]<=limit) return;
+
+    // Return half of the cached blocks to the global list.
+    pthread_mutex_lock(&g_lock);
+    while(cache->m_count[size_class]>limit/2)
+    {
+        block = cache->m_free[size_class];
+        cache->m_free[size_class] = block->m_next;
+        cache->m_count[size_class]--;
+        block->m_next = g_free[size_class];
+        g_free[size_class] = block;
+    }
+    pthread_mutex_unlock(&g_lock);
+}   // free
+
+// ----------------------------------------------------------------------------
+/** Returns the number of bytes that can be used in a buffer, which can be
+ *  more than what was requested. */
+size_t BufferArena::getUsableSize(const char *buffer)
+{
+    const BlockHeader *header = (const BlockHeader*)buffer - 1;
+    if(header->m_info.m_size_class==LARGE_CLASS)
+        return header->m_info.m_mapped_size - HEADER_SIZE;
+    return (MIN_BLOCK_SIZE<<header->m_info.m_size_class) - HEADER_SIZE;
+}   // getUsableSize
+
+// ----------------------------------------------------------------------------
+/** Sets how memory mapped from now on is backed. */
+void BufferArena::setHugePageMode(HugePageMode mode)
+{
+    pthread_mutex_lock(&g_lock);
+    g_mode = mode;
+    pthread_mutex_unlock(&g_lock);
+}   // setHugePageMode
+
+// ----------------------------------------------------------------------------
+/** Sets the huge page mode from a config string: "no", "transparent" or
+ *  "hugetlb".
+ *  \return False if the string is not a valid mode.
+ */
+bool BufferArena::setHugePageMode(const char *mode)
+{
+    if(strcmp(mode, "no")==0)
+        setHugePageMode(HP_NONE);
+    else if(strcmp(mode, "transparent")==0)
+        setHugePageMode(HP_TRANSPARENT);
+    else if(strcmp(mode, "hugetlb")==0)
+        setHugePageMode(HP_HUGETLB);
+    else
+        return false;
+    return true;
+}   // setHugePageMode
+
+// ----------------------------------------------------------------------------
+/** Adds a registration hook. It is immediately called for all regions that
+ *  are already mapped.
+ */
+void BufferArena::addRegistrationHook(RegistrationHook hook)
+{
+    pthread_mutex_lock(&g_lock);
+    if(g_num_hooks<MAX_HOOKS)
+    {
+        g_hooks[g_num_hooks++] = hook;
+        for(size_t i=0; i<g_num_regions; i++)
+            hook(g_regions[i].m_base, g_regions[i].m_size, true);
+    }
+    else
+        printf("Too many arena registration hooks, ignored.\n");
+    pthread_mutex_unlock(&g_lock);
+}   // addRegistrationHook
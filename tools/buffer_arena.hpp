@@ -0,0 +1,63 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef HEADER_BUFFER_ARENA_HPP
+#define HEADER_BUFFER_ARENA_HPP
+
+#include <stddef.h>
+
+namespace ALIO
+{
+
+/** An allocator for IO buffers (message payloads, read replies, ...).
+ *  Buffers are grouped into power-of-two size classes from 64 bytes to
+ *  4 MB. Each class is carved from slabs of (at least) 2 MB, which are
+ *  backed by huge pages if possible, so large buffers need few TLB entries.
+ *  Each thread keeps a small cache of free buffers per class, so most
+ *  allocations and frees do not need a lock. Buffers can be freed by any
+ *  thread. Bigger buffers are mapped individually.
+ *  All buffers are 64-byte aligned. Slabs are never returned to the OS.
+ *  A communication layer can install registration hooks, which are called
+ *  for each memory region the arena maps (e.g. to register the memory for
+ *  RDMA once instead of for each message).
+ */
+class BufferArena
+{
+public:
+    /** How the arena's memory is backed. */
+    enum HugePageMode
+    {
+        HP_NONE,         //!< Normal pages.
+        HP_TRANSPARENT,  //!< Aligned slabs with madvise(MADV_HUGEPAGE).
+        HP_HUGETLB       //!< MAP_HUGETLB, falls back to HP_TRANSPARENT.
+    };
+
+    /** Called with added=true when the arena maps a new memory region, and
+     *  with added=false before a region is unmapped. */
+    typedef void (*RegistrationHook)(void *base, size_t size, bool added);
+
+    static char  *allocate(size_t size);
+    static void   free(char *buffer);
+    static size_t getUsableSize(const char *buffer);
+    static void   setHugePageMode(HugePageMode mode);
+    static bool   setHugePageMode(const char *mode);
+    static void   addRegistrationHook(RegistrationHook hook);
+};   // BufferArena
+
+}   // namespace ALIO
+#endif
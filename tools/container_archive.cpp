@@ -0,0 +1,265 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "tools/container_archive.hpp"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace ALIO;
+
+namespace
+{
+    const char     CONTAINER_MAGIC[8] = {'A','L','I','O','C','N','T','1'};
+    const uint32_t RECORD_MAGIC       = 0xa110c0de;
+
+    // ------------------------------------------------------------------------
+    bool readFully(int filedes, void *p, size_t n, off64_t offset)
+    {
+        char *data = (char*)p;
+        while(n>0)
+        {
+            ssize_t count = ::pread64(filedes, data, n, offset);
+            if(count<0 && errno==EINTR) continue;
+            if(count<=0) return false;
+            data   += count;
+            n      -= count;
+            offset += count;
+        }
+        return true;
+    }   // readFully
+
+    // ------------------------------------------------------------------------
+    bool writeFully(int filedes, const void *p, size_t n, off64_t offset)
+    {
+        const char *data = (const char*)p;
+        while(n>0)
+        {
+            ssize_t count = ::pwrite64(filedes, data, n, offset);
+            if(count<0 && errno==EINTR) continue;
+            if(count<=0) return false;
+            data   += count;
+            n      -= count;
+            offset += count;
+        }
+        return true;
+    }   // writeFully
+}   // namespace
+
+// ----------------------------------------------------------------------------
+ContainerArchive::ContainerArchive()
+{
+    m_filedes = -1;
+    m_end     = 0;
+}   // ContainerArchive
+
+// ----------------------------------------------------------------------------
+/** Reads the index of a container, or initialises an empty file as a
+ *  container. Records after the first invalid or incomplete one are
+ *  ignored, and overwritten by the next record written.
+ *  \return False (and sets errno) if the file is not a container.
+ */
+bool ContainerArchive::load(int filedes)
+{
+    m_filedes = filedes;
+    m_entries.clear();
+    struct stat64 buf;
+    if(::fstat64(filedes, &buf)!=0)
+        return false;
+    if(buf.st_size==0)
+    {
+        if(!writeFully(filedes, CONTAINER_MAGIC, sizeof(CONTAINER_MAGIC), 0))
+            return false;
+        m_end = sizeof(CONTAINER_MAGIC);
+        return true;
+    }
+    char magic[sizeof(CONTAINER_MAGIC)];
+    if(buf.st_size<(off64_t)sizeof(magic) ||
+       !readFully(filedes, magic, sizeof(magic), 0) ||
+       memcmp(magic, CONTAINER_MAGIC, sizeof(magic))!=0)
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    off64_t position = sizeof(magic);
+    while(position+(off64_t)sizeof(RecordHeader)<=buf.st_size)
+    {
+        RecordHeader header;
+        if(!readFully(filedes, &header, sizeof(header), position) ||
+           header.m_magic!=RECORD_MAGIC ||
+           header.m_type<RT_DATA || header.m_type>RT_RENAME ||
+           header.m_name_length==0)
+            break;
+        off64_t name_position = position+sizeof(header);
+        off64_t data_position = name_position+header.m_name_length;
+        off64_t next          = data_position+header.m_data_length;
+        if(next>buf.st_size)
+            break;
+        std::string name(header.m_name_length, ' ');
+        std::string data;
+        if(!readFully(filedes, &name[0], name.size(), name_position))
+            break;
+        if(header.m_type==RT_RENAME)
+        {
+            data.resize(header.m_data_length);
+            if(data.empty() ||
+               !readFully(filedes, &data[0], data.size(), data_position))
+                break;
+        }
+        apply(header, name, data, data_position);
+        position = next;
+    }
+    m_end = position;
+    return true;
+}   // load
+
+// ----------------------------------------------------------------------------
+/** Updates the index for one record. */
+bool ContainerArchive::apply(const RecordHeader &header,
+                             const std::string &name, const std::string &data,
+                             uint64_t data_position)
+{
+    switch(header.m_type)
+    {
+    case RT_DATA:
+        {
+            Entry &entry = m_entries[name];
+            Extent extent;
+            extent.m_offset   = header.m_offset;
+            extent.m_position = data_position;
+            extent.m_length   = header.m_data_length;
+            entry.m_extents.push_back(extent);
+            if(extent.m_offset+extent.m_length>entry.m_size)
+                entry.m_size = extent.m_offset+extent.m_length;
+            break;
+        }
+    case RT_TRUNCATE:
+        {
+            Entry &entry = m_entries[name];
+            entry.m_size = 0;
+            entry.m_extents.clear();
+            break;
+        }
+    case RT_REMOVE:
+        m_entries.erase(name);
+        break;
+    case RT_RENAME:
+        {
+            EntryMap::iterator i = m_entries.find(name);
+            if(i==m_entries.end())
+                return false;
+            Entry entry = i->second;
+            m_entries.erase(i);
+            m_entries[data] = entry;
+            break;
+        }
+    }
+    return true;
+}   // apply
+
+// ----------------------------------------------------------------------------
+/** Appends a record to the container and applies it to the index.
+ *  \return False (and sets errno) if writing failed.
+ */
+bool ContainerArchive::appendRecord(RecordType type, const std::string &name,
+                                    uint64_t offset, const char *data,
+                                    size_t n)
+{
+    RecordHeader header;
+    memset(&header, 0, sizeof(header));
+    header.m_magic       = RECORD_MAGIC;
+    header.m_type        = type;
+    header.m_name_length = name.size();
+    header.m_offset      = offset;
+    header.m_data_length = n;
+    std::vector<char> head((char*)&header, (char*)&header+sizeof(header));
+    head.insert(head.end(), name.begin(), name.end());
+    off64_t data_position = m_end+head.size();
+    if(!writeFully(m_filedes, &head[0], head.size(), m_end) ||
+       (n>0 && !writeFully(m_filedes, data, n, data_position)) )
+        return false;
+    m_end = data_position+n;
+    apply(header, name, type==RT_RENAME ? std::string(data, n)
+                                        : std::string(),
+          data_position);
+    return true;
+}   // appendRecord
+
+// ----------------------------------------------------------------------------
+/** Stores data of a file (creating the file if necessary). */
+bool ContainerArchive::writeData(const std::string &name, uint64_t offset,
+                                 const char *data, size_t n)
+{
+    return appendRecord(RT_DATA, name, offset, data, n);
+}   // writeData
+
+// ----------------------------------------------------------------------------
+/** Creates a file, or removes all data of an existing file. */
+bool ContainerArchive::truncate(const std::string &name)
+{
+    return appendRecord(RT_TRUNCATE, name, 0, NULL, 0);
+}   // truncate
+
+// ----------------------------------------------------------------------------
+bool ContainerArchive::remove(const std::string &name)
+{
+    return appendRecord(RT_REMOVE, name, 0, NULL, 0);
+}   // remove
+
+// ----------------------------------------------------------------------------
+/** Renames a file, replacing an existing file with the new name. */
+bool ContainerArchive::rename(const std::string &name,
+                              const std::string &new_name)
+{
+    return appendRecord(RT_RENAME, name, 0, new_name.c_str(),
+                        new_name.size());
+}   // rename
+
+// ----------------------------------------------------------------------------
+/** Reads data of a file. Parts that were never written read as zeros.
+ *  \return The number of bytes read, or -1 (and errno set).
+ */
+ssize_t ContainerArchive::read(const Entry &entry, char *buf, size_t n,
+                               uint64_t offset) const
+{
+    if(offset>=entry.m_size)
+        return 0;
+    if(n>entry.m_size-offset)
+        n = entry.m_size-offset;
+    memset(buf, 0, n);
+    uint64_t end = offset+n;
+    for(unsigned int i=0; i<entry.m_extents.size(); i++)
+    {
+        const Extent &extent = entry.m_extents[i];
+        uint64_t start = extent.m_offset>offset ? extent.m_offset : offset;
+        uint64_t stop  = extent.m_offset+extent.m_length;
+        if(stop>end) stop = end;
+        if(start>=stop)
+            continue;
+        if(!readFully(m_filedes, buf+(start-offset), stop-start,
+                      extent.m_position+(start-extent.m_offset)))
+        {
+            if(errno==0) errno = EIO;
+            return -1;
+        }
+    }
+    return n;
+}   // read
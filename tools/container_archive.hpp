@@ -0,0 +1,119 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef HEADER_CONTAINER_ARCHIVE_HPP
+#define HEADER_CONTAINER_ARCHIVE_HPP
+
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+namespace ALIO
+{
+
+/** A container file that stores many small files. It starts with the
+ *  magic "ALIOCNT1", followed by a log of records: data of a file at a
+ *  given offset, truncation (which also creates a file), removal and
+ *  renaming. Records are only ever appended, so a container can be
+ *  written without any metadata operations except for the container
+ *  itself, and a record that was cut off (e.g. by a crash) is ignored
+ *  when the container is loaded. The index of all files is built in
+ *  memory by scanning the records. Space of overwritten or removed data
+ *  is not reclaimed. Used by the container io type and the unpack tool.
+ *  This class is not thread-safe.
+ */
+class ContainerArchive
+{
+public:
+    /** A part of a file stored in the container. */
+    struct Extent
+    {
+        /** Offset in the file. */
+        uint64_t m_offset;
+        /** Position of the data in the container. */
+        uint64_t m_position;
+        uint64_t m_length;
+    };   // Extent
+
+    /** A file in the container. Later extents overwrite earlier ones. */
+    struct Entry
+    {
+        uint64_t            m_size;
+        std::vector<Extent> m_extents;
+    };   // Entry
+
+    typedef std::map<std::string, Entry> EntryMap;
+
+private:
+    /** The record types. The values are stored in files. */
+    enum RecordType {RT_DATA=1, RT_TRUNCATE=2, RT_REMOVE=3, RT_RENAME=4};
+
+    /** The header of each record. It is followed by the name, and the data
+     *  (for RT_RENAME the new name). */
+    struct RecordHeader
+    {
+        uint32_t m_magic;
+        uint32_t m_type;
+        uint32_t m_name_length;
+        uint32_t m_reserved;
+        uint64_t m_offset;
+        uint64_t m_data_length;
+    };   // RecordHeader
+
+    int      m_filedes;
+
+    /** Where the next record is written. */
+    off64_t  m_end;
+
+    EntryMap m_entries;
+
+    bool appendRecord(RecordType type, const std::string &name,
+                      uint64_t offset, const char *data, size_t n);
+    bool apply(const RecordHeader &header, const std::string &name,
+               const std::string &data, uint64_t data_position);
+
+public:
+             ContainerArchive();
+    bool     load(int filedes);
+    bool     writeData(const std::string &name, uint64_t offset,
+                       const char *data, size_t n);
+    bool     truncate(const std::string &name);
+    bool     remove(const std::string &name);
+    bool     rename(const std::string &name, const std::string &new_name);
+    ssize_t  read(const Entry &entry, char *buf, size_t n,
+                  uint64_t offset) const;
+    // ------------------------------------------------------------------------
+    /** Returns the entry of a file, or NULL if it does not exist. */
+    const Entry *find(const std::string &name) const
+    {
+        EntryMap::const_iterator i = m_entries.find(name);
+        return i==m_entries.end() ? NULL : &i->second;
+    }   // find
+    // ------------------------------------------------------------------------
+    const EntryMap &getEntries() const { return m_entries; }
+    // ------------------------------------------------------------------------
+    /** Returns the size of the container. */
+    off64_t  getEnd() const { return m_end; }
+    // ------------------------------------------------------------------------
+    int      getFiledes() const { return m_filedes; }
+};   // ContainerArchive
+
+}   // namespace ALIO
+#endif
@@ -0,0 +1,130 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef HEADER_EXTENT_MAP_HPP
+#define HEADER_EXTENT_MAP_HPP
+
+#include <assert.h>
+#include <map>
+#include <sys/types.h>
+
+namespace ALIO
+{
+
+/** Stores a set of non-overlapping, half-open byte ranges [start, end).
+ *  Adding a range that overlaps or touches existing ranges merges them,
+ *  so the map always contains the minimal number of extents. This is
+ *  used to keep track of which parts of a buffer contain valid data.
+ */
+class ExtentMap
+{
+public:
+    /** Maps the start of an extent to its (exclusive) end. */
+    typedef std::map<off64_t, off64_t>   ExtentType;
+    typedef ExtentType::const_iterator   const_iterator;
+
+private:
+    /** All extents, sorted by start offset. */
+    ExtentType m_extents;
+
+    /** Sum of the sizes of all extents. */
+    off64_t    m_num_bytes;
+
+public:
+    ExtentMap() : m_num_bytes(0) {}
+    // ------------------------------------------------------------------------
+    /** Adds the range [start, end), merging it with all existing extents
+     *  it overlaps or touches. */
+    void add(off64_t start, off64_t end)
+    {
+        assert(start<=end);
+        if(start==end) return;
+
+        // The extent just before start might overlap or touch the new one.
+        ExtentType::iterator i = m_extents.upper_bound(start);
+        if(i!=m_extents.begin())
+        {
+            ExtentType::iterator prev = i;
+            --prev;
+            if(prev->second>=start)
+                i = prev;
+        }
+        while(i!=m_extents.end() && i->first<=end)
+        {
+            if(i->first <start) start = i->first;
+            if(i->second>end  ) end   = i->second;
+            m_num_bytes -= i->second - i->first;
+            m_extents.erase(i++);
+        }
+        m_extents[start] = end;
+        m_num_bytes     += end - start;
+    }   // add
+
+    // ------------------------------------------------------------------------
+    /** Returns true if the range [start, end) is completely contained in
+     *  one extent. */
+    bool covers(off64_t start, off64_t end) const
+    {
+        ExtentType::const_iterator i = m_extents.upper_bound(start);
+        if(i==m_extents.begin()) return false;
+        --i;
+        return i->second>=end;
+    }   // covers
+
+    // ------------------------------------------------------------------------
+    /** Returns an iterator to the first extent that ends after the given
+     *  offset, i.e. the first extent that might intersect a range starting
+     *  at offset. */
+    const_iterator firstIntersecting(off64_t offset) const
+    {
+        ExtentType::const_iterator i = m_extents.upper_bound(offset);
+        if(i!=m_extents.begin())
+        {
+            ExtentType::const_iterator prev = i;
+            --prev;
+            if(prev->second>offset)
+                return prev;
+        }
+        return i;
+    }   // firstIntersecting
+
+    // ------------------------------------------------------------------------
+    /** Returns the end of the last extent, or 0 if the map is empty. */
+    off64_t getEnd() const
+    {
+        if(m_extents.empty()) return 0;
+        return m_extents.rbegin()->second;
+    }   // getEnd
+    // ------------------------------------------------------------------------
+    /** Returns the number of bytes in all extents. */
+    off64_t getNumBytes() const { return m_num_bytes; }
+    // ------------------------------------------------------------------------
+    /** Returns the number of separate extents. */
+    size_t getNumExtents() const { return m_extents.size(); }
+    // ------------------------------------------------------------------------
+    bool empty() const { return m_extents.empty(); }
+    // ------------------------------------------------------------------------
+    void clear() { m_extents.clear(); m_num_bytes = 0; }
+    // ------------------------------------------------------------------------
+    const_iterator begin() const { return m_extents.begin(); }
+    // ------------------------------------------------------------------------
+    const_iterator end() const { return m_extents.end(); }
+};   // ExtentMap
+
+}   // namespace ALIO
+#endif
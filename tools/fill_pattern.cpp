@@ -0,0 +1,242 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "tools/fill_pattern.hpp"
+
+#include "tools/os.hpp"
+#include "tools/string_utils.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef FALLOC_FL_PUNCH_HOLE
+#  include <linux/falloc.h>
+#endif
+
+using namespace ALIO;
+
+// ----------------------------------------------------------------------------
+FillPattern::FillPattern()
+{
+    memset(m_pattern, 0, sizeof(m_pattern));
+    m_size       = 0;
+    m_zero       = true;
+    m_block_size = 64*1024;
+}   // FillPattern
+
+// ----------------------------------------------------------------------------
+/** Sets the fill value from the config file: "no", "zero", or a type and
+ *  value, e.g. "float32:9.96921e36" (types are int8, int16, int32, int64,
+ *  float32 and float64).
+ *  \param block_size Size of the blocks that are checked (default 64K, a
+ *         multiple of 4K so that holes can be punched).
+ *  \return False if the values are invalid.
+ */
+bool FillPattern::parse(const std::string &fill,
+                        const std::string &block_size)
+{
+    m_size = 0;
+    m_zero = true;
+    memset(m_pattern, 0, sizeof(m_pattern));
+    if(!block_size.empty())
+    {
+        int64_t size;
+        if(!StringUtils::parseSize(block_size, &size) || size<4096 ||
+           size%4096!=0)
+            return false;
+        m_block_size = size;
+    }
+    if(fill.empty() || fill=="no")
+        return true;
+    if(fill=="zero")
+    {
+        m_size = 1;
+        return true;
+    }
+
+    size_t colon = fill.find(':');
+    if(colon==std::string::npos)
+        return false;
+    std::string type  = fill.substr(0, colon);
+    const char *value = fill.c_str()+colon+1;
+    char *end;
+    errno = 0;
+    if(type=="float32")
+    {
+        float f = strtof(value, &end);
+        memcpy(m_pattern, &f, sizeof(f));
+        m_size = sizeof(f);
+    }
+    else if(type=="float64")
+    {
+        double d = strtod(value, &end);
+        memcpy(m_pattern, &d, sizeof(d));
+        m_size = sizeof(d);
+    }
+    else
+    {
+        long long v = strtoll(value, &end, 0);
+        if     (type=="int8" ) { int8_t  i = v; memcpy(m_pattern, &i, 1); }
+        else if(type=="int16") { int16_t i = v; memcpy(m_pattern, &i, 2); }
+        else if(type=="int32") { int32_t i = v; memcpy(m_pattern, &i, 4); }
+        else if(type=="int64") { int64_t i = v; memcpy(m_pattern, &i, 8); }
+        else return false;
+        m_size = type=="int8" ? 1 : type=="int16" ? 2 : type=="int32" ? 4
+                                                                        : 8;
+    }
+    if(end==value || *end || errno)
+    {
+        m_size = 0;
+        return false;
+    }
+    for(unsigned int i=0; i<m_size; i++)
+        if(m_pattern[i]) m_zero = false;
+    return true;
+}   // parse
+
+// ----------------------------------------------------------------------------
+/** Returns 8 bytes of the repeated fill value as they appear in a file
+ *  starting at the given offset. */
+uint64_t FillPattern::getWord(off64_t offset) const
+{
+    unsigned char bytes[8];
+    for(unsigned int i=0; i<8; i++)
+        bytes[i] = m_pattern[(offset+i)%m_size];
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+    return word;
+}   // getWord
+
+// ----------------------------------------------------------------------------
+/** Checks if n bytes (stored at the given file offset) only contain the
+ *  fill value. The main loop ORs the differences of 64 bytes at a time
+ *  without branches, which the compiler turns into vector instructions.
+ */
+bool FillPattern::isFill(const char *p, size_t n, off64_t offset) const
+{
+    // The size of the fill value divides 8, so all words use the same
+    // phase of the pattern.
+    const uint64_t word = getWord(offset);
+    size_t i = 0;
+    for(; i+64<=n; i+=64)
+    {
+        uint64_t v[8];
+        memcpy(v, p+i, sizeof(v));
+        uint64_t diff = 0;
+        for(unsigned int k=0; k<8; k++)
+            diff |= v[k]^word;
+        if(diff)
+            return false;
+    }
+    for(; i+8<=n; i+=8)
+    {
+        uint64_t v;
+        memcpy(&v, p+i, sizeof(v));
+        if(v!=word)
+            return false;
+    }
+    for(; i<n; i++)
+    {
+        if((unsigned char)p[i]!=m_pattern[(offset+i)%m_size])
+            return false;
+    }
+    return true;
+}   // isFill
+
+// ----------------------------------------------------------------------------
+/** Finds all aligned blocks in [offset, offset+n) that only contain the
+ *  fill value. Adjacent blocks are merged into one range.
+ *  \param p The data, stored at file offset offset.
+ *  \param runs Receives the ranges of file offsets that can be skipped.
+ */
+void FillPattern::findFillRuns(const char *p, size_t n, off64_t offset,
+                               std::vector<Range> *runs) const
+{
+    off64_t block = (offset+m_block_size-1)/m_block_size*m_block_size;
+    for(; block+(off64_t)m_block_size<=offset+(off64_t)n;
+          block+=m_block_size)
+    {
+        if(!isFill(p+(block-offset), m_block_size, block))
+            continue;
+        if(!runs->empty() && runs->back().second==block)
+            runs->back().second = block+m_block_size;
+        else
+            runs->push_back(Range(block, block+m_block_size));
+    }
+}   // findFillRuns
+
+// ----------------------------------------------------------------------------
+/** Stores the fill value in n bytes that belong to the given file offset.
+ */
+void FillPattern::fill(char *p, size_t n, off64_t offset) const
+{
+    if(m_zero)
+    {
+        memset(p, 0, n);
+        return;
+    }
+    for(size_t i=0; i<n; i++)
+        p[i] = m_pattern[(offset+i)%m_size];
+}   // fill
+
+// ----------------------------------------------------------------------------
+/** Replaces the data read from holes of the file with the fill value. The
+ *  holes are found with SEEK_DATA/SEEK_HOLE; the file position is restored
+ *  afterwards. Nothing is done for a zero fill value.
+ *  \param buf The data read from [offset, offset+n).
+ */
+void FillPattern::fillHoles(int filedes, char *buf, size_t n,
+                            off64_t offset) const
+{
+    if(!needsFill() || n==0)
+        return;
+    off64_t position = OS::lseek64(filedes, 0, SEEK_CUR);
+    off64_t pos = offset, end = offset+n;
+    while(pos<end)
+    {
+        off64_t data = OS::lseek64(filedes, pos, SEEK_DATA);
+        // ENXIO: no data after pos, the rest is a hole. Other errors mean
+        // that holes can not be detected, so nothing is filled.
+        if(data<0 && errno!=ENXIO)
+            break;
+        off64_t hole_end = data<0 || data>end ? end : data;
+        if(hole_end>pos)
+            fill(buf+(pos-offset), hole_end-pos, pos);
+        if(data<0 || data>=end)
+            break;
+        pos = OS::lseek64(filedes, data, SEEK_HOLE);
+        if(pos<0)
+            break;
+    }
+    if(position>=0)
+        OS::lseek64(filedes, position, SEEK_SET);
+}   // fillHoles
+
+// ----------------------------------------------------------------------------
+/** Deallocates a range of a file, which then reads as zeros.
+ *  \return False if the file system does not support this.
+ */
+bool FillPattern::punchHole(int filedes, off64_t offset, off64_t length)
+{
+    return ::fallocate64(filedes, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
+                         offset, length)==0;
+}   // punchHole
@@ -0,0 +1,82 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef HEADER_FILL_PATTERN_HPP
+#define HEADER_FILL_PATTERN_HPP
+
+#include <stdint.h>
+#include <string>
+#include <sys/types.h>
+#include <utility>
+#include <vector>
+
+namespace ALIO
+{
+
+/** Detects blocks that only contain a fill value, so that they can be
+ *  skipped when writing (leaving a hole in a sparse file). The fill value
+ *  is either zero, or a 1, 2, 4 or 8 byte value that is repeated at
+ *  offsets that are a multiple of its size (e.g. the float fill value of
+ *  masked grid points). Holes read as zeros; for a non-zero fill value
+ *  fillHoles() restores the value when reading through ALIO (other
+ *  programs will read zeros).
+ */
+class FillPattern
+{
+public:
+    /** A range [first, second) of file offsets. */
+    typedef std::pair<off64_t, off64_t> Range;
+
+private:
+    /** The fill value. */
+    unsigned char m_pattern[8];
+
+    /** Size of the fill value in bytes, 0 if disabled. */
+    unsigned int  m_size;
+
+    /** True if the fill value is zero. */
+    bool          m_zero;
+
+    /** Only aligned blocks of this size are skipped. */
+    size_t        m_block_size;
+
+    uint64_t getWord(off64_t offset) const;
+
+public:
+             FillPattern();
+    bool     parse(const std::string &fill, const std::string &block_size);
+    bool     isFill(const char *p, size_t n, off64_t offset) const;
+    void     findFillRuns(const char *p, size_t n, off64_t offset,
+                          std::vector<Range> *runs) const;
+    void     fill(char *p, size_t n, off64_t offset) const;
+    void     fillHoles(int filedes, char *buf, size_t n,
+                       off64_t offset) const;
+    static bool punchHole(int filedes, off64_t offset, off64_t length);
+    // ------------------------------------------------------------------------
+    /** True if fill blocks should be detected. */
+    bool isEnabled() const { return m_size>0; }
+    // ------------------------------------------------------------------------
+    /** True if the fill value is not zero, i.e. holes must be filled when
+     *  reading. */
+    bool needsFill() const { return m_size>0 && !m_zero; }
+    // ------------------------------------------------------------------------
+    size_t getBlockSize() const { return m_block_size; }
+};   // FillPattern
+
+}   // namespace ALIO
+#endif
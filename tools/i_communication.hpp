@@ -56,15 +56,35 @@ public:
      *  \return 0 If no error occured, 1 otherwise. */
     virtual int waitForMessage() = 0;
     // ------------------------------------------------------------------------
+    /** Checks, without blocking, if a message from any connected client is
+     *  available. Clients are checked round-robin, so that a busy client
+     *  can not starve the others.
+     *  \return True if a message can be received. */
+    virtual bool pollForMessage() = 0;
+    // ------------------------------------------------------------------------
+    /** Disconnects a client.
+     *  \param client The id of the client, see getClientId(). */
+    virtual void disconnectClient(int client) = 0;
+    // ------------------------------------------------------------------------
     /** Allocates a buffer to receive an incoming message, and returns a 
      *  pointer to that buffer to the caller. It is the caller's
-     *  responsibility to free the buffer when it is not needed anymore. */
+     *  responsibility to free the buffer (with BufferArena::free) when it
+     *  is not needed anymore. */
     virtual char *receive() = 0;
     // ------------------------------------------------------------------------
     virtual int getMessageLength() = 0;
     // ------------------------------------------------------------------------
     virtual int send(void *buffer, int len, int tag) = 0;
     // ------------------------------------------------------------------------
+    /** Sends a message to a client (which is not necessarily the client
+     *  that sent the last message).
+     *  \param client The id of the client, see getClientId(). */
+    virtual int sendToClient(int client, void *buffer, int len, int tag) = 0;
+    // ------------------------------------------------------------------------
+    /** Returns an id of the client that sent the last message received.
+     *  Together with the index of a file object it identifies a file. */
+    virtual int getClientId() = 0;
+    // ------------------------------------------------------------------------
     // ------------------------------------------------------------------------
     // ------------------------------------------------------------------------
 };   // ICommunication
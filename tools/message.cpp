@@ -16,6 +16,7 @@
 //    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
 //
 
+#include "tools/buffer_arena.hpp"
 #include "tools/i_communication.hpp"
 #include "tools/message.hpp"
 
@@ -25,7 +26,9 @@
 #include <assert.h>
 #include <stdio.h>
 
-/** Creates a message to be sent.
+uint32_t Message::m_last_request_id = 0;
+
+/** Creates a message to be sent. It gets a new request ID.
  *  This only initialised the data structures, it does not reserve any memory.
  *  A call to allocate() is therefore necessary.
  *  \param type  The type of the message
@@ -35,14 +38,20 @@ Message::Message(MessageType type, int index)
     assert(sizeof(int)==4);
     m_index         = index;
     m_type          = type;
+    m_flags         = 0;
+    m_request_id    = __sync_add_and_fetch(&m_last_request_id, 1);
+    m_status        = 0;
     m_pos           = 0;
     m_data_size     = -1;
     m_data          = NULL;
     m_needs_destroy = false;
+    m_payload       = NULL;
+    m_payload_size  = 0;
 }   // Message
 
 // ----------------------------------------------------------------------------
-/** Handles a received message.
+/** Handles a received message. The message does not take ownership of the
+ *  buffer, which is freed by whoever received it.
  *  \param type The type of the message. Used in asserts to detect errors.
  *  \param buffer The actual data.
  *  \param len Amount of data in bytes.
@@ -51,17 +60,42 @@ Message::Message(MessageType type, int index)
 Message::Message(MessageType type, const void *buffer, int len)
 {
     assert(sizeof(int)==4);
-    m_data_size = len;
-    m_data      = (char*)buffer;
-    m_type      = type;
-    m_pos       = 0;
-    m_needs_destroy = true;
-    MessageType message_type;
-    get(&message_type);
-    assert(message_type==type);
-    get(&m_index);
+    m_data_size     = len;
+    m_data          = (char*)buffer;
+    m_needs_destroy = false;
+    m_payload       = NULL;
+    m_payload_size  = 0;
+    Header header   = peekHeader(m_data);
+    assert(header.m_magic==MAGIC && header.m_version==VERSION);
+    assert(header.m_type==type);
+    m_type          = type;
+    m_flags         = header.m_flags;
+    m_index         = header.m_index;
+    m_request_id    = header.m_request_id;
+    m_status        = header.m_status;
+    m_pos           = HEADER_SIZE;
 }   // Message(type, buffer, len);
 
+// ----------------------------------------------------------------------------
+/** Handles a received message of any type, see Message(type, buffer, len).
+ */
+Message::Message(const void *buffer, int len)
+{
+    m_data_size     = len;
+    m_data          = (char*)buffer;
+    m_needs_destroy = false;
+    m_payload       = NULL;
+    m_payload_size  = 0;
+    Header header   = peekHeader(m_data);
+    assert(header.m_magic==MAGIC && header.m_version==VERSION);
+    m_type          = (MessageType)header.m_type;
+    m_flags         = header.m_flags;
+    m_index         = header.m_index;
+    m_request_id    = header.m_request_id;
+    m_status        = header.m_status;
+    m_pos           = HEADER_SIZE;
+}   // Message(buffer, len)
+
 // ----------------------------------------------------------------------------
 /** Frees the memory allocated for this message. */
 Message::~Message()
@@ -70,43 +104,237 @@ Message::~Message()
 }   // ~Message
 
 // ----------------------------------------------------------------------------
-/** Frees the memory for a received message.
- *  Calls enet_packet_destroy if necessary (i.e. if the message was received).
- *  The memory for a message created to be sent does not need to be freed, it 
- *  is handled by enet. */
+/** Frees the memory of a message that was created to be sent. The buffer
+ *  of a received message is not owned by the message. */
 void Message::clear()
 {
-    if(m_needs_destroy)
-        delete [] m_data;
+    if(m_needs_destroy && !isInline())
+        ALIO::BufferArena::free(m_data);
 
     m_data = NULL;
     m_needs_destroy = false;
 }   // clear
 
 // ----------------------------------------------------------------------------
-/** Reserves the memory for a message. 
+/** Reserves the memory for a message. Small messages are stored in the
+ *  message object, bigger ones in a buffer from the BufferArena.
  *  \param size Number of bytes to reserve.
  */
 void Message::allocate(size_t size)
 {
-    // Message type and local file index at the beginning
-    m_data_size = sizeof(m_type)+sizeof(m_index)+size;
-    m_data      = new char[m_data_size];
-    if(!m_data)
-    {
-        printf("can't allocate '%d' bytes.\n", m_data_size);
-        assert(false);
-    }
-    add(m_type);
-    add(m_index);
+    m_data_size = HEADER_SIZE+size;
+    if(m_data_size<=INLINE_SIZE)
+        m_data = m_inline.m_bytes;
+    else
+        m_data = ALIO::BufferArena::allocate(m_data_size);
     m_needs_destroy = true;
+    writeHeader();
+    m_pos = HEADER_SIZE;
 }   // allocate
 
 // ----------------------------------------------------------------------------
+/** Writes the header into the message buffer (if it is allocated). */
+void Message::writeHeader()
+{
+    if(!m_data)
+        return;
+    Header header;
+    header.m_magic      = MAGIC;
+    header.m_version    = VERSION;
+    header.m_flags      = m_flags;
+    header.m_type       = m_type;
+    header.m_index      = m_index;
+    header.m_request_id = m_request_id;
+    header.m_length     = m_data_size-HEADER_SIZE+m_payload_size;
+    header.m_status     = m_status;
+    memcpy(m_data, &header, sizeof(header));
+}   // writeHeader
+
+// ----------------------------------------------------------------------------
+/** Returns the header of a received message. */
+Message::Header Message::peekHeader(const char *buffer)
+{
+    Header header;
+    memcpy(&header, buffer, sizeof(header));
+    return header;
+}   // peekHeader
+
+// ----------------------------------------------------------------------------
+/** Checks that a received buffer is a complete message of this version of
+ *  the wire format. */
+bool Message::isValid(const char *buffer, int len)
+{
+    if(len<(int)HEADER_SIZE)
+        return false;
+    Header header = peekHeader(buffer);
+    return header.m_magic==MAGIC && header.m_version==VERSION &&
+           header.m_length==len-HEADER_SIZE;
+}   // isValid
+
+// ----------------------------------------------------------------------------
+/** Returns the data of a message to be sent, and gives up ownership of it:
+ *  the caller must free it with BufferArena::free. Data stored in the
+ *  message object is copied into an arena buffer first.
+ */
+char *Message::release()
+{
+    m_needs_destroy = false;
+    if(!isInline())
+        return m_data;
+    char *buffer = ALIO::BufferArena::allocate(m_data_size);
+    memcpy(buffer, m_data, m_data_size);
+    return buffer;
+}   // release
+
+// ----------------------------------------------------------------------------
+/** Sends the message. A payload is copied behind the message, since the
+ *  communication interface only sends contiguous buffers (Remote sends
+ *  payloads without a copy).
+ */
 void Message::send(ICommunication *communication)
 {
-    communication->send(getData(), getLen(), /*tag*/9);
+    if(!m_payload)
+    {
+        communication->send(getData(), getLen(), /*tag*/9);
+        return;
+    }
+    char *buffer = ALIO::BufferArena::allocate(getLen()+m_payload_size);
+    memcpy(buffer, getData(), getLen());
+    memcpy(buffer+getLen(), m_payload, m_payload_size);
+    communication->send(buffer, getLen()+m_payload_size, /*tag*/9);
+    ALIO::BufferArena::free(buffer);
 }   // send
 
+// ============================================================================
+/** Creates the answer to a request.
+ *  \param max_data Maximum size of the data of the answer.
+ */
+ReplyMessage::ReplyMessage(Message *request, size_t max_data)
+            : Message(request->getType(), request->getIndex())
+{
+    m_flags      = FLAG_REPLY;
+    m_request_id = request->getRequestId();
+    allocate(sizeof(int64_t)+max_data);
+    setResult(0, 0);
+}   // ReplyMessage
+
+// ----------------------------------------------------------------------------
+/** Handles a received answer. */
+ReplyMessage::ReplyMessage(const void *buffer, int len)
+            : Message(buffer, len)
+{
+    assert(isReply());
+}   // ReplyMessage
+
+// ----------------------------------------------------------------------------
+/** Stores the result of the request.
+ *  \param error The errno, only used if the result is negative.
+ *  \param data_len The size of the data of the answer (at most the
+ *         max_data given in the constructor).
+ */
+void ReplyMessage::setResult(int64_t result, int error, size_t data_len)
+{
+    memcpy(getData()+HEADER_SIZE, &result, sizeof(result));
+    m_status    = result<0 ? error : 0;
+    m_data_size = DATA_OFFSET+data_len;
+    writeHeader();
+}   // setResult
+
+// ----------------------------------------------------------------------------
+int64_t ReplyMessage::getResult() const
+{
+    int64_t result;
+    memcpy(&result, m_data+HEADER_SIZE, sizeof(result));
+    return result;
+}   // getResult
+
+// ============================================================================
+/** Creates an empty frame. */
+CompoundMessage::CompoundMessage()
+{
+    m_capacity = 4096;
+    m_data     = ALIO::BufferArena::allocate(m_capacity);
+    clear();
+}   // CompoundMessage
+
+// ----------------------------------------------------------------------------
+CompoundMessage::~CompoundMessage()
+{
+    ALIO::BufferArena::free(m_data);
+}   // ~CompoundMessage
+
+// ----------------------------------------------------------------------------
+/** Removes all messages from the frame. */
+void CompoundMessage::clear()
+{
+    m_count = 0;
+    m_len   = HEADER_SIZE;
+    writeHeader();
+}   // clear
+
+// ----------------------------------------------------------------------------
+/** Writes the header and the number of messages. */
+void CompoundMessage::writeHeader()
+{
+    Message::Header header;
+    header.m_magic      = Message::MAGIC;
+    header.m_version    = Message::VERSION;
+    header.m_flags      = 0;
+    header.m_type       = Message::MSG_COMPOUND;
+    header.m_index      = -1;
+    header.m_request_id = 0;
+    header.m_length     = m_len-Message::HEADER_SIZE;
+    header.m_status     = 0;
+    memcpy(m_data, &header, sizeof(header));
+    memcpy(m_data+Message::HEADER_SIZE, &m_count, sizeof(m_count));
+}   // writeHeader
+
 // ----------------------------------------------------------------------------
+/** Appends a copy of a message (and its payload) to the frame. */
+void CompoundMessage::add(Message *m)
+{
+    size_t space = getSpace(m);
+    if(m_len+space>m_capacity)
+    {
+        while(m_len+space>m_capacity)
+            m_capacity *= 2;
+        char *data = ALIO::BufferArena::allocate(m_capacity);
+        memcpy(data, m_data, m_len);
+        ALIO::BufferArena::free(m_data);
+        m_data = data;
+    }
+    int len = (int)(m->getLen()+m->getPayloadSize());
+    memcpy(m_data+m_len, &len, sizeof(len));
+    memcpy(m_data+m_len+sizeof(len), m->getData(), m->getLen());
+    if(m->getPayload())
+        memcpy(m_data+m_len+sizeof(len)+m->getLen(), m->getPayload(),
+               m->getPayloadSize());
+    m_len += space;
+    m_count++;
+    writeHeader();
+}   // add
+
+// ----------------------------------------------------------------------------
+/** Returns the next message of a received frame.
+ *  \param pos Position in the frame, must be 0 for the first message.
+ *  \param msg_len Returns the length of the message.
+ *  \return The message, or NULL at the end of the frame (or if the frame
+ *          is corrupt).
+ */
+const char *CompoundMessage::getMessage(const char *buffer, int len,
+                                        int *pos, int *msg_len)
+{
+    if(*pos==0)
+        *pos = HEADER_SIZE;
+    if(*pos+(int)sizeof(int)>len)
+        return NULL;
+    memcpy(msg_len, buffer+*pos, sizeof(int));
+    const char *msg = buffer+*pos+sizeof(int);
+    if(*msg_len<(int)Message::HEADER_SIZE ||
+       *pos+(int)sizeof(int)+*msg_len>len)
+        return NULL;
+    *pos += sizeof(int)+*msg_len;
+    return msg;
+}   // getMessage
 
+// ----------------------------------------------------------------------------
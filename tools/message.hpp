@@ -22,6 +22,7 @@
 #include <cstring>
 #include <string>
 #include <assert.h>
+#include <stdint.h>
 #include <sys/types.h>
 
 #include <stdio.h>
@@ -30,6 +31,11 @@ class ICommunication;
 
 using std::memcpy;
 
+/** A message between client and server. Each message starts with a fixed
+ *  header (see Header), followed by the data of the message type. A reply
+ *  has the type, index and request ID of its request, so it can be
+ *  matched to the request it answers.
+ */
 class Message
 { 
 public:
@@ -44,14 +50,63 @@ public:
         MSG___FXSTAT64, MSG___LXSTAT,  MSG_LSEEK,
         MSG_LSEEK64,    MSG_WRITE,     MSG_READ,
         MSG_CLOSE,      MSG_RENAME,  
-        MSG_QUIT,
-        MSG_FSEEK_ANSWER, MSG_FREAD_ANSWER
+        MSG_QUIT,       MSG_COMPOUND,  MSG_UNLINK
     } MessageType;
 
+    /** Flags in the header. FLAG_READ_AHEAD marks a read whose answer is
+     *  received in the background (it is sent with a separate tag). */
+    enum { FLAG_REPLY = 1, FLAG_READ_AHEAD = 2 };
+
+    /** The header in front of each message. Client and server run on the
+     *  same kind of machine, so it is in host byte order. */
+    struct Header
+    {
+        uint16_t m_magic;
+        /** Version of the wire format. */
+        uint8_t  m_version;
+        uint8_t  m_flags;
+        /** The message type (opcode). */
+        int32_t  m_type;
+        /** Local index of the file object on the client. */
+        int32_t  m_index;
+        /** Set by the client, and copied into the reply. */
+        uint32_t m_request_id;
+        /** Number of bytes after the header (including a payload). */
+        uint32_t m_length;
+        /** 0, or the errno of a failed request in a reply. */
+        int32_t  m_status;
+    };   // Header
+
+    static const uint16_t MAGIC         = 0xa110;
+    /** Increased with each incompatible change of the wire format. */
+    static const uint8_t  VERSION       = 1;
+    static const size_t   HEADER_SIZE   = sizeof(Header);
+
+    /** Messages up to this size (including the header) are stored in the
+     *  message object itself, so sending them needs no allocation. */
+    enum { INLINE_SIZE = 64 };
+
 private:
     /** The message type. */
     MessageType   m_type;
 
+protected:
+    uint8_t       m_flags;
+    uint32_t      m_request_id;
+    int           m_status;
+
+private:
+    /** The last request ID used by this process. */
+    static uint32_t m_last_request_id;
+
+    /** Storage for small messages, see INLINE_SIZE. */
+    union
+    {
+        char      m_bytes[INLINE_SIZE];
+        int64_t   m_align;
+    } m_inline;
+
+protected:
     /** The actual content of the messsage. */
     char         *m_data;
 
@@ -64,10 +119,25 @@ public:
     /** Local index of the file object that is responsible for this 
      *  message. */
     int           m_index;
+
+    /** Data that is sent after the message without being copied into
+     *  it, see setPayload(). */
+    const void   *m_payload;
+    size_t        m_payload_size;
 protected:
     // only received messages need to be destroyed
     bool          m_needs_destroy;
 
+private:
+    // m_data can point to m_inline, so messages can not be copied.
+                  Message(const Message &);
+    Message&      operator=(const Message &);
+
+    static Header peekHeader(const char *buffer);
+
+protected:
+    void          writeHeader();
+
 public:
 
     /** Template add function, that adds one element of the given type 
@@ -158,6 +228,7 @@ public:
 public:
                  Message(MessageType m, int index);
                  Message(MessageType m, const void *buffer, int len);
+                 Message(const void *buffer, int len);
                 ~Message();
     void         clear();
     void         allocate(size_t size);
@@ -166,18 +237,68 @@ public:
     /** Returns the message type. */
     MessageType  getType() const   { return m_type; }
     // ------------------------------------------------------------------------
-    /** Returns the data size - excluding the 1 byte type. */
+    /** Returns the size of the message including the header (but not the
+     *  payload). */
     int          getLen() const { return m_data_size; }
     // ------------------------------------------------------------------------
-    /** Returns a pointer to the actual data - excluding the 1 byte type. */
+    /** Returns a pointer to the message, starting with the header. */
     char*        getData() {return m_data; }
     // ------------------------------------------------------------------------
+    uint32_t     getRequestId() const { return m_request_id;          }
+    // ------------------------------------------------------------------------
+    bool         isReply() const      { return m_flags & FLAG_REPLY;  }
+    // ------------------------------------------------------------------------
+    uint8_t      getFlags() const     { return m_flags;               }
+    // ------------------------------------------------------------------------
+    void         setFlags(uint8_t flags)
+    {
+        m_flags = flags;
+        writeHeader();
+    }   // setFlags
+    // ------------------------------------------------------------------------
+    /** Returns 0, or the errno of a failed request (in a reply). */
+    int          getStatus() const    { return m_status;              }
+    // ------------------------------------------------------------------------
+    char*        release();
+    // ------------------------------------------------------------------------
+    /** True if the data is stored in the message object itself. */
+    bool         isInline() const { return m_data==m_inline.m_bytes; }
+    // ------------------------------------------------------------------------
+    /** Sets data that is sent directly after the message, without being
+     *  copied into the message buffer. It must stay valid till the message
+     *  is sent. The receiver gets header and data as one message. */
+    void         setPayload(const void *p, size_t n)
+    {
+        m_payload      = p;
+        m_payload_size = n;
+        writeHeader();
+    }   // setPayload
+    // ------------------------------------------------------------------------
+    const void*  getPayload() const     { return m_payload;      }
+    // ------------------------------------------------------------------------
+    size_t       getPayloadSize() const { return m_payload_size; }
+    // ------------------------------------------------------------------------
     /** Returns the local index of the file object responsible for this
      *  message. */
     int getIndex() const 
     {
         return m_index;
     }   // getIndex
+    // ------------------------------------------------------------------------
+    /** Returns the local index of the file object from a received buffer,
+     *  without having to know the message type. */
+    static int peekIndex(const char *buffer)
+    {
+        return peekHeader(buffer).m_index;
+    }   // peekIndex
+    // ------------------------------------------------------------------------
+    /** Returns the type of a received message. */
+    static MessageType peekType(const char *buffer)
+    {
+        return (MessageType)peekHeader(buffer).m_type;
+    }   // peekType
+    // ------------------------------------------------------------------------
+    static bool isValid(const char *buffer, int len);
 
 };   // Message
 
@@ -219,13 +340,19 @@ public:
 
     // ------------------------------------------------------------------------
     /** Special constructor that adds n bytes of binary data.
+     *  \param copy If false the data is not copied, but sent as payload
+     *         (see setPayload).
      */
-    Message1(int index, T1 &t1, const void *p, size_t n) : Message(MT, index)
+    Message1(int index, T1 &t1, const void *p, size_t n, bool copy=true)
+        : Message(MT, index)
     {
         size_t n1 = getSize(t1);
-        allocate(n1+n);
+        allocate(copy ? n1+n : n1);
         add(t1);
-        add(p, n);
+        if(copy)
+            add(p, n);
+        else
+            setPayload(p, n);
     }   // Message1
 
     // ------------------------------------------------------------------------
@@ -263,16 +390,22 @@ public:
 
     // ------------------------------------------------------------------------
     /** Special constructor that adds n bytes of binary data.
+     *  \param copy If false the data is not copied, but sent as payload
+     *         (see setPayload).
      */
-    Message2(int index, const T1 &t1, const T2 &t2, const void *p, size_t n) 
+    Message2(int index, const T1 &t1, const T2 &t2, const void *p, size_t n,
+             bool copy=true)
         : Message(MT, index)
     {
         size_t n1 = getSize(t1);
         size_t n2 = getSize(t2);
-        allocate(n1+n2+n);
+        allocate(copy ? n1+n2+n : n1+n2);
         add(t1);
         add(t2);
-        add(p,   n);
+        if(copy)
+            add(p, n);
+        else
+            setPayload(p, n);
     }   // Message2
     // ------------------------------------------------------------------------
     Message2(const void *buffer, int n, T1 *t1, T2 *t2) : Message(MT, buffer, n)
@@ -325,6 +458,76 @@ public:
     }
 };   // class Message3
 
+// ============================================================================
+/** The answer to a request. It has the type, index and request ID of the
+ *  request, and FLAG_REPLY set. Its data is a 64 bit result, followed by
+ *  the data of the answer (e.g. the bytes read). The status is the errno
+ *  of a failed request (a negative result).
+ */
+class ReplyMessage : public Message
+{
+public:
+    /** Offset of the data of the answer. */
+    static const size_t DATA_OFFSET = HEADER_SIZE+sizeof(int64_t);
+
+            ReplyMessage(Message *request, size_t max_data=0);
+            ReplyMessage(const void *buffer, int len);
+    void    setResult(int64_t result, int error, size_t data_len=0);
+    int64_t getResult() const;
+    // ------------------------------------------------------------------------
+    /** Returns the space for the data of the answer. */
+    char*   getReplyData() { return getData()+DATA_OFFSET; }
+};   // class ReplyMessage
+
+// ============================================================================
+/** A frame that carries a sequence of messages, possibly for different
+ *  files (MSG_COMPOUND), so that several requests need only one send. It
+ *  starts with a message header (index -1), followed by the number of
+ *  messages, and the length and data of each message. The receiver
+ *  executes the messages in order.
+ */
+class CompoundMessage
+{
+private:
+    char   *m_data;
+    size_t  m_len;
+    size_t  m_capacity;
+    int     m_count;
+
+                     CompoundMessage(const CompoundMessage &);
+    CompoundMessage& operator=(const CompoundMessage &);
+
+    void     writeHeader();
+
+public:
+    /** Size of the message header and the number of messages. */
+    static const size_t HEADER_SIZE = Message::HEADER_SIZE+sizeof(int);
+
+             CompoundMessage();
+            ~CompoundMessage();
+    void     add(Message *m);
+    void     clear();
+    static const char *getMessage(const char *buffer, int len, int *pos,
+                                  int *msg_len);
+    // ------------------------------------------------------------------------
+    /** Returns the space a message (including its payload) needs in the
+     *  frame. */
+    static size_t getSpace(const Message *m)
+    {
+        return sizeof(int) + m->getLen() + m->getPayloadSize();
+    }   // getSpace
+    // ------------------------------------------------------------------------
+    /** Returns the number of messages in the frame. */
+    int      getCount() const { return m_count;    }
+    // ------------------------------------------------------------------------
+    bool     empty() const    { return m_count==0; }
+    // ------------------------------------------------------------------------
+    /** Returns the size of the frame. */
+    int      getLen() const   { return (int)m_len; }
+    // ------------------------------------------------------------------------
+    char*    getData()        { return m_data;     }
+};   // CompoundMessage
+
 // ============================================================================
 
 typedef Message2<Message::MSG_FOPEN,        std::string, std::string> Message_fopen;
@@ -332,20 +535,21 @@ typedef Message2<Message::MSG_FOPEN64,      std::string, std::string> Message_fo
 typedef Message2<Message::MSG_FSEEK,        long,        int        > Message_fseek_long;
 typedef Message2<Message::MSG_FSEEKO,       off_t,       int        > Message_fseek_off_t;
 typedef Message2<Message::MSG_FSEEKO64,     off64_t,     int        > Message_fseek_off64_t;
-typedef Message2<Message::MSG_FSEEK_ANSWER, int,         int        > Message_fseek_answer;
 typedef Message0<Message::MSG_FTELL                                 > Message_ftell;
 typedef Message0<Message::MSG_FTELLO                                > Message_ftello;
 typedef Message0<Message::MSG_FTELLO64                              > Message_ftello64;
 typedef Message0<Message::MSG_FERROR                                > Message_ferror;
 typedef Message2<Message::MSG_FWRITE,       size_t,      size_t     > Message_fwrite;
 typedef Message2<Message::MSG_FREAD,        size_t,      size_t     > Message_fread;
-typedef Message0<Message::MSG_FREAD_ANSWER                          > Message_fread_answer;
 typedef Message0<Message::MSG_FCLOSE                                > Message_fclose;
 typedef Message0<Message::MSG_FEOF                                  > Message_feof;
 typedef Message1<Message::MSG_FGETS,        int                     > Message_fgets;
 typedef Message3<Message::MSG_OPEN,         std::string, int, mode_t> Message_open;
 typedef Message3<Message::MSG_OPEN64,       std::string, int, mode_t> Message_open64;
-typedef Message0<Message::MSG___XSTAT                               > Message_stat;
+typedef Message1<Message::MSG___XSTAT,      std::string             > Message_stat;
+typedef Message1<Message::MSG___LXSTAT,     std::string             > Message_lstat;
+typedef Message0<Message::MSG___FXSTAT                              > Message_fstat;
+typedef Message0<Message::MSG___FXSTAT64                            > Message_fstat64;
 typedef Message0<Message::MSG_QUIT                                  > Message_quit;
 typedef Message2<Message::MSG_LSEEK,        off_t,       int        > Message_lseek_off_t;
 typedef Message2<Message::MSG_LSEEK64,      off64_t,     int        > Message_lseek_off64_t;
@@ -353,6 +557,7 @@ typedef Message1<Message::MSG_WRITE,        size_t                  > Message_wr
 typedef Message1<Message::MSG_READ,         size_t                  > Message_read;
 typedef Message0<Message::MSG_CLOSE                                 > Message_close;
 typedef Message2<Message::MSG_RENAME,       std::string, std::string> Message_rename;
+typedef Message1<Message::MSG_UNLINK,       std::string             > Message_unlink;
 
 #endif
 
@@ -18,15 +18,22 @@
 
 #include "tools/mpi_communication.hpp"
 
+#include "tools/buffer_arena.hpp"
+
 #ifdef USE_MPI
 
 #include "mpi.h"
 
+#include <time.h>
+
 MPICommunication::MPICommunication(bool is_server, int argc, char **argv)
                 : ICommunication(is_server)
 {
     m_port_name      = NULL;
     m_message_length = -1;
+    m_current        = 0;
+    m_next           = 0;
+    m_next_id        = 0;
     MPI_Init(&argc, &argv);
 }   // MPICommunication
 
@@ -50,20 +57,64 @@ int MPICommunication::openPort()
 }   // waitForConnection
 
 // ----------------------------------------------------------------------------
+/** Accepts a client that is connecting, and adds it to the connected
+ *  clients.
+ */
 int MPICommunication::waitForConnection()
 {
-    printf("Server: accepting.\n");
-    MPI_Comm_accept(m_port_name, MPI_INFO_NULL, 0, MPI_COMM_SELF, &m_intercomm);
-    printf("Accepted.\n");
+    Connection connection;
+    MPI_Comm_accept(m_port_name, MPI_INFO_NULL, 0, MPI_COMM_SELF,
+                    &connection.m_intercomm);
+    connection.m_id = m_next_id++;
+    m_connections.push_back(connection);
+    printf("Server: client %d connected, %d clients.\n", connection.m_id,
+           (int)m_connections.size());
     return 0;
 }   // waitForConnection
 
 // ----------------------------------------------------------------------------
+/** Checks all clients round-robin for a message, starting after the client
+ *  whose message was found last.
+ *  \return True if a message is available (then m_current and
+ *          m_message_length describe it).
+ */
+bool MPICommunication::pollForMessage()
+{
+    unsigned int n = m_connections.size();
+    for(unsigned int i=0; i<n; i++)
+    {
+        unsigned int c = (m_next+i) % n;
+        int flag = 0;
+        MPI_Iprobe(MPI_ANY_SOURCE, 1, m_connections[c].m_intercomm, &flag,
+                   &m_status);
+        if(flag)
+        {
+            m_current = c;
+            m_next    = (c+1) % n;
+            MPI_Get_count(&m_status, MPI_CHAR, &m_message_length);
+            return true;
+        }
+    }
+    return false;
+}   // pollForMessage
+
+// ----------------------------------------------------------------------------
+/** Waits till a message from any client is available. While no message
+ *  arrives the waiting time between polls is increased (up to 1ms), so
+ *  that an idle server does not keep a core busy.
+ *  \return 0 If no error occured, 1 if no client is connected.
+ */
 int MPICommunication::waitForMessage()
 {
-    printf("probe.\n");fflush(stdout);
-    MPI_Probe(0, 1, m_intercomm, &m_status);
-    MPI_Get_count(&m_status, MPI_CHAR, &m_message_length);
+    if(m_connections.empty())
+        return 1;
+    long delay = 1000;   // in ns
+    while(!pollForMessage())
+    {
+        struct timespec t = {0, delay};
+        nanosleep(&t, NULL);
+        if(delay<1000000) delay *= 2;
+    }
     return 0;
 }   // waitForMessage
 
@@ -74,23 +125,65 @@ char *MPICommunication::receive()
     if(m_message_length < 0)
         waitForMessage();
 
-    char *buffer = new char[m_message_length];
-    MPI_Recv(buffer, m_message_length, MPI_CHAR, MPI_ANY_SOURCE, 
-             MPI_ANY_TAG, m_intercomm, &m_status);
+    char *buffer = ALIO::BufferArena::allocate(m_message_length);
+    MPI_Recv(buffer, m_message_length, MPI_CHAR, m_status.MPI_SOURCE,
+             m_status.MPI_TAG, m_connections[m_current].m_intercomm,
+             &m_status);
     return buffer;
 }   // receive
 
+// ----------------------------------------------------------------------------
+/** Returns the position of a client in m_connections, or -1. */
+int MPICommunication::findConnection(int client) const
+{
+    for(unsigned int i=0; i<m_connections.size(); i++)
+    {
+        if(m_connections[i].m_id==client)
+            return i;
+    }
+    return -1;
+}   // findConnection
+
+// ----------------------------------------------------------------------------
+/** Disconnects a client. The client must disconnect as well, since
+ *  MPI_Comm_disconnect is collective.
+ */
+void MPICommunication::disconnectClient(int client)
+{
+    int n = findConnection(client);
+    if(n<0)
+        return;
+    printf("Server: client %d disconnected.\n", client);
+    MPI_Comm_disconnect(&m_connections[n].m_intercomm);
+    m_connections.erase(m_connections.begin()+n);
+    m_current = 0;
+    if(m_next>=m_connections.size())
+        m_next = 0;
+}   // disconnectClient
+
 // ----------------------------------------------------------------------------
 int MPICommunication::send(void *buffer, int len, int tag)
 {
-    printf("MPI Sending tag %d\n", tag);
-    if(m_is_server)
-        MPI_Send(buffer, len, MPI_CHAR, 0, tag, m_intercomm);
-    else
-        MPI_Send(buffer, len, MPI_CHAR, 0, tag, m_intercomm);
+    MPI_Send(buffer, len, MPI_CHAR, m_status.MPI_SOURCE, tag,
+             m_connections[m_current].m_intercomm);
     return 0;
 }   // send
 
+// ----------------------------------------------------------------------------
+/** Sends a message to a client. Clients connect from MPI_COMM_SELF, so
+ *  the client is rank 0 in the remote group.
+ *  \return 0 on success, 1 if the client is not connected.
+ */
+int MPICommunication::sendToClient(int client, void *buffer, int len,
+                                   int tag)
+{
+    int n = findConnection(client);
+    if(n<0)
+        return 1;
+    MPI_Send(buffer, len, MPI_CHAR, 0, tag, m_connections[n].m_intercomm);
+    return 0;
+}   // sendToClient
+
 // ----------------------------------------------------------------------------
 // ----------------------------------------------------------------------------
 // ----------------------------------------------------------------------------
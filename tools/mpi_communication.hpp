@@ -27,14 +27,35 @@
 
 #include "mpi.h"
 
+#include <vector>
+
 class MPICommunication : public ICommunication
 {
 private:
+    /** A connected client. */
+    struct Connection
+    {
+        MPI_Comm m_intercomm;
+        /** Unique id of the client, see getClientId(). */
+        int      m_id;
+    };   // Connection
+
     /** The port name used when opening a port. */
     char *m_port_name;
 
-    /** Communicator for the server. */
-    MPI_Comm m_intercomm;
+    /** All connected clients. */
+    std::vector<Connection> m_connections;
+
+    /** The client that sent the last message. */
+    unsigned int m_current;
+
+    /** The client checked first by the next pollForMessage. */
+    unsigned int m_next;
+
+    /** Id to be given to the next client. */
+    int m_next_id;
+
+    int findConnection(int client) const;
 
     /** Status of last message received. */
     MPI_Status m_status;
@@ -48,8 +69,11 @@ public:
     virtual int   openPort();
     virtual int   waitForConnection();
     virtual int   waitForMessage();
+    virtual bool  pollForMessage();
+    virtual void  disconnectClient(int client);
     virtual char *receive();
     virtual int   send(void *buffer, int len, int tag);
+    virtual int   sendToClient(int client, void *buffer, int len, int tag);
     // ------------------------------------------------------------------------
     /** Returns the length of an incoming message. */
     virtual int   getMessageLength()
@@ -57,6 +81,13 @@ public:
         return m_message_length;
     }
     // ------------------------------------------------------------------------
+    /** Returns the id of the client that sent the last message. Ids are
+     *  not reused when a client disconnects. */
+    virtual int   getClientId()
+    {
+        return m_connections[m_current].m_id;
+    }
+    // ------------------------------------------------------------------------
     /** Allocates a buffer to receive an incoming message, and returns a 
      *  pointer to that buffer to the caller. It is the caller's
      *  responsibility to free the buffer when it is not needed anymore. */
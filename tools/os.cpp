@@ -65,6 +65,11 @@ namespace OS  {
     t_fclose   fclose   = NULL;
 
     t_rename  rename    = NULL;
+    t_unlink  unlink    = NULL;
+    t_stat    stat      = NULL;
+    t_stat    lstat     = NULL;
+    t_fstat   fstat     = NULL;
+    t_fstat64 fstat64   = NULL;
 } }  // namespace ALIO::OS
 
 /** This function saves the function pointers to the original IO functions.
@@ -112,6 +117,11 @@ int ALIO::OS::init()
     ALIO::OS::feof     = GET(t_feof,     "feof"    );
     ALIO::OS::fclose   = GET(t_fclose,   "fclose"  );
     ALIO::OS::rename   = GET(t_rename,   "rename"  );
+    ALIO::OS::unlink   = GET(t_unlink,   "unlink"  );
+    ALIO::OS::stat     = GET(t_stat,     "stat"    );
+    ALIO::OS::lstat    = GET(t_stat,     "lstat"   );
+    ALIO::OS::fstat    = GET(t_fstat,    "fstat"   );
+    ALIO::OS::fstat64  = GET(t_fstat64,  "fstat64" );
     return 0;
 }   // init
 
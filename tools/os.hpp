@@ -64,6 +64,10 @@ namespace OS {
         typedef int     (*t_fclose  )(FILE *fp);
 
         typedef int     (*t_rename  )(const char *old, const char *newn);
+        typedef int     (*t_unlink  )(const char *pathname);
+        typedef int     (*t_stat    )(const char *pathname, struct stat *buf);
+        typedef int     (*t_fstat   )(int filedes, struct stat *buf);
+        typedef int     (*t_fstat64 )(int filedes, struct stat64 *buf);
     }   // extern "C"
 
     extern t_open     open;
@@ -99,6 +103,11 @@ namespace OS {
     extern t_fclose   fclose;
 
     extern t_rename   rename;
+    extern t_unlink   unlink;
+    extern t_stat     stat;
+    extern t_stat     lstat;
+    extern t_fstat    fstat;
+    extern t_fstat64  fstat64;
     // ---------------------------------------------------------------------
     int init();
     const std::string getConfigDir();
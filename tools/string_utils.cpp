@@ -72,5 +72,68 @@ std::vector<std::string> split(const std::string& s, char c)
     }
 }   // split
 
+// ----------------------------------------------------------------------------
+/** Converts a size with an optional binary suffix into a number of bytes,
+ *  e.g. "512" --> 512, "4k" --> 4096, "16M" --> 16777216.
+ *  \param s The string to convert.
+ *  \param size On success the number of bytes is stored here.
+ *  \return True if the string was a valid size.
+ */
+bool parseSize(const std::string &s, int64_t *size)
+{
+    if(s.empty())
+        return false;
+
+    int64_t factor = 1;
+    std::string number = s;
+    switch(s[s.size()-1])
+    {
+    case 'k': case 'K': factor = 1024LL;               break;
+    case 'm': case 'M': factor = 1024LL*1024;          break;
+    case 'g': case 'G': factor = 1024LL*1024*1024;     break;
+    default:            factor = 0;                    break;
+    }
+    if(factor==0)
+        factor = 1;
+    else
+        number = s.substr(0, s.size()-1);
+
+    int64_t n;
+    if(!parseString(number, &n) || n<0)
+        return false;
+    *size = n*factor;
+    return true;
+}   // parseSize
+
+// ----------------------------------------------------------------------------
+/** Converts a list of numbers and ranges as used by the kernel for CPU and
+ *  node lists into the list of numbers, e.g. "0-3,8" --> 0, 1, 2, 3, 8.
+ *  \param s The string to convert (surrounding white space is ignored).
+ *  \param list The numbers are appended to this vector.
+ *  \return True if the string was a valid list.
+ */
+bool parseList(const std::string &s, std::vector<int> *list)
+{
+    std::string::size_type start = s.find_first_not_of(" \t\n");
+    std::string::size_type end   = s.find_last_not_of(" \t\n");
+    if(start==std::string::npos)
+        return true;
+    std::vector<std::string> parts = split(s.substr(start, end-start+1), ',');
+    for(unsigned int i=0; i<parts.size(); i++)
+    {
+        std::vector<std::string> range = split(parts[i], '-');
+        int from, to;
+        if(range.empty() || range.size()>2 ||
+           !parseString(range[0], &from) || from<0)
+            return false;
+        to = from;
+        if(range.size()==2 && (!parseString(range[1], &to) || to<from))
+            return false;
+        for(int n=from; n<=to; n++)
+            list->push_back(n);
+    }
+    return true;
+}   // parseList
+
 }   // namspace StringUtils
 }   // namespace ALIO
@@ -19,6 +19,7 @@
 #ifndef HEADER_STRING_UTILS_HPP
 #define HEADER_STRING_UTILS_HPP
 
+#include <stdint.h>
 #include <string>
 #include <sstream>
 #include <vector>
@@ -27,6 +28,8 @@ namespace ALIO {
 namespace StringUtils {
 
     std::vector<std::string> split(const std::string& s, char c);
+    bool parseSize(const std::string &s, int64_t *size);
+    bool parseList(const std::string &s, std::vector<int> *list);
 
     // ------------------------------------------------------------------------
     template<typename TYPE>
@@ -0,0 +1,175 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "tools/stripe_layout.hpp"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace ALIO;
+
+namespace
+{
+    const char LAYOUT_MAGIC[8] = {'A','L','I','O','S','T','R','1'};
+
+    /** The fixed part of a layout file. */
+    struct LayoutHeader
+    {
+        char     m_magic[8];
+        uint64_t m_stripe_size;
+        uint64_t m_size;
+        uint32_t m_count;
+        uint32_t m_reserved;
+    };   // LayoutHeader
+
+    // ------------------------------------------------------------------------
+    bool readFully(int filedes, void *p, size_t n, off64_t offset)
+    {
+        char *data = (char*)p;
+        while(n>0)
+        {
+            ssize_t count = ::pread64(filedes, data, n, offset);
+            if(count<0 && errno==EINTR) continue;
+            if(count<=0) return false;
+            data   += count;
+            n      -= count;
+            offset += count;
+        }
+        return true;
+    }   // readFully
+}   // namespace
+
+// ----------------------------------------------------------------------------
+StripeLayout::StripeLayout()
+{
+    m_stripe_size = 0;
+    m_size        = 0;
+}   // StripeLayout
+
+// ----------------------------------------------------------------------------
+/** Returns true if the file starts with the layout magic. */
+bool StripeLayout::isLayout(int filedes)
+{
+    char magic[sizeof(LAYOUT_MAGIC)];
+    return readFully(filedes, magic, sizeof(magic), 0) &&
+           memcmp(magic, LAYOUT_MAGIC, sizeof(magic))==0;
+}   // isLayout
+
+// ----------------------------------------------------------------------------
+/** Reads the layout from a file.
+ *  \return False if the file is not a (valid) layout file.
+ */
+bool StripeLayout::read(int filedes)
+{
+    struct stat64 buf;
+    LayoutHeader header;
+    if(::fstat64(filedes, &buf)!=0 ||
+       buf.st_size<(off64_t)sizeof(header) ||
+       !readFully(filedes, &header, sizeof(header), 0) ||
+       memcmp(header.m_magic, LAYOUT_MAGIC, sizeof(LAYOUT_MAGIC))!=0 ||
+       header.m_stripe_size==0 || header.m_count==0)
+        return false;
+    std::vector<char> data(buf.st_size-sizeof(header));
+    if(!data.empty() &&
+       !readFully(filedes, &data[0], data.size(), sizeof(header)))
+        return false;
+    std::vector<std::string> names;
+    size_t pos = 0;
+    for(unsigned int i=0; i<header.m_count; i++)
+    {
+        uint32_t length;
+        if(pos+sizeof(length)>data.size())
+            return false;
+        memcpy(&length, &data[pos], sizeof(length));
+        pos += sizeof(length);
+        if(length==0 || pos+length>data.size())
+            return false;
+        names.push_back(std::string(&data[pos], length));
+        pos += length;
+    }
+    m_stripe_size = header.m_stripe_size;
+    m_size        = header.m_size;
+    m_names.swap(names);
+    return true;
+}   // read
+
+// ----------------------------------------------------------------------------
+/** Writes the layout to a file (and truncates the file to its size).
+ *  \return False (and sets errno) if an error occurred.
+ */
+bool StripeLayout::write(int filedes) const
+{
+    LayoutHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.m_magic, LAYOUT_MAGIC, sizeof(LAYOUT_MAGIC));
+    header.m_stripe_size = m_stripe_size;
+    header.m_size        = m_size;
+    header.m_count       = m_names.size();
+    std::vector<char> data((char*)&header, (char*)&header+sizeof(header));
+    for(unsigned int i=0; i<m_names.size(); i++)
+    {
+        uint32_t length = m_names[i].size();
+        data.insert(data.end(), (char*)&length, (char*)&length+sizeof(length));
+        data.insert(data.end(), m_names[i].begin(), m_names[i].end());
+    }
+    size_t done = 0;
+    while(done<data.size())
+    {
+        ssize_t count = ::pwrite64(filedes, &data[done], data.size()-done,
+                                   done);
+        if(count<0 && errno==EINTR) continue;
+        if(count<=0) return false;
+        done += count;
+    }
+    return ::ftruncate64(filedes, data.size())==0;
+}   // write
+
+// ----------------------------------------------------------------------------
+/** Returns the path of a backing file. Relative names are relative to the
+ *  directory of the layout file.
+ *  \param layout Path of the layout file.
+ */
+std::string StripeLayout::getPath(unsigned int n,
+                                  const std::string &layout) const
+{
+    const std::string &name = m_names[n];
+    if(name[0]=='/')
+        return name;
+    size_t slash = layout.rfind('/');
+    if(slash==std::string::npos)
+        return name;
+    return layout.substr(0, slash+1)+name;
+}   // getPath
+
+// ----------------------------------------------------------------------------
+/** Maps a logical offset to a position in a backing file.
+ *  \param stripe Index of the backing file.
+ *  \param backing Offset in the backing file.
+ *  \param left Number of bytes till the end of the stripe.
+ */
+void StripeLayout::map(off64_t offset, unsigned int *stripe,
+                       off64_t *backing, size_t *left) const
+{
+    uint64_t n     = offset / m_stripe_size;
+    uint64_t inner = offset % m_stripe_size;
+    *stripe  = n % m_names.size();
+    *backing = (n / m_names.size())*m_stripe_size + inner;
+    *left    = m_stripe_size - inner;
+}   // map
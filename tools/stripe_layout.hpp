@@ -0,0 +1,61 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef HEADER_STRIPE_LAYOUT_HPP
+#define HEADER_STRIPE_LAYOUT_HPP
+
+#include <stdint.h>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+namespace ALIO
+{
+
+/** The layout of a striped file: the logical file is split into stripes
+ *  of m_stripe_size bytes, which are assigned round-robin to the backing
+ *  files. The layout is stored in place of the logical file: a header
+ *  (magic "ALIOSTR1", stripe size, logical size, number of backing files)
+ *  followed by the names of the backing files (a 32 bit length and the
+ *  characters). Relative names are relative to the directory of the
+ *  layout file. The layout is used by the striped io type and by the
+ *  unstripe tool.
+ */
+class StripeLayout
+{
+public:
+    /** Size of one stripe. */
+    uint64_t m_stripe_size;
+
+    /** Size of the logical file. */
+    uint64_t m_size;
+
+    /** Names of the backing files. */
+    std::vector<std::string> m_names;
+
+             StripeLayout();
+    bool     read(int filedes);
+    bool     write(int filedes) const;
+    std::string getPath(unsigned int n, const std::string &layout) const;
+    void     map(off64_t offset, unsigned int *stripe, off64_t *backing,
+                 size_t *left) const;
+    static bool isLayout(int filedes);
+};   // StripeLayout
+
+}   // namespace ALIO
+#endif
@@ -0,0 +1,159 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+/** unpack: lists or extracts the files stored in a container written with
+ *  the container io type.
+ *  Usage: unpack [-l] CONTAINER [DIR]
+ *  Without -l all files are written below DIR (default: the current
+ *  directory); a leading '/' of the stored names is removed, and missing
+ *  directories are created.
+ */
+
+#include "tools/container_archive.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace ALIO;
+
+// ----------------------------------------------------------------------------
+/** Creates all directories of a path (excluding the last component).
+ *  \return False if a directory can not be created.
+ */
+static bool createParents(const std::string &path)
+{
+    for(size_t i=path.find('/', 1); i!=std::string::npos;
+        i=path.find('/', i+1))
+    {
+        std::string dir = path.substr(0, i);
+        if(mkdir(dir.c_str(), 0755)!=0 && errno!=EEXIST)
+        {
+            printf("Can not create '%s': %s.\n", dir.c_str(),
+                   strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}   // createParents
+
+// ----------------------------------------------------------------------------
+/** Writes one file of the container.
+ *  \return False if an error occurred.
+ */
+static bool extract(const ContainerArchive &archive,
+                    const ContainerArchive::Entry &entry,
+                    const std::string &path)
+{
+    if(!createParents(path))
+        return false;
+    int out = open(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if(out<0)
+    {
+        printf("Can not create '%s': %s.\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    std::vector<char> buffer(1024*1024);
+    uint64_t offset = 0;
+    while(offset<entry.m_size)
+    {
+        ssize_t n = archive.read(entry, &buffer[0], buffer.size(), offset);
+        if(n<=0)
+        {
+            printf("Can not read '%s' from the container: %s.\n",
+                   path.c_str(), strerror(errno));
+            close(out);
+            return false;
+        }
+        ssize_t written = 0;
+        while(written<n)
+        {
+            ssize_t count = write(out, &buffer[written], n-written);
+            if(count<0 && errno==EINTR) continue;
+            if(count<=0)
+            {
+                printf("Can not write '%s': %s.\n", path.c_str(),
+                       strerror(errno));
+                close(out);
+                return false;
+            }
+            written += count;
+        }
+        offset += n;
+    }
+    if(close(out)!=0)
+    {
+        printf("Can not write '%s': %s.\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    return true;
+}   // extract
+
+// ----------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    bool list = argc>1 && strcmp(argv[1], "-l")==0;
+    int  first = list ? 2 : 1;
+    if(argc<first+1 || argc>first+2)
+    {
+        printf("Usage: %s [-l] CONTAINER [DIR]\n", argv[0]);
+        return 1;
+    }
+    int filedes = open(argv[first], O_RDONLY);
+    ContainerArchive archive;
+    if(filedes<0 || !archive.load(filedes))
+    {
+        printf("'%s' is not a container.\n", argv[first]);
+        return 1;
+    }
+    std::string dir = argc>first+1 ? argv[first+1] : ".";
+
+    int errors = 0;
+    const ContainerArchive::EntryMap &entries = archive.getEntries();
+    ContainerArchive::EntryMap::const_iterator i;
+    for(i=entries.begin(); i!=entries.end(); i++)
+    {
+        if(list)
+        {
+            printf("%12llu %s\n", (unsigned long long)i->second.m_size,
+                   i->first.c_str());
+            continue;
+        }
+        std::string name = i->first;
+        while(!name.empty() && name[0]=='/')
+            name.erase(0, 1);
+        // Do not write outside of the output directory.
+        if(name.empty() || name=="." || name==".." ||
+           name.compare(0, 3, "../")==0 ||
+           name.find("/../")!=std::string::npos ||
+           (name.size()>=3 && name.compare(name.size()-3, 3, "/..")==0) )
+        {
+            printf("Skipping '%s'.\n", i->first.c_str());
+            errors++;
+            continue;
+        }
+        if(!extract(archive, i->second, dir+"/"+name))
+            errors++;
+    }
+    close(filedes);
+    return errors>0 ? 1 : 0;
+}   // main
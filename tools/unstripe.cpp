@@ -0,0 +1,124 @@
+//
+//    ALIO - ALternative IO library
+//    Copyright (C) 2014  Joerg Henrichs
+//
+//    ALIO is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    ALIO is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with ALIO.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+/** unstripe: concatenates the backing files of a file written with the
+ *  striped io type into a plain file.
+ *  Usage: unstripe LAYOUT OUTPUT
+ */
+
+#include "tools/stripe_layout.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+using namespace ALIO;
+
+int main(int argc, char **argv)
+{
+    if(argc!=3)
+    {
+        printf("Usage: %s LAYOUT OUTPUT\n", argv[0]);
+        return 1;
+    }
+    int layout_fd = open(argv[1], O_RDONLY);
+    StripeLayout layout;
+    if(layout_fd<0 || !layout.read(layout_fd))
+    {
+        printf("'%s' is not a striped file.\n", argv[1]);
+        return 1;
+    }
+    close(layout_fd);
+
+    std::vector<int> stripes;
+    for(unsigned int i=0; i<layout.m_names.size(); i++)
+    {
+        std::string path = layout.getPath(i, argv[1]);
+        int fd = open(path.c_str(), O_RDONLY);
+        if(fd<0)
+        {
+            printf("Can not open stripe '%s': %s.\n", path.c_str(),
+                   strerror(errno));
+            return 1;
+        }
+        stripes.push_back(fd);
+    }
+    int out = open(argv[2], O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if(out<0)
+    {
+        printf("Can not create '%s': %s.\n", argv[2], strerror(errno));
+        return 1;
+    }
+
+    std::vector<char> buffer(layout.m_stripe_size);
+    off64_t offset = 0;
+    while(offset<(off64_t)layout.m_size)
+    {
+        unsigned int stripe;
+        off64_t      backing;
+        size_t       n;
+        layout.map(offset, &stripe, &backing, &n);
+        if(n>layout.m_size-offset)
+            n = layout.m_size-offset;
+        // Parts of a stripe that were never written read as zeros.
+        size_t got = 0;
+        while(got<n)
+        {
+            ssize_t count = pread64(stripes[stripe], &buffer[got], n-got,
+                                    backing+got);
+            if(count<0 && errno==EINTR) continue;
+            if(count<0)
+            {
+                printf("Can not read stripe '%s': %s.\n",
+                       layout.m_names[stripe].c_str(), strerror(errno));
+                return 1;
+            }
+            if(count==0)
+            {
+                memset(&buffer[got], 0, n-got);
+                break;
+            }
+            got += count;
+        }
+        size_t written = 0;
+        while(written<n)
+        {
+            ssize_t count = write(out, &buffer[written], n-written);
+            if(count<0 && errno==EINTR) continue;
+            if(count<=0)
+            {
+                printf("Can not write '%s': %s.\n", argv[2],
+                       strerror(errno));
+                return 1;
+            }
+            written += count;
+        }
+        offset += n;
+    }
+    if(close(out)!=0)
+    {
+        printf("Can not write '%s': %s.\n", argv[2], strerror(errno));
+        return 1;
+    }
+    for(unsigned int i=0; i<stripes.size(); i++)
+        close(stripes[i]);
+    return 0;
+}   // main